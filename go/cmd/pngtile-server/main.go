@@ -16,6 +16,16 @@ var options struct {
 	Quiet        bool   `long:"pngtile-quiet"`
 	Path         string `long:"pngtile-path"`
 	TemplatePath string `long:"pngtile-templates" default:"web/templates"`
+
+	OpenRandom bool     `long:"pngtile-open-random" description:"Disable readahead for image caches"`
+	OpenHoles  bool     `long:"pngtile-open-holes" description:"Map out the holes in image caches, and do not read them"`
+	LockImages []string `long:"pngtile-lock" value-name:"NAME" description:"Preload and lock the named image cache into memory"`
+
+	TileProfile string `long:"pngtile-tile-profile" value-name:"default|fast|small" description:"Encoder profile for map tiles"`
+	ViewProfile string `long:"pngtile-view-profile" value-name:"default|fast|small" description:"Encoder profile for centered views"`
+	ZoomMode    string `long:"pngtile-zoom-mode" value-name:"average|palette|dominant" description:"Zoom mode for zoomed-out tiles of palette images"`
+
+	RenderThreads uint `long:"pngtile-render-threads" value-name:"N" description:"Render tiles using a pool of N threads"`
 }
 
 func main() {
@@ -33,6 +43,30 @@ func main() {
 	var config = server.Config{
 		Path:         options.Path,
 		TemplatePath: options.TemplatePath,
+		OpenParams: pngtile.OpenParams{
+			Random: options.OpenRandom,
+			Holes:  options.OpenHoles,
+		},
+		LockImages:    options.LockImages,
+		RenderThreads: options.RenderThreads,
+	}
+
+	if profile, err := pngtile.ParseTileProfile(options.TileProfile); err != nil {
+		log.Fatalf("--pngtile-tile-profile: %v", err)
+	} else {
+		config.TileProfile = profile
+	}
+
+	if profile, err := pngtile.ParseTileProfile(options.ViewProfile); err != nil {
+		log.Fatalf("--pngtile-view-profile: %v", err)
+	} else {
+		config.ViewProfile = profile
+	}
+
+	if zoomMode, err := pngtile.ParseTileZoomMode(options.ZoomMode); err != nil {
+		log.Fatalf("--pngtile-zoom-mode: %v", err)
+	} else {
+		config.ZoomMode = zoomMode
 	}
 
 	if server, err := config.MakeServer(); err != nil {
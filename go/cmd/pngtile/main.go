@@ -9,6 +9,7 @@ import (
 	"math/rand"
 	"os"
 	"regexp"
+	"runtime"
 	"time"
 )
 
@@ -20,10 +21,22 @@ type Options struct {
 	MultipartPattern string
 	Update           bool
 
-	Background string
-	TileOut    string
-	TileParams pngtile.TileParams
-	TileRandom bool
+	Background   string
+	ZoomLevels   bool
+	Compress     bool
+	Packed       bool
+	Incremental  bool
+	Stream       bool
+	Direct       bool
+	Checkpoint   bool
+	Threads      uint
+	Progress     bool
+	TileOut      string
+	TileParams   pngtile.TileParams
+	TileProfile  string
+	TileEncoder  string
+	TileZoomMode string
+	TileRandom   bool
 }
 
 func (options Options) imageParams() (pngtile.ImageParams, error) {
@@ -46,17 +59,56 @@ func (options Options) imageParams() (pngtile.ImageParams, error) {
 		imageParams.BackgroundPixel = &backgroundPixel
 	}
 
+	imageParams.ZoomLevels = options.ZoomLevels
+	imageParams.Compress = options.Compress
+	imageParams.Packed = options.Packed
+	imageParams.Incremental = options.Incremental
+	imageParams.Stream = options.Stream
+	imageParams.Direct = options.Direct
+	imageParams.Checkpoint = options.Checkpoint
+	imageParams.Threads = options.Threads
+
+	if options.Progress {
+		imageParams.Progress = updateProgress
+	}
+
 	return imageParams, nil
 }
 
+// Display the progress of a cache update on a single line, with the throughput of decoded pixel data
+func updateProgress(progress pngtile.ImageProgress) error {
+	fmt.Fprintf(os.Stderr, "\r\t%d/%d rows (%.1f%%), %.1f MB stored, %.1f MB sparse, %.1f MB/s ",
+		progress.Rows, progress.RowsTotal, progress.Fraction()*100,
+		float64(progress.Bytes)/1e6, float64(progress.SparseBytes)/1e6, progress.Rate()/1e6,
+	)
+
+	return nil
+}
+
+// Update the image cache, ending the progress line
+func (options Options) update(update func(pngtile.ImageParams) error) error {
+	imageParams, err := options.imageParams()
+	if err != nil {
+		return err
+	}
+
+	err = update(imageParams)
+
+	if options.Progress {
+		fmt.Fprintf(os.Stderr, "\n")
+	}
+
+	return err
+}
+
 func (options Options) run(scanImage pngtile.ScanImage) error {
 	log.Printf("%s", scanImage.ImagePath)
 
 	return pngtile.WithImage(scanImage.CachePath, func(image *pngtile.Image) error {
 		if scanImage.ImagePaths != nil {
-			if imageParams, err := options.imageParams(); err != nil {
-				return err
-			} else if err := image.UpdateParts(scanImage.Format, scanImage.ImagePaths, imageParams); err != nil {
+			if err := options.update(func(imageParams pngtile.ImageParams) error {
+				return image.UpdateParts(scanImage.Format, scanImage.ImagePaths, imageParams)
+			}); err != nil {
 				return err
 			}
 		} else if cacheStatus, err := image.Status(scanImage.ImagePath); err != nil {
@@ -64,16 +116,16 @@ func (options Options) run(scanImage pngtile.ScanImage) error {
 		} else if cacheStatus != pngtile.CACHE_FRESH || options.Update {
 			log.Printf("%s: cache update (status %v)", scanImage.ImagePath, cacheStatus)
 
-			if imageParams, err := options.imageParams(); err != nil {
-				return err
-			} else if err := image.Update(scanImage.ImagePath, imageParams); err != nil {
+			if err := options.update(func(imageParams pngtile.ImageParams) error {
+				return image.Update(scanImage.ImagePath, imageParams)
+			}); err != nil {
 				return err
 			}
 
 		} else {
 			log.Printf("%s: cache fresh", scanImage.ImagePath)
 
-			if err := image.Open(); err != nil {
+			if err := image.Open(pngtile.OpenParams{}); err != nil {
 				return err
 			}
 		}
@@ -85,6 +137,7 @@ func (options Options) run(scanImage pngtile.ScanImage) error {
 			fmt.Printf("\tImage: %dx%d@%d\n", info.ImageWidth, info.ImageHeight, info.ImageBPP)
 			//fmt.Printf("\tImage %s: mtime=%v bytes=%d\n", scanImage.ImagePath, info.ImageModifiedTime, info.ImageBytes)
 			fmt.Printf("\tCache %s: mtime=%v bytes=%d version=%d blocks=%d\n", scanImage.CachePath, info.CacheModifiedTime, info.CacheBytes, info.CacheVersion, info.CacheBlocks)
+			fmt.Printf("\tCache data: %d/%d bytes (%.1f%%)\n", info.CacheDataBytes, info.CacheDataSize, info.CacheDataFraction()*100)
 
 			if options.TileRandom {
 				r := rand.New(rand.NewSource(time.Now().Unix()))
@@ -150,6 +203,52 @@ func main() {
 			Usage:       "Hexadecimal [1..4]uint8 pixel value",
 			Destination: &options.Background,
 		},
+		cli.BoolFlag{
+			Name:        "zoom-levels",
+			Usage:       "Store downsampled zoom levels",
+			Destination: &options.ZoomLevels,
+		},
+		cli.BoolFlag{
+			Name:        "compress",
+			Usage:       "Store compressed blocks",
+			Destination: &options.Compress,
+		},
+		cli.BoolFlag{
+			Name:        "packed",
+			Usage:       "Store 1/2/4-bit pixels bit-packed",
+			Destination: &options.Packed,
+		},
+		cli.BoolFlag{
+			Name:        "incremental",
+			Usage:       "Only decode the changed parts of multi-part images",
+			Destination: &options.Incremental,
+		},
+		cli.BoolFlag{
+			Name:        "stream",
+			Usage:       "Write caches using throttled pwrite instead of mmap",
+			Destination: &options.Stream,
+		},
+		cli.BoolFlag{
+			Name:        "direct",
+			Usage:       "Write caches using O_DIRECT",
+			Destination: &options.Direct,
+		},
+		cli.BoolFlag{
+			Name:        "checkpoint",
+			Usage:       "Checkpoint cache updates, resuming interrupted updates",
+			Destination: &options.Checkpoint,
+		},
+		cli.UintFlag{
+			Name:        "threads",
+			Usage:       "Decode images using N threads",
+			Value:       uint(runtime.NumCPU()),
+			Destination: &options.Threads,
+		},
+		cli.BoolFlag{
+			Name:        "progress",
+			Usage:       "Display the progress of cache updates",
+			Destination: &options.Progress,
+		},
 		cli.BoolFlag{
 			Name:        "update",
 			Usage:       "Force cache udpate",
@@ -191,6 +290,21 @@ func main() {
 			Value:       0,
 			Destination: &options.TileParams.Zoom,
 		},
+		cli.StringFlag{
+			Name:        "tile-profile",
+			Usage:       "Tile encoder profile (default/fast/small)",
+			Destination: &options.TileProfile,
+		},
+		cli.StringFlag{
+			Name:        "tile-encoder",
+			Usage:       "Tile encoder (auto/libpng/builtin)",
+			Destination: &options.TileEncoder,
+		},
+		cli.StringFlag{
+			Name:        "tile-zoom-mode",
+			Usage:       "Tile zoom mode for palette images (average/palette/dominant)",
+			Destination: &options.TileZoomMode,
+		},
 		cli.BoolFlag{
 			Name:        "tile-random",
 			Usage:       "Randomize tile X/Y",
@@ -204,6 +318,24 @@ func main() {
 		return nil
 	}
 	app.Action = func(c *cli.Context) error {
+		if profile, err := pngtile.ParseTileProfile(options.TileProfile); err != nil {
+			return fmt.Errorf("Invalid --tile-profile=%s: %v", options.TileProfile, err)
+		} else {
+			options.TileParams.Profile = profile
+		}
+
+		if encoder, err := pngtile.ParseTileEncoder(options.TileEncoder); err != nil {
+			return fmt.Errorf("Invalid --tile-encoder=%s: %v", options.TileEncoder, err)
+		} else {
+			options.TileParams.Encoder = encoder
+		}
+
+		if zoomMode, err := pngtile.ParseTileZoomMode(options.TileZoomMode); err != nil {
+			return fmt.Errorf("Invalid --tile-zoom-mode=%s: %v", options.TileZoomMode, err)
+		} else {
+			options.TileParams.ZoomMode = zoomMode
+		}
+
 		if options.MultipartPattern != "" {
 			if re, err := regexp.Compile(options.MultipartPattern); err != nil {
 				return fmt.Errorf("Invalid --multipart-pattern=%s: %s", options.MultipartPattern, err)
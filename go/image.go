@@ -20,7 +20,10 @@ static void free_strarray(char **a, int size) {
 }
 */
 import "C"
-import "unsafe"
+import (
+	"io"
+	"unsafe"
+)
 
 // mode: OPEN_*
 func imageOpen(cachePath string) (*Image, error) {
@@ -63,9 +66,11 @@ func (image *Image) Info() (ImageInfo, error) {
 	return makeImageCacheInfo(&cache_info, &image_info), nil
 }
 
-// Open image cache in read-only mode
-func (image *Image) Open() error {
-	if ret, err := C.pt_image_open(image.pt_image); ret < 0 {
+// Open image cache in read-only mode, using the given memory residency policy
+func (image *Image) Open(params OpenParams) error {
+	var open_params = params.c_struct()
+
+	if ret, err := C.pt_image_open_params(image.pt_image, &open_params); ret < 0 {
 		return makeError("pt_image_open", ret, err)
 	}
 
@@ -78,14 +83,20 @@ func (image *Image) Update(path string, params ImageParams) error {
 	var c_path = C.CString(path)
 	defer C.free(unsafe.Pointer(c_path))
 
-	if ret, err := C.pt_image_update(image.pt_image, c_path, &image_params); ret < 0 {
+	var progressDone = params.c_progress(&image_params)
+
+	ret, err := C.pt_image_update(image.pt_image, c_path, &image_params)
+
+	if progressErr := progressDone(); progressErr != nil {
+		return progressErr
+	} else if ret < 0 {
 		return makeError("pt_image_update", ret, err)
 	}
 
 	return nil
 }
 
-// Open image cache in update mode,
+// Open image cache in update mode, using empty paths for any missing parts
 func (image *Image) UpdateParts(format ImageFormat, paths [][]string, params ImageParams) error {
 	var image_params = params.c_struct()
 
@@ -102,30 +113,156 @@ func (image *Image) UpdateParts(format ImageFormat, paths [][]string, params Ima
 
 	for row, rowPaths := range paths {
 		for col, path := range rowPaths {
+			// missing parts are left as NULL
+			if path == "" {
+				continue
+			}
+
 			C.set_strarray(c_paths, C.int(row*len(rowPaths)+col), C.CString(path))
 		}
 	}
 
-	if ret, err := C.pt_image_update_parts(image.pt_image, &c_parts, &image_params); ret < 0 {
+	var progressDone = params.c_progress(&image_params)
+
+	ret, err := C.pt_image_update_parts(image.pt_image, &c_parts, &image_params)
+
+	if progressErr := progressDone(); progressErr != nil {
+		return progressErr
+	} else if ret < 0 {
 		return makeError("pt_image_update", ret, err)
 	}
 
 	return nil
 }
 
+// Start reading in the cache data for a tile, without waiting for it
+func (image *Image) Prefetch(params TileParams) error {
+	var tile_params = params.c_struct()
+
+	if ret, err := C.pt_image_prefetch(image.pt_image, &tile_params); ret < 0 {
+		return makeError("pt_image_prefetch", ret, err)
+	}
+
+	return nil
+}
+
 // Render tile to PNG image
 func (image *Image) Tile(params TileParams) ([]byte, error) {
+	return image.TileInto(nil, params)
+}
+
+// Estimate the size of the tile once rendered, from the average size of the tiles rendered so far.
+func (image *Image) TileSizeHint(params TileParams) (int, error) {
 	var tile_params = params.c_struct()
-	var tile_buf *C.char
-	var tile_size C.size_t
+	var size C.size_t
 
-	if ret, err := C.pt_image_tile_mem(image.pt_image, &tile_params, &tile_buf, &tile_size); ret < 0 {
-		return nil, makeError("pt_image_tile_mem", ret, err)
-	} else {
-		defer C.free(unsafe.Pointer(tile_buf))
+	if ret, err := C.pt_image_tile_size_hint(image.pt_image, &tile_params, &size); ret < 0 {
+		return 0, makeError("pt_image_tile_size_hint", ret, err)
+	}
+
+	return int(size), nil
+}
+
+// Render tile to PNG image into the given buffer, which can be reused across renders.
+//
+// Returns the buffer sliced to the length of the PNG data. If the buffer has less capacity than the TileSizeHint, or
+// turns out to be too small for the tile, a new buffer is allocated instead.
+func (image *Image) TileInto(buf []byte, params TileParams) ([]byte, error) {
+	var tile_params = params.c_struct()
+
+	// reuse the encoder state across renders
+	tile_params.ctx = getRenderCtx()
+	defer putRenderCtx(tile_params.ctx)
+
+	if size, err := image.TileSizeHint(params); err != nil {
+		return nil, err
+	} else if cap(buf) < size {
+		buf = make([]byte, size)
+	}
+
+	for {
+		var tile_buf = buf[:cap(buf)]
+		var tile_len C.size_t
+
+		ret, err := C.pt_image_tile_buf(image.pt_image, &tile_params, (*C.char)(unsafe.Pointer(&tile_buf[0])), C.size_t(len(tile_buf)), &tile_len)
+
+		if ret == -C.PT_ERR_TILE_BUF {
+			// render again at the required size
+			buf = make([]byte, int(tile_len))
+		} else if ret < 0 {
+			return nil, makeError("pt_image_tile_buf", ret, err)
+		} else {
+			return tile_buf[:tile_len], nil
+		}
+	}
+}
+
+// Render tile to PNG image, streaming it out to the io.Writer as it is encoded.
+//
+// The PNG data written out is incomplete if an error is returned.
+func (image *Image) TileTo(w io.Writer, params TileParams) error {
+	var tile_params = params.c_struct()
+	var tile_writer C.struct_pt_tile_writer
+
+	// reuse the encoder state and output buffer across renders
+	tile_params.ctx = getRenderCtx()
+	defer putRenderCtx(tile_params.ctx)
+
+	var writerDone = makeTileWriter(w, &tile_writer)
+
+	ret, err := C.pt_image_tile_write(image.pt_image, &tile_params, &tile_writer)
+
+	if writerErr := writerDone(); writerErr != nil {
+		return writerErr
+	} else if ret < 0 {
+		return makeError("pt_image_tile_write", ret, err)
+	}
+
+	return nil
+}
+
+// Result of each tile rendered by TileBatch
+type TileResult struct {
+	Data []byte
+	Err  error
+}
+
+// Render a set of tiles to PNG images, reading them from the cache in order of their offset into the cache.
+//
+// Returns the result of each tile in the same order as the params, or an error for the batch as a whole.
+func (image *Image) TileBatch(params []TileParams) ([]TileResult, error) {
+	if len(params) == 0 {
+		return nil, nil
+	}
+
+	var tile_params = make([]C.struct_pt_tile_params, len(params))
+	var tile_results = make([]C.struct_pt_tile_result, len(params))
+	var results = make([]TileResult, len(params))
+
+	// reuse the encoder state across the batch
+	var ctx = getRenderCtx()
+	defer putRenderCtx(ctx)
+
+	for i, params := range params {
+		tile_params[i] = params.c_struct()
+		tile_params[i].ctx = ctx
+	}
+
+	if ret, err := C.pt_image_tile_batch(image.pt_image, &tile_params[0], C.uint(len(params)), &tile_results[0]); ret < 0 {
+		return nil, makeError("pt_image_tile_batch", ret, err)
+	}
+
+	for i, tile_result := range tile_results {
+		if tile_result.err < 0 {
+			results[i].Err = makeError("pt_image_tile_batch", tile_result.err, nil)
+		} else {
+			results[i].Data = C.GoBytes(unsafe.Pointer(tile_result.buf), C.int(tile_result.len))
+		}
+
+		C.free(unsafe.Pointer(tile_result.buf))
 	}
 
-	return C.GoBytes(unsafe.Pointer(tile_buf), C.int(tile_size)), nil // XXX: overflow?
+	return results, nil
 }
 
 // Close image, and destroy it to release resources.
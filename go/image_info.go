@@ -23,6 +23,8 @@ func makeImageCacheInfo(ci *C.struct_pt_cache_info, ii *C.struct_pt_image_info)
 		CacheModifiedTime: makeTime(ci.mtime),
 		CacheBytes:        uint(ci.bytes),
 		CacheBlocks:       uint(ci.blocks),
+		CacheDataSize:     uint(ci.data_size),
+		CacheDataBytes:    uint(ci.data_bytes),
 	}
 }
 
@@ -35,4 +37,15 @@ type ImageInfo struct {
 	CacheModifiedTime time.Time   `json:"cache_mtime"`
 	CacheBytes        uint        `json:"cache_bytes"`
 	CacheBlocks       uint        `json:"cache_blocks"`
+	CacheDataSize     uint        `json:"cache_data_size"`
+	CacheDataBytes    uint        `json:"cache_data_bytes"`
+}
+
+// Fraction of the cache data stored in the cache file, excluding holes
+func (info ImageInfo) CacheDataFraction() float64 {
+	if info.CacheDataSize == 0 {
+		return 1
+	}
+
+	return float64(info.CacheDataBytes) / float64(info.CacheDataSize)
 }
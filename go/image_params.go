@@ -4,11 +4,27 @@ package pngtile
 #include "pngtile.h"
 */
 import "C"
+import "time"
 
 type ImagePixel [4]uint8
 
 type ImageParams struct {
 	BackgroundPixel *ImagePixel
+	ZoomLevels      bool
+	Compress        bool
+	Packed          bool
+	Incremental     bool
+	Stream          bool
+	Direct          bool
+	Checkpoint      bool
+	Threads         uint
+
+	// Minimum intervals between checkpoints and calls to Progress, or zero for the defaults
+	CheckpointInterval time.Duration
+	ProgressInterval   time.Duration
+
+	// Optional func called periodically with the progress of the update, returning an error to cancel the update
+	Progress func(ImageProgress) error
 }
 
 func (params ImageParams) c_struct() C.struct_pt_image_params {
@@ -22,5 +38,42 @@ func (params ImageParams) c_struct() C.struct_pt_image_params {
 		image_params.flags |= C.PT_IMAGE_BACKGROUND_PIXEL
 	}
 
+	if params.ZoomLevels {
+		image_params.flags |= C.PT_IMAGE_ZOOM_LEVELS
+	}
+
+	if params.Compress {
+		image_params.flags |= C.PT_IMAGE_COMPRESS
+	}
+
+	if params.Packed {
+		image_params.flags |= C.PT_IMAGE_PACKED
+	}
+
+	if params.Incremental {
+		image_params.flags |= C.PT_IMAGE_INCREMENTAL
+	}
+
+	if params.Stream {
+		image_params.flags |= C.PT_IMAGE_STREAM
+	}
+
+	if params.Direct {
+		image_params.flags |= C.PT_IMAGE_DIRECT
+	}
+
+	if params.Checkpoint {
+		image_params.flags |= C.PT_IMAGE_CHECKPOINT
+	}
+
+	image_params.threads = C.uint(params.Threads)
+	image_params.checkpoint_interval = c_interval(params.CheckpointInterval)
+	image_params.progress_interval = c_interval(params.ProgressInterval)
+
 	return image_params
 }
+
+// Round up to milliseconds, keeping any non-zero interval non-zero
+func c_interval(interval time.Duration) C.uint {
+	return C.uint((interval + time.Millisecond - 1) / time.Millisecond)
+}
@@ -0,0 +1,96 @@
+package pngtile
+
+/*
+#include <stdint.h>
+#include "pngtile.h"
+
+extern int pngtileImageProgress(void *arg, struct pt_image_progress *progress);
+
+static int pngtile_image_progress(void *arg, const struct pt_image_progress *progress) {
+        return pngtileImageProgress(arg, (struct pt_image_progress *) progress);
+}
+
+static void pngtile_image_params_progress(struct pt_image_params *params, uintptr_t handle) {
+        params->progress = pngtile_image_progress;
+        params->progress_arg = (void *) handle;
+}
+*/
+import "C"
+import (
+	"runtime/cgo"
+	"time"
+)
+
+// Progress of an Image.Update or Image.UpdateParts, as passed to ImageParams.Progress.
+//
+// The Bytes and SparseBytes count the pixel data stored into the cache, and the pixel data skipped as background.
+type ImageProgress struct {
+	Rows        uint64
+	RowsTotal   uint64
+	Bytes       uint64
+	SparseBytes uint64
+	Elapsed     time.Duration
+}
+
+// Return the fraction of the rows decoded so far.
+func (progress ImageProgress) Fraction() float64 {
+	if progress.RowsTotal == 0 {
+		return 1
+	}
+
+	return float64(progress.Rows) / float64(progress.RowsTotal)
+}
+
+// Return the throughput of the pixel data stored or skipped so far, in bytes per second.
+func (progress ImageProgress) Rate() float64 {
+	if progress.Elapsed <= 0 {
+		return 0
+	}
+
+	return float64(progress.Bytes+progress.SparseBytes) / progress.Elapsed.Seconds()
+}
+
+type imageProgress struct {
+	fn  func(ImageProgress) error
+	err error
+}
+
+// Set up the image_params to call the params.Progress func, if any.
+//
+// The returned func must be called after the update returns, and returns the error that cancelled the update, if any.
+func (params ImageParams) c_progress(image_params *C.struct_pt_image_params) func() error {
+	if params.Progress == nil {
+		return func() error { return nil }
+	}
+
+	var progress = &imageProgress{fn: params.Progress}
+	var handle = cgo.NewHandle(progress)
+
+	C.pngtile_image_params_progress(image_params, C.uintptr_t(handle))
+
+	return func() error {
+		handle.Delete()
+
+		return progress.err
+	}
+}
+
+func (progress *imageProgress) call(c_progress *C.struct_pt_image_progress) C.int {
+	if progress.err != nil {
+		return 1
+	}
+
+	progress.err = progress.fn(ImageProgress{
+		Rows:        uint64(c_progress.rows),
+		RowsTotal:   uint64(c_progress.rows_total),
+		Bytes:       uint64(c_progress.bytes),
+		SparseBytes: uint64(c_progress.sparse_bytes),
+		Elapsed:     time.Duration(c_progress.elapsed.tv_sec)*time.Second + time.Duration(c_progress.elapsed.tv_nsec),
+	})
+
+	if progress.err != nil {
+		return 1
+	}
+
+	return 0
+}
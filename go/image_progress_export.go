@@ -0,0 +1,17 @@
+package pngtile
+
+/*
+#include "pngtile.h"
+*/
+import "C"
+import (
+	"runtime/cgo"
+	"unsafe"
+)
+
+//export pngtileImageProgress
+func pngtileImageProgress(arg unsafe.Pointer, c_progress *C.struct_pt_image_progress) C.int {
+	var progress = cgo.Handle(uintptr(arg)).Value().(*imageProgress)
+
+	return progress.call(c_progress)
+}
@@ -0,0 +1,777 @@
+package pngtile
+
+import (
+	"bytes"
+	"errors"
+	"github.com/stretchr/testify/assert"
+	"image"
+	"image/color"
+	"image/png"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"strings"
+	"testing"
+	"time"
+)
+
+// Pixels of the test image: a gradient, with noise in the bottom half to defeat the tile compression
+func testImagePixel(x, y int) color.NRGBA {
+	if y >= testImageHeight/2 {
+		var h = uint32(y*testImageWidth+x) * 2654435761
+
+		h ^= h >> 15
+		h *= 2246822519
+		h ^= h >> 13
+
+		return color.NRGBA{uint8(h), uint8(h >> 8), uint8(h >> 16), 255}
+	}
+
+	return color.NRGBA{uint8(x), uint8(y), uint8(x ^ y), 255}
+}
+
+// Pixels of the gray test image, the same pattern as the RGB one
+func testGrayPixel(x, y int) color.NRGBA {
+	var pixel = testImagePixel(x, y)
+
+	return color.NRGBA{pixel.B, pixel.B, pixel.B, 255}
+}
+
+// Palette of the palette test image, with enough colors for 8-bit indexes
+var testPalette = func() color.Palette {
+	var palette = make(color.Palette, 64)
+
+	for i := range palette {
+		var h = uint32(i+1) * 2654435761
+
+		palette[i] = color.RGBA{uint8(h >> 8), uint8(h >> 16), uint8(h >> 24), 255}
+	}
+
+	return palette
+}()
+
+// Palette indexes of the palette test image: squares of each color, with noise in the bottom half
+func testPaletteIndex(x, y int) uint8 {
+	if y >= testImageHeight/2 {
+		return testImagePixel(x, y).R % uint8(len(testPalette))
+	}
+
+	return uint8((x/16 + y/16*3) % len(testPalette))
+}
+
+// Pixels of the palette test image
+func testPalettePixel(x, y int) color.NRGBA {
+	return color.NRGBAModel.Convert(testPalette[testPaletteIndex(x, y)]).(color.NRGBA)
+}
+
+const testImageWidth = 512
+const testImageHeight = 512
+
+// Write out the test image as an RGB PNG, returning its path
+func testImagePath(t *testing.T) string {
+	var img = image.NewNRGBA(image.Rect(0, 0, testImageWidth, testImageHeight))
+
+	for y := 0; y < testImageHeight; y++ {
+		for x := 0; x < testImageWidth; x++ {
+			img.SetNRGBA(x, y, testImagePixel(x, y))
+		}
+	}
+
+	return testImageWrite(t, img)
+}
+
+// Write out the gray test image as an 8-bit grayscale PNG, returning its path
+func testGrayImagePath(t *testing.T) string {
+	var img = image.NewGray(image.Rect(0, 0, testImageWidth, testImageHeight))
+
+	for y := 0; y < testImageHeight; y++ {
+		for x := 0; x < testImageWidth; x++ {
+			img.SetGray(x, y, color.Gray{testGrayPixel(x, y).R})
+		}
+	}
+
+	return testImageWrite(t, img)
+}
+
+// Write out the palette test image as an 8-bit palette PNG, returning its path
+func testPaletteImagePath(t *testing.T) string {
+	var img = image.NewPaletted(image.Rect(0, 0, testImageWidth, testImageHeight), testPalette)
+
+	for y := 0; y < testImageHeight; y++ {
+		for x := 0; x < testImageWidth; x++ {
+			img.SetColorIndex(x, y, testPaletteIndex(x, y))
+		}
+	}
+
+	return testImageWrite(t, img)
+}
+
+// Write out the image as a PNG within a temporary directory, returning its path
+func testImageWrite(t *testing.T, img image.Image) string {
+	var dir, err = ioutil.TempDir("", "pngtile-test")
+
+	if err != nil {
+		t.Fatalf("TempDir: %v", err)
+	}
+
+	t.Cleanup(func() { os.RemoveAll(dir) })
+
+	var path = filepath.Join(dir, "test.png")
+
+	if file, err := os.Create(path); err != nil {
+		t.Fatalf("Create %v: %v", path, err)
+	} else if err := png.Encode(file, img); err != nil {
+		t.Fatalf("png.Encode %v: %v", path, err)
+	} else if err := file.Close(); err != nil {
+		t.Fatalf("Close %v: %v", path, err)
+	}
+
+	return path
+}
+
+// Update the cache of the image at path
+func testImageUpdate(t *testing.T, path string, params ImageParams) *Image {
+	cachePath, err := CachePath(path)
+	if err != nil {
+		t.Fatalf("CachePath %v: %v", path, err)
+	}
+
+	image, err := OpenImage(cachePath)
+	if err != nil {
+		t.Fatalf("OpenImage %v: %v", cachePath, err)
+	}
+
+	t.Cleanup(func() { image.Close() })
+
+	if err := image.Update(path, params); err != nil {
+		t.Fatalf("Update %v: %v", path, err)
+	}
+
+	return image
+}
+
+// Write out the test image, and update its cache
+func testImage(t *testing.T, params ImageParams) *Image {
+	return testImageUpdate(t, testImagePath(t), params)
+}
+
+// Expected pixel of the tile: each image pixel repeated when zoomed in, or the rounded average of each square of
+// image pixels when zoomed out
+func testTilePixel(imagePixel func(x, y int) color.NRGBA, params TileParams, x, y int) color.NRGBA {
+	if params.Zoom < 0 {
+		return imagePixel(int(params.X)+x>>uint(-params.Zoom), int(params.Y)+y>>uint(-params.Zoom))
+	}
+
+	var scale = 1 << uint(params.Zoom)
+	var sum [3]int
+	var count int
+
+	for iy := int(params.Y) + y*scale; iy < int(params.Y)+(y+1)*scale && iy < testImageHeight; iy++ {
+		for ix := int(params.X) + x*scale; ix < int(params.X)+(x+1)*scale && ix < testImageWidth; ix++ {
+			var pixel = imagePixel(ix, iy)
+
+			sum[0] += int(pixel.R)
+			sum[1] += int(pixel.G)
+			sum[2] += int(pixel.B)
+			count++
+		}
+	}
+
+	return color.NRGBA{uint8((sum[0] + count/2) / count), uint8((sum[1] + count/2) / count), uint8((sum[2] + count/2) / count), 255}
+}
+
+// Decode the rendered tile, and compare it against the image pixels
+func testTile(t *testing.T, data []byte, params TileParams) {
+	testTileWithin(t, data, params, 0)
+}
+
+// Decode the rendered tile, and compare it against the image pixels, allowing each channel to differ by up to delta
+func testTileWithin(t *testing.T, data []byte, params TileParams, delta int) {
+	testTileOf(t, testImagePixel, data, params, delta)
+}
+
+// Decode the rendered tile, and compare it against the pixels of the given test image
+func testTileOf(t *testing.T, imagePixel func(x, y int) color.NRGBA, data []byte, params TileParams, delta int) {
+	tile, err := png.Decode(bytes.NewReader(data))
+
+	if !assert.NoError(t, err, "png.Decode %#v", params) {
+		return
+	}
+
+	assert.Equal(t, image.Rect(0, 0, int(params.Width), int(params.Height)), tile.Bounds(), "bounds %#v", params)
+
+	for y := 0; y < int(params.Height); y++ {
+		for x := 0; x < int(params.Width); x++ {
+			var pixel = color.NRGBAModel.Convert(tile.At(x, y)).(color.NRGBA)
+			var expect = testTilePixel(imagePixel, params, x, y)
+
+			if !testPixelWithin(pixel, expect, delta) {
+				assert.Equal(t, expect, pixel, "pixel %d,%d of %#v", x, y, params)
+				return
+			}
+		}
+	}
+}
+
+// Expected palette index of the tile pixel: each image index repeated when zoomed in, or the index mapped from each
+// square of image pixels when zoomed out, as for the zoom mode
+func testTileIndex(params TileParams, x, y int) uint8 {
+	if params.Zoom <= 0 {
+		return testPaletteIndex(int(params.X)+x>>uint(-params.Zoom), int(params.Y)+y>>uint(-params.Zoom))
+	}
+
+	var scale = 1 << uint(params.Zoom)
+
+	if params.ZoomMode == TILE_ZOOM_DOMINANT {
+		var counts [256]int
+		var best uint8
+		var bestCount int
+
+		// the first index to reach the highest count wins
+		for iy := int(params.Y) + y*scale; iy < int(params.Y)+(y+1)*scale && iy < testImageHeight; iy++ {
+			for ix := int(params.X) + x*scale; ix < int(params.X)+(x+1)*scale && ix < testImageWidth; ix++ {
+				var index = testPaletteIndex(ix, iy)
+
+				if counts[index]++; counts[index] > bestCount {
+					best = index
+					bestCount = counts[index]
+				}
+			}
+		}
+
+		return best
+	}
+
+	// the nearest palette color to the center of the 6-bit color that the average quantizes to, preferring the lowest
+	// index
+	var pixel = testTilePixel(testPalettePixel, params, x, y)
+	var center = [3]int{int(pixel.R&^3 | 2), int(pixel.G&^3 | 2), int(pixel.B&^3 | 2)}
+	var best uint8
+	var bestDist = -1
+
+	for i, c := range testPalette {
+		var rgba = c.(color.RGBA)
+		var r, g, b = int(rgba.R) - center[0], int(rgba.G) - center[1], int(rgba.B) - center[2]
+
+		if dist := r*r + g*g + b*b; bestDist < 0 || dist < bestDist {
+			best = uint8(i)
+			bestDist = dist
+		}
+	}
+
+	return best
+}
+
+// Decode the rendered tile as a palette PNG, and compare its palette indexes against the palette test image
+func testTilePaletted(t *testing.T, data []byte, params TileParams) {
+	tile, err := png.Decode(bytes.NewReader(data))
+
+	if !assert.NoError(t, err, "png.Decode %#v", params) {
+		return
+	}
+
+	paletted, ok := tile.(*image.Paletted)
+
+	if !assert.True(t, ok, "palette PNG for %#v, not %T", params, tile) {
+		return
+	}
+
+	assert.Equal(t, image.Rect(0, 0, int(params.Width), int(params.Height)), paletted.Bounds(), "bounds %#v", params)
+	assert.Equal(t, testPalette, paletted.Palette, "palette %#v", params)
+
+	for y := 0; y < int(params.Height); y++ {
+		for x := 0; x < int(params.Width); x++ {
+			var index = paletted.ColorIndexAt(x, y)
+			var expect = testTileIndex(params, x, y)
+
+			if index != expect {
+				assert.Equal(t, expect, index, "index %d,%d of %#v", x, y, params)
+				return
+			}
+		}
+	}
+}
+
+func testPixelWithin(pixel, expect color.NRGBA, delta int) bool {
+	for _, d := range []int{
+		int(pixel.R) - int(expect.R),
+		int(pixel.G) - int(expect.G),
+		int(pixel.B) - int(expect.B),
+		int(pixel.A) - int(expect.A),
+	} {
+		if d < -delta || d > delta {
+			return false
+		}
+	}
+
+	return true
+}
+
+var testImageTiles = []TileParams{
+	{Width: 64, Height: 64},
+	{Width: 100, Height: 30, X: 7, Y: 5},
+	{Width: 256, Height: 256, X: 256, Y: 256},
+	{Width: 32, Height: 64, X: 480, Y: 100, Encoder: TILE_ENCODER_LIBPNG},
+	{Width: 100, Height: 30, X: 7, Y: 5, Encoder: TILE_ENCODER_BUILTIN},
+	{Width: 256, Height: 128, X: 200, Y: 200, Profile: TILE_PROFILE_FAST},
+}
+
+func TestImageTile(t *testing.T) {
+	var image = testImage(t, ImageParams{})
+
+	for _, params := range testImageTiles {
+		if data, err := image.Tile(params); assert.NoError(t, err, "Tile %#v", params) {
+			testTile(t, data, params)
+		}
+	}
+}
+
+func TestImageTileInto(t *testing.T) {
+	var image = testImage(t, ImageParams{})
+	var buf = make([]byte, 0, 1024*1024)
+
+	for _, params := range testImageTiles {
+		if data, err := image.TileInto(buf, params); assert.NoError(t, err, "TileInto %#v", params) {
+			assert.True(t, &data[:1][0] == &buf[:1][0], "rendered into the given buffer")
+
+			testTile(t, data, params)
+		}
+	}
+}
+
+var errTestWrite = errors.New("write failed by test")
+
+// Fails any write past the first len bytes
+type testFailWriter struct {
+	len int
+}
+
+func (w *testFailWriter) Write(data []byte) (int, error) {
+	if len(data) > w.len {
+		return 0, errTestWrite
+	}
+
+	w.len -= len(data)
+
+	return len(data), nil
+}
+
+// A tile written out to a failing writer returns its error, at any point of the tile, and the next tile renders using
+// the same render state
+func TestImageTileTo(t *testing.T) {
+	var image = testImage(t, ImageParams{})
+	var tiles []TileParams
+
+	tiles = append(tiles, testImageTiles...)
+	tiles = append(tiles, testImageZoomTiles...)
+	tiles = append(tiles, testImageZoomInTiles...)
+
+	for _, params := range tiles {
+		for _, encoder := range []TileEncoder{TILE_ENCODER_LIBPNG, TILE_ENCODER_BUILTIN} {
+			var buf bytes.Buffer
+
+			params.Encoder = encoder
+
+			if err := image.TileTo(&buf, params); !assert.NoError(t, err, "TileTo %#v", params) {
+				continue
+			}
+
+			testTile(t, buf.Bytes(), params)
+
+			for _, len := range []int{0, buf.Len() / 2, buf.Len() - 1} {
+				err := image.TileTo(&testFailWriter{len: len}, params)
+
+				assert.Equal(t, errTestWrite, err, "TileTo %#v failing after %d bytes", params, len)
+			}
+		}
+	}
+}
+
+// Drive the size hint down with flat tiles, so that the noisy tile renders again at the required size
+func TestImageTileIntoGrow(t *testing.T) {
+	var image = testImage(t, ImageParams{})
+	var flatParams = TileParams{Width: 16, Height: 16}
+	var noiseParams = TileParams{Width: 256, Height: 128, Y: testImageHeight / 2}
+	var buf []byte
+
+	for i := 0; i < 100; i++ {
+		if _, err := image.Tile(flatParams); err != nil {
+			t.Fatalf("Tile %#v: %v", flatParams, err)
+		}
+	}
+
+	hint, err := image.TileSizeHint(noiseParams)
+	if err != nil {
+		t.Fatalf("TileSizeHint %#v: %v", noiseParams, err)
+	}
+
+	buf = make([]byte, 0, hint)
+
+	if data, err := image.TileInto(buf, noiseParams); assert.NoError(t, err, "TileInto %#v", noiseParams) {
+		assert.True(t, len(data) > hint, "tile of %d bytes larger than the size hint of %d bytes", len(data), hint)
+
+		testTile(t, data, noiseParams)
+	}
+}
+
+func TestImageTileSizeHint(t *testing.T) {
+	var image = testImage(t, ImageParams{})
+
+	_, err := image.TileSizeHint(TileParams{Width: 0, Height: 64})
+	assert.Error(t, err, "TileSizeHint without width")
+
+	var hints = make([]int, len(testImageTiles))
+
+	for i, params := range testImageTiles {
+		if hint, err := image.TileSizeHint(params); err != nil {
+			t.Fatalf("TileSizeHint %#v: %v", params, err)
+		} else {
+			hints[i] = hint
+		}
+	}
+
+	// nothing was rendered yet, so the hints are the upper bound for each tile
+	for i, params := range testImageTiles {
+		if data, err := image.Tile(params); assert.NoError(t, err, "Tile %#v", params) {
+			assert.True(t, len(data) <= hints[i], "tile of %d bytes within the size hint of %d bytes", len(data), hints[i])
+		}
+	}
+}
+
+// Aligned to the zoom, as the stored zoom levels are
+var testImageZoomTiles = []TileParams{
+	{Width: 64, Height: 64, Zoom: 1},
+	{Width: 100, Height: 30, X: 8, Y: 6, Zoom: 1},
+	{Width: 64, Height: 64, X: 128, Y: 200, Zoom: 2},
+	{Width: 32, Height: 32, X: 8, Y: 248, Zoom: 3},
+	{Width: 16, Height: 16, X: 256, Y: 256, Zoom: 4},
+	{Width: 10, Height: 10, X: 96, Y: 96, Zoom: 5},
+	{Width: 64, Height: 64, X: 64, Y: 256, Zoom: 2, Encoder: TILE_ENCODER_BUILTIN},
+	{Width: 32, Height: 32, X: 16, Y: 240, Zoom: 3, Profile: TILE_PROFILE_FAST},
+	{Width: 8, Height: 8, X: 64, Y: 64, Zoom: 5, Encoder: TILE_ENCODER_BUILTIN},
+}
+
+func TestImageTileZoom(t *testing.T) {
+	var image = testImage(t, ImageParams{})
+
+	for _, params := range testImageZoomTiles {
+		if data, err := image.Tile(params); assert.NoError(t, err, "Tile %#v", params) {
+			testTile(t, data, params)
+		}
+	}
+}
+
+// Number of zoom levels stored in the cache
+const testImageZoomLevels = 4
+
+// Each stored zoom level is downsampled from the full-size image, and matches the average of the image pixels.
+//
+// Tiles zoomed out further are downsampled again from the last stored level, and may be off by one.
+func TestImageTileZoomLevels(t *testing.T) {
+	for _, imageParams := range []ImageParams{{ZoomLevels: true}, {ZoomLevels: true, Compress: true}} {
+		var image = testImage(t, imageParams)
+
+		for _, params := range testImageZoomTiles {
+			var delta = 0
+
+			if params.Zoom > testImageZoomLevels {
+				delta = 1
+			}
+
+			if data, err := image.Tile(params); assert.NoError(t, err, "Tile %#v with %#v", params, imageParams) {
+				testTileWithin(t, data, params, delta)
+			}
+		}
+	}
+}
+
+var testImageZoomInTiles = []TileParams{
+	{Width: 64, Height: 64, Zoom: -1},
+	{Width: 100, Height: 30, X: 7, Y: 5, Zoom: -1},
+	{Width: 64, Height: 64, X: 496, Y: 250, Zoom: -2},
+	{Width: 256, Height: 256, X: 480, Y: 480, Zoom: -3},
+	{Width: 33, Height: 17, X: 1, Y: 2, Zoom: -8},
+	{Width: 64, Height: 64, X: 300, Y: 300, Zoom: -2, Encoder: TILE_ENCODER_LIBPNG},
+	{Width: 100, Height: 30, X: 7, Y: 5, Zoom: -1, Encoder: TILE_ENCODER_BUILTIN},
+	{Width: 64, Height: 64, X: 200, Y: 300, Zoom: -3, Profile: TILE_PROFILE_FAST},
+}
+
+func TestImageTileZoomIn(t *testing.T) {
+	var image = testImage(t, ImageParams{})
+
+	for _, params := range testImageZoomInTiles {
+		if data, err := image.Tile(params); assert.NoError(t, err, "Tile %#v", params) {
+			testTile(t, data, params)
+		}
+	}
+
+	_, err := image.Tile(TileParams{Width: 64, Height: 64, Zoom: -9})
+	assert.Error(t, err, "Tile zoomed in past -8")
+}
+
+// Each profile renders the same pixels, trading speed for size
+func TestImageTileProfile(t *testing.T) {
+	var image = testImage(t, ImageParams{})
+	var tiles []TileParams
+	var sizes = make(map[TileProfile]int)
+
+	tiles = append(tiles, testImageTiles...)
+	tiles = append(tiles, testImageZoomTiles...)
+	tiles = append(tiles, testImageZoomInTiles...)
+
+	for _, profile := range []TileProfile{TILE_PROFILE_DEFAULT, TILE_PROFILE_FAST, TILE_PROFILE_SMALL} {
+		for _, params := range tiles {
+			params.Profile = profile
+
+			if data, err := image.Tile(params); assert.NoError(t, err, "Tile %#v", params) {
+				testTile(t, data, params)
+
+				sizes[profile] += len(data)
+			}
+		}
+	}
+
+	assert.True(t, sizes[TILE_PROFILE_SMALL] <= sizes[TILE_PROFILE_DEFAULT], "small profile tiles of %d bytes within the default of %d bytes", sizes[TILE_PROFILE_SMALL], sizes[TILE_PROFILE_DEFAULT])
+	assert.True(t, sizes[TILE_PROFILE_DEFAULT] <= sizes[TILE_PROFILE_FAST], "default profile tiles of %d bytes within the fast of %d bytes", sizes[TILE_PROFILE_DEFAULT], sizes[TILE_PROFILE_FAST])
+}
+
+// Palette tiles keep the palette indexes as stored, and are zoomed out to RGB, or back to palette indexes using the
+// palette and dominant zoom modes, with or without the stored zoom levels
+func TestImageTilePalette(t *testing.T) {
+	for _, imageParams := range []ImageParams{{}, {ZoomLevels: true}} {
+		var image = testImageUpdate(t, testPaletteImagePath(t), imageParams)
+		var tiles []TileParams
+
+		tiles = append(tiles, testImageTiles...)
+		tiles = append(tiles, testImageZoomInTiles...)
+
+		for _, params := range tiles {
+			for _, encoder := range []TileEncoder{TILE_ENCODER_LIBPNG, TILE_ENCODER_BUILTIN} {
+				params.Encoder = encoder
+
+				if data, err := image.Tile(params); assert.NoError(t, err, "Tile %#v with %#v", params, imageParams) {
+					testTilePaletted(t, data, params)
+				}
+			}
+		}
+
+		for _, params := range testImageZoomTiles {
+			var delta = 0
+
+			// downsampled again from the last stored level
+			if imageParams.ZoomLevels && params.Zoom > testImageZoomLevels {
+				delta = 1
+			}
+
+			if data, err := image.Tile(params); assert.NoError(t, err, "Tile %#v with %#v", params, imageParams) {
+				testTileOf(t, testPalettePixel, data, params, delta)
+			}
+
+			for _, mode := range []TileZoomMode{TILE_ZOOM_PALETTE, TILE_ZOOM_DOMINANT} {
+				params.ZoomMode = mode
+
+				// the average may be off by one, and map to another color
+				if delta > 0 && mode == TILE_ZOOM_PALETTE {
+					continue
+				}
+
+				for _, encoder := range []TileEncoder{TILE_ENCODER_LIBPNG, TILE_ENCODER_BUILTIN} {
+					params.Encoder = encoder
+
+					if data, err := image.Tile(params); assert.NoError(t, err, "Tile %#v with %#v", params, imageParams) {
+						testTilePaletted(t, data, params)
+					}
+				}
+			}
+		}
+	}
+}
+
+// Grayscale tiles are encoded as stored by either encoder, and zoomed out to RGB
+func TestImageTileGray(t *testing.T) {
+	var image = testImageUpdate(t, testGrayImagePath(t), ImageParams{})
+	var tiles []TileParams
+
+	tiles = append(tiles, testImageTiles...)
+	tiles = append(tiles, testImageZoomTiles...)
+	tiles = append(tiles, testImageZoomInTiles...)
+
+	for _, params := range tiles {
+		for _, encoder := range []TileEncoder{TILE_ENCODER_LIBPNG, TILE_ENCODER_BUILTIN} {
+			params.Encoder = encoder
+
+			if data, err := image.Tile(params); assert.NoError(t, err, "Tile %#v", params) {
+				testTileOf(t, testGrayPixel, data, params, 0)
+			}
+		}
+	}
+}
+
+func TestImageTileBatch(t *testing.T) {
+	var image = testImage(t, ImageParams{ZoomLevels: true})
+	var params []TileParams
+
+	params = append(params, testImageTiles...)
+	params = append(params, testImageZoomTiles...)
+	params = append(params, testImageZoomInTiles...)
+
+	// an invalid tile fails on its own, without failing the batch
+	params = append(params, TileParams{Width: 64, Height: 64, X: testImageWidth})
+
+	// reversed, so that the batch has to reorder them by their offset into the cache
+	for i, j := 0, len(params)-1; i < j; i, j = i+1, j-1 {
+		params[i], params[j] = params[j], params[i]
+	}
+
+	results, err := image.TileBatch(params)
+
+	if !assert.NoError(t, err, "TileBatch") || !assert.Len(t, results, len(params)) {
+		return
+	}
+
+	for i, result := range results {
+		data, err := image.Tile(params[i])
+
+		if err != nil {
+			assert.Error(t, result.Err, "TileBatch %#v", params[i])
+		} else if assert.NoError(t, result.Err, "TileBatch %#v", params[i]) {
+			assert.Equal(t, data, result.Data, "TileBatch %#v", params[i])
+		}
+	}
+
+	results, err = image.TileBatch(nil)
+
+	assert.NoError(t, err, "TileBatch without tiles")
+	assert.Len(t, results, 0, "TileBatch without tiles")
+}
+
+// A checkpointed update writes out the same cache as a plain update, ignoring any stale checkpoint
+func TestImageUpdateCheckpoint(t *testing.T) {
+	for _, imageParams := range []ImageParams{{}, {Compress: true}, {ZoomLevels: true, Compress: true}} {
+		var path = testImagePath(t)
+		var cachePath, _ = CachePath(path)
+		var base = strings.TrimSuffix(cachePath, filepath.Ext(cachePath))
+		var checkpointParams = imageParams
+
+		checkpointParams.Checkpoint = true
+
+		testImageUpdate(t, path, imageParams)
+
+		expect, err := ioutil.ReadFile(cachePath)
+		if err != nil {
+			t.Fatalf("ReadFile %v: %v", cachePath, err)
+		}
+
+		// left behind by an interrupted update of some other image
+		for _, ext := range []string{".tmp", ".ckpt"} {
+			if err := ioutil.WriteFile(base+ext, bytes.Repeat([]byte{0xff}, 4096), 0644); err != nil {
+				t.Fatalf("WriteFile %v: %v", base+ext, err)
+			}
+		}
+
+		var image = testImageUpdate(t, path, checkpointParams)
+
+		if data, err := ioutil.ReadFile(cachePath); assert.NoError(t, err, "ReadFile %v", cachePath) {
+			assert.True(t, bytes.Equal(expect, data), "cache with %#v matches the cache without checkpoints", checkpointParams)
+		}
+
+		for _, ext := range []string{".tmp", ".ckpt"} {
+			_, err := os.Stat(base + ext)
+
+			assert.True(t, os.IsNotExist(err), "%v removed after the update: %v", base+ext, err)
+		}
+
+		for _, params := range testImageTiles {
+			if data, err := image.Tile(params); assert.NoError(t, err, "Tile %#v", params) {
+				testTile(t, data, params)
+			}
+		}
+	}
+}
+
+var errTestCancel = errors.New("cancelled by test")
+
+// An update cancelled after a checkpoint resumes from it, and writes out the same cache as a plain update
+func TestImageUpdateResume(t *testing.T) {
+	for _, imageParams := range []ImageParams{{}, {Compress: true}, {Stream: true}, {ZoomLevels: true, Compress: true}} {
+		var path = testImagePath(t)
+		var cachePath, _ = CachePath(path)
+		var base = strings.TrimSuffix(cachePath, filepath.Ext(cachePath))
+		var plainProgress, resumeProgress ImageProgress
+
+		// the bytes stored by an update from the start
+		imageParams.Progress = func(progress ImageProgress) error {
+			plainProgress = progress
+			return nil
+		}
+
+		testImageUpdate(t, path, imageParams)
+
+		expect, err := ioutil.ReadFile(cachePath)
+		if err != nil {
+			t.Fatalf("ReadFile %v: %v", cachePath, err)
+		}
+
+		os.Remove(cachePath)
+
+		// checkpoint at every chunk of rows, slowed down so that each one is due, and cancel within the noisy half of
+		// the image, where the deflate blocks to checkpoint at are
+		imageParams.Checkpoint = true
+		imageParams.CheckpointInterval = time.Millisecond
+		imageParams.ProgressInterval = time.Millisecond
+		imageParams.Progress = func(progress ImageProgress) error {
+			time.Sleep(2 * time.Millisecond)
+
+			if progress.Rows >= progress.RowsTotal*3/4 {
+				return errTestCancel
+			}
+
+			return nil
+		}
+
+		if image, err := OpenImage(cachePath); err != nil {
+			t.Fatalf("OpenImage %v: %v", cachePath, err)
+		} else {
+			err := image.Update(path, imageParams)
+
+			image.Close()
+
+			if !assert.Equal(t, errTestCancel, err, "Update cancelled with %#v", imageParams) {
+				continue
+			}
+		}
+
+		for _, ext := range []string{".tmp", ".ckpt"} {
+			_, err := os.Stat(base + ext)
+
+			assert.NoError(t, err, "%v kept to resume from", base+ext)
+		}
+
+		imageParams.Progress = func(progress ImageProgress) error {
+			resumeProgress = progress
+			return nil
+		}
+
+		var image = testImageUpdate(t, path, imageParams)
+
+		assert.True(t, resumeProgress.Bytes+resumeProgress.SparseBytes < plainProgress.Bytes+plainProgress.SparseBytes,
+			"resumed update stored %d of %d bytes", resumeProgress.Bytes+resumeProgress.SparseBytes, plainProgress.Bytes+plainProgress.SparseBytes)
+		assert.Equal(t, plainProgress.Rows, resumeProgress.Rows, "resumed update counts the rows before the checkpoint")
+
+		if data, err := ioutil.ReadFile(cachePath); assert.NoError(t, err, "ReadFile %v", cachePath) {
+			assert.True(t, bytes.Equal(expect, data), "resumed cache with %#v matches the cache without checkpoints", imageParams)
+		}
+
+		for _, ext := range []string{".tmp", ".ckpt"} {
+			_, err := os.Stat(base + ext)
+
+			assert.True(t, os.IsNotExist(err), "%v removed after the update: %v", base+ext, err)
+		}
+
+		for _, params := range testImageTiles {
+			if data, err := image.Tile(params); assert.NoError(t, err, "Tile %#v", params) {
+				testTile(t, data, params)
+			}
+		}
+	}
+}
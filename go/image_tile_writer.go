@@ -0,0 +1,59 @@
+package pngtile
+
+/*
+#include <stdint.h>
+#include "pngtile.h"
+
+extern int pngtileTileWrite(void *arg, void *data, size_t len);
+
+static int pngtile_tile_write(void *arg, const void *data, size_t len) {
+        return pngtileTileWrite(arg, (void *) data, len);
+}
+
+static void pngtile_tile_writer(struct pt_tile_writer *writer, uintptr_t handle) {
+        writer->write = pngtile_tile_write;
+        writer->arg = (void *) handle;
+}
+*/
+import "C"
+import (
+	"io"
+	"runtime/cgo"
+	"unsafe"
+)
+
+type tileWriter struct {
+	w   io.Writer
+	err error
+}
+
+// Set up the C writer to stream out to the io.Writer.
+//
+// The returned func must be called after the render returns, and returns the io.Writer error that aborted the render, if any.
+func makeTileWriter(w io.Writer, c_writer *C.struct_pt_tile_writer) func() error {
+	var writer = &tileWriter{w: w}
+	var handle = cgo.NewHandle(writer)
+
+	C.pngtile_tile_writer(c_writer, C.uintptr_t(handle))
+
+	return func() error {
+		handle.Delete()
+
+		return writer.err
+	}
+}
+
+func (writer *tileWriter) write(data unsafe.Pointer, len C.size_t) C.int {
+	if writer.err != nil {
+		return 1
+	}
+
+	// the io.Writer must not retain the C buffer
+	if _, err := writer.w.Write(unsafe.Slice((*byte)(data), int(len))); err != nil {
+		writer.err = err
+
+		return 1
+	}
+
+	return 0
+}
@@ -0,0 +1,17 @@
+package pngtile
+
+/*
+#include "pngtile.h"
+*/
+import "C"
+import (
+	"runtime/cgo"
+	"unsafe"
+)
+
+//export pngtileTileWrite
+func pngtileTileWrite(arg unsafe.Pointer, data unsafe.Pointer, len C.size_t) C.int {
+	var writer = cgo.Handle(uintptr(arg)).Value().(*tileWriter)
+
+	return writer.write(data, len)
+}
@@ -1,7 +1,7 @@
 package pngtile
 
 // #cgo CFLAGS: -I${SRCDIR}/../include
-// #cgo LDFLAGS: ${SRCDIR}/../lib/libpngtile.a -lpng
+// #cgo LDFLAGS: ${SRCDIR}/../lib/libpngtile.a -lpng -lz -lpthread
 /*
 #include "pngtile.h"
 */
@@ -0,0 +1,46 @@
+package pngtile
+
+/*
+#include "pngtile.h"
+*/
+import "C"
+
+// Memory residency policy for the opened cache
+type OpenParams struct {
+	Random     bool // disable readahead for random tile access
+	Sequential bool // aggressive readahead for sequential access
+	Populate   bool // read the entire cache into memory on open
+	HugePage   bool // use transparent hugepages
+	Lock       bool // mlock the entire cache into memory
+	Holes      bool // map out the holes in the cache file, and do not read them
+}
+
+func (params OpenParams) c_struct() C.struct_pt_open_params {
+	var open_params C.struct_pt_open_params
+
+	if params.Random {
+		open_params.flags |= C.PT_OPEN_RANDOM
+	}
+
+	if params.Sequential {
+		open_params.flags |= C.PT_OPEN_SEQUENTIAL
+	}
+
+	if params.Populate {
+		open_params.flags |= C.PT_OPEN_POPULATE
+	}
+
+	if params.HugePage {
+		open_params.flags |= C.PT_OPEN_HUGEPAGE
+	}
+
+	if params.Lock {
+		open_params.flags |= C.PT_OPEN_MLOCK
+	}
+
+	if params.Holes {
+		open_params.flags |= C.PT_OPEN_HOLES
+	}
+
+	return open_params
+}
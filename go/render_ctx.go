@@ -0,0 +1,40 @@
+package pngtile
+
+/*
+#include "pngtile.h"
+*/
+import "C"
+import "runtime"
+
+// Render contexts kept for reuse by Image.Tile, up to one per concurrently running goroutine
+var renderCtxPool = make(chan *C.struct_pt_render_ctx, runtime.GOMAXPROCS(0))
+
+// Return a pooled render context, or a new one. Returns nil on errors, rendering without a context.
+func getRenderCtx() *C.struct_pt_render_ctx {
+	select {
+	case ctx := <-renderCtxPool:
+		return ctx
+	default:
+	}
+
+	var ctx *C.struct_pt_render_ctx
+
+	if ret, _ := C.pt_render_ctx_new(&ctx); ret < 0 {
+		return nil
+	}
+
+	return ctx
+}
+
+// Return the render context to the pool, or release it if the pool is full.
+func putRenderCtx(ctx *C.struct_pt_render_ctx) {
+	if ctx == nil {
+		return
+	}
+
+	select {
+	case renderCtxPool <- ctx:
+	default:
+		C.pt_render_ctx_destroy(ctx)
+	}
+}
@@ -0,0 +1,207 @@
+package pngtile
+
+/*
+#include <stdlib.h>
+#include "pngtile.h"
+*/
+import "C"
+import (
+	"runtime"
+	"sync"
+	"unsafe"
+)
+
+// Pool of threads rendering tiles, without each render blocking an OS thread in a cgo call.
+//
+// Completed renders are collected by a single goroutine while there are any renders in progress.
+type Renderer struct {
+	pt_renderer *C.struct_pt_renderer
+
+	mutex      sync.Mutex
+	jobs       map[*C.struct_pt_render_job]chan struct{}
+	collecting bool
+	collector  sync.WaitGroup
+}
+
+func NewRenderer(threads uint) (*Renderer, error) {
+	var renderer = Renderer{
+		jobs: make(map[*C.struct_pt_render_job]chan struct{}),
+	}
+
+	if ret, err := C.pt_renderer_new(&renderer.pt_renderer, C.uint(threads)); ret < 0 {
+		return nil, makeError("pt_renderer_new", ret, err)
+	}
+
+	return &renderer, nil
+}
+
+// Wait for jobs to complete, until there are no more jobs submitted
+func (renderer *Renderer) collect() {
+	defer renderer.collector.Done()
+
+	for {
+		var job *C.struct_pt_render_job
+
+		C.pt_renderer_complete(renderer.pt_renderer, &job, true)
+
+		renderer.mutex.Lock()
+
+		if job != nil {
+			close(renderer.jobs[job])
+			delete(renderer.jobs, job)
+		} else if len(renderer.jobs) == 0 {
+			renderer.collecting = false
+			renderer.mutex.Unlock()
+
+			return
+		}
+
+		renderer.mutex.Unlock()
+	}
+}
+
+// Submit the job, and start collecting completed jobs if not yet doing so
+func (renderer *Renderer) submit(job *C.struct_pt_render_job) (chan struct{}, error) {
+	var done = make(chan struct{})
+
+	renderer.mutex.Lock()
+	defer renderer.mutex.Unlock()
+
+	if ret, err := C.pt_renderer_submit(renderer.pt_renderer, job); ret < 0 {
+		return nil, makeError("pt_renderer_submit", ret, err)
+	}
+
+	renderer.jobs[job] = done
+
+	if !renderer.collecting {
+		renderer.collecting = true
+		renderer.collector.Add(1)
+
+		go renderer.collect()
+	}
+
+	return done, nil
+}
+
+// Render tile to PNG image using the renderer's threads, waiting for it to complete.
+//
+// The image must not be closed while rendering.
+func (renderer *Renderer) Tile(image *Image, params TileParams) ([]byte, error) {
+	var job = (*C.struct_pt_render_job)(C.calloc(1, C.sizeof_struct_pt_render_job))
+
+	if job == nil {
+		return nil, makeError("pt_renderer_submit", -C.PT_ERR_MEM, nil)
+	}
+
+	defer C.free(unsafe.Pointer(job))
+
+	if err := renderer.render(job, image, params); err != nil {
+		return nil, err
+	}
+
+	defer C.free(unsafe.Pointer(job.result.buf))
+
+	return C.GoBytes(unsafe.Pointer(job.result.buf), C.int(job.result.len)), nil
+}
+
+// Submit the job, and wait for it to complete
+func (renderer *Renderer) render(job *C.struct_pt_render_job, image *Image, params TileParams) error {
+	job.image = image.pt_image
+	job.params = params.c_struct()
+
+	if done, err := renderer.submit(job); err != nil {
+		return err
+	} else {
+		<-done
+	}
+
+	if job.result.err < 0 {
+		return makeError("pt_renderer_complete", job.result.err, nil)
+	}
+
+	return nil
+}
+
+// Buffer for Renderer.TileInto to render into, which can be reused across renders.
+//
+// The buffer is held in C memory, as the renderer's threads write to it after the cgo call to submit the render has
+// returned, and freed once the RenderBuffer is garbage collected. Allocate with new(RenderBuffer). Not safe for
+// concurrent use.
+type RenderBuffer struct {
+	job *C.struct_pt_render_job
+}
+
+func freeRenderBuffer(buffer *RenderBuffer) {
+	C.free(unsafe.Pointer(buffer.job.buf))
+	C.free(unsafe.Pointer(buffer.job))
+}
+
+// Grow the buffer to at least the given size, discarding any contents
+func (buffer *RenderBuffer) grow(size int) error {
+	if buffer.job == nil {
+		if buffer.job = (*C.struct_pt_render_job)(C.calloc(1, C.sizeof_struct_pt_render_job)); buffer.job == nil {
+			return makeError("pt_renderer_submit", -C.PT_ERR_MEM, nil)
+		}
+
+		runtime.SetFinalizer(buffer, freeRenderBuffer)
+	}
+
+	if buffer.job.buf != nil && int(buffer.job.size) >= size {
+		return nil
+	} else if size < 1 {
+		size = 1 // a NULL buf renders into a new buffer instead
+	}
+
+	if buf := (*C.char)(C.realloc(unsafe.Pointer(buffer.job.buf), C.size_t(size))); buf == nil {
+		return makeError("pt_renderer_submit", -C.PT_ERR_MEM, nil)
+	} else {
+		buffer.job.buf = buf
+		buffer.job.size = C.size_t(size)
+	}
+
+	return nil
+}
+
+// Render tile to PNG image into the given buffer using the renderer's threads, waiting for it to complete.
+//
+// Returns the PNG data within the buffer, which is only valid until the next render into the same buffer, and for as
+// long as the buffer is kept. The buffer is grown to the TileSizeHint, or to the size of the tile if it turns out to
+// be too small.
+//
+// The image must not be closed while rendering.
+func (renderer *Renderer) TileInto(buffer *RenderBuffer, image *Image, params TileParams) ([]byte, error) {
+	var size int
+
+	if hint, err := image.TileSizeHint(params); err != nil {
+		return nil, err
+	} else {
+		size = hint
+	}
+
+	for {
+		if err := buffer.grow(size); err != nil {
+			return nil, err
+		}
+
+		err := renderer.render(buffer.job, image, params)
+
+		if buffer.job.result.err == -C.PT_ERR_TILE_BUF {
+			// render again at the required size
+			size = int(buffer.job.result.len)
+		} else if err != nil {
+			return nil, err
+		} else {
+			return unsafe.Slice((*byte)(unsafe.Pointer(buffer.job.result.buf)), int(buffer.job.result.len)), nil
+		}
+	}
+}
+
+// Stop the threads, once all calls to Tile and TileInto have returned.
+func (renderer *Renderer) Close() {
+	renderer.collector.Wait()
+
+	if renderer.pt_renderer != nil {
+		C.pt_renderer_destroy(renderer.pt_renderer)
+		renderer.pt_renderer = nil
+	}
+}
@@ -0,0 +1,111 @@
+package pngtile
+
+import (
+	"github.com/stretchr/testify/assert"
+	"sync"
+	"testing"
+)
+
+func testRenderer(t *testing.T, threads uint) *Renderer {
+	renderer, err := NewRenderer(threads)
+
+	if err != nil {
+		t.Fatalf("NewRenderer: %v", err)
+	}
+
+	t.Cleanup(renderer.Close)
+
+	return renderer
+}
+
+func TestRendererTile(t *testing.T) {
+	var image = testImage(t, ImageParams{})
+	var renderer = testRenderer(t, 2)
+
+	for _, params := range testImageTiles {
+		if data, err := renderer.Tile(image, params); assert.NoError(t, err, "Tile %#v", params) {
+			testTile(t, data, params)
+		}
+	}
+}
+
+func TestRendererTileError(t *testing.T) {
+	var image = testImage(t, ImageParams{})
+	var renderer = testRenderer(t, 2)
+	var buffer = new(RenderBuffer)
+
+	_, err := renderer.Tile(image, TileParams{Width: 64, Height: 64, X: testImageWidth})
+	assert.Error(t, err, "Tile outside of image")
+
+	_, err = renderer.TileInto(buffer, image, TileParams{Width: 64, Height: 64, X: testImageWidth})
+	assert.Error(t, err, "TileInto outside of image")
+}
+
+func TestRendererTileInto(t *testing.T) {
+	var image = testImage(t, ImageParams{})
+	var renderer = testRenderer(t, 2)
+	var buffer = new(RenderBuffer)
+	var params []TileParams
+
+	params = append(params, testImageTiles...)
+	params = append(params, testImageZoomTiles...)
+	params = append(params, testImageZoomInTiles...)
+
+	for _, params := range params {
+		if data, err := renderer.TileInto(buffer, image, params); assert.NoError(t, err, "TileInto %#v", params) {
+			testTile(t, data, params)
+		}
+	}
+}
+
+// Drive the size hint down with flat tiles, so that the noisy tiles render again at the required size
+func TestRendererTileIntoGrow(t *testing.T) {
+	var image = testImage(t, ImageParams{})
+	var renderer = testRenderer(t, 2)
+	var buffer = new(RenderBuffer)
+	var flatParams = TileParams{Width: 16, Height: 16}
+	var noiseParams = TileParams{Width: 256, Height: 128, Y: testImageHeight / 2}
+
+	for i := 0; i < 100; i++ {
+		if _, err := renderer.TileInto(buffer, image, flatParams); err != nil {
+			t.Fatalf("TileInto %#v: %v", flatParams, err)
+		}
+	}
+
+	hint, err := image.TileSizeHint(noiseParams)
+	if err != nil {
+		t.Fatalf("TileSizeHint %#v: %v", noiseParams, err)
+	}
+
+	if data, err := renderer.TileInto(buffer, image, noiseParams); assert.NoError(t, err, "TileInto %#v", noiseParams) {
+		assert.True(t, len(data) > hint, "tile of %d bytes larger than the size hint of %d bytes", len(data), hint)
+
+		testTile(t, data, noiseParams)
+	}
+}
+
+func TestRendererConcurrent(t *testing.T) {
+	var image = testImage(t, ImageParams{})
+	var renderer = testRenderer(t, 4)
+	var wg sync.WaitGroup
+
+	for i := 0; i < 8; i++ {
+		wg.Add(1)
+
+		go func() {
+			defer wg.Done()
+
+			var buffer = new(RenderBuffer)
+
+			for n := 0; n < 20; n++ {
+				for _, params := range testImageTiles {
+					if data, err := renderer.TileInto(buffer, image, params); assert.NoError(t, err, "TileInto %#v", params) {
+						testTile(t, data, params)
+					}
+				}
+			}
+		}()
+	}
+
+	wg.Wait()
+}
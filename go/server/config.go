@@ -1,12 +1,29 @@
 package server
 
 import (
+	"github.com/qmsk/pngtile/go"
 	"path/filepath"
 )
 
 type Config struct {
 	TemplatePath string
 	Path         string
+
+	// Residency policy for opened image caches
+	OpenParams pngtile.OpenParams
+
+	// Names of hot images to preload and lock into memory
+	LockImages []string
+
+	// Encoder profiles for map tiles, and for centered views
+	TileProfile pngtile.TileProfile
+	ViewProfile pngtile.TileProfile
+
+	// Zoom mode for zoomed-out tiles of palette images
+	ZoomMode pngtile.TileZoomMode
+
+	// Render tiles using a pool of threads, instead of on the goroutine handling the request
+	RenderThreads uint
 }
 
 func (config Config) MakeServer() (*Server, error) {
@@ -16,3 +33,16 @@ func (config Config) MakeServer() (*Server, error) {
 func (config Config) templatePath(name string) string {
 	return filepath.Join(config.TemplatePath, name)
 }
+
+func (config Config) openParams(name string) pngtile.OpenParams {
+	var openParams = config.OpenParams
+
+	for _, lockName := range config.LockImages {
+		if lockName == name {
+			openParams.Populate = true
+			openParams.Lock = true
+		}
+	}
+
+	return openParams
+}
@@ -15,10 +15,13 @@ type httpResponse struct {
 	Status      int
 	ContentType string
 	Content     []byte
+
+	// Optional func to release the Content once written out
+	Release func()
 }
 
-func renderResponsePNG(data []byte) (httpResponse, error) {
-	return httpResponse{200, "image/png", data}, nil
+func renderResponsePNG(data []byte, release func()) (httpResponse, error) {
+	return httpResponse{200, "image/png", data, release}, nil
 }
 
 func renderResponseJSON(data interface{}) (httpResponse, error) {
@@ -27,7 +30,7 @@ func renderResponseJSON(data interface{}) (httpResponse, error) {
 	if err := json.NewEncoder(&buffer).Encode(data); err != nil {
 		return httpResponse{}, err
 	} else {
-		return httpResponse{200, "application/json", buffer.Bytes()}, nil
+		return httpResponse{200, "application/json", buffer.Bytes(), nil}, nil
 	}
 }
 
@@ -37,7 +40,7 @@ func renderResponseHTML(data interface{}, template *template.Template) (httpResp
 	if err := template.Execute(&buffer, data); err != nil {
 		return httpResponse{}, err
 	} else {
-		return httpResponse{200, "text/html", buffer.Bytes()}, nil
+		return httpResponse{200, "text/html", buffer.Bytes(), nil}, nil
 	}
 }
 
@@ -75,6 +78,8 @@ func (server *Server) Handle(r *http.Request) (httpResponse, error) {
 		return server.HandleIndex(r, name)
 	} else if ext == "" {
 		return server.HandleImage(r, name)
+	} else if ext == "png" && r.URL.Query().Get("tiles") != "" {
+		return server.HandleImageTileBatch(r, name, r.URL.Query())
 	} else if ext == "png" {
 		return server.HandleImageTile(r, name, r.URL.Query())
 	} else {
@@ -89,6 +94,10 @@ func (server *Server) ServeHTTP(w http.ResponseWriter, r *http.Request) {
 
 		w.Write(response.Content)
 
+		if response.Release != nil {
+			response.Release()
+		}
+
 	} else {
 		var status = response.Status
 
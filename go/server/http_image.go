@@ -15,6 +15,7 @@ type ImageConfig struct {
 	TileURL      string `json:"tile_url"`
 	TileSize     uint   `json:"tile_size"`
 	TileZoom     int    `json:"tile_zoom"`
+	TileZoomMin  int    `json:"tile_zoom_min"`
 	ViewURL      string `json:"view_url"`
 	ImageFormat  string `json:"image_format"`
 	ImageWidth   uint   `json:"image_width"`
@@ -33,6 +34,7 @@ func (server *Server) HandleImage(r *http.Request, name string) (httpResponse, e
 				TileURL:      TileURLTemplate,
 				TileSize:     TileSize,
 				TileZoom:     TileZoomMax,
+				TileZoomMin:  TileZoomMin,
 				ViewURL:      ViewURLTemplate,
 				ImageFormat:  imageInfo.ImageFormat.String(),
 				ImageWidth:   imageInfo.ImageWidth,
@@ -6,10 +6,29 @@ import (
 	"github.com/qmsk/pngtile/go"
 	"net/http"
 	"net/url"
+	"sync"
 )
 
+// Buffers for rendering tiles into, kept for reuse once the response has been written out
+type tileBuffer struct {
+	buf    []byte                // for Image.TileInto
+	render *pngtile.RenderBuffer // for Renderer.TileInto
+}
+
+var tileBufferPool = sync.Pool{
+	New: func() interface{} { return &tileBuffer{render: new(pngtile.RenderBuffer)} },
+}
+
+func getTileBuffer() *tileBuffer {
+	return tileBufferPool.Get().(*tileBuffer)
+}
+
+func putTileBuffer(buffer *tileBuffer) {
+	tileBufferPool.Put(buffer)
+}
+
 const TileSize uint = 256
-const TileZoomMin int = 0
+const TileZoomMin int = -2 // zoomed in, for high-DPI displays
 const TileZoomMax int = 4
 const TileLimit uint = 1920 * 1200
 
@@ -43,16 +62,21 @@ type TileParams struct {
 }
 
 // Scale coordinate by zoom level
-func (params TileParams) zoomScale(xy uint) uint {
-	if params.Zoom > 0 {
-		return xy << uint(params.Zoom)
-	} else if params.Zoom < 0 {
-		return xy >> uint(-params.Zoom)
+func zoomScale(xy uint, zoom int) uint {
+	if zoom > 0 {
+		return xy << uint(zoom)
+	} else if zoom < 0 {
+		return xy >> uint(-zoom)
 	} else {
 		return xy
 	}
 }
 
+// Scale coordinate by zoom level
+func (params TileParams) zoomScale(xy uint) uint {
+	return zoomScale(xy, params.Zoom)
+}
+
 // Scale view center coordinate to view width/height
 func (params TileParams) zoomScaleCentered(xy uint, wh uint) uint {
 	if xy > wh/2 {
@@ -62,23 +86,35 @@ func (params TileParams) zoomScaleCentered(xy uint, wh uint) uint {
 	}
 }
 
-func (params TileParams) tileParams() (pngtile.TileParams, error) {
+// Map tile at tile-x/tile-y
+func (params TileParams) mapTileParams(config Config) pngtile.TileParams {
+	return pngtile.TileParams{
+		Width:    TileSize,
+		Height:   TileSize,
+		X:        params.zoomScale(params.TileX * TileSize),
+		Y:        params.zoomScale(params.TileY * TileSize),
+		Zoom:     params.Zoom,
+		Profile:  config.TileProfile,
+		ZoomMode: config.ZoomMode,
+	}
+}
+
+func (params TileParams) tileParams(config Config) (pngtile.TileParams, error) {
 	var tileParams = pngtile.TileParams{
-		Zoom: params.Zoom,
+		Zoom:     params.Zoom,
+		ZoomMode: config.ZoomMode,
 	}
 
 	if params.TileX != 0 || params.TileY != 0 {
 		// normal tile
-		tileParams.Width = TileSize
-		tileParams.Height = TileSize
-		tileParams.X = params.zoomScale(params.TileX * TileSize)
-		tileParams.Y = params.zoomScale(params.TileY * TileSize)
+		tileParams = params.mapTileParams(config)
 	} else if params.Width != 0 && params.Height != 0 {
 		// centered view
 		tileParams.Width = params.Width
 		tileParams.Height = params.Height
 		tileParams.X = params.zoomScaleCentered(params.X, params.Width)
 		tileParams.Y = params.zoomScaleCentered(params.Y, params.Height)
+		tileParams.Profile = config.ViewProfile
 	} else {
 		return tileParams, fmt.Errorf("Invalid parameters: use either ?tx=&ty= or ?w=&h=")
 	}
@@ -100,11 +136,17 @@ func (server *Server) HandleImageTile(r *http.Request, name string, query url.Va
 
 	if err := schema.NewDecoder().Decode(&params, query); err != nil {
 		return httpResponse{Status: 400}, err
-	} else if tileParams, err := params.tileParams(); err != nil {
+	} else if tileParams, err := params.tileParams(server.config); err != nil {
 		return httpResponse{Status: 400}, err
-	} else if tileData, err := server.ImageTile(name, tileParams); err != nil {
-		return httpResponse{}, err
 	} else {
-		return renderResponsePNG(tileData)
+		var buffer = getTileBuffer()
+
+		if tileData, err := server.ImageTile(name, tileParams, buffer); err != nil {
+			putTileBuffer(buffer)
+
+			return httpResponse{}, err
+		} else {
+			return renderResponsePNG(tileData, func() { putTileBuffer(buffer) })
+		}
 	}
 }
@@ -0,0 +1,112 @@
+package server
+
+import (
+	"bytes"
+	"fmt"
+	"github.com/gorilla/schema"
+	"github.com/qmsk/pngtile/go"
+	"mime/multipart"
+	"net/http"
+	"net/textproto"
+	"net/url"
+	"strconv"
+	"strings"
+)
+
+const TileBatchLimit = 64
+
+type TileBatchParams struct {
+	Time  int    `schema:"t"`
+	Zoom  int    `schema:"zoom"`
+	Tiles string `schema:"tiles"` // comma-separated tile-x:tile-y
+}
+
+// Parse the map tiles in the batch
+func (params TileBatchParams) tileParams() ([]TileParams, error) {
+	var tiles = strings.Split(params.Tiles, ",")
+	var tileParams = make([]TileParams, len(tiles))
+
+	if len(tiles) > TileBatchLimit {
+		return nil, fmt.Errorf("Invalid tiles: %d (limit %d)", len(tiles), TileBatchLimit)
+	}
+
+	for i, tile := range tiles {
+		var parts = strings.SplitN(tile, ":", 2)
+
+		tileParams[i] = TileParams{Time: params.Time, Zoom: params.Zoom}
+
+		if len(parts) != 2 {
+			return nil, fmt.Errorf("Invalid tile: %s (use tile-x:tile-y)", tile)
+		} else if tileX, err := strconv.ParseUint(parts[0], 10, 0); err != nil {
+			return nil, fmt.Errorf("Invalid tile-x: %s: %v", tile, err)
+		} else if tileY, err := strconv.ParseUint(parts[1], 10, 0); err != nil {
+			return nil, fmt.Errorf("Invalid tile-y: %s: %v", tile, err)
+		} else {
+			tileParams[i].TileX = uint(tileX)
+			tileParams[i].TileY = uint(tileY)
+		}
+	}
+
+	if params.Zoom > TileZoomMax || params.Zoom < TileZoomMin {
+		return nil, fmt.Errorf("Invalid zoom level: %d (limit %d-%d)", params.Zoom, TileZoomMin, TileZoomMax)
+	}
+
+	return tileParams, nil
+}
+
+// Render the batch of map tiles as a multipart/mixed response, with a part for each tile in the order requested.
+//
+// Each part has a Content-Location of the query for the single tile, and is either an image/png, or a text/plain
+// error for tiles that failed to render.
+func (server *Server) HandleImageTileBatch(r *http.Request, name string, query url.Values) (httpResponse, error) {
+	var params TileBatchParams
+	var buffer bytes.Buffer
+	var writer = multipart.NewWriter(&buffer)
+
+	if err := schema.NewDecoder().Decode(&params, query); err != nil {
+		return httpResponse{Status: 400}, err
+	}
+
+	tileParams, err := params.tileParams()
+	if err != nil {
+		return httpResponse{Status: 400}, err
+	}
+
+	var batchParams = make([]pngtile.TileParams, len(tileParams))
+
+	for i, params := range tileParams {
+		batchParams[i] = params.mapTileParams(server.config)
+	}
+
+	results, err := server.ImageTileBatch(name, batchParams)
+	if err != nil {
+		return httpResponse{}, err
+	}
+
+	for i, result := range results {
+		var header = make(textproto.MIMEHeader)
+
+		// as for TileURLTemplate
+		header.Set("Content-Location", fmt.Sprintf("?t=%d&tile-x=%d&tile-y=%d&zoom=%d", params.Time, tileParams[i].TileX, tileParams[i].TileY, params.Zoom))
+
+		if result.Err != nil {
+			header.Set("Content-Type", "text/plain")
+		} else {
+			header.Set("Content-Type", "image/png")
+		}
+
+		if part, err := writer.CreatePart(header); err != nil {
+			return httpResponse{}, err
+		} else if result.Err != nil {
+			fmt.Fprintf(part, "%v", result.Err)
+		} else if _, err := part.Write(result.Data); err != nil {
+			return httpResponse{}, err
+		}
+	}
+
+	if err := writer.Close(); err != nil {
+		return httpResponse{}, err
+	}
+
+	return httpResponse{200, "multipart/mixed; boundary=" + writer.Boundary(), buffer.Bytes(), nil}, nil
+}
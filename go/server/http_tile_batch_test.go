@@ -0,0 +1,70 @@
+package server
+
+import (
+	"github.com/stretchr/testify/assert"
+	"strings"
+	"testing"
+)
+
+var testTileBatchParams = []struct {
+	params TileBatchParams
+
+	tiles []TileParams
+	err   bool
+}{
+	{TileBatchParams{Time: 1, Zoom: 0, Tiles: "0:0"}, []TileParams{{Time: 1, TileX: 0, TileY: 0}}, false},
+	{TileBatchParams{Time: 1, Zoom: 2, Tiles: "1:2,3:4"}, []TileParams{{Time: 1, Zoom: 2, TileX: 1, TileY: 2}, {Time: 1, Zoom: 2, TileX: 3, TileY: 4}}, false},
+	{TileBatchParams{Zoom: TileZoomMin, Tiles: "5:6"}, []TileParams{{Zoom: TileZoomMin, TileX: 5, TileY: 6}}, false},
+	{TileBatchParams{Zoom: TileZoomMax, Tiles: "5:6"}, []TileParams{{Zoom: TileZoomMax, TileX: 5, TileY: 6}}, false},
+
+	// malformed tiles
+	{TileBatchParams{Tiles: ""}, nil, true},
+	{TileBatchParams{Tiles: "1"}, nil, true},
+	{TileBatchParams{Tiles: "1:"}, nil, true},
+	{TileBatchParams{Tiles: ":1"}, nil, true},
+	{TileBatchParams{Tiles: "x:1"}, nil, true},
+	{TileBatchParams{Tiles: "1:y"}, nil, true},
+	{TileBatchParams{Tiles: "-1:1"}, nil, true},
+	{TileBatchParams{Tiles: "1:2:3"}, nil, true},
+	{TileBatchParams{Tiles: "1:2,"}, nil, true},
+	{TileBatchParams{Tiles: "1:2;3:4"}, nil, true},
+
+	// zoom bounds
+	{TileBatchParams{Zoom: TileZoomMin - 1, Tiles: "0:0"}, nil, true},
+	{TileBatchParams{Zoom: TileZoomMax + 1, Tiles: "0:0"}, nil, true},
+}
+
+func TestTileBatchParams(t *testing.T) {
+	for _, test := range testTileBatchParams {
+		tiles, err := test.params.tileParams()
+
+		if test.err {
+			assert.Error(t, err, "tiles=%s zoom=%d", test.params.Tiles, test.params.Zoom)
+		} else if assert.NoError(t, err, "tiles=%s zoom=%d", test.params.Tiles, test.params.Zoom) {
+			assert.Equal(t, test.tiles, tiles, "tiles=%s zoom=%d", test.params.Tiles, test.params.Zoom)
+		}
+	}
+}
+
+// Repeat the tile count times as a tiles= list
+func testTileBatchTiles(tile string, count int) string {
+	var tiles = make([]string, count)
+
+	for i := range tiles {
+		tiles[i] = tile
+	}
+
+	return strings.Join(tiles, ",")
+}
+
+func TestTileBatchParamsLimit(t *testing.T) {
+	tiles, err := TileBatchParams{Tiles: testTileBatchTiles("1:1", TileBatchLimit)}.tileParams()
+
+	if assert.NoError(t, err, "%d tiles", TileBatchLimit) {
+		assert.Len(t, tiles, TileBatchLimit, "%d tiles", TileBatchLimit)
+	}
+
+	_, err = TileBatchParams{Tiles: testTileBatchTiles("1:1", TileBatchLimit+1)}.tileParams()
+
+	assert.Error(t, err, "%d tiles", TileBatchLimit+1)
+}
@@ -74,7 +74,7 @@ func (server *Server) openImage(name string) (*Image, error) {
 		return nil, err
 	} else if pngtileImage, err := pngtile.OpenImage(path); err != nil {
 		return nil, err
-	} else if err := pngtileImage.Open(); err != nil {
+	} else if err := pngtileImage.Open(server.config.openParams(name)); err != nil {
 		return nil, err
 	} else if pngtileInfo, err := pngtileImage.Info(); err != nil {
 		return nil, err
@@ -110,12 +110,53 @@ func (server *Server) ImageInfo(name string) (pngtile.ImageInfo, error) {
 	}
 }
 
-func (server *Server) ImageTile(name string, params pngtile.TileParams) ([]byte, error) {
+// Prefetch the ring of tiles surrounding the given tile, which are likely to be requested next when panning
+func (image *Image) prefetchRing(params pngtile.TileParams) error {
+	var width = zoomScale(params.Width, params.Zoom)
+	var height = zoomScale(params.Height, params.Zoom)
+	var ringParams = params
+
+	ringParams.Width = params.Width * 3
+	ringParams.Height = params.Height * 3
+
+	if params.X > width {
+		ringParams.X = params.X - width
+	} else {
+		ringParams.X = 0
+	}
+
+	if params.Y > height {
+		ringParams.Y = params.Y - height
+	} else {
+		ringParams.Y = 0
+	}
+
+	return image.pngtileImage.Prefetch(ringParams)
+}
+
+// Render the tile into the given buffer, returning the PNG data, which is valid until the buffer is reused
+func (server *Server) ImageTile(name string, params pngtile.TileParams, buffer *tileBuffer) ([]byte, error) {
 	if image, err := server.image(name); err != nil {
 		return nil, err
-	} else if tileData, err := image.pngtileImage.Tile(params); err != nil {
+	} else if err := image.prefetchRing(params); err != nil {
+		return nil, err
+	} else if server.renderer != nil {
+		return server.renderer.TileInto(buffer.render, image.pngtileImage, params)
+	} else if data, err := image.pngtileImage.TileInto(buffer.buf, params); err != nil {
+		return nil, err
+	} else {
+		// keep any grown buffer for reuse
+		buffer.buf = data
+
+		return data, nil
+	}
+}
+
+// Render a batch of tiles, in order of their offset into the image cache
+func (server *Server) ImageTileBatch(name string, params []pngtile.TileParams) ([]pngtile.TileResult, error) {
+	if image, err := server.image(name); err != nil {
 		return nil, err
 	} else {
-		return tileData, nil
+		return image.pngtileImage.TileBatch(params)
 	}
 }
@@ -2,6 +2,7 @@ package server
 
 import (
 	"fmt"
+	"github.com/qmsk/pngtile/go"
 	"path/filepath"
 	"strings"
 )
@@ -20,6 +21,14 @@ func makeServer(config Config) (*Server, error) {
 		server.templates = templates
 	}
 
+	if config.RenderThreads > 0 {
+		if renderer, err := pngtile.NewRenderer(config.RenderThreads); err != nil {
+			return nil, err
+		} else {
+			server.renderer = renderer
+		}
+	}
+
 	return &server, nil
 }
 
@@ -29,6 +38,7 @@ type Server struct {
 
 	templates templates
 	images    map[string]*Image
+	renderer  *pngtile.Renderer
 }
 
 func (server *Server) URL(name string) string {
@@ -4,11 +4,123 @@ package pngtile
 #include "pngtile.h"
 */
 import "C"
+import "fmt"
+
+// Tile encoder profile, choosing between render latency and tile size
+type TileProfile int
+
+const (
+	TILE_PROFILE_DEFAULT = C.PT_TILE_PROFILE_DEFAULT
+	TILE_PROFILE_FAST    = C.PT_TILE_PROFILE_FAST
+	TILE_PROFILE_SMALL   = C.PT_TILE_PROFILE_SMALL
+)
+
+func ParseTileProfile(value string) (TileProfile, error) {
+	switch value {
+	case "", "default":
+		return TILE_PROFILE_DEFAULT, nil
+	case "fast":
+		return TILE_PROFILE_FAST, nil
+	case "small":
+		return TILE_PROFILE_SMALL, nil
+	default:
+		return TILE_PROFILE_DEFAULT, fmt.Errorf("Invalid tile profile: %s", value)
+	}
+}
+
+func (profile TileProfile) String() string {
+	switch profile {
+	case TILE_PROFILE_DEFAULT:
+		return "default"
+	case TILE_PROFILE_FAST:
+		return "fast"
+	case TILE_PROFILE_SMALL:
+		return "small"
+	default:
+		return fmt.Sprintf("%d", profile)
+	}
+}
+
+// Tile encoder implementation, using the built-in encoder for fast tiles by default
+type TileEncoder int
+
+const (
+	TILE_ENCODER_AUTO    = C.PT_TILE_ENCODER_AUTO
+	TILE_ENCODER_LIBPNG  = C.PT_TILE_ENCODER_LIBPNG
+	TILE_ENCODER_BUILTIN = C.PT_TILE_ENCODER_BUILTIN
+)
+
+func ParseTileEncoder(value string) (TileEncoder, error) {
+	switch value {
+	case "", "auto":
+		return TILE_ENCODER_AUTO, nil
+	case "libpng":
+		return TILE_ENCODER_LIBPNG, nil
+	case "builtin":
+		return TILE_ENCODER_BUILTIN, nil
+	default:
+		return TILE_ENCODER_AUTO, fmt.Errorf("Invalid tile encoder: %s", value)
+	}
+}
+
+func (encoder TileEncoder) String() string {
+	switch encoder {
+	case TILE_ENCODER_AUTO:
+		return "auto"
+	case TILE_ENCODER_LIBPNG:
+		return "libpng"
+	case TILE_ENCODER_BUILTIN:
+		return "builtin"
+	default:
+		return fmt.Sprintf("%d", encoder)
+	}
+}
+
+// Zoom mode for palette images, choosing between averaged RGB tiles and palette tiles.
+//
+// TILE_ZOOM_DOMINANT always renders from the full-size data, which gets several times slower than the other modes
+// from zoom 2 on.
+type TileZoomMode int
+
+const (
+	TILE_ZOOM_AVERAGE  = C.PT_TILE_ZOOM_AVERAGE
+	TILE_ZOOM_PALETTE  = C.PT_TILE_ZOOM_PALETTE
+	TILE_ZOOM_DOMINANT = C.PT_TILE_ZOOM_DOMINANT
+)
+
+func ParseTileZoomMode(value string) (TileZoomMode, error) {
+	switch value {
+	case "", "average":
+		return TILE_ZOOM_AVERAGE, nil
+	case "palette":
+		return TILE_ZOOM_PALETTE, nil
+	case "dominant":
+		return TILE_ZOOM_DOMINANT, nil
+	default:
+		return TILE_ZOOM_AVERAGE, fmt.Errorf("Invalid tile zoom mode: %s", value)
+	}
+}
+
+func (mode TileZoomMode) String() string {
+	switch mode {
+	case TILE_ZOOM_AVERAGE:
+		return "average"
+	case TILE_ZOOM_PALETTE:
+		return "palette"
+	case TILE_ZOOM_DOMINANT:
+		return "dominant"
+	default:
+		return fmt.Sprintf("%d", mode)
+	}
+}
 
 type TileParams struct {
 	Width, Height uint
 	X, Y          uint
 	Zoom          int
+	Profile       TileProfile
+	Encoder       TileEncoder
+	ZoomMode      TileZoomMode
 }
 
 func (params TileParams) c_struct() C.struct_pt_tile_params {
@@ -19,6 +131,9 @@ func (params TileParams) c_struct() C.struct_pt_tile_params {
 	tile_params.x = C.uint(params.X)
 	tile_params.y = C.uint(params.Y)
 	tile_params.zoom = C.int(params.Zoom)
+	tile_params.profile = C.enum_pt_tile_profile(params.Profile)
+	tile_params.encoder = C.enum_pt_tile_encoder(params.Encoder)
+	tile_params.zoom_mode = C.enum_pt_tile_zoom_mode(params.ZoomMode)
 
 	return tile_params
 }
@@ -0,0 +1,56 @@
+package pngtile
+
+import (
+	"fmt"
+	"github.com/stretchr/testify/assert"
+	"testing"
+)
+
+func testParseTileProfile(value string) (fmt.Stringer, error)  { return ParseTileProfile(value) }
+func testParseTileEncoder(value string) (fmt.Stringer, error)  { return ParseTileEncoder(value) }
+func testParseTileZoomMode(value string) (fmt.Stringer, error) { return ParseTileZoomMode(value) }
+
+// Names of each of the tile params, parsed and returned by String, with an empty name for the default
+var testTileParamNames = []struct {
+	parse func(string) (fmt.Stringer, error)
+	value string
+	param fmt.Stringer
+	err   bool
+}{
+	{testParseTileProfile, "", TileProfile(TILE_PROFILE_DEFAULT), false},
+	{testParseTileProfile, "default", TileProfile(TILE_PROFILE_DEFAULT), false},
+	{testParseTileProfile, "fast", TileProfile(TILE_PROFILE_FAST), false},
+	{testParseTileProfile, "small", TileProfile(TILE_PROFILE_SMALL), false},
+	{testParseTileProfile, "Fast", TileProfile(TILE_PROFILE_DEFAULT), true},
+	{testParseTileProfile, "smallest", TileProfile(TILE_PROFILE_DEFAULT), true},
+
+	{testParseTileEncoder, "", TileEncoder(TILE_ENCODER_AUTO), false},
+	{testParseTileEncoder, "auto", TileEncoder(TILE_ENCODER_AUTO), false},
+	{testParseTileEncoder, "libpng", TileEncoder(TILE_ENCODER_LIBPNG), false},
+	{testParseTileEncoder, "builtin", TileEncoder(TILE_ENCODER_BUILTIN), false},
+	{testParseTileEncoder, "png", TileEncoder(TILE_ENCODER_AUTO), true},
+	{testParseTileEncoder, "built-in", TileEncoder(TILE_ENCODER_AUTO), true},
+
+	{testParseTileZoomMode, "", TileZoomMode(TILE_ZOOM_AVERAGE), false},
+	{testParseTileZoomMode, "average", TileZoomMode(TILE_ZOOM_AVERAGE), false},
+	{testParseTileZoomMode, "palette", TileZoomMode(TILE_ZOOM_PALETTE), false},
+	{testParseTileZoomMode, "dominant", TileZoomMode(TILE_ZOOM_DOMINANT), false},
+	{testParseTileZoomMode, "nearest", TileZoomMode(TILE_ZOOM_AVERAGE), true},
+	{testParseTileZoomMode, "rgb", TileZoomMode(TILE_ZOOM_AVERAGE), true},
+}
+
+func TestParseTileParams(t *testing.T) {
+	for _, test := range testTileParamNames {
+		param, err := test.parse(test.value)
+
+		if test.err {
+			assert.Error(t, err, "Parse %T %#v", test.param, test.value)
+		} else if assert.NoError(t, err, "Parse %T %#v", test.param, test.value) {
+			assert.Equal(t, test.param, param, "Parse %T %#v", test.param, test.value)
+
+			if test.value != "" {
+				assert.Equal(t, test.value, param.String(), "%T.String", param)
+			}
+		}
+	}
+}
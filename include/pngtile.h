@@ -11,12 +11,23 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <sys/types.h> // for time_t
+#include <time.h> // for struct timespec
 
 /**
  * Per-image state
  */
 struct pt_image;
 
+/**
+ * Reusable state for rendering tiles, see pt_render_ctx_new()
+ */
+struct pt_render_ctx;
+
+/**
+ * Pool of threads for rendering tiles, see pt_renderer_new()
+ */
+struct pt_renderer;
+
 /** Bitmask for pt_image_open modes */
 enum pt_open_mode {
     /** Open cache for read*/
@@ -65,6 +76,9 @@ struct pt_cache_info {
   /** Size of cache file in blocks (for sparse cache files) - 512 bytes / block? */
   size_t blocks;
 
+  /** Size of the cache data in bytes, and the number of those bytes stored in the cache file, excluding holes */
+  size_t data_size, data_bytes;
+
   /** Cache format version or -err */
   int version;
 };
@@ -82,28 +96,139 @@ struct pt_image_info {
 };
 
 /**
- * Sparse background color pattern: matched aginst each individual PNG pixel in each block of pt_image_block_size pixels.
+ * Sparse background color pattern: matched aginst each individual PNG pixel in each block of pt_image_block_size x pt_image_block_size pixels.
  * Must be in the same raw format that the PNG data is in.
  *
  * Blocks containing only background pixels are not written to the cache file, allowing the use of sparse files.
+ * Tile renders fill in these blocks with the background pixel, without reading the cache file.
  */
 typedef uint8_t pt_image_pixel[4];
 
 /**
- * Handle sparse data at this granularity (pixels)
+ * Store the cache data in square blocks of this size, and handle sparse data and compression at this granularity (pixels)
  */
 extern const size_t pt_image_block_size; // 64
 
+/**
+ * Progress of a cache update, as passed to the pt_image_params progress callback
+ */
+struct pt_image_progress {
+    /** Rows of source image data decoded, or skipped as unchanged parts, out of the total rows of all parts */
+    size_t rows, rows_total;
+
+    /** Bytes of decoded pixel data stored in the cache, and skipped as background blocks */
+    size_t bytes, sparse_bytes;
+
+    /** Time since the start of the update */
+    struct timespec elapsed;
+};
+
 /**
  * Modifyable params for update
  */
 struct pt_image_params {
     enum {
       PT_IMAGE_BACKGROUND_PIXEL = 1,
+
+      /** Store downsampled zoom levels in the cache, to render zoomed-out tiles from */
+      PT_IMAGE_ZOOM_LEVELS = 2,
+
+      /** Store each block of the cache compressed, trading render CPU for disk space */
+      PT_IMAGE_COMPRESS = 4,
+
+      /** Keep pixels of less than 8 bits bit-packed in the cache, instead of using a byte per pixel */
+      PT_IMAGE_PACKED = 8,
+
+      /** Update a multi-part cache from a copy of the existing cache, decoding only the parts that have changed since */
+      PT_IMAGE_INCREMENTAL = 16,
+
+      /**
+       * Write the cache data out using pwrite instead of a shared mmap, limiting the amount of dirty data waiting for
+       * writeback, and dropping the written data from the page cache.
+       *
+       * The parts of multi-part images are still written via the mmap.
+       */
+      PT_IMAGE_STREAM = 32,
+
+      /** Write the cache data out using O_DIRECT where aligned, bypassing the page cache. Implies PT_IMAGE_STREAM */
+      PT_IMAGE_DIRECT = 64,
+
+      /**
+       * Write out a checkpoint alongside the .tmp cache file every checkpoint_interval, and resume an update
+       * interrupted after a checkpoint instead of starting over. The image data is decoded on the calling thread only.
+       *
+       * Not supported for multi-part images.
+       */
+      PT_IMAGE_CHECKPOINT = 128,
     } flags;
 
     /** Don't write out any contiguous regions of this color. Left-aligned in whatever format the source image is in */
     pt_image_pixel background_pixel;
+
+    /**
+     * Decode using this many threads; 0 or 1 to only use the calling thread.
+     *
+     * The parts of multi-part images are decoded concurrently. Single images are decoded on the calling thread, and
+     * stored into the cache on the other threads.
+     */
+    unsigned int threads;
+
+    /** Minimum interval between checkpoints for PT_IMAGE_CHECKPOINT in milliseconds, or 0 for PT_IMAGE_CHECKPOINT_INTERVAL */
+    unsigned int checkpoint_interval;
+
+    /** Minimum interval between calls to the progress callback in milliseconds, or 0 for PT_IMAGE_PROGRESS_INTERVAL */
+    unsigned int progress_interval;
+
+    /**
+     * Optional callback to report the progress of the update, called at most every progress_interval while decoding,
+     * and once more when the update is done. Calls may come from any of the threads
+     * decoding the image, but never concurrently.
+     *
+     * Returning nonzero cancels the update, which fails with -PT_ERR_CANCEL.
+     */
+    int (*progress)(void *arg, const struct pt_image_progress *progress);
+    void *progress_arg;
+};
+
+/**
+ * Default minimum interval between calls to the pt_image_params progress callback, in milliseconds
+ */
+#define PT_IMAGE_PROGRESS_INTERVAL 250
+
+/**
+ * Default minimum interval between checkpoints for PT_IMAGE_CHECKPOINT, in milliseconds
+ */
+#define PT_IMAGE_CHECKPOINT_INTERVAL 60000
+
+/**
+ * Memory residency policy for pt_image_open_params.
+ *
+ * These only apply to the read-only mapping of an existing cache; any advice that the kernel does not support is
+ * logged as a warning and ignored.
+ */
+struct pt_open_params {
+    enum {
+      /** Tile renders access the cache in random order: disable readahead */
+      PT_OPEN_RANDOM = 1,
+
+      /** The cache is read in sequential order: use aggressive readahead. Cannot be combined with PT_OPEN_RANDOM */
+      PT_OPEN_SEQUENTIAL = 2,
+
+      /** Read the entire cache into memory when opening it, instead of page-faulting on each tile render */
+      PT_OPEN_POPULATE = 4,
+
+      /** Advise the kernel to back the mapping using transparent hugepages */
+      PT_OPEN_HUGEPAGE = 8,
+
+      /** Lock the entire cache into memory while it is open. Fails if RLIMIT_MEMLOCK does not allow it */
+      PT_OPEN_MLOCK = 16,
+
+      /**
+       * Map out the holes in the cache file when opening it, so that tile renders do not touch any cache data within
+       * holes, such as blocks that were zeroed out by sparse-aware copies of the cache file.
+       */
+      PT_OPEN_HOLES = 32,
+    } flags;
 };
 
 /**
@@ -114,9 +239,66 @@ struct pt_image_parts {
 
   unsigned int rows, cols;
 
+  /** rows * cols paths in row-major order, or NULL for missing parts, which are left empty */
   const char **paths;
 };
 
+/**
+ * Tile encoder profiles, choosing between render latency and tile size
+ */
+enum pt_tile_profile {
+    /** libpng's defaults: zlib level 6, with its adaptive row filter heuristic for images of at least 8 bits per pixel */
+    PT_TILE_PROFILE_DEFAULT = 0,
+
+    /** Fastest render: zlib level 1 using Z_RLE, without row filters for palette or sub-8-bit images, or only Sub */
+    PT_TILE_PROFILE_FAST,
+
+    /** Smallest tiles: zlib level 9 using the full window and memory level, with the adaptive row filter heuristic */
+    PT_TILE_PROFILE_SMALL,
+};
+
+/**
+ * Tile encoder implementations
+ */
+enum pt_tile_encoder {
+    /** Use the built-in encoder for PT_TILE_PROFILE_FAST tiles that it supports, and libpng otherwise */
+    PT_TILE_ENCODER_AUTO = 0,
+
+    /** Always use libpng */
+    PT_TILE_ENCODER_LIBPNG,
+
+    /**
+     * Use the built-in encoder for tiles of 8 bits per channel, including all zoomed tiles, and libpng otherwise.
+     *
+     * The built-in encoder filters rows using SSE2 and deflates them directly into the output as a single IDAT chunk.
+     * The encoded pixels are identical to libpng's, but the PNG data is not byte-for-byte the same.
+     */
+    PT_TILE_ENCODER_BUILTIN,
+};
+
+/**
+ * Pixel formats for zoomed-out tiles
+ */
+enum pt_tile_zoom_mode {
+    /** Average each square of pixels into an 8bpp RGB pixel, rendering from any stored zoom levels */
+    PT_TILE_ZOOM_AVERAGE = 0,
+
+    /**
+     * For palette images, average each square of pixels and map it back to the nearest palette color, as an 8bpp
+     * palette pixel
+     */
+    PT_TILE_ZOOM_PALETTE,
+
+    /**
+     * For palette images, use the most common palette index within each square of pixels, without any color math.
+     *
+     * Always renders from the full-size data, as the stored zoom levels are RGB, and the most common index cannot be
+     * found from the indexes of a smaller level. The render time grows with the 4^zoom input pixels read for each
+     * output pixel, so this is several times slower than the other modes from zoom 2 on.
+     */
+    PT_TILE_ZOOM_DOMINANT,
+};
+
 /**
  * Parameters for tile render.
  *
@@ -129,8 +311,45 @@ struct pt_tile_params {
     /** Pixel coordinates of top-left corner */
     unsigned int x, y;
 
-    /** Zoom factor of 2^z (out < zero < in) */
+    /**
+     * Zoom factor of 2^z, with x, y in image pixels.
+     *
+     * Zooming out (z > 0) averages each square of image pixels into an 8bpp RGB pixel. Zooming in (z < 0, down to -8)
+     * replicates each image pixel, keeping the image's pixel format and palette.
+     */
     int zoom;
+
+    /** Optional render context to reuse, see pt_render_ctx_new() */
+    struct pt_render_ctx *ctx;
+
+    /** Encoder profile */
+    enum pt_tile_profile profile;
+
+    /** Encoder implementation */
+    enum pt_tile_encoder encoder;
+
+    /** Pixel format when zooming out. Other images than palette images are always zoomed out using PT_TILE_ZOOM_AVERAGE */
+    enum pt_tile_zoom_mode zoom_mode;
+
+    /** Encoder settings overriding the profile */
+    enum pt_tile_flags {
+        /** zlib compression level, 0-9 */
+        PT_TILE_LEVEL       = 1,
+
+        /** zlib strategy: Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE or Z_FIXED */
+        PT_TILE_STRATEGY    = 2,
+
+        /** Bitmask of the libpng PNG_FILTER_* row filters to choose from for each row */
+        PT_TILE_FILTERS     = 4,
+
+        /** zlib window size, 8-15 bits */
+        PT_TILE_WINDOW_BITS = 8,
+
+        /** zlib memory level, 1-9 */
+        PT_TILE_MEM_LEVEL   = 16,
+    } flags;
+
+    int level, strategy, filters, window_bits, mem_level;
 };
 
 /**
@@ -206,6 +425,9 @@ int pt_image_update (struct pt_image *image, const char *path, const struct pt_i
  *
  * Also opens the image.
  *
+ * The modification time and size of each part is recorded in the cache. Using PT_IMAGE_INCREMENTAL, only the parts
+ * that have changed are decoded, if the existing cache was built using the same params and part layout.
+ *
  * @param path paths to source image files, all of the same format
  * @param params optional parameters to use for the update process
  */
@@ -218,6 +440,13 @@ int pt_image_update_parts (struct pt_image *image, const struct pt_image_parts *
  */
 int pt_image_open (struct pt_image *image);
 
+/**
+ * Load the image's cache in read-only mode, using the given memory residency policy.
+ *
+ * @param params optional residency policy for the cache mapping
+ */
+int pt_image_open_params (struct pt_image *image, const struct pt_open_params *params);
+
 /**
  * Render a PNG tile to a FILE*.
  *
@@ -232,7 +461,8 @@ int pt_image_tile_file (struct pt_image *image, const struct pt_tile_params *par
 /**
  * Render a PNG tile to memory.
  *
- * The PNG data will be written to a malloc'd buffer, which must be free()'d by the caller.'
+ * The PNG data will be written to a malloc'd buffer, which must be free()'d by the caller.' The buffer starts out at
+ * the size given by pt_image_tile_size_hint(), and is grown as needed.
  *
  * The image must be open for read or update.
  *
@@ -245,6 +475,107 @@ int pt_image_tile_file (struct pt_image *image, const struct pt_tile_params *par
  */
 int pt_image_tile_mem (struct pt_image *image, const struct pt_tile_params *params, char **buf_ptr, size_t *len_ptr);
 
+/**
+ * Render a PNG tile into the caller's buffer, which can be reused across renders.
+ *
+ * If the buffer is too small for the tile, the render still runs to completion, and returns -PT_ERR_TILE_BUF with the
+ * required size in len_ptr, so that the tile can be rendered again into a buffer of that size. Use
+ * pt_image_tile_size_hint() to size the buffer.
+ *
+ * Tile render operations are threadsafe as long as the pt_image is not modified during execution: call pt_image_load() first.
+ *
+ * @param image render from image's cache
+ * @param params tile parameters
+ * @param buf buffer to render into, which may be NULL if size is zero
+ * @param size size of the buffer
+ * @param len_ptr returned length of the PNG data, or the required size for -PT_ERR_TILE_BUF
+ */
+int pt_image_tile_buf (struct pt_image *image, const struct pt_tile_params *params, char *buf, size_t size, size_t *len_ptr);
+
+/**
+ * Estimate the size of the buffer to render the given tile into, from the tile dimensions, the output pixel format,
+ * and the average compression ratio of the tiles rendered from this image so far.
+ *
+ * Until the first tile has been rendered, this is the largest possible size of the tile. Later tiles with more detail
+ * than average may exceed the estimate.
+ */
+int pt_image_tile_size_hint (struct pt_image *image, const struct pt_tile_params *params, size_t *size_ptr);
+
+/**
+ * Output callbacks for pt_image_tile_write()
+ */
+struct pt_tile_writer {
+    /**
+     * Write out the next  len bytes of PNG data, which are only valid for the duration of the call.
+     *
+     * Return nonzero to abort the render with -PT_ERR_TILE_WRITE.
+     */
+    int (*write)(void *arg, const void *data, size_t len);
+
+    /**
+     * Optional callback once all of the PNG data has been written out.
+     *
+     * Return nonzero to fail the render with -PT_ERR_TILE_WRITE.
+     */
+    int (*flush)(void *arg);
+
+    void *arg;
+};
+
+/**
+ * Render a PNG tile, streaming it out to the given callbacks as it is encoded.
+ *
+ * The PNG data is passed to the write callback in chunks of up to 16k, using the params->ctx to buffer them, without
+ * first rendering the entire tile into a buffer. If the render fails, the PNG data written out so far is incomplete.
+ *
+ * Tile render operations are threadsafe as long as the pt_image is not modified during execution: call pt_image_load() first.
+ */
+int pt_image_tile_write (struct pt_image *image, const struct pt_tile_params *params, const struct pt_tile_writer *writer);
+
+/**
+ * Render a PNG tile, streaming it out to the given file descriptor using write(), as pt_image_tile_write().
+ */
+int pt_image_tile_fd (struct pt_image *image, const struct pt_tile_params *params, int fd);
+
+/**
+ * Result of each tile rendered using pt_image_tile_batch()
+ */
+struct pt_tile_result {
+    /** Error from rendering the tile, or zero */
+    int err;
+
+    /** Heap buffer of PNG data, as for pt_image_tile_mem(), which must be free()'d by the caller. NULL on errors. */
+    char *buf;
+    size_t len;
+};
+
+/**
+ * Render a set of PNG tiles to memory, as for pt_image_tile_mem().
+ *
+ * The tiles are rendered in the order of their offset into the cache, after first prefetching them all in that order,
+ * so that the cache is read in ascending order. Tiles without a params->ctx share a render context for the batch.
+ *
+ * Tile render operations are threadsafe as long as the pt_image is not modified during execution: call pt_image_load() first.
+ *
+ * @param image render from image's cache
+ * @param params tile parameters for each tile
+ * @param count number of tiles
+ * @param results returned result for each tile, in the same order as params
+ * @return error for the batch as a whole, with any errors rendering each tile returned in the results
+ */
+int pt_image_tile_batch (struct pt_image *image, const struct pt_tile_params *params, unsigned count, struct pt_tile_result *results);
+
+/**
+ * Start reading in the cache data for a tile in the background, so that a later render of the tile does not need to
+ * wait for it to be read from disk.
+ *
+ * Returns without waiting for any I/O. Any part of the tile outside of the image is ignored.
+ *
+ * @param image prefetch from image's cache
+ * @param params region to prefetch, as for pt_image_tile_mem()
+ */
+int pt_image_prefetch (struct pt_image *image, const struct pt_tile_params *params);
+
 /**
  * Close associated resources, returning error.
  *
@@ -259,6 +590,83 @@ int pt_image_close (struct pt_image *image);
  */
 void pt_image_destroy (struct pt_image *image);
 
+/**
+ * Allocate a new render context, to be passed in pt_tile_params.ctx.
+ *
+ * The context keeps the memory used by libpng's encoder, the inflate stream for compressed caches, and the row buffers
+ * from one render to the next, instead of allocating and releasing them for each tile.
+ *
+ * A render context may only be used by one render at a time: keep one per thread.
+ */
+int pt_render_ctx_new (struct pt_render_ctx **ctx_ptr);
+
+/**
+ * Release the given render context, and all memory kept by it
+ */
+void pt_render_ctx_destroy (struct pt_render_ctx *ctx);
+
+/**
+ * Tile render submitted to a pt_renderer, owned by the caller until returned by pt_renderer_complete()
+ */
+struct pt_render_job {
+    /** Render from the image's cache, which must not be closed or modified until the job is complete */
+    struct pt_image *image;
+
+    /** Tile parameters, as for pt_image_tile_mem(). The params.ctx is ignored, each thread uses its own. */
+    struct pt_tile_params params;
+
+    /** Caller's state */
+    void *arg;
+
+    /**
+     * Optional buffer to render into, as for pt_image_tile_buf(), which must remain valid until the job is complete.
+     *
+     * If set, the result.buf is this buffer rather than a new one, and if the buffer is too small, the result.err is
+     * -PT_ERR_TILE_BUF with the required size in result.len. Otherwise, the result.buf must be free()'d by the caller.
+     */
+    char *buf;
+    size_t size;
+
+    /** Result of the render, once complete */
+    struct pt_tile_result result;
+
+    /** Internal */
+    struct pt_render_job *next;
+};
+
+/**
+ * Start a pool of threads for rendering tiles, each with its own render context and queue of jobs.
+ *
+ * Jobs are queued in turn across the threads, and threads without any queued jobs of their own take jobs from the
+ * queues of the other threads, so that a burst of jobs keeps all of the threads busy.
+ *
+ * @param threads number of threads to start
+ * @return -PT_ERR_THREAD if no threads could be started
+ */
+int pt_renderer_new (struct pt_renderer **renderer_ptr, unsigned threads);
+
+/**
+ * Queue the given job to be rendered, returning without waiting for it.
+ *
+ * The job is returned by pt_renderer_complete() once rendered, with the result of the render.
+ */
+int pt_renderer_submit (struct pt_renderer *renderer, struct pt_render_job *job);
+
+/**
+ * Return the next completed job, in the order that the renders completed.
+ *
+ * @param job_ptr returned job, or NULL if there are no completed jobs
+ * @param wait wait for a job to complete, if there are any jobs still queued or rendering
+ */
+int pt_renderer_complete (struct pt_renderer *renderer, struct pt_render_job **job_ptr, bool wait);
+
+/**
+ * Render any jobs still queued, and stop the threads.
+ *
+ * Any completed jobs not yet returned by pt_renderer_complete() are left as they are, including their results.
+ */
+void pt_renderer_destroy (struct pt_renderer *renderer);
+
 /**
  * Error codes returned
  */
@@ -303,6 +711,19 @@ enum pt_error {
     PT_ERR_TILE_CLIP,
     PT_ERR_TILE_ZOOM,
 
+    PT_ERR_CACHE_COMPRESS,
+    PT_ERR_CACHE_DEFLATE,
+    PT_ERR_CACHE_INFLATE,
+    PT_ERR_CACHE_MLOCK,
+    PT_ERR_CACHE_SYNC,
+
+    PT_ERR_CANCEL,
+
+    PT_ERR_TILE_ENCODE,
+    PT_ERR_TILE_WRITE,
+    PT_ERR_TILE_BUF,
+
+    PT_ERR_THREAD,
 
     PT_ERR_MAX,
 };
@@ -27,10 +27,29 @@ cdef extern from "pngtile.h" :
 
     enum pt_image_flags :
         PT_IMAGE_BACKGROUND_PIXEL
+        PT_IMAGE_ZOOM_LEVELS
+        PT_IMAGE_COMPRESS
+        PT_IMAGE_PACKED
+        PT_IMAGE_INCREMENTAL
+        PT_IMAGE_STREAM
+        PT_IMAGE_DIRECT
+        PT_IMAGE_CHECKPOINT
 
     struct pt_image_params :
         int flags
         pt_image_pixel background_pixel
+        unsigned int threads
+
+    enum pt_open_flags :
+        PT_OPEN_RANDOM
+        PT_OPEN_SEQUENTIAL
+        PT_OPEN_POPULATE
+        PT_OPEN_HUGEPAGE
+        PT_OPEN_MLOCK
+        PT_OPEN_HOLES
+
+    struct pt_open_params :
+        int flags
 
     struct pt_tile_params :
         size_t width, height
@@ -42,6 +61,7 @@ cdef extern from "pngtile.h" :
     int pt_image_info_ "pt_image_info" (pt_image *image, pt_image_info *info_ptr) nogil
     int pt_image_status (pt_image *image) nogil
     int pt_image_open (pt_image *image) nogil
+    int pt_image_open_params (pt_image *image, pt_open_params *params) nogil
     int pt_image_update (pt_image *image, pt_image_params *params) nogil
     int pt_image_tile_file (pt_image *image, pt_tile_params *params, FILE *out) nogil
     int pt_image_tile_mem (pt_image *image, pt_tile_params *params, char **buf_ptr, size_t *len_ptr) nogil
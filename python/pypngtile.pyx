@@ -134,25 +134,60 @@ cdef class Image :
 
         return ret
 
-    def open (self) :
+    def open (self, random = False, sequential = False, populate = False, hugepage = False, mlock = False, holes = False) :
         """
             Open the underlying cache file for reading, if available.
+
+            random              - disable readahead for random tile access
+            sequential          - use aggressive readahead for sequential access
+            populate            - read the entire cache into memory
+            hugepage            - back the cache mapping using transparent hugepages
+            mlock               - lock the entire cache into memory
+            holes               - map out the holes in the cache file, and do not read them
         """
 
+        cdef pt_open_params params
         cdef int err
 
+        memset(&params, 0, sizeof(params))
+
+        if random :
+            params.flags |= PT_OPEN_RANDOM
+
+        if sequential :
+            params.flags |= PT_OPEN_SEQUENTIAL
+
+        if populate :
+            params.flags |= PT_OPEN_POPULATE
+
+        if hugepage :
+            params.flags |= PT_OPEN_HUGEPAGE
+
+        if mlock :
+            params.flags |= PT_OPEN_MLOCK
+
+        if holes :
+            params.flags |= PT_OPEN_HOLES
+
         with nogil :
-            err = pt_image_open(self.image)
+            err = pt_image_open_params(self.image, &params)
 
         if err :
             raise Error("pt_image_open", err)
 
 
-    def update (self, background_pixel = None) :
+    def update (self, background_pixel = None, zoom_levels = False, compress = False, packed = False, stream = False, direct = False, checkpoint = False, threads = 0) :
         """
             Update the underlying cache file from the source image.
 
             background_pixel    - skip consecutive pixels that match this byte pattern in output
+            zoom_levels         - store downsampled zoom levels for rendering zoomed-out tiles
+            compress            - store compressed blocks, decompressed when rendering tiles
+            packed              - store 1/2/4-bit pixels bit-packed
+            stream              - write the cache using throttled pwrite instead of mmap
+            direct              - write the cache using O_DIRECT
+            checkpoint          - checkpoint the update, and resume an interrupted update
+            threads             - decode using this many threads
 
             Requires that the Image was opened using OPEN_UPDATE.
         """
@@ -176,6 +211,26 @@ cdef class Image :
 
             params.flags |= PT_IMAGE_BACKGROUND_PIXEL
 
+        if zoom_levels :
+            params.flags |= PT_IMAGE_ZOOM_LEVELS
+
+        if compress :
+            params.flags |= PT_IMAGE_COMPRESS
+
+        if packed :
+            params.flags |= PT_IMAGE_PACKED
+
+        if stream :
+            params.flags |= PT_IMAGE_STREAM
+
+        if direct :
+            params.flags |= PT_IMAGE_DIRECT
+
+        if checkpoint :
+            params.flags |= PT_IMAGE_CHECKPOINT
+
+        params.threads = threads
+
         # run update
         with nogil :
             err = pt_image_update(self.image, &params)
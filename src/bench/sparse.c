@@ -0,0 +1,146 @@
+/**
+ * Microbenchmark for the background block detection used by sparse caches.
+ *
+ * Times each implementation of pt_sparse_match against the per-pixel comparison it replaced, on rows of background
+ * pixels for each pixel size.
+ */
+#include "lib/sparse.h"
+
+#include <getopt.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+
+static const char *usage =
+    "Usage: %s [options]\n"
+    "Time the background pattern matching for sparse caches, for each pixel size.\n"
+    "\n"
+    "\t-h, --help            show this help and exit\n"
+    "\t-w, --width    PX     set row width in pixels (default 64)\n"
+    "\t-n, --count    N      match N rows per pixel size (default 1000000)\n"
+;
+
+static const struct option options[] = {
+    { "help",           false,  NULL,   'h' },
+    { "width",          true,   NULL,   'w' },
+    { "count",          true,   NULL,   'n' },
+    { 0,                0,      0,      0   }
+};
+
+static const size_t pixel_sizes[] = { 1, 2, 3, 4, 6, 8 };
+
+/**
+ * The per-pixel comparison that pt_sparse_match replaced
+ */
+static bool bench_match_pixel (const uint8_t *buf, size_t len, const uint8_t pattern[PT_SPARSE_PATTERN_SIZE], size_t pixel_bytes)
+{
+    for (size_t i = 0; i < len; i += pixel_bytes) {
+        if (memcmp(buf + i, pattern, pixel_bytes))
+            return false;
+    }
+
+    return true;
+}
+
+static double bench_time (const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+int main (int argc, char **argv)
+{
+    const char *impls[] = { "memcmp", "avx2" };
+    size_t width = 64;
+    unsigned long count = 1000000;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "hw:n:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'h':
+                printf(usage, argv[0]);
+                return EXIT_SUCCESS;
+
+            case 'w':
+                width = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'n':
+                count = strtoul(optarg, NULL, 0);
+                break;
+
+            default:
+                fprintf(stderr, usage, argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    printf("%-6s %-8s %10s\n", "pixel", "impl", "ns/row");
+
+    for (size_t p = 0; p < sizeof(pixel_sizes) / sizeof(*pixel_sizes); p++) {
+        size_t pixel_bytes = pixel_sizes[p], len = width * pixel_bytes;
+        uint8_t pixel[8], pattern[PT_SPARSE_PATTERN_SIZE];
+        uint8_t *buf;
+        struct timespec start, end;
+        unsigned long matched = 0, runs = count;
+
+        for (size_t i = 0; i < pixel_bytes; i++)
+            pixel[i] = 0x80 + i;
+
+        pt_sparse_pattern(pattern, pixel, pixel_bytes);
+
+        if ((buf = malloc(len)) == NULL) {
+            perror("malloc");
+            return EXIT_FAILURE;
+        }
+
+        for (size_t i = 0; i < len; i += PT_SPARSE_PATTERN_SIZE)
+            memcpy(buf + i, pattern, len - i < PT_SPARSE_PATTERN_SIZE ? len - i : PT_SPARSE_PATTERN_SIZE);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (unsigned long n = 0; n < count; n++) {
+            matched += bench_match_pixel(buf, len, pattern, pixel_bytes);
+
+            // keep the compiler from hoisting the comparison out of the loop
+            __asm__ volatile ("" : : "r" (buf) : "memory");
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        printf("%-6zu %-8s %10.1f\n", pixel_bytes, "pixel", bench_time(&start, &end) * 1e9 / count);
+
+        for (size_t i = 0; i < sizeof(impls) / sizeof(*impls); i++) {
+            pt_sparse_match_func match;
+
+            if ((match = pt_sparse_match_impl(impls[i])) == NULL) {
+                printf("%-6zu %-8s %10s\n", pixel_bytes, impls[i], "-");
+                continue;
+            }
+
+            runs += count;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+
+            for (unsigned long n = 0; n < count; n++) {
+                matched += match(buf, len, pattern);
+
+                __asm__ volatile ("" : : "r" (buf) : "memory");
+            }
+
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            printf("%-6zu %-8s %10.1f\n", pixel_bytes, impls[i], bench_time(&start, &end) * 1e9 / count);
+        }
+
+        if (matched != runs) {
+            fprintf(stderr, "background row did not match\n");
+            return EXIT_FAILURE;
+        }
+
+        free(buf);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,166 @@
+#include "block.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int pt_block_deflate_init (z_stream *zs)
+{
+    memset(zs, 0, sizeof(*zs));
+
+    // raw deflate data without zlib header, the block index has the lengths
+    if (deflateInit2(zs, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return -PT_ERR_MEM;
+
+    return 0;
+}
+
+size_t pt_block_deflate_bound (z_stream *zs, size_t len)
+{
+    return deflateBound(zs, len);
+}
+
+int pt_block_deflate (z_stream *zs, const uint8_t *data, size_t len, uint8_t *buf, size_t *buf_len)
+{
+    if (deflateReset(zs) != Z_OK)
+        return -PT_ERR_CACHE_DEFLATE;
+
+    zs->next_in = (Bytef *) data;
+    zs->avail_in = len;
+    zs->next_out = buf;
+    zs->avail_out = *buf_len;
+
+    if (deflate(zs, Z_FINISH) != Z_STREAM_END)
+        return -PT_ERR_CACHE_DEFLATE;
+
+    *buf_len = zs->total_out;
+
+    return 0;
+}
+
+void pt_block_deflate_end (z_stream *zs)
+{
+    deflateEnd(zs);
+}
+
+int pt_block_inflate_init (z_stream *zs)
+{
+    memset(zs, 0, sizeof(*zs));
+
+    if (inflateInit2(zs, -MAX_WBITS) != Z_OK)
+        return -PT_ERR_MEM;
+
+    return 0;
+}
+
+int pt_block_inflate (z_stream *zs, const uint8_t *data, size_t len, uint8_t *buf, size_t buf_len)
+{
+    if (inflateReset(zs) != Z_OK)
+        return -PT_ERR_CACHE_INFLATE;
+
+    zs->next_in = (Bytef *) data;
+    zs->avail_in = len;
+    zs->next_out = buf;
+    zs->avail_out = buf_len;
+
+    if (inflate(zs, Z_FINISH) != Z_STREAM_END || zs->total_out != buf_len) {
+        PT_WARN("inflate %zu -> %zu bytes: %s", len, buf_len, zs->msg ? zs->msg : "short block");
+        return -PT_ERR_CACHE_INFLATE;
+    }
+
+    return 0;
+}
+
+void pt_block_inflate_end (z_stream *zs)
+{
+    inflateEnd(zs);
+}
+
+int pt_block_cache_new (struct pt_block_cache **cache_ptr)
+{
+    struct pt_block_cache *cache;
+
+    if ((cache = calloc(1, sizeof(*cache))) == NULL)
+        return -PT_ERR_MEM;
+
+    pthread_mutex_init(&cache->lock, NULL);
+
+    *cache_ptr = cache;
+
+    return 0;
+}
+
+bool pt_block_cache_get (struct pt_block_cache *cache, const void *key, uint8_t *buf, size_t len)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&cache->lock);
+
+    for (unsigned i = 0; i < PT_BLOCK_CACHE_SIZE; i++) {
+        struct pt_block_cache_slot *slot = &cache->slots[i];
+
+        if (slot->key == key && slot->len == len) {
+            memcpy(buf, slot->data, len);
+
+            slot->tick = ++cache->tick;
+            found = true;
+
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return found;
+}
+
+void pt_block_cache_put (struct pt_block_cache *cache, const void *key, const uint8_t *data, size_t len)
+{
+    struct pt_block_cache_slot *slot = &cache->slots[0];
+
+    pthread_mutex_lock(&cache->lock);
+
+    // least recently used, or unused
+    for (unsigned i = 0; i < PT_BLOCK_CACHE_SIZE; i++) {
+        if (cache->slots[i].key == key) {
+            // raced with another render
+            slot = &cache->slots[i];
+            break;
+        }
+
+        if (cache->slots[i].tick < slot->tick)
+            slot = &cache->slots[i];
+    }
+
+    if (slot->size < len) {
+        uint8_t *buf;
+
+        if ((buf = realloc(slot->data, len)) == NULL) {
+            // just don't cache it
+            slot->key = NULL;
+            goto out;
+        }
+
+        slot->data = buf;
+        slot->size = len;
+    }
+
+    memcpy(slot->data, data, len);
+
+    slot->key = key;
+    slot->len = len;
+    slot->tick = ++cache->tick;
+
+out:
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void pt_block_cache_destroy (struct pt_block_cache *cache)
+{
+    for (unsigned i = 0; i < PT_BLOCK_CACHE_SIZE; i++)
+        free(cache->slots[i].data);
+
+    pthread_mutex_destroy(&cache->lock);
+
+    free(cache);
+}
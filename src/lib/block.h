@@ -0,0 +1,100 @@
+#ifndef PNGTILE_BLOCK_H
+#define PNGTILE_BLOCK_H
+
+/**
+ * @file
+ *
+ * Compressed cache blocks
+ */
+#include "pngtile.h"
+
+#include <zlib.h>
+#include <pthread.h>
+
+/**
+ * Number of decompressed blocks kept in each pt_block_cache
+ */
+#define PT_BLOCK_CACHE_SIZE 64
+
+/**
+ * Initialize a z_stream for compressing blocks
+ */
+int pt_block_deflate_init (z_stream *zs);
+
+/**
+ * Compress a block of \a len bytes into \a buf of \a *buf_len bytes, returning the compressed length in \a buf_len.
+ *
+ * The compressed length will be at least \a len if the data does not compress.
+ */
+int pt_block_deflate (z_stream *zs, const uint8_t *data, size_t len, uint8_t *buf, size_t *buf_len);
+
+/**
+ * Release a z_stream initialized by pt_block_deflate_init
+ */
+void pt_block_deflate_end (z_stream *zs);
+
+/**
+ * Upper bound on the compressed size of a block of \a len bytes
+ */
+size_t pt_block_deflate_bound (z_stream *zs, size_t len);
+
+/**
+ * Initialize a z_stream for decompressing blocks
+ */
+int pt_block_inflate_init (z_stream *zs);
+
+/**
+ * Decompress a block of \a len compressed bytes into \a buf of exactly \a buf_len bytes.
+ */
+int pt_block_inflate (z_stream *zs, const uint8_t *data, size_t len, uint8_t *buf, size_t buf_len);
+
+/**
+ * Release a z_stream initialized by pt_block_inflate_init
+ */
+void pt_block_inflate_end (z_stream *zs);
+
+/**
+ * Shared cache of decompressed blocks, keyed by the address of the compressed data.
+ *
+ * Safe for concurrent use from multiple renders.
+ */
+struct pt_block_cache {
+    pthread_mutex_t lock;
+
+    /** Incremented on each use, for LRU eviction */
+    unsigned long tick;
+
+    struct pt_block_cache_slot {
+        const void *key;
+
+        unsigned long tick;
+
+        /** Decompressed data */
+        uint8_t *data;
+        size_t len, size;
+    } slots[PT_BLOCK_CACHE_SIZE];
+};
+
+/**
+ * Allocate a new, empty pt_block_cache
+ */
+int pt_block_cache_new (struct pt_block_cache **cache_ptr);
+
+/**
+ * Copy out the cached data for the given key, if found.
+ *
+ * @return true if found
+ */
+bool pt_block_cache_get (struct pt_block_cache *cache, const void *key, uint8_t *buf, size_t len);
+
+/**
+ * Store a copy of the decompressed data for the given key, evicting the least recently used block.
+ */
+void pt_block_cache_put (struct pt_block_cache *cache, const void *key, const uint8_t *data, size_t len);
+
+/**
+ * Release all cached blocks
+ */
+void pt_block_cache_destroy (struct pt_block_cache *cache);
+
+#endif
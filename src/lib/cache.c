@@ -1,4 +1,7 @@
+#define _GNU_SOURCE // copy_file_range, SEEK_DATA
+
 #include "cache.h"
+#include "zoom.h"
 #include "log.h"
 #include "path.h"
 
@@ -9,9 +12,13 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h> // FICLONE
 #include <errno.h>
 #include <assert.h>
 
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+
 const uint16_t pt_cache_version = PT_CACHE_VERSION;
 const uint8_t pt_cache_magic[6] = PT_CACHE_MAGIC;
 
@@ -206,6 +213,27 @@ int pt_stat_cache (const char *path, const char *img_path)
     return PT_CACHE_FRESH;
 }
 
+/**
+ * Count the bytes of data stored in the data segment of the cache file, excluding holes
+ */
+static int pt_read_cache_data_bytes (const char *path, const struct pt_cache_header *header, size_t *bytes_ptr)
+{
+    struct pt_sparse_map map;
+    int fd;
+    int err;
+
+    if ((err = pt_open_cache_read_fd(path, &fd)))
+        return err;
+
+    if ((err = pt_sparse_map_read(&map, fd, sizeof(struct pt_cache_file), header->data_size, NULL)) == 0)
+        *bytes_ptr = pt_sparse_map_bytes(&map);
+
+    pt_sparse_map_release(&map);
+    close(fd);
+
+    return err;
+}
+
 int pt_read_cache_info (const char *path, struct pt_cache_info *cache_info, struct pt_image_info *info)
 {
     struct pt_cache_header header;
@@ -230,6 +258,10 @@ int pt_read_cache_info (const char *path, struct pt_cache_info *cache_info, stru
 
     if (cache_info) {
       cache_info->version = header.version;
+      cache_info->data_size = header.data_size;
+
+      if ((err = pt_read_cache_data_bytes(path, &header, &cache_info->data_bytes)))
+        return err;
     }
 
     // image info
@@ -291,12 +323,46 @@ static void pt_cache_abort (struct pt_cache *cache)
     PT_DEBUG("%s", cache->path);
 
     if (cache->file != NULL) {
-        if (munmap(cache->file, sizeof_pt_cache_file(cache->file->header.data_size)))
-            PT_WARN_ERRNO("munmap %p, %zu", cache->file, sizeof_pt_cache_file(cache->file->header.data_size));
+        if (munmap(cache->file, cache->size))
+            PT_WARN_ERRNO("munmap %p, %zu", cache->file, cache->size);
 
         cache->file = NULL;
     }
 
+    if (cache->block_cache) {
+        pt_block_cache_destroy(cache->block_cache);
+
+        cache->block_cache = NULL;
+    }
+
+    free(cache->palette_lut);
+    cache->palette_lut = NULL;
+
+    if (cache->holes_init) {
+        pt_sparse_map_release(&cache->holes);
+
+        cache->holes_init = false;
+    }
+
+    if (cache->deflate_init) {
+        pt_block_deflate_end(&cache->deflate);
+
+        cache->deflate_init = false;
+    }
+
+    free(cache->deflate_buf);
+    cache->deflate_buf = NULL;
+    cache->deflate_size = 0;
+
+    if (cache->stream_init) {
+        pt_stream_release(&cache->stream);
+
+        cache->stream_init = false;
+    }
+
+    free(cache->resume);
+    cache->resume = NULL;
+
     if (cache->fd >= 0) {
         if (close(cache->fd))
             PT_WARN_ERRNO("close %d", cache->fd);
@@ -314,6 +380,34 @@ static int pt_cache_tmp_name (struct pt_cache *cache, char tmp_path[], size_t tm
     return 0;
 }
 
+/**
+ * Get the .ckpt path for the checkpoint of the .tmp, or the given variant of it
+ */
+static int pt_cache_checkpoint_name (struct pt_cache *cache, char path[], size_t len, const char *ext)
+{
+    if (pt_path_make_ext(path, len, cache->path, ext))
+        return -PT_ERR_PATH;
+
+    return 0;
+}
+
+/**
+ * Remove any checkpoint of the .tmp
+ */
+static int pt_cache_checkpoint_unlink (struct pt_cache *cache)
+{
+    char ckpt_path[1024];
+    int err;
+
+    if ((err = pt_cache_checkpoint_name(cache, ckpt_path, sizeof(ckpt_path), ".ckpt")))
+        return err;
+
+    if (unlink(ckpt_path) < 0 && errno != ENOENT)
+        return -PT_ERR_CACHE_UNLINK_TMP;
+
+    return 0;
+}
+
 /**
  * Open the .tmp cache file as an fd for writing
  */
@@ -327,10 +421,13 @@ static int pt_cache_open_tmp_fd (struct pt_cache *cache, int *fd_ptr)
     if ((err = pt_cache_tmp_name(cache, tmp_path, sizeof(tmp_path))))
         return err;
 
-    // replace any old .tmp file
+    // replace any old .tmp file, and any checkpoint of it
     if (unlink(tmp_path) < 0 && errno != ENOENT)
         return -PT_ERR_CACHE_UNLINK_TMP;
 
+    if ((err = pt_cache_checkpoint_unlink(cache)))
+        return err;
+
     // open for write, create, fail if someone else already opened it for update
     if ((fd = open(tmp_path, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0)
         return -PT_ERR_CACHE_OPEN_TMP;
@@ -344,8 +441,10 @@ static int pt_cache_open_tmp_fd (struct pt_cache *cache, int *fd_ptr)
 
 /**
  * Mmap the pt_cache_file using sizeof_pt_cache_file(data_size)
+ *
+ * @param flags additional MAP_* flags
  */
-static int pt_cache_open_mmap (struct pt_cache *cache, size_t data_size, bool readonly)
+static int pt_cache_open_mmap (struct pt_cache *cache, size_t data_size, bool readonly, int flags)
 {
     int prot = 0;
     void *addr;
@@ -358,23 +457,81 @@ static int pt_cache_open_mmap (struct pt_cache *cache, size_t data_size, bool re
     }
 
     // mmap() the full file including header
-    if ((addr = mmap(NULL, sizeof_pt_cache_file(data_size), prot, MAP_SHARED, cache->fd, 0)) == MAP_FAILED)
+    if ((addr = mmap(NULL, sizeof_pt_cache_file(data_size), prot, MAP_SHARED | flags, cache->fd, 0)) == MAP_FAILED)
         return -PT_ERR_CACHE_MMAP;
 
     // ok
     cache->file = addr;
+    cache->size = sizeof_pt_cache_file(data_size);
     cache->readonly = readonly;
 
     return 0;
 }
 
-int pt_cache_open (struct pt_cache *cache)
+/**
+ * Replace the existing mmap to cover a different amount of data, after appending compressed blocks
+ */
+static int pt_cache_remap (struct pt_cache *cache, size_t data_size, bool readonly)
+{
+    if (munmap(cache->file, cache->size))
+        return -PT_ERR_CACHE_MUNMAP;
+
+    cache->file = NULL;
+
+    return pt_cache_open_mmap(cache, data_size, readonly, 0);
+}
+
+/**
+ * Apply the pt_open_params residency policy to the read-only mmap
+ */
+static int pt_cache_advise (struct pt_cache *cache, const struct pt_open_params *params)
+{
+    if (params->flags & PT_OPEN_RANDOM) {
+        if (madvise(cache->file, cache->size, MADV_RANDOM))
+            PT_WARN_ERRNO("madvise %p, %zu: MADV_RANDOM", cache->file, cache->size);
+    }
+
+    if (params->flags & PT_OPEN_SEQUENTIAL) {
+        if (madvise(cache->file, cache->size, MADV_SEQUENTIAL))
+            PT_WARN_ERRNO("madvise %p, %zu: MADV_SEQUENTIAL", cache->file, cache->size);
+    }
+
+    if (params->flags & PT_OPEN_HUGEPAGE) {
+#ifdef MADV_HUGEPAGE
+        if (madvise(cache->file, cache->size, MADV_HUGEPAGE))
+            PT_WARN_ERRNO("madvise %p, %zu: MADV_HUGEPAGE", cache->file, cache->size);
+#else
+        PT_WARN("%s: MADV_HUGEPAGE is not supported", cache->path);
+#endif
+    }
+
+    if (params->flags & PT_OPEN_MLOCK) {
+        // the lock is released by munmap() on close
+        if (mlock(cache->file, cache->size))
+            return -PT_ERR_CACHE_MLOCK;
+    }
+
+    return 0;
+}
+
+int pt_cache_open (struct pt_cache *cache, const struct pt_open_params *params)
 {
     PT_DEBUG("%s", cache->path);
 
+    struct pt_open_params default_params = { };
     struct pt_cache_header header;
+    int map_flags = 0;
     int err;
 
+    if (!params)
+        params = &default_params;
+
+    if ((params->flags & PT_OPEN_RANDOM) && (params->flags & PT_OPEN_SEQUENTIAL))
+        return -PT_ERR_CACHE_MODE;
+
+    if (params->flags & PT_OPEN_POPULATE)
+        map_flags |= MAP_POPULATE;
+
     // ignore if already open
     if (cache->file)
         return 0;
@@ -393,9 +550,25 @@ int pt_cache_open (struct pt_cache *cache)
         goto error;
 
     // mmap the header + data
-    if ((err = pt_cache_open_mmap(cache, header.data_size, true)))
+    if ((err = pt_cache_open_mmap(cache, header.data_size, true, map_flags)))
+        goto error;
+
+    if ((err = pt_cache_advise(cache, params)))
         goto error;
 
+    if (header.compression && (err = pt_block_cache_new(&cache->block_cache)))
+        goto error;
+
+    // compressed blocks are not sparse
+    if ((params->flags & PT_OPEN_HOLES) && !header.compression) {
+        cache->holes_init = true;
+
+        if ((err = pt_sparse_map_read(&cache->holes, cache->fd, sizeof(struct pt_cache_file), header.data_size, cache->file->data)))
+            goto error;
+
+        PT_DEBUG("%s: extents=%zu data=%zu/%zu", cache->path, cache->holes.count, pt_sparse_map_bytes(&cache->holes), header.data_size);
+    }
+
     // done
     return 0;
 
@@ -434,7 +607,7 @@ static int pt_cache_create (struct pt_cache *cache, struct pt_cache_header *head
       }
 
     // mmap header and data
-    if ((err = pt_cache_open_mmap(cache, header->data_size, false)))
+    if ((err = pt_cache_open_mmap(cache, header->data_size, false, 0)))
       goto error;
 
     // done
@@ -447,133 +620,1368 @@ error:
     return err;
 }
 
-int pt_cache_create_png (struct pt_cache *cache, const struct pt_png_header *png_header, const struct pt_image_params *params)
+/**
+ * Start writing to the opened .tmp file using the streaming writer, if requested by the params
+ *
+ * @param flags additional pt_stream_flags
+ */
+static int pt_cache_stream_init (struct pt_cache *cache, const struct pt_image_params *params, enum pt_stream_flags flags)
 {
-  struct pt_cache_header header = {
-    .version = pt_cache_version,
-    .magic   = PT_CACHE_MAGIC,
-    .format  = PT_FORMAT_PNG,
-  };
-  int err;
+    char tmp_path[1024];
+    int err;
 
-  if (cache->file) {
-    return -PT_ERR_CACHE_MODE;
-  }
+    if (!params || !(params->flags & (PT_IMAGE_STREAM | PT_IMAGE_DIRECT)))
+        return 0;
 
-  PT_DEBUG("%s: width=%u height=%u", cache->path, png_header->width, png_header->height);
+    flags |= PT_STREAM_SYNC;
 
-  // save any params
-  header.png = *png_header;
+    if (params->flags & PT_IMAGE_DIRECT)
+        flags |= PT_STREAM_DIRECT;
 
-  if (params)
-      header.params = *params;
+    // the O_DIRECT fd is opened separately
+    if ((err = pt_cache_tmp_name(cache, tmp_path, sizeof(tmp_path))))
+        return err;
 
-  header.data_size = pt_png_data_size(png_header);
+    if ((err = pt_stream_init(&cache->stream, cache->fd, tmp_path, flags)))
+        return err;
 
-  // create/open .tmp and write out header
-  if ((err = pt_cache_create(cache, &header)))
-      return err;
+    cache->stream_init = true;
 
-  return 0;
+    return 0;
 }
 
-int pt_cache_update_png (struct pt_cache *cache, struct pt_png_img *img, const struct pt_png_header *header, const struct pt_image_params *params)
+/**
+ * Write out all of the given data at the given file offset
+ */
+static int pt_cache_pwrite (int fd, const void *data, size_t len, off_t offset)
 {
-    struct pt_png_out png_out = {
-      .header = &cache->file->header.png, // should match *header in this case
-      .data = cache->file->data,
-    };
-    int err;
+    for (size_t off = 0; off < len; ) {
+        ssize_t ret;
 
-    // decode to disk
-    if ((err = pt_png_decode(img, header, params, &png_out)))
-        return err;
+        if ((ret = pwrite(fd, (const uint8_t *) data + off, len - off, offset + off)) <= 0)
+            return -PT_ERR_CACHE_WRITE;
+
+        off += ret;
+    }
 
     return 0;
 }
 
-int pt_cache_update_png_part (struct pt_cache *cache, struct pt_png_img *img, const struct pt_png_header *header, const struct pt_image_params *params, unsigned row, unsigned col)
+/**
+ * Write out data at the given offset within the data segment, bypassing the mmap
+ */
+static int pt_cache_write (struct pt_cache *cache, const uint8_t *data, size_t len, size_t offset)
 {
-    struct pt_png_out png_out = {
-      .header = &cache->file->header.png,
-      .data = cache->file->data,
-      .row = row,
-      .col = col,
-    };
-    int err;
+    if (cache->stream_init)
+        return pt_stream_write(&cache->stream, data, len, sizeof(struct pt_cache_file) + offset);
 
-    // decode to disk
-    if ((err = pt_png_decode(img, header, params, &png_out)))
-        return err;
+    return pt_cache_pwrite(cache->fd, data, len, sizeof(struct pt_cache_file) + offset);
+}
 
-    return 0;
+/**
+ * Compute the data layout for the PNG cache
+ */
+static void pt_cache_png_layout (const struct pt_cache_header *header, struct pt_png_layout *layout)
+{
+  pt_png_layout(layout, &header->png, header->block_width, header->block_height);
 }
 
-int pt_cache_create_done (struct pt_cache *cache)
+/**
+ * Compute the header and data layout for the given zoom level of the PNG cache, 0 for the full-size data.
+ *
+ * The zoom level must be supported by pt_png_zoom_header.
+ */
+static const struct pt_png_header *pt_cache_png_level (const struct pt_cache_header *header, int zoom, struct pt_png_header *zoom_header, struct pt_png_layout *layout)
 {
-    char tmp_path[1024];
-    int err;
+  const struct pt_png_header *png_header = &header->png;
 
-    // get .tmp path
-    if ((err = pt_cache_tmp_name(cache, tmp_path, sizeof(tmp_path))))
-        return err;
+  if (zoom) {
+    pt_png_zoom_header(zoom_header, &header->png, zoom);
 
-    // rename
-    if (rename(tmp_path, cache->path) < 0)
-        return -PT_ERR_CACHE_RENAME_TMP;
+    png_header = zoom_header;
+  }
 
-    // ok
-    return 0;
+  pt_png_layout(layout, png_header, header->block_width, header->block_height);
+
+  return png_header;
 }
 
-void pt_cache_create_abort (struct pt_cache *cache)
+/**
+ * Count the number of blocks in the zoom levels preceding the given zoom level
+ */
+static size_t pt_cache_png_blocks (const struct pt_cache_header *header, int zoom)
 {
-    char tmp_path[1024];
-    int err;
+  struct pt_png_header zoom_header;
+  struct pt_png_layout layout;
+  size_t blocks = 0;
 
-    // close open stuff
-    pt_cache_abort(cache);
+  for (int z = 0; z < zoom; z++) {
+    pt_cache_png_level(header, z, &zoom_header, &layout);
 
-    // get .tmp path
-    if ((err = pt_cache_tmp_name(cache, tmp_path, sizeof(tmp_path)))) {
-        PT_WARN("pt_cache_tmp_name %s: %s", cache->path, pt_strerror(err));
+    blocks += (size_t) layout.block_rows * layout.block_cols;
+  }
 
-        return;
-    }
+  return blocks;
+}
 
-    // remove .tmp
-    if (unlink(tmp_path))
-        PT_WARN_ERRNO("unlink %s", tmp_path);
+/**
+ * Describe the data for the given zoom level of the PNG cache, 0 for the full-size data
+ */
+static void pt_cache_png_in (const struct pt_cache *cache, int zoom, struct pt_png_header *zoom_header, struct pt_png_layout *layout, struct pt_png_in *in)
+{
+  const struct pt_cache_file *file = cache->file;
+
+  *in = (struct pt_png_in) {
+    .header = pt_cache_png_level(&file->header, zoom, zoom_header, layout),
+    .layout = layout,
+    .data = file->data,
+    .zoom = zoom,
+  };
+
+  if (file->header.compression) {
+    // the blocks for each zoom level follow each other in the index
+    in->index = (const size_t *) file->data + pt_cache_png_blocks(&file->header, zoom);
+    in->block_cache = cache->block_cache;
+
+  } else {
+    if (zoom)
+      in->data = file->data + file->header.zoom_offset[zoom - 1];
+
+    in->occupancy = file->data + file->header.occupancy_offset[zoom];
+
+    if (cache->holes_init)
+      in->holes = &cache->holes;
+  }
+
+  pt_png_fill_pixel(in->fill, &file->header.png, &file->header.params, zoom);
+
+  in->palette_lut = __atomic_load_n(&cache->palette_lut, __ATOMIC_ACQUIRE);
 }
 
-int pt_cache_render_tile (struct pt_cache *cache, struct pt_tile *tile)
+/**
+ * Compress the block into the deflate buffer, or leave incompressible blocks as-is
+ */
+static int pt_cache_deflate_block (struct pt_cache *cache, const uint8_t *data, size_t len, const uint8_t **out_ptr, size_t *len_ptr)
 {
-    int err;
+  size_t bound = pt_block_deflate_bound(&cache->deflate, len);
+  size_t out_len;
+  int err;
 
-    if (!cache->file) {
-      return -PT_ERR_CACHE_MODE;
-    }
+  if (cache->deflate_size < bound) {
+    uint8_t *buf;
 
-    // validate params
-    if (!tile->params.width || !tile->params.height)
-        return -PT_ERR_TILE_DIM;
+    if ((buf = realloc(cache->deflate_buf, bound)) == NULL)
+      return -PT_ERR_MEM;
 
-    // render
-    if ((err = pt_png_tile(&cache->file->header.png, cache->file->data, tile)))
-        return err;
+    cache->deflate_buf = buf;
+    cache->deflate_size = bound;
+  }
 
-    return 0;
+  out_len = cache->deflate_size;
+
+  if ((err = pt_block_deflate(&cache->deflate, data, len, cache->deflate_buf, &out_len)))
+    return err;
+
+  if (out_len >= len) {
+    // store incompressible blocks as-is
+    *out_ptr = data;
+    *len_ptr = len;
+  } else {
+    *out_ptr = cache->deflate_buf;
+    *len_ptr = out_len;
+  }
+
+  return 0;
 }
 
-int pt_cache_close (struct pt_cache *cache)
+/**
+ * pt_png_out write_block callback: compress and append the block, and update the block index
+ */
+static int pt_cache_write_block (void *arg, const uint8_t *data, size_t len)
 {
-    PT_DEBUG("%s", cache->path);
+  struct pt_cache *cache = arg;
+  size_t *index = (size_t *) cache->file->data;
+  size_t out_len = 0;
+  int err;
 
-    if (cache->file != NULL) {
-        if (munmap(cache->file, sizeof(struct pt_cache_file) + cache->file->header.data_size))
-            return -PT_ERR_CACHE_MUNMAP;
+  if (data) {
+    const uint8_t *out;
 
-        cache->file = NULL;
+    if ((err = pt_cache_deflate_block(cache, data, len, &out, &out_len)))
+      return err;
+
+    if ((err = pt_cache_write(cache, out, out_len, cache->write_offset)))
+      return err;
+  }
+
+  cache->write_offset += out_len;
+  cache->write_block++;
+
+  index[cache->write_block] = cache->write_offset;
+
+  return 0;
+}
+
+/**
+ * pt_png_out write_block callback: write out the uncompressed block at its position within the zoom level, and mark it
+ * in the occupancy bitmap
+ */
+static int pt_cache_stream_block (void *arg, const uint8_t *data, size_t len)
+{
+  struct pt_cache *cache = arg;
+  size_t block = cache->write_block++;
+  size_t offset = cache->write_offset + block * len;
+
+  if (!data)
+    return pt_stream_hole(&cache->stream, len, sizeof(struct pt_cache_file) + offset);
+
+  cache->write_occupancy[block / 8] |= 1 << (block % 8);
+
+  return pt_cache_write(cache, data, len, offset);
+}
+
+/**
+ * Compute the cache header and data layout for the given PNG header
+ */
+static int pt_cache_png_header (struct pt_cache_header *header, const struct pt_png_header *png_header, const struct pt_image_params *params, const struct pt_image_parts *parts)
+{
+  struct pt_png_layout layout;
+  int err;
+
+  *header = (struct pt_cache_header) {
+    .version = pt_cache_version,
+    .magic   = PT_CACHE_MAGIC,
+    .format  = PT_FORMAT_PNG,
+    .block_width = pt_image_block_size,
+    .block_height = pt_image_block_size,
+  };
+
+  // save any params
+  header->png = *png_header;
+
+  if (params) {
+      header->params = *params;
+
+      // does not affect the cache contents
+      header->params.flags &= ~(PT_IMAGE_INCREMENTAL | PT_IMAGE_STREAM | PT_IMAGE_DIRECT | PT_IMAGE_CHECKPOINT);
+      header->params.threads = 0;
+      header->params.checkpoint_interval = 0;
+      header->params.progress_interval = 0;
+      header->params.progress = NULL;
+      header->params.progress_arg = NULL;
+  }
+
+  pt_cache_png_layout(header, &layout);
+
+  header->data_size = pt_png_data_size(&layout);
+
+  // downsampled zoom levels follow the full-size data
+  if (params && (params->flags & PT_IMAGE_ZOOM_LEVELS)) {
+    struct pt_png_header zoom_header;
+
+    for (int zoom = 1; zoom <= PT_CACHE_ZOOM_LEVELS; zoom++) {
+      if ((err = pt_png_zoom_header(&zoom_header, png_header, zoom))) {
+        PT_DEBUG("zoom levels not supported: %s", pt_strerror(err));
+        break;
+      }
+
+      pt_png_layout(&layout, &zoom_header, header->block_width, header->block_height);
+
+      header->zoom_offset[zoom - 1] = header->data_size;
+      header->zoom_levels = zoom;
+      header->data_size += pt_png_data_size(&layout);
+    }
+  }
+
+  // compressed blocks are appended after the block index as they are written
+  if (params && (params->flags & PT_IMAGE_COMPRESS)) {
+    // the blocks of each part would need to be written out interleaved
+    if (parts)
+      return -PT_ERR_CACHE_COMPRESS;
+
+    header->compression = PT_CACHE_COMPRESS_DEFLATE;
+    header->data_size = (pt_cache_png_blocks(header, 1 + header->zoom_levels) + 1) * sizeof(size_t);
+
+  } else {
+    // occupancy bitmaps follow the pixel data
+    for (int zoom = 0; zoom <= (int) header->zoom_levels; zoom++) {
+      struct pt_png_header zoom_header;
+
+      pt_cache_png_level(header, zoom, &zoom_header, &layout);
+
+      header->occupancy_offset[zoom] = header->data_size;
+      header->data_size += pt_png_occupancy_size(&layout);
+    }
+  }
+
+  // followed by the source file of each part
+  if (parts) {
+    header->part_rows = parts->rows;
+    header->part_cols = parts->cols;
+    header->parts_offset = header->data_size;
+    header->data_size += (size_t) parts->rows * parts->cols * sizeof(struct pt_cache_part);
+  }
+
+  return 0;
+}
+
+int pt_cache_create_png (struct pt_cache *cache, const struct pt_png_header *png_header, const struct pt_image_params *params, const struct pt_image_parts *parts)
+{
+  struct pt_cache_header header;
+  int err;
+
+  if (cache->file) {
+    return -PT_ERR_CACHE_MODE;
+  }
+
+  PT_DEBUG("%s: width=%u height=%u", cache->path, png_header->width, png_header->height);
+
+  if ((err = pt_cache_png_header(&header, png_header, params, parts)))
+    return err;
+
+  if (header.compression) {
+    if ((err = pt_block_deflate_init(&cache->deflate)))
+      return err;
+
+    cache->deflate_init = true;
+  }
+
+  // create/open .tmp and write out header
+  if ((err = pt_cache_create(cache, &header)))
+      return err;
+
+  if ((err = pt_cache_stream_init(cache, params, 0))) {
+    pt_cache_create_abort(cache);
+    return err;
+  }
+
+  if (header.compression) {
+    cache->write_block = 0;
+    cache->write_offset = header.data_size;
+
+    ((size_t *) cache->file->data)[0] = cache->write_offset;
+  }
+
+  return 0;
+}
+
+/**
+ * Test if an existing cache header has the same data layout as the given header
+ */
+static bool pt_cache_header_compatible (const struct pt_cache_header *header, const struct pt_cache_header *old)
+{
+  const struct pt_png_header *png = &header->png, *old_png = &old->png;
+
+  if (pt_cache_header_check(old))
+    return false;
+
+  if (old->format != header->format || old->data_size != header->data_size)
+    return false;
+
+  if (old_png->width != png->width || old_png->height != png->height || old_png->bit_depth != png->bit_depth || old_png->color_type != png->color_type)
+    return false;
+
+  if (old_png->pixel_bits != png->pixel_bits || old_png->num_palette != png->num_palette || memcmp(old_png->palette, png->palette, png->num_palette * sizeof(*png->palette)))
+    return false;
+
+  if (old->params.flags != header->params.flags || memcmp(old->params.background_pixel, header->params.background_pixel, sizeof(header->params.background_pixel)))
+    return false;
+
+  if (old->compression != header->compression || old->zoom_levels != header->zoom_levels)
+    return false;
+
+  if (old->part_rows != header->part_rows || old->part_cols != header->part_cols || old->parts_offset != header->parts_offset)
+    return false;
+
+  return true;
+}
+
+/**
+ * Copy \a len bytes at \a offset from one file to the other
+ */
+static int pt_cache_copy_range (int fd, int src_fd, off_t offset, size_t len)
+{
+  off_t in_offset = offset, out_offset = offset;
+  char buf[64 * 1024];
+
+  while (len) {
+    ssize_t ret = copy_file_range(src_fd, &in_offset, fd, &out_offset, len, 0);
+
+    if (ret > 0) {
+      len -= ret;
+
+      continue;
+    }
+
+    if (ret == 0 || (errno != ENOSYS && errno != EXDEV && errno != EINVAL && errno != EOPNOTSUPP))
+      return -PT_ERR_CACHE_WRITE;
+
+    // fall back to read/write
+    if ((ret = pread(src_fd, buf, min(len, sizeof(buf)), in_offset)) <= 0)
+      return -PT_ERR_CACHE_READ;
+
+    if (pwrite(fd, buf, ret, out_offset) != ret)
+      return -PT_ERR_CACHE_WRITE;
+
+    in_offset += ret;
+    out_offset += ret;
+    len -= ret;
+  }
+
+  return 0;
+}
+
+/**
+ * Copy the contents of the existing .cache file to the opened .tmp file, keeping it sparse
+ */
+static int pt_cache_copy (int fd, int src_fd, size_t size)
+{
+  off_t offset = 0;
+  int err;
+
+  // share the data on filesystems that support it
+  if (ioctl(fd, FICLONE, src_fd) == 0)
+    return 0;
+
+  if (ftruncate(fd, size) < 0)
+    return -PT_ERR_CACHE_TRUNC;
+
+  // copy only the data regions, leaving holes in the .tmp
+  while (offset < (off_t) size) {
+    off_t data, hole;
+
+    if ((data = lseek(src_fd, offset, SEEK_DATA)) < 0) {
+      if (errno == ENXIO)
+        break; // trailing hole
+
+      return -PT_ERR_CACHE_SEEK;
+    }
+
+    if ((hole = lseek(src_fd, data, SEEK_HOLE)) < 0)
+      return -PT_ERR_CACHE_SEEK;
+
+    if ((err = pt_cache_copy_range(fd, src_fd, data, hole - data)))
+      return err;
+
+    offset = hole;
+  }
+
+  return 0;
+}
+
+int pt_cache_clone_png (struct pt_cache *cache, const struct pt_png_header *png_header, const struct pt_image_params *params, const struct pt_image_parts *parts)
+{
+  struct pt_cache_header header, old_header;
+  int src_fd;
+  int err;
+
+  if (cache->file) {
+    return -PT_ERR_CACHE_MODE;
+  }
+
+  if ((err = pt_cache_png_header(&header, png_header, params, parts)))
+    return err;
+
+  if (pt_open_cache_read_fd(cache->path, &src_fd)) {
+    PT_DEBUG("%s: no existing cache", cache->path);
+
+    return 1;
+  }
+
+  if ((err = pt_cache_header_read(&old_header, src_fd)))
+    goto error;
+
+  if (!pt_cache_header_compatible(&header, &old_header)) {
+    PT_DEBUG("%s: existing cache is not compatible", cache->path);
+
+    err = 1;
+    goto error;
+  }
+
+  PT_DEBUG("%s: data_size=%zu", cache->path, header.data_size);
+
+  if ((err = pt_cache_open_tmp_fd(cache, &cache->fd)))
+    goto error;
+
+  if ((err = pt_cache_copy(cache->fd, src_fd, sizeof_pt_cache_file(header.data_size))))
+    goto error;
+
+  if ((err = pt_cache_header_write(&header, cache->fd)))
+    goto error;
+
+  if ((err = pt_cache_open_mmap(cache, header.data_size, false, 0)))
+    goto error;
+
+  // any empty blocks written may have been written by the previous update
+  if ((err = pt_cache_stream_init(cache, params, PT_STREAM_PUNCH)))
+    goto error;
+
+  // ok
+  close(src_fd);
+
+  return 0;
+
+error:
+  close(src_fd);
+
+  if (cache->fd >= 0) {
+    // cleanup .tmp
+    pt_cache_create_abort(cache);
+  }
+
+  return err;
+}
+
+/**
+ * Stat the given source file, or leave the part zeroed for a missing part
+ */
+static int pt_cache_stat_source (const char *path, struct pt_cache_part *part)
+{
+  struct stat st;
+
+  *part = (struct pt_cache_part) { };
+
+  if (path) {
+    if (stat(path, &st) < 0)
+      return -PT_ERR_IMG_STAT;
+
+    part->mtime = st.st_mtim;
+    part->size = st.st_size;
+  }
+
+  return 0;
+}
+
+/**
+ * Test if the source file is unchanged
+ */
+static bool pt_cache_source_equal (const struct pt_cache_part *part, const struct pt_cache_part *old)
+{
+  return old->mtime.tv_sec == part->mtime.tv_sec && old->mtime.tv_nsec == part->mtime.tv_nsec && old->size == part->size;
+}
+
+int pt_cache_stat_part (struct pt_cache *cache, unsigned part, const char *path)
+{
+  const struct pt_cache_header *header = &cache->file->header;
+  struct pt_cache_part *cache_part = (struct pt_cache_part *) (cache->file->data + header->parts_offset) + part;
+  struct pt_cache_part stat_part;
+  int err;
+
+  if (part >= header->part_rows * header->part_cols)
+    return -PT_ERR_CACHE_MODE;
+
+  if ((err = pt_cache_stat_source(path, &stat_part)))
+    return err;
+
+  if (pt_cache_source_equal(&stat_part, cache_part))
+    return 0;
+
+  PT_DEBUG("%s: part=%u path=%s mtime=%ld size=%ld: stale", cache->path, part, path, (long) stat_part.mtime.tv_sec, (long) stat_part.size);
+
+  *cache_part = stat_part;
+
+  return 1;
+}
+
+void pt_cache_clear_part (struct pt_cache *cache, unsigned row, unsigned col, unsigned width, unsigned height)
+{
+    struct pt_png_layout layout;
+    struct pt_png_out png_out = {
+      .header = &cache->file->header.png,
+      .layout = &layout,
+      .data = cache->file->data,
+      .occupancy = cache->file->data + cache->file->header.occupancy_offset[0],
+      .row = row,
+      .col = col,
+    };
+
+    pt_cache_png_layout(&cache->file->header, &layout);
+
+    pt_png_clear(&png_out, width, height);
+}
+
+int pt_cache_resume_png (struct pt_cache *cache, const struct pt_png_header *png_header, const struct pt_image_params *params, const char *path)
+{
+  struct pt_cache_header header, tmp_header;
+  struct pt_cache_checkpoint *checkpoint = NULL;
+  struct pt_cache_part source;
+  char ckpt_path[1024], tmp_path[1024];
+  struct stat st;
+  size_t data_size;
+  int fd;
+  int err;
+
+  if (cache->file) {
+    return -PT_ERR_CACHE_MODE;
+  }
+
+  if ((err = pt_cache_png_header(&header, png_header, params, NULL)))
+    return err;
+
+  if ((err = pt_cache_checkpoint_name(cache, ckpt_path, sizeof(ckpt_path), ".ckpt")))
+    return err;
+
+  if ((err = pt_cache_tmp_name(cache, tmp_path, sizeof(tmp_path))))
+    return err;
+
+  if ((fd = open(ckpt_path, O_RDONLY)) < 0) {
+    PT_DEBUG("%s: no checkpoint", cache->path);
+
+    return 1;
+  }
+
+  if (fstat(fd, &st) < 0) {
+    err = -PT_ERR_CACHE_STAT;
+    goto error;
+  }
+
+  if ((size_t) st.st_size < sizeof(*checkpoint))
+    goto stale;
+
+  if ((checkpoint = malloc(st.st_size)) == NULL) {
+    err = -PT_ERR_MEM;
+    goto error;
+  }
+
+  if (pread(fd, checkpoint, st.st_size, 0) != st.st_size) {
+    err = -PT_ERR_CACHE_READ;
+    goto error;
+  }
+
+  if (sizeof(*checkpoint) + checkpoint->prev_len + checkpoint->raw_len + checkpoint->rows_len != (size_t) st.st_size)
+    goto stale;
+
+  if (!pt_cache_header_compatible(&header, &checkpoint->header) || checkpoint->write_block > pt_cache_png_blocks(&header, 1))
+    goto stale;
+
+  if (header.compression && checkpoint->write_offset < header.data_size)
+    goto stale;
+
+  // the image must not have changed since
+  if ((err = pt_cache_stat_source(path, &source)))
+    goto error;
+
+  if (!pt_cache_source_equal(&source, &checkpoint->source))
+    goto stale;
+
+  // the .tmp must have been written at least up to the checkpoint
+  if ((cache->fd = open(tmp_path, O_RDWR)) < 0)
+    goto stale;
+
+  if (pt_cache_header_read(&tmp_header, cache->fd) || !pt_cache_header_compatible(&checkpoint->header, &tmp_header))
+    goto stale;
+
+  data_size = header.compression ? checkpoint->write_offset : header.data_size;
+
+  if (fstat(cache->fd, &st) < 0) {
+    err = -PT_ERR_CACHE_STAT;
+    goto error;
+  }
+
+  if ((size_t) st.st_size < sizeof_pt_cache_file(data_size))
+    goto stale;
+
+  PT_DEBUG("%s: resume row=%u write_block=%zu write_offset=%zu", cache->path, checkpoint->point.row, checkpoint->write_block, checkpoint->write_offset);
+
+  if (header.compression) {
+    // drop any compressed blocks appended after the checkpoint
+    if (ftruncate(cache->fd, sizeof_pt_cache_file(data_size)) < 0) {
+      err = -PT_ERR_CACHE_TRUNC;
+      goto error;
+    }
+
+    if ((err = pt_block_deflate_init(&cache->deflate)))
+      goto error;
+
+    cache->deflate_init = true;
+  }
+
+  if ((err = pt_cache_open_mmap(cache, header.data_size, false, 0)))
+    goto error;
+
+  if ((err = pt_cache_stream_init(cache, params, 0)))
+    goto error;
+
+  cache->write_block = checkpoint->write_block;
+  cache->write_offset = checkpoint->write_offset;
+  cache->source = source;
+  cache->resume = checkpoint;
+  cache->checkpointed = true;
+
+  close(fd);
+
+  return 0;
+
+stale:
+  PT_WARN("%s: not resuming from stale checkpoint", ckpt_path);
+
+  if (unlink(ckpt_path))
+    PT_WARN_ERRNO("unlink %s", ckpt_path);
+
+  err = 1;
+
+error:
+  free(checkpoint);
+  close(fd);
+
+  pt_cache_abort(cache);
+
+  return err;
+}
+
+/**
+ * pt_png_out checkpoint callback: make the data written to the .tmp so far durable, and then write out the decoder
+ * state to the .ckpt
+ */
+static int pt_cache_checkpoint (void *arg, const struct pt_png_resume *resume)
+{
+  struct pt_cache *cache = arg;
+  struct pt_cache_checkpoint checkpoint = {
+    .header = cache->file->header,
+    .source = cache->source,
+    .write_block = cache->write_block,
+    .write_offset = cache->write_offset,
+    .point = *resume->point,
+    .prev_len = resume->prev_len,
+    .raw_len = resume->raw_len,
+    .rows_len = resume->rows_len,
+  };
+  char ckpt_path[1024], tmp_path[1024];
+  off_t offset = 0;
+  int fd;
+  int err;
+
+  if (cache->stream_init && (err = pt_stream_flush(&cache->stream)))
+    return err;
+
+  if (msync(cache->file, cache->size, MS_SYNC))
+    return -PT_ERR_CACHE_SYNC;
+
+  if (fdatasync(cache->fd))
+    return -PT_ERR_CACHE_SYNC;
+
+  if ((err = pt_cache_checkpoint_name(cache, ckpt_path, sizeof(ckpt_path), ".ckpt")))
+    return err;
+
+  if ((err = pt_cache_checkpoint_name(cache, tmp_path, sizeof(tmp_path), ".ckpt.tmp")))
+    return err;
+
+  // replace the previous checkpoint atomically
+  if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    return -PT_ERR_CACHE_OPEN_TMP;
+
+  if ((err = pt_cache_pwrite(fd, &checkpoint, sizeof(checkpoint), offset)))
+    goto error;
+
+  offset += sizeof(checkpoint);
+
+  if ((err = pt_cache_pwrite(fd, resume->prev, resume->prev_len, offset)))
+    goto error;
+
+  offset += resume->prev_len;
+
+  if ((err = pt_cache_pwrite(fd, resume->raw, resume->raw_len, offset)))
+    goto error;
+
+  offset += resume->raw_len;
+
+  if ((err = pt_cache_pwrite(fd, resume->rows, resume->rows_len, offset)))
+    goto error;
+
+  if (fdatasync(fd)) {
+    err = -PT_ERR_CACHE_SYNC;
+    goto error;
+  }
+
+  if (close(fd)) {
+    fd = -1;
+    err = -PT_ERR_CACHE_WRITE;
+    goto error;
+  }
+
+  fd = -1;
+
+  if (rename(tmp_path, ckpt_path) < 0) {
+    err = -PT_ERR_CACHE_RENAME_TMP;
+    goto error;
+  }
+
+  PT_DEBUG("%s: row=%u offset=%ld write_block=%zu", ckpt_path, resume->point->row, (long) resume->point->offset, cache->write_block);
+
+  cache->checkpointed = true;
+
+  return 0;
+
+error:
+  if (fd >= 0)
+    close(fd);
+
+  if (unlink(tmp_path))
+    PT_WARN_ERRNO("unlink %s", tmp_path);
+
+  return err;
+}
+
+int pt_cache_update_png (struct pt_cache *cache, struct pt_png_img *img, const struct pt_png_header *header, const struct pt_image_params *params, const char *path)
+{
+    struct pt_png_layout layout;
+    struct pt_png_out png_out = {
+      .header = &cache->file->header.png, // should match *header in this case
+      .layout = &layout,
+      .data = cache->file->data,
+      .progress = cache->progress,
+    };
+    int err;
+
+    pt_cache_png_layout(&cache->file->header, &layout);
+
+    if (cache->file->header.compression) {
+      png_out.data = NULL;
+      png_out.write_block = pt_cache_write_block;
+      png_out.write_arg = cache;
+    } else if (cache->stream_init) {
+      png_out.data = NULL;
+      png_out.write_block = pt_cache_stream_block;
+      png_out.write_arg = cache;
+
+      // restored from any checkpoint
+      if (!cache->resume) {
+        cache->write_block = 0;
+        cache->write_offset = 0;
+      }
+
+      cache->write_occupancy = cache->file->data + cache->file->header.occupancy_offset[0];
+    } else {
+      png_out.occupancy = cache->file->data + cache->file->header.occupancy_offset[0];
+    }
+
+    if (params && (params->flags & PT_IMAGE_CHECKPOINT)) {
+      struct pt_cache_checkpoint *checkpoint = cache->resume;
+      struct pt_png_resume resume;
+
+      png_out.checkpoint = pt_cache_checkpoint;
+      png_out.checkpoint_arg = cache;
+
+      if (checkpoint) {
+        resume = (struct pt_png_resume) {
+          .point = &checkpoint->point,
+          .prev = checkpoint->data,
+          .prev_len = checkpoint->prev_len,
+          .raw = checkpoint->data + checkpoint->prev_len,
+          .raw_len = checkpoint->raw_len,
+          .rows = checkpoint->data + checkpoint->prev_len + checkpoint->raw_len,
+          .rows_len = checkpoint->rows_len,
+        };
+      } else if ((err = pt_cache_stat_source(path, &cache->source))) {
+        return err;
+      }
+
+      // decode to disk, from the file
+      err = pt_png_decode_resumable(path, header, params, &png_out, checkpoint ? &resume : NULL);
+
+      free(cache->resume);
+      cache->resume = NULL;
+
+      return err;
+    }
+
+    // decode to disk
+    if ((err = pt_png_decode(img, header, params, &png_out)))
+        return err;
+
+    return 0;
+}
+
+int pt_cache_update_png_part (struct pt_cache *cache, struct pt_png_img *img, const struct pt_png_header *header, const struct pt_image_params *params, unsigned row, unsigned col)
+{
+    struct pt_png_layout layout;
+    struct pt_png_out png_out = {
+      .header = &cache->file->header.png,
+      .layout = &layout,
+      .data = cache->file->data,
+      .occupancy = cache->file->data + cache->file->header.occupancy_offset[0],
+      .row = row,
+      .col = col,
+      .progress = cache->progress,
+    };
+    int err;
+
+    // the blocks of each part would need to be written out interleaved
+    if (cache->file->header.compression)
+      return -PT_ERR_CACHE_COMPRESS;
+
+    pt_cache_png_layout(&cache->file->header, &layout);
+
+    // decode to disk
+    if ((err = pt_png_decode(img, header, params, &png_out)))
+        return err;
+
+    return 0;
+}
+
+/**
+ * Writer for each of the zoom levels built at once by pt_cache_update_png_zoom, with the levels interleaved.
+ *
+ * Each level is streamed out in order on its own. Compressed levels are appended to a spool within the .tmp, sized for
+ * the uncompressed level and following the previous one, and moved down into place once done.
+ */
+struct pt_cache_zoom_writer {
+  struct pt_cache *cache;
+
+  /** Streaming writer of the level, for PT_IMAGE_STREAM */
+  struct pt_stream stream;
+  bool stream_init;
+
+  /** Number of blocks written, and the offset of the next block, within the data segment */
+  size_t write_block, write_offset;
+
+  /** Occupancy bitmap of the level, for uncompressed blocks */
+  uint8_t *occupancy;
+
+  /** Offset of the spool, for compressed blocks */
+  size_t spool_offset;
+};
+
+/**
+ * Write out data of the zoom level at the given offset within the data segment
+ */
+static int pt_cache_zoom_write (struct pt_cache_zoom_writer *writer, const uint8_t *data, size_t len, size_t offset)
+{
+  if (writer->stream_init)
+    return pt_stream_write(&writer->stream, data, len, sizeof(struct pt_cache_file) + offset);
+
+  return pt_cache_pwrite(writer->cache->fd, data, len, sizeof(struct pt_cache_file) + offset);
+}
+
+/**
+ * pt_png_out write_block callback: compress and append the block to the spool of the zoom level, and update the block
+ * index
+ */
+static int pt_cache_zoom_write_block (void *arg, const uint8_t *data, size_t len)
+{
+  struct pt_cache_zoom_writer *writer = arg;
+  size_t *index = (size_t *) writer->cache->file->data;
+  size_t out_len = 0;
+  int err;
+
+  if (data) {
+    const uint8_t *out;
+
+    if ((err = pt_cache_deflate_block(writer->cache, data, len, &out, &out_len)))
+      return err;
+
+    if ((err = pt_cache_zoom_write(writer, out, out_len, writer->write_offset)))
+      return err;
+  }
+
+  writer->write_offset += out_len;
+  writer->write_block++;
+
+  index[writer->write_block] = writer->write_offset;
+
+  return 0;
+}
+
+/**
+ * pt_png_out write_block callback: write out the uncompressed block at its position within the zoom level, and mark
+ * it in the occupancy bitmap
+ */
+static int pt_cache_zoom_stream_block (void *arg, const uint8_t *data, size_t len)
+{
+  struct pt_cache_zoom_writer *writer = arg;
+  size_t block = writer->write_block++;
+  size_t offset = writer->write_offset + block * len;
+
+  if (!data)
+    return pt_stream_hole(&writer->stream, len, sizeof(struct pt_cache_file) + offset);
+
+  writer->occupancy[block / 8] |= 1 << (block % 8);
+
+  return pt_stream_write(&writer->stream, data, len, sizeof(struct pt_cache_file) + offset);
+}
+
+/**
+ * Move the spooled compressed blocks of each zoom level down to follow the previous level, and truncate the spools
+ */
+static int pt_cache_zoom_unspool (struct pt_cache *cache, struct pt_cache_zoom_writer *writers, int levels)
+{
+  size_t *index = (size_t *) cache->file->data;
+  size_t offset = writers[0].spool_offset;
+  uint8_t buf[64 * 1024];
+  int err;
+
+  for (int zoom = 1; zoom <= levels; zoom++) {
+    struct pt_cache_zoom_writer *writer = &writers[zoom - 1];
+    size_t delta = writer->spool_offset - offset;
+    size_t first_block = pt_cache_png_blocks(&cache->file->header, zoom);
+
+    // moving forwards, each part is read before it gets overwritten
+    for (size_t off = writer->spool_offset; delta && off < writer->write_offset; ) {
+      ssize_t ret;
+
+      if ((ret = pread(cache->fd, buf, min(writer->write_offset - off, sizeof(buf)), sizeof(struct pt_cache_file) + off)) <= 0)
+        return -PT_ERR_CACHE_READ;
+
+      if ((err = pt_cache_write(cache, buf, ret, off - delta)))
+        return err;
+
+      off += ret;
+    }
+
+    for (size_t block = first_block + 1; block <= writer->write_block; block++)
+      index[block] -= delta;
+
+    offset = writer->write_offset - delta;
+  }
+
+  cache->write_block = writers[levels - 1].write_block;
+  cache->write_offset = offset;
+
+  if (cache->stream_init && (err = pt_stream_flush(&cache->stream)))
+    return err;
+
+  if (ftruncate(cache->fd, sizeof_pt_cache_file(cache->write_offset)) < 0)
+    return -PT_ERR_CACHE_TRUNC;
+
+  return 0;
+}
+
+int pt_cache_update_png_zoom (struct pt_cache *cache)
+{
+    const struct pt_cache_header *header;
+    struct pt_png_header in_header, out_headers[PT_CACHE_ZOOM_LEVELS];
+    struct pt_png_layout in_layout, out_layouts[PT_CACHE_ZOOM_LEVELS];
+    struct pt_png_in png_in;
+    struct pt_png_out png_outs[PT_CACHE_ZOOM_LEVELS] = { };
+    struct pt_cache_zoom_writer writers[PT_CACHE_ZOOM_LEVELS] = { };
+    int levels = cache->file->header.zoom_levels;
+    char tmp_path[1024];
+    int err = 0;
+
+    if (!levels)
+      return 0;
+
+    PT_DEBUG("%s: zoom_levels=%d", cache->path, levels);
+
+    // read back the data written so far
+    if (cache->stream_init && (err = pt_stream_flush(&cache->stream)))
+      return err;
+
+    // cover the compressed blocks written so far
+    if (cache->file->header.compression && (err = pt_cache_remap(cache, cache->write_offset, false)))
+      return err;
+
+    if (cache->stream_init && (err = pt_cache_tmp_name(cache, tmp_path, sizeof(tmp_path))))
+      return err;
+
+    header = &cache->file->header;
+
+    pt_cache_png_in(cache, 0, &in_header, &in_layout, &png_in);
+
+    // all levels are downsampled at once, from a single pass over the full-size data
+    for (int zoom = 1; zoom <= levels; zoom++) {
+      struct pt_cache_zoom_writer *writer = &writers[zoom - 1];
+      struct pt_png_out *png_out = &png_outs[zoom - 1];
+
+      png_out->header = &out_headers[zoom - 1];
+      png_out->layout = &out_layouts[zoom - 1];
+
+      pt_cache_png_level(header, zoom, &out_headers[zoom - 1], &out_layouts[zoom - 1]);
+
+      writer->cache = cache;
+
+      if (cache->stream_init) {
+        // same flags, including any fallback from O_DIRECT
+        if ((err = pt_stream_init(&writer->stream, cache->fd, tmp_path, cache->stream.flags)))
+          goto error;
+
+        writer->stream_init = true;
+      }
+
+      if (header->compression) {
+        // spooled after the previous level, for at most the uncompressed size of the level
+        writer->spool_offset = zoom > 1 ? writers[zoom - 2].spool_offset + pt_png_data_size(&out_layouts[zoom - 2]) : cache->write_offset;
+        writer->write_block = pt_cache_png_blocks(header, zoom);
+        writer->write_offset = writer->spool_offset;
+
+        png_out->write_block = pt_cache_zoom_write_block;
+        png_out->write_arg = writer;
+
+        continue;
+      }
+
+      writer->occupancy = cache->file->data + header->occupancy_offset[zoom];
+
+      // empty blocks are not written, and may have been written by a previous update that this is a clone of
+      memset(writer->occupancy, 0, pt_png_occupancy_size(&out_layouts[zoom - 1]));
+
+      if (cache->stream_init) {
+        writer->write_offset = header->zoom_offset[zoom - 1];
+
+        png_out->write_block = pt_cache_zoom_stream_block;
+        png_out->write_arg = writer;
+      } else {
+        png_out->data = cache->file->data + header->zoom_offset[zoom - 1];
+        png_out->occupancy = writer->occupancy;
+      }
+    }
+
+    if ((err = pt_png_downsample(&png_in, png_outs, levels)))
+      goto error;
+
+    for (int zoom = 1; zoom <= levels; zoom++) {
+      if (writers[zoom - 1].stream_init && (err = pt_stream_flush(&writers[zoom - 1].stream)))
+        goto error;
+    }
+
+    if (header->compression && (err = pt_cache_zoom_unspool(cache, writers, levels)))
+      goto error;
+
+error:
+    for (int zoom = 1; zoom <= levels; zoom++) {
+      if (writers[zoom - 1].stream_init)
+        pt_stream_release(&writers[zoom - 1].stream);
+    }
+
+    return err;
+}
+
+int pt_cache_create_done (struct pt_cache *cache)
+{
+    char tmp_path[1024];
+    int err;
+
+    if (cache->stream_init && (err = pt_stream_flush(&cache->stream)))
+        return err;
+
+    if (cache->file->header.compression) {
+        // written out via the mmap
+        cache->file->header.data_size = cache->write_offset;
+
+        // cover all blocks for rendering
+        if ((err = pt_cache_remap(cache, cache->write_offset, true)))
+            return err;
+
+        if ((err = pt_block_cache_new(&cache->block_cache)))
+            return err;
+    }
+
+    // get .tmp path
+    if ((err = pt_cache_tmp_name(cache, tmp_path, sizeof(tmp_path))))
+        return err;
+
+    // rename
+    if (rename(tmp_path, cache->path) < 0)
+        return -PT_ERR_CACHE_RENAME_TMP;
+
+    // no longer needed to resume
+    if (cache->checkpointed) {
+        cache->checkpointed = false;
+
+        if ((err = pt_cache_checkpoint_unlink(cache)))
+            PT_WARN("pt_cache_checkpoint_unlink %s: %s", cache->path, pt_strerror(err));
+    }
+
+    // ok
+    return 0;
+}
+
+void pt_cache_create_abort (struct pt_cache *cache)
+{
+    char tmp_path[1024];
+    int err;
+
+    // close open stuff
+    pt_cache_abort(cache);
+
+    // resume the next update from the checkpoint
+    if (cache->checkpointed) {
+        PT_WARN("%s: keeping .tmp to resume from checkpoint", cache->path);
+
+        cache->checkpointed = false;
+
+        return;
+    }
+
+    // get .tmp path
+    if ((err = pt_cache_tmp_name(cache, tmp_path, sizeof(tmp_path)))) {
+        PT_WARN("pt_cache_tmp_name %s: %s", cache->path, pt_strerror(err));
+
+        return;
+    }
+
+    // remove .tmp
+    if (unlink(tmp_path))
+        PT_WARN_ERRNO("unlink %s", tmp_path);
+}
+
+/**
+ * The zoom level to render the given tile from: the closest downsampled zoom level, except for counting the palette
+ * indexes of the full-size data
+ */
+static int pt_cache_tile_level (const struct pt_cache *cache, const struct pt_tile_params *params)
+{
+    const struct pt_cache_header *header = &cache->file->header;
+
+    if (params->zoom <= 0 || pt_zoom_mode(&header->png, params->zoom_mode) == PT_TILE_ZOOM_DOMINANT)
+        return 0;
+
+    return min(params->zoom, (int) header->zoom_levels);
+}
+
+/**
+ * Allocate the nearest palette color table on first use, racing with any other renders doing the same
+ */
+static int pt_cache_palette_lut (struct pt_cache *cache)
+{
+    uint16_t *lut, *expected = NULL;
+
+    if (__atomic_load_n(&cache->palette_lut, __ATOMIC_ACQUIRE))
+        return 0;
+
+    if ((lut = pt_zoom_palette_lut_new()) == NULL)
+        return -PT_ERR_MEM;
+
+    if (!__atomic_compare_exchange_n(&cache->palette_lut, &expected, lut, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        // lost the race
+        free(lut);
+
+    return 0;
+}
+
+int pt_cache_render_tile (struct pt_cache *cache, struct pt_tile *tile)
+{
+    struct pt_png_header zoom_header;
+    struct pt_png_layout layout;
+    struct pt_png_in png_in;
+    int err;
+
+    if (!cache->file) {
+      return -PT_ERR_CACHE_MODE;
+    }
+
+    // validate params
+    if (!tile->params.width || !tile->params.height)
+        return -PT_ERR_TILE_DIM;
+
+    if (tile->params.zoom > 0 && pt_zoom_mode(&cache->file->header.png, tile->params.zoom_mode) == PT_TILE_ZOOM_PALETTE) {
+        if ((err = pt_cache_palette_lut(cache)))
+            return err;
+    }
+
+    pt_cache_png_in(cache, pt_cache_tile_level(cache, &tile->params), &zoom_header, &layout, &png_in);
+
+    // render
+    if ((err = pt_png_tile(&png_in, tile)))
+        return err;
+
+    // running average of the compression ratio, for pt_cache_tile_size_hint
+    __atomic_add_fetch(&cache->tile_bytes, tile->out_bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&cache->tile_raw_bytes, pt_png_tile_raw_size(&cache->file->header.png, &tile->params), __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+int pt_cache_tile_size_hint (struct pt_cache *cache, const struct pt_tile_params *params, size_t *size_ptr)
+{
+    const struct pt_png_header *header;
+    uint64_t tile_bytes, tile_raw_bytes;
+    size_t raw_size, bound;
+
+    if (!cache->file) {
+      return -PT_ERR_CACHE_MODE;
+    }
+
+    if (!params->width || !params->height)
+        return -PT_ERR_TILE_DIM;
+
+    header = &cache->file->header.png;
+    raw_size = pt_png_tile_raw_size(header, params);
+    bound = pt_png_tile_size_bound(header, raw_size);
+
+    tile_bytes = __atomic_load_n(&cache->tile_bytes, __ATOMIC_RELAXED);
+    tile_raw_bytes = __atomic_load_n(&cache->tile_raw_bytes, __ATOMIC_RELAXED);
+
+    if (tile_raw_bytes) {
+        // the average size, with some room for tiles with more detail than average
+        size_t size = raw_size * ((double) tile_bytes / tile_raw_bytes) * PT_CACHE_TILE_SIZE_MARGIN + PT_TILE_BUF_SIZE;
+
+        *size_ptr = min(size, bound);
+    } else {
+        *size_ptr = bound;
+    }
+
+    return 0;
+}
+
+int pt_cache_prefetch (struct pt_cache *cache, const struct pt_tile_params *params)
+{
+    struct pt_png_header zoom_header;
+    struct pt_png_layout layout;
+    struct pt_png_in png_in;
+
+    if (!cache->file) {
+      return -PT_ERR_CACHE_MODE;
+    }
+
+    if (!params->width || !params->height)
+        return -PT_ERR_TILE_DIM;
+
+    // the same zoom level that pt_cache_render_tile renders from
+    pt_cache_png_in(cache, pt_cache_tile_level(cache, params), &zoom_header, &layout, &png_in);
+
+    return pt_png_prefetch(&png_in, params);
+}
+
+int pt_cache_tile_block (struct pt_cache *cache, const struct pt_tile_params *params, size_t *block_ptr)
+{
+    struct pt_png_header zoom_header;
+    struct pt_png_layout layout;
+    unsigned block_row, block_col;
+    int zoom;
+
+    if (!cache->file) {
+      return -PT_ERR_CACHE_MODE;
+    }
+
+    // the same zoom level that pt_cache_render_tile renders from
+    zoom = pt_cache_tile_level(cache, params);
+
+    pt_cache_png_level(&cache->file->header, zoom, &zoom_header, &layout);
+
+    block_row = min((params->y >> zoom) / layout.block_height, layout.block_rows - 1);
+    block_col = min((params->x >> zoom) / layout.block_width, layout.block_cols - 1);
+
+    // the blocks for each zoom level follow each other in the data, as they do in the index
+    *block_ptr = pt_cache_png_blocks(&cache->file->header, zoom) + (size_t) block_row * layout.block_cols + block_col;
+
+    return 0;
+}
+
+int pt_cache_close (struct pt_cache *cache)
+{
+    PT_DEBUG("%s", cache->path);
+
+    if (cache->file != NULL) {
+        if (munmap(cache->file, cache->size))
+            return -PT_ERR_CACHE_MUNMAP;
+
+        cache->file = NULL;
+    }
+
+    if (cache->block_cache) {
+        pt_block_cache_destroy(cache->block_cache);
+
+        cache->block_cache = NULL;
+    }
+
+    free(cache->palette_lut);
+    cache->palette_lut = NULL;
+
+    if (cache->holes_init) {
+        pt_sparse_map_release(&cache->holes);
+
+        cache->holes_init = false;
     }
 
     if (cache->fd >= 0) {
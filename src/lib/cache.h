@@ -7,12 +7,17 @@
  * Internal image cache implementation
  */
 #include "png.h"
+#include "block.h"
+#include "stream.h"
+#include "idat.h"
+#include "progress.h"
 
 #include "pngtile.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <time.h>
 
-#define PT_CACHE_VERSION 5
+#define PT_CACHE_VERSION 13
 #define PT_CACHE_MAGIC { 'P', 'N', 'G', 'T', 'I', 'L' }
 
 /**
@@ -20,6 +25,27 @@
  */
 #define PT_CACHE_HEADER_SIZE 4096
 
+/**
+ * Maximum number of downsampled zoom levels stored, each at half the size of the previous one
+ */
+#define PT_CACHE_ZOOM_LEVELS 4
+
+/**
+ * Size hints for tiles are this many times the average compressed size, plus PT_TILE_BUF_SIZE
+ */
+#define PT_CACHE_TILE_SIZE_MARGIN 1.5
+
+/**
+ * Storage of the blocks within the data segment
+ */
+enum pt_cache_compression {
+    /** Fixed-size blocks, addressed by pt_png_data_offset() */
+    PT_CACHE_COMPRESS_NONE = 0,
+
+    /** Block index of size_t offsets, followed by raw deflate data for each block */
+    PT_CACHE_COMPRESS_DEFLATE = 1,
+};
+
 /**
  * On-disk header
  */
@@ -40,6 +66,58 @@ struct pt_cache_header {
 
     /** Size of the data segment */
     size_t data_size;
+
+    /** Data layout: dimensions of each block of pixels */
+    uint32_t block_width, block_height;
+
+    /** Number of downsampled zoom levels stored in the data segment after the full-size data */
+    uint32_t zoom_levels;
+
+    /** Offset of each zoom level within the data segment, starting from zoom level 1 */
+    size_t zoom_offset[PT_CACHE_ZOOM_LEVELS];
+
+    /** Block storage, one of pt_cache_compression */
+    uint32_t compression;
+
+    /** Offset of the occupancy bitmap of each zoom level within the data segment, starting from zoom level 0. Unused for compressed blocks */
+    size_t occupancy_offset[1 + PT_CACHE_ZOOM_LEVELS];
+
+    /** Number of rows and columns of source image parts for multi-part images, or zero */
+    uint32_t part_rows, part_cols;
+
+    /** Offset of the pt_cache_part for each source image part within the data segment, in row-major order */
+    size_t parts_offset;
+};
+
+/**
+ * Source file of a multi-part image, as of the last update of its data in the cache
+ */
+struct pt_cache_part {
+    /** Modification time, zero for missing parts */
+    struct timespec mtime;
+
+    /** Size in bytes */
+    off_t size;
+};
+
+/**
+ * Checkpoint of a partially written .tmp, stored in a .ckpt file alongside it for PT_IMAGE_CHECKPOINT
+ */
+struct pt_cache_checkpoint {
+    /** Header of the .tmp */
+    struct pt_cache_header header;
+
+    /** Source file being decoded */
+    struct pt_cache_part source;
+
+    /** Writer state */
+    size_t write_block, write_offset;
+
+    /** Decoder state, followed by prev_len + raw_len + rows_len bytes of data for the pt_png_resume */
+    struct pt_idat_point point;
+    size_t prev_len, raw_len, rows_len;
+
+    uint8_t data[];
 };
 
 /**
@@ -102,8 +180,55 @@ struct pt_cache {
     /** The mmap'd file */
     struct pt_cache_file *file;
 
+    /** Size of the mmap'd file, which may not yet cover the entire data segment while writing compressed blocks */
+    size_t size;
+
     /** Opened read-only? */
     bool readonly;
+
+    /** Decompressed blocks shared between renders, for compressed caches */
+    struct pt_block_cache *block_cache;
+
+    /** Nearest palette color table shared between renders, allocated on first use by a PT_TILE_ZOOM_PALETTE render */
+    uint16_t *palette_lut;
+
+    /** Holes in the data segment, for PT_OPEN_HOLES */
+    struct pt_sparse_map holes;
+    bool holes_init;
+
+    /** Compressed block writer state */
+    z_stream deflate;
+    bool deflate_init;
+    uint8_t *deflate_buf;
+    size_t deflate_size;
+
+    /** Streaming writer, for PT_IMAGE_STREAM */
+    struct pt_stream stream;
+    bool stream_init;
+
+    /**
+     * Number of blocks written, and the offset of the next block, within the data segment.
+     *
+     * For uncompressed blocks written using the streaming writer, this is the number of blocks written within the
+     * zoom level, and the offset of the zoom level.
+     */
+    size_t write_block, write_offset;
+
+    /** Occupancy bitmap of the zoom level being written using the streaming writer */
+    uint8_t *write_occupancy;
+
+    /** Source file of the update, and any checkpoint to resume it from, for PT_IMAGE_CHECKPOINT */
+    struct pt_cache_part source;
+    struct pt_cache_checkpoint *resume;
+
+    /** A checkpoint of the .tmp has been written, keep the .tmp on abort */
+    bool checkpointed;
+
+    /** Optional progress of the update */
+    struct pt_progress *progress;
+
+    /** Running totals of the size of the rendered tiles, and of their raw image data, for pt_cache_tile_size_hint */
+    uint64_t tile_bytes, tile_raw_bytes;
 };
 
 /**
@@ -113,19 +238,58 @@ int pt_cache_new (struct pt_cache **cache_ptr, const char *path);
 
 /**
  * initialize new cache file for PNG header.
+ *
+ * @param parts optional source image parts to record
+ */
+int pt_cache_create_png (struct pt_cache *cache, const struct pt_png_header *png_header, const struct pt_image_params *params, const struct pt_image_parts *parts);
+
+/**
+ * Initialize a new cache file for an incremental update of a multi-part PNG image, as a copy of the existing .cache.
+ *
+ * @return 1 if there is no existing .cache with the same layout, without doing anything
+ */
+int pt_cache_clone_png (struct pt_cache *cache, const struct pt_png_header *png_header, const struct pt_image_params *params, const struct pt_image_parts *parts);
+
+/**
+ * Compare the source file of the given part against the one recorded in the cache, and record it.
+ *
+ * @param part index of the part, in row-major order
+ * @param path source file path, or NULL for a missing part
+ * @return 0 if unchanged, 1 if the part needs to be updated
+ */
+int pt_cache_stat_part (struct pt_cache *cache, unsigned part, const char *path);
+
+/**
+ * Clear the data for a stale part of a cloned cache, before updating it using pt_cache_update_png_part
+ */
+void pt_cache_clear_part (struct pt_cache *cache, unsigned row, unsigned col, unsigned width, unsigned height);
+
+/**
+ * Re-open the .tmp cache file left behind by an interrupted PT_IMAGE_CHECKPOINT update of the same PNG image, to
+ * resume the update from its checkpoint using pt_cache_update_png.
+ *
+ * @return 1 if there is no usable checkpoint, without doing anything
  */
-int pt_cache_create_png (struct pt_cache *cache, const struct pt_png_header *png_header, const struct pt_image_params *params);
+int pt_cache_resume_png (struct pt_cache *cache, const struct pt_png_header *png_header, const struct pt_image_params *params, const char *path);
 
 /**
- * Update the cache data from the given PNG image data
+ * Update the cache data from the given PNG image data.
+ *
+ * Using PT_IMAGE_CHECKPOINT, the image data is decoded from the file at \a path instead, periodically writing out a
+ * checkpoint to resume from.
  */
-int pt_cache_update_png (struct pt_cache *cache, struct pt_png_img *img, const struct pt_png_header *header, const struct pt_image_params *params);
+int pt_cache_update_png (struct pt_cache *cache, struct pt_png_img *img, const struct pt_png_header *header, const struct pt_image_params *params, const char *path);
 
 /**
  * Update partial cache data from the given PNG image data
  */
 int pt_cache_update_png_part (struct pt_cache *cache, struct pt_png_img *img, const struct pt_png_header *header, const struct pt_image_params *params, unsigned row, unsigned col);
 
+/**
+ * Build the downsampled zoom levels, if any, from the updated cache data
+ */
+int pt_cache_update_png_zoom (struct pt_cache *cache);
+
 /**
  * Rename the opened .tmp to .cache
  */
@@ -138,8 +302,10 @@ void pt_cache_create_abort (struct pt_cache *cache);
 
 /**
  * Open the existing .cache for use. If already opened, does nothing.
+ *
+ * @param params optional memory residency policy for the mmap
  */
-int pt_cache_open (struct pt_cache *cache);
+int pt_cache_open (struct pt_cache *cache, const struct pt_open_params *params);
 
 /**
  * Render out the given tile
@@ -148,6 +314,26 @@ int pt_cache_open (struct pt_cache *cache);
  */
 int pt_cache_render_tile (struct pt_cache *cache, struct pt_tile *tile);
 
+/**
+ * Estimate the size of the given tile once rendered, from the average compression ratio of the tiles rendered so far.
+ *
+ * Returns the largest possible size until the first tile has been rendered.
+ */
+int pt_cache_tile_size_hint (struct pt_cache *cache, const struct pt_tile_params *params, size_t *size_ptr);
+
+/**
+ * Advise the kernel to start reading in the cache data covering the given tile
+ */
+int pt_cache_prefetch (struct pt_cache *cache, const struct pt_tile_params *params);
+
+/**
+ * Find the first block of cache data read to render the given tile, counting across the zoom levels, to order renders
+ * by their offset into the cache file.
+ *
+ * Tiles outside of the image are ordered by the last block of the row or column of blocks closest to them.
+ */
+int pt_cache_tile_block (struct pt_cache *cache, const struct pt_tile_params *params, size_t *block_ptr);
+
 /**
  * Close the cache, if opened
  */
@@ -0,0 +1,473 @@
+#include "encode.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const uint8_t pt_encode_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+static inline void pt_encode_uint32 (uint8_t *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+/**
+ * Write out a complete chunk of \a len bytes of data
+ */
+static int pt_encode_chunk (struct pt_tile_mem *out, const char type[4], const uint8_t *data, size_t len)
+{
+    uint8_t *p;
+    int err;
+
+    if ((err = pt_tile_mem_reserve(out, 12 + len)))
+        return err;
+
+    p = (uint8_t *) out->base + out->off;
+
+    pt_encode_uint32(p, len);
+    memcpy(p + 4, type, 4);
+
+    if (len)
+        memcpy(p + 8, data, len);
+
+    // covers the type and data
+    pt_encode_uint32(p + 8 + len, crc32(0, p + 4, 4 + len));
+
+    out->off += 12 + len;
+
+    return 0;
+}
+
+static inline uint8_t pt_encode_paeth (uint8_t a, uint8_t b, uint8_t c)
+{
+    int p = (int) a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+
+    if (pa <= pb && pa <= pc)
+        return a;
+    else if (pb <= pc)
+        return b;
+    else
+        return c;
+}
+
+/*
+ * Row filters, from the \a len bytes of the \a row and the \a prev row into \a out, for \a bpp bytes per pixel.
+ *
+ * The filters only depend on the unfiltered rows, so each byte can be filtered independently.
+ */
+static void pt_encode_filter_none (uint8_t *out, const uint8_t *row, const uint8_t *prev, size_t len, size_t bpp)
+{
+    memcpy(out, row, len);
+}
+
+static void pt_encode_filter_sub (uint8_t *out, const uint8_t *row, const uint8_t *prev, size_t len, size_t bpp)
+{
+    size_t i = 0;
+
+    for (; i < bpp && i < len; i++)
+        out[i] = row[i];
+
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (row + i));
+        __m128i a = _mm_loadu_si128((const __m128i *) (row + i - bpp));
+
+        _mm_storeu_si128((__m128i *) (out + i), _mm_sub_epi8(x, a));
+    }
+#endif
+
+    for (; i < len; i++)
+        out[i] = row[i] - row[i - bpp];
+}
+
+static void pt_encode_filter_up (uint8_t *out, const uint8_t *row, const uint8_t *prev, size_t len, size_t bpp)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (row + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (prev + i));
+
+        _mm_storeu_si128((__m128i *) (out + i), _mm_sub_epi8(x, b));
+    }
+#endif
+
+    for (; i < len; i++)
+        out[i] = row[i] - prev[i];
+}
+
+static void pt_encode_filter_avg (uint8_t *out, const uint8_t *row, const uint8_t *prev, size_t len, size_t bpp)
+{
+    size_t i = 0;
+
+    for (; i < bpp && i < len; i++)
+        out[i] = row[i] - (prev[i] >> 1);
+
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (row + i));
+        __m128i a = _mm_loadu_si128((const __m128i *) (row + i - bpp));
+        __m128i b = _mm_loadu_si128((const __m128i *) (prev + i));
+
+        // _mm_avg_epu8 rounds up
+        __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+
+        _mm_storeu_si128((__m128i *) (out + i), _mm_sub_epi8(x, avg));
+    }
+#endif
+
+    for (; i < len; i++)
+        out[i] = row[i] - ((row[i - bpp] + prev[i]) >> 1);
+}
+
+#ifdef __SSE2__
+static inline __m128i pt_encode_abs_epi16 (__m128i x)
+{
+    return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+/**
+ * Paeth predictor for eight pixels, as 16-bit lanes
+ */
+static inline __m128i pt_encode_paeth_epi16 (__m128i a, __m128i b, __m128i c)
+{
+    // p = a + b - c, so pa = |b - c|, pb = |a - c|, pc = |a + b - 2c|
+    __m128i bc = _mm_sub_epi16(b, c), ac = _mm_sub_epi16(a, c);
+    __m128i pa = pt_encode_abs_epi16(bc), pb = pt_encode_abs_epi16(ac), pc = pt_encode_abs_epi16(_mm_add_epi16(bc, ac));
+
+    // pa <= pb && pa <= pc
+    __m128i use_a = _mm_andnot_si128(_mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc)), _mm_set1_epi16(-1));
+
+    // pb <= pc
+    __m128i use_b = _mm_andnot_si128(_mm_cmpgt_epi16(pb, pc), _mm_set1_epi16(-1));
+
+    __m128i bc_pred = _mm_or_si128(_mm_and_si128(use_b, b), _mm_andnot_si128(use_b, c));
+
+    return _mm_or_si128(_mm_and_si128(use_a, a), _mm_andnot_si128(use_a, bc_pred));
+}
+#endif
+
+static void pt_encode_filter_paeth (uint8_t *out, const uint8_t *row, const uint8_t *prev, size_t len, size_t bpp)
+{
+    size_t i = 0;
+
+    for (; i < bpp && i < len; i++)
+        out[i] = row[i] - prev[i];
+
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (row + i));
+        __m128i a = _mm_loadu_si128((const __m128i *) (row + i - bpp));
+        __m128i b = _mm_loadu_si128((const __m128i *) (prev + i));
+        __m128i c = _mm_loadu_si128((const __m128i *) (prev + i - bpp));
+
+        __m128i lo = pt_encode_paeth_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero));
+        __m128i hi = pt_encode_paeth_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero));
+
+        _mm_storeu_si128((__m128i *) (out + i), _mm_sub_epi8(x, _mm_packus_epi16(lo, hi)));
+    }
+#endif
+
+    for (; i < len; i++)
+        out[i] = row[i] - pt_encode_paeth(row[i - bpp], prev[i], prev[i - bpp]);
+}
+
+typedef void (*pt_encode_filter_func) (uint8_t *out, const uint8_t *row, const uint8_t *prev, size_t len, size_t bpp);
+
+/**
+ * Row filters, by PNG_FILTER_VALUE_*
+ */
+static const pt_encode_filter_func pt_encode_filters[PNG_FILTER_VALUE_LAST] = {
+    [PNG_FILTER_VALUE_NONE]     = pt_encode_filter_none,
+    [PNG_FILTER_VALUE_SUB]      = pt_encode_filter_sub,
+    [PNG_FILTER_VALUE_UP]       = pt_encode_filter_up,
+    [PNG_FILTER_VALUE_AVG]      = pt_encode_filter_avg,
+    [PNG_FILTER_VALUE_PAETH]    = pt_encode_filter_paeth,
+};
+
+/**
+ * Sum of the filtered bytes as signed values, as used by libpng to choose between filters
+ */
+static size_t pt_encode_filter_sum (const uint8_t *buf, size_t len)
+{
+    size_t sum = 0, i = 0;
+
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128(), sums = zero;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (buf + i));
+
+        // |x| for signed bytes, with -128 as 128
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(_mm_min_epu8(x, _mm_sub_epi8(zero, x)), zero));
+    }
+
+    sum = _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+#endif
+
+    for (; i < len; i++)
+        sum += buf[i] < 128 ? buf[i] : 256 - buf[i];
+
+    return sum;
+}
+
+/**
+ * Set up the deflate stream, reusing the render context's stream if possible
+ */
+static int pt_encode_deflate_init (struct pt_encoder *enc, int level, int strategy, int window_bits, int mem_level)
+{
+    struct pt_render_ctx *ctx = enc->ctx;
+
+    if (!ctx) {
+        enc->zs = &enc->_zs;
+
+        if (deflateInit2(enc->zs, level, Z_DEFLATED, window_bits, mem_level, strategy) != Z_OK)
+            return -PT_ERR_MEM;
+
+        enc->_zs_init = true;
+
+        return 0;
+    }
+
+    enc->zs = &ctx->deflate_zs;
+
+    // the window and memory level can only be set on init
+    if (ctx->deflate_init && (ctx->deflate_window_bits != window_bits || ctx->deflate_mem_level != mem_level)) {
+        deflateEnd(&ctx->deflate_zs);
+
+        ctx->deflate_init = false;
+    }
+
+    if (ctx->deflate_init) {
+        if (deflateReset(enc->zs) != Z_OK || deflateParams(enc->zs, level, strategy) != Z_OK)
+            return -PT_ERR_PNG;
+
+    } else {
+        memset(enc->zs, 0, sizeof(*enc->zs));
+
+        if (deflateInit2(enc->zs, level, Z_DEFLATED, window_bits, mem_level, strategy) != Z_OK)
+            return -PT_ERR_MEM;
+
+        ctx->deflate_init = true;
+        ctx->deflate_window_bits = window_bits;
+        ctx->deflate_mem_level = mem_level;
+    }
+
+    return 0;
+}
+
+/**
+ * Point the deflate stream at the free space after the IDAT data deflated so far, growing the output buffer if it is
+ * full. The buffer may move, so the IDAT chunk is only located by its offset.
+ */
+static int pt_encode_output (struct pt_encoder *enc)
+{
+    struct pt_tile_mem *out = enc->out;
+    size_t off = enc->idat_offset + 8 + enc->zs->total_out;
+    int err;
+
+    // double the buffer
+    if (off >= out->len && (err = pt_tile_mem_reserve(out, off - out->off + 1)))
+        return err;
+
+    enc->zs->next_out = (Bytef *) out->base + off;
+    enc->zs->avail_out = out->len - off;
+
+    return 0;
+}
+
+int pt_encode_begin (struct pt_encoder *enc, struct pt_render_ctx *ctx, const struct pt_encode_settings *settings, const struct pt_encode_format *format, struct pt_tile_mem *out)
+{
+    int level = settings->level >= 0 ? settings->level : Z_DEFAULT_COMPRESSION;
+    int window_bits = settings->window_bits >= 0 ? settings->window_bits : MAX_WBITS;
+    int mem_level = settings->mem_level >= 0 ? settings->mem_level : 8;
+    int strategy;
+    uint8_t ihdr[13], plte[3 * PNG_MAX_PALETTE_LENGTH];
+    int err;
+
+    memset(enc, 0, sizeof(*enc));
+
+    enc->out = out;
+    enc->ctx = ctx;
+    enc->bpp = format->col_bytes;
+    enc->row_bytes = format->width * format->col_bytes;
+
+    // as libpng does, palette indexes are not filtered by default
+    if (settings->filters >= 0)
+        enc->filters = settings->filters;
+    else if (format->color_type == PNG_COLOR_TYPE_PALETTE)
+        enc->filters = PNG_FILTER_NONE;
+    else
+        enc->filters = PNG_ALL_FILTERS;
+
+    // as libpng does, filtered rows use Z_FILTERED by default
+    if (settings->strategy >= 0)
+        strategy = settings->strategy;
+    else if (enc->filters == PNG_FILTER_NONE)
+        strategy = Z_DEFAULT_STRATEGY;
+    else
+        strategy = Z_FILTERED;
+
+    if ((err = pt_encode_deflate_init(enc, level, strategy, window_bits, mem_level)))
+        return err;
+
+    enc->prev = pt_render_calloc(ctx, enc->row_bytes);
+    enc->best = pt_render_malloc(ctx, 1 + enc->row_bytes);
+    enc->try = pt_render_malloc(ctx, 1 + enc->row_bytes);
+
+    if (!enc->prev || !enc->best || !enc->try)
+        return -PT_ERR_MEM;
+
+    // signature
+    if ((err = pt_tile_mem_write(out, (void *) pt_encode_signature, sizeof(pt_encode_signature))))
+        return err;
+
+    // header
+    pt_encode_uint32(ihdr + 0, format->width);
+    pt_encode_uint32(ihdr + 4, format->height);
+    ihdr[8] = 8;
+    ihdr[9] = format->color_type;
+    ihdr[10] = PNG_COMPRESSION_TYPE_BASE;
+    ihdr[11] = PNG_FILTER_TYPE_BASE;
+    ihdr[12] = PNG_INTERLACE_NONE;
+
+    if ((err = pt_encode_chunk(out, "IHDR", ihdr, sizeof(ihdr))))
+        return err;
+
+    if (format->color_type == PNG_COLOR_TYPE_PALETTE) {
+        for (unsigned i = 0; i < format->num_palette; i++) {
+            plte[i * 3 + 0] = format->palette[i].red;
+            plte[i * 3 + 1] = format->palette[i].green;
+            plte[i * 3 + 2] = format->palette[i].blue;
+        }
+
+        if ((err = pt_encode_chunk(out, "PLTE", plte, format->num_palette * 3)))
+            return err;
+    }
+
+    // the IDAT chunk header is filled in once the length is known, and the data is deflated into whatever room the
+    // buffer has left, growing it as needed
+    if ((err = pt_tile_mem_reserve(out, 8)))
+        return err;
+
+    enc->idat_offset = out->off;
+
+    return pt_encode_output(enc);
+}
+
+int pt_encode_row (struct pt_encoder *enc, const uint8_t *row)
+{
+    int filter = PNG_FILTER_VALUE_NONE;
+    size_t best_sum = SIZE_MAX;
+
+    for (int value = PNG_FILTER_VALUE_NONE; value < PNG_FILTER_VALUE_LAST; value++) {
+        size_t sum;
+
+        if (!(enc->filters & (PNG_FILTER_NONE << value)))
+            continue;
+
+        if (enc->filters == (PNG_FILTER_NONE << value)) {
+            // the only choice
+            pt_encode_filters[value](enc->best + 1, row, enc->prev, enc->row_bytes, enc->bpp);
+
+            filter = value;
+
+            break;
+        }
+
+        pt_encode_filters[value](enc->try + 1, row, enc->prev, enc->row_bytes, enc->bpp);
+
+        if ((sum = pt_encode_filter_sum(enc->try + 1, enc->row_bytes)) < best_sum) {
+            uint8_t *best = enc->best;
+
+            enc->best = enc->try;
+            enc->try = best;
+
+            filter = value;
+            best_sum = sum;
+        }
+    }
+
+    enc->best[0] = filter;
+
+    memcpy(enc->prev, row, enc->row_bytes);
+
+    enc->zs->next_in = enc->best;
+    enc->zs->avail_in = 1 + enc->row_bytes;
+
+    while (enc->zs->avail_in) {
+        int err;
+
+        if (!enc->zs->avail_out && (err = pt_encode_output(enc)))
+            return err;
+
+        if (deflate(enc->zs, Z_NO_FLUSH) != Z_OK) {
+            PT_DEBUG("deflate: %s", enc->zs->msg);
+            return -PT_ERR_PNG;
+        }
+    }
+
+    return 0;
+}
+
+int pt_encode_end (struct pt_encoder *enc)
+{
+    struct pt_tile_mem *out = enc->out;
+    uint8_t *idat;
+    size_t len;
+    int ret, err;
+
+    enc->zs->next_in = NULL;
+    enc->zs->avail_in = 0;
+
+    while ((ret = deflate(enc->zs, Z_FINISH)) != Z_STREAM_END) {
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            PT_DEBUG("deflate: %s", enc->zs->msg);
+            return -PT_ERR_PNG;
+        }
+
+        if ((err = pt_encode_output(enc)))
+            return err;
+    }
+
+    len = enc->zs->total_out;
+
+    // the IDAT data and its CRC
+    if ((err = pt_tile_mem_reserve(out, 8 + len + 4)))
+        return err;
+
+    idat = (uint8_t *) out->base + enc->idat_offset;
+
+    pt_encode_uint32(idat, len);
+    memcpy(idat + 4, "IDAT", 4);
+    pt_encode_uint32(idat + 8 + len, crc32(0, idat + 4, 4 + len));
+
+    out->off += 8 + len + 4;
+
+    return pt_encode_chunk(out, "IEND", NULL, 0);
+}
+
+void pt_encode_release (struct pt_encoder *enc)
+{
+    pt_render_free(enc->ctx, enc->prev);
+    pt_render_free(enc->ctx, enc->best);
+    pt_render_free(enc->ctx, enc->try);
+
+    // the render context keeps its deflate stream
+    if (enc->_zs_init)
+        deflateEnd(&enc->_zs);
+
+    enc->prev = enc->best = enc->try = NULL;
+    enc->_zs_init = false;
+}
@@ -0,0 +1,99 @@
+#ifndef PNGTILE_ENCODE_H
+#define PNGTILE_ENCODE_H
+
+/**
+ * @file
+ *
+ * Built-in PNG encoder for tiles of 8-bit pixels, bypassing libpng.
+ *
+ * The rows are filtered using SSE2 where available, and deflated straight into the tile's output buffer as a single
+ * IDAT chunk.
+ */
+#include "tile.h"
+#include "render.h"
+
+#include <png.h>
+#include <zlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Encoder settings, as resolved from the pt_tile_params, with -1 for the libpng defaults
+ */
+struct pt_encode_settings {
+    int level, strategy, filters, window_bits, mem_level;
+};
+
+/**
+ * Output image format
+ */
+struct pt_encode_format {
+    unsigned width, height;
+
+    /** PNG color type, of 8 bits per channel */
+    int color_type;
+
+    /** Bytes per pixel */
+    size_t col_bytes;
+
+    /** Palette for PNG_COLOR_TYPE_PALETTE */
+    const png_color *palette;
+    unsigned num_palette;
+};
+
+/**
+ * Encoder state
+ */
+struct pt_encoder {
+    struct pt_tile_mem *out;
+
+    /** Either _zs, or kept in the render context */
+    z_stream *zs, _zs;
+    bool _zs_init;
+
+    struct pt_render_ctx *ctx;
+
+    /** Bytes per pixel, and per row without the filter type */
+    size_t bpp, row_bytes;
+
+    /** Bitmask of PNG_FILTER_* to choose from */
+    int filters;
+
+    /** Previous row, and the filtered row being deflated along with a scratch row for trying out filters */
+    uint8_t *prev, *best, *try;
+
+    /** Offset of the IDAT chunk within out, which is left at the start of the chunk until the image is finished */
+    size_t idat_offset;
+};
+
+/**
+ * Test if the built-in encoder supports the given output format
+ */
+static inline bool pt_encode_supported (int color_type, int bit_depth)
+{
+    return bit_depth == 8;
+}
+
+/**
+ * Start encoding an image of the given format into \a out, writing out the PNG signature and header chunks.
+ *
+ * @param ctx optional render context to reuse the deflate stream and buffers from
+ */
+int pt_encode_begin (struct pt_encoder *enc, struct pt_render_ctx *ctx, const struct pt_encode_settings *settings, const struct pt_encode_format *format, struct pt_tile_mem *out);
+
+/**
+ * Encode the next row of format->width pixels
+ */
+int pt_encode_row (struct pt_encoder *enc, const uint8_t *row);
+
+/**
+ * Finish the image data, and write out the end of the image
+ */
+int pt_encode_end (struct pt_encoder *enc);
+
+/**
+ * Release resources, after pt_encode_begin, whether or not the image was finished
+ */
+void pt_encode_release (struct pt_encoder *enc);
+
+#endif
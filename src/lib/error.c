@@ -40,6 +40,20 @@ const char *error_names[PT_ERR_MAX] = {
     [PT_ERR_TILE_DIM]           = "Invalid tile dimensions",
     [PT_ERR_TILE_CLIP]          = "Tile outside of image",
     [PT_ERR_TILE_ZOOM]          = "Invalid zoom level",
+
+    [PT_ERR_CACHE_COMPRESS]     = "Unsupported operation for compressed cache",
+    [PT_ERR_CACHE_DEFLATE]      = "deflate(block)",
+    [PT_ERR_CACHE_INFLATE]      = "inflate(block)",
+    [PT_ERR_CACHE_MLOCK]        = "mlock(cache)",
+    [PT_ERR_CACHE_SYNC]         = "fdatasync(cache)",
+
+    [PT_ERR_CANCEL]             = "Update cancelled by progress callback",
+
+    [PT_ERR_TILE_ENCODE]        = "Invalid tile encoder settings",
+    [PT_ERR_TILE_WRITE]         = "write tile",
+    [PT_ERR_TILE_BUF]           = "Tile buffer too small",
+
+    [PT_ERR_THREAD]             = "pthread_create",
 };
 
 const char *pt_strerror (int err)
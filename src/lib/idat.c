@@ -0,0 +1,498 @@
+#include "idat.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+
+static const uint8_t pt_idat_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+static inline uint32_t pt_idat_uint32 (const uint8_t *p)
+{
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+/**
+ * Read exactly \a len bytes at the given offset
+ */
+static int pt_idat_pread (struct pt_idat *idat, uint8_t *buf, size_t len, off_t offset)
+{
+    while (len) {
+        ssize_t ret;
+
+        if ((ret = pread(idat->fd, buf, len, offset)) < 0)
+            return -PT_ERR_IMG_OPEN;
+
+        if (ret == 0)
+            // truncated
+            return -PT_ERR_PNG;
+
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+
+    return 0;
+}
+
+/**
+ * Read the CRC at the end of the current IDAT chunk, and compare it with the CRC of the data inflated from it
+ */
+static int pt_idat_crc (struct pt_idat *idat)
+{
+    uint8_t buf[4];
+    int err;
+
+    if ((err = pt_idat_pread(idat, buf, sizeof(buf), idat->offset)))
+        return err;
+
+    idat->offset += sizeof(buf);
+
+    if (pt_idat_uint32(buf) != idat->crc) {
+        PT_DEBUG("IDAT: CRC error");
+        return -PT_ERR_PNG;
+    }
+
+    return 0;
+}
+
+/**
+ * Advance to the next IDAT chunk following the chunk at idat->offset
+ *
+ * @param crc check the CRC of the current chunk
+ */
+static int pt_idat_chunk (struct pt_idat *idat, bool crc)
+{
+    uint8_t buf[8];
+    int err;
+
+    if (crc && (err = pt_idat_crc(idat)))
+        return err;
+
+    for (;;) {
+        uint32_t len;
+
+        if ((err = pt_idat_pread(idat, buf, sizeof(buf), idat->offset)))
+            return err;
+
+        len = pt_idat_uint32(buf);
+        idat->offset += sizeof(buf);
+
+        if (memcmp(buf + 4, "IDAT", 4) == 0) {
+            idat->chunk_len = len;
+            idat->crc = crc32(crc32(0, NULL, 0), buf + 4, 4);
+
+            return 0;
+        }
+
+        // the image data must be contiguous
+        if (crc || memcmp(buf + 4, "IEND", 4) == 0)
+            return -PT_ERR_PNG;
+
+        idat->offset += len + 4;
+    }
+}
+
+/**
+ * Read in more compressed data, from the current IDAT chunk only
+ */
+static int pt_idat_fill (struct pt_idat *idat)
+{
+    size_t len;
+    int err;
+
+    while (!idat->chunk_len) {
+        if ((err = pt_idat_chunk(idat, true)))
+            return err;
+    }
+
+    len = min(idat->chunk_len, sizeof(idat->buf));
+
+    // the partially consumed byte of a point may be the last byte of the previous buffer
+    if (idat->zs.next_in > idat->buf)
+        idat->last = idat->zs.next_in[-1];
+
+    if ((err = pt_idat_pread(idat, idat->buf, len, idat->offset)))
+        return err;
+
+    idat->offset += len;
+    idat->chunk_len -= len;
+
+    idat->zs.next_in = idat->buf;
+    idat->zs.avail_in = len;
+
+    return 0;
+}
+
+/**
+ * Update the CRC of the IDAT chunk for the compressed data consumed since \a in
+ */
+static inline void pt_idat_consumed (struct pt_idat *idat, const uint8_t *in)
+{
+    idat->crc = crc32(idat->crc, in, idat->zs.next_in - in);
+}
+
+/**
+ * Open the file and allocate the row buffers
+ */
+static int pt_idat_init (struct pt_idat *idat, const char *path, const struct pt_png_header *header)
+{
+    // the packed bit depth is either 8 or 16
+    size_t channels = (header->bit_depth == 16) ? header->col_bytes / 2 : header->col_bytes;
+    size_t pixel_bits = channels * header->bit_depth;
+
+    memset(idat, 0, sizeof(*idat));
+
+    idat->fd = -1;
+    idat->adler = adler32(0, NULL, 0);
+    idat->width = header->width;
+    idat->height = header->height;
+    idat->bit_depth = header->bit_depth;
+    idat->unpack = header->bit_depth < 8 && header->pixel_bits >= 8;
+    idat->filter_bytes = (pixel_bits + 7) / 8;
+    idat->raw_bytes = 1 + (header->width * pixel_bits + 7) / 8;
+
+    if ((idat->unpack ? header->width : idat->raw_bytes - 1) != header->row_bytes)
+        return -PT_ERR_PNG_FORMAT;
+
+    if ((idat->fd = open(path, O_RDONLY)) < 0)
+        return -PT_ERR_IMG_OPEN;
+
+    idat->raw = malloc(idat->raw_bytes);
+    idat->prev = calloc(1, idat->raw_bytes - 1);
+    idat->cur = malloc(idat->raw_bytes - 1);
+    idat->point_raw = malloc(idat->raw_bytes);
+    idat->point_prev = malloc(idat->raw_bytes - 1);
+
+    if (!idat->raw || !idat->prev || !idat->cur || !idat->point_raw || !idat->point_prev)
+        return -PT_ERR_MEM;
+
+    return 0;
+}
+
+int pt_idat_open (struct pt_idat *idat, const char *path, const struct pt_png_header *header)
+{
+    uint8_t signature[sizeof(pt_idat_signature)];
+    int err;
+
+    if ((err = pt_idat_init(idat, path, header)))
+        return err;
+
+    if ((err = pt_idat_pread(idat, signature, sizeof(signature), 0)))
+        return err;
+
+    if (memcmp(signature, pt_idat_signature, sizeof(signature)))
+        return -PT_ERR_PNG;
+
+    idat->offset = sizeof(signature);
+
+    if ((err = pt_idat_chunk(idat, false)))
+        return err;
+
+    // includes the zlib header, and checks the adler32 at the end
+    if (inflateInit(&idat->zs) != Z_OK)
+        return -PT_ERR_MEM;
+
+    idat->zs_init = true;
+
+    return 0;
+}
+
+int pt_idat_resume (struct pt_idat *idat, const char *path, const struct pt_png_header *header, const struct pt_idat_point *point, const uint8_t *prev, size_t prev_len, const uint8_t *raw)
+{
+    int err;
+
+    if ((err = pt_idat_init(idat, path, header)))
+        return err;
+
+    if (prev_len != idat->raw_bytes - 1 || point->row >= idat->height || point->row_len > idat->raw_bytes || point->bits > 7 || point->window_len > PT_IDAT_WINDOW)
+        return -PT_ERR_PNG;
+
+    // raw deflate data from within the zlib stream
+    if (inflateInit2(&idat->zs, -MAX_WBITS) != Z_OK)
+        return -PT_ERR_MEM;
+
+    idat->zs_init = true;
+    idat->raw_deflate = true;
+
+    if (point->bits && inflatePrime(&idat->zs, point->bits, point->byte >> (8 - point->bits)) != Z_OK)
+        return -PT_ERR_PNG;
+
+    if (point->window_len && inflateSetDictionary(&idat->zs, point->window, point->window_len) != Z_OK)
+        return -PT_ERR_PNG;
+
+    idat->offset = point->offset;
+    idat->chunk_len = point->chunk_len;
+    idat->crc = point->crc;
+    idat->adler = point->adler;
+    idat->row = point->row;
+    idat->raw_len = point->row_len;
+
+    memcpy(idat->prev, prev, idat->raw_bytes - 1);
+    memcpy(idat->raw, raw, point->row_len);
+
+    return 0;
+}
+
+/**
+ * Save a point at the current deflate block boundary
+ */
+static int pt_idat_point (struct pt_idat *idat)
+{
+    struct pt_idat_point *point = &idat->point;
+    unsigned window_len = sizeof(point->window);
+
+    point->row = idat->row;
+    point->row_len = idat->raw_len;
+
+    // unconsumed data in the buffer
+    point->offset = idat->offset - idat->zs.avail_in;
+    point->chunk_len = idat->chunk_len + idat->zs.avail_in;
+    point->crc = idat->crc;
+    point->adler = idat->adler;
+
+    point->bits = idat->zs.data_type & 7;
+    point->byte = 0;
+
+    if (point->bits)
+        point->byte = (idat->zs.next_in > idat->buf) ? idat->zs.next_in[-1] : idat->last;
+
+    if (inflateGetDictionary(&idat->zs, point->window, &window_len) != Z_OK)
+        return -PT_ERR_PNG;
+
+    point->window_len = window_len;
+
+    memcpy(idat->point_prev, idat->prev, idat->raw_bytes - 1);
+    memcpy(idat->point_raw, idat->raw, idat->raw_len);
+
+    idat->want_point = false;
+    idat->have_point = true;
+
+    return 0;
+}
+
+static inline uint8_t pt_idat_paeth (uint8_t a, uint8_t b, uint8_t c)
+{
+    int p = (int) a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+
+    if (pa <= pb && pa <= pc)
+        return a;
+    else if (pb <= pc)
+        return b;
+    else
+        return c;
+}
+
+/**
+ * Unfilter the decoded row against the previous row
+ */
+static int pt_idat_unfilter (struct pt_idat *idat, uint8_t *row)
+{
+    const uint8_t *raw = idat->raw + 1, *prev = idat->prev;
+    size_t len = idat->raw_bytes - 1, bpp = idat->filter_bytes;
+
+    switch (idat->raw[0]) {
+        case PNG_FILTER_VALUE_NONE:
+            memcpy(row, raw, len);
+            break;
+
+        case PNG_FILTER_VALUE_SUB:
+            memcpy(row, raw, min(bpp, len));
+
+            for (size_t i = bpp; i < len; i++)
+                row[i] = raw[i] + row[i - bpp];
+            break;
+
+        case PNG_FILTER_VALUE_UP:
+            for (size_t i = 0; i < len; i++)
+                row[i] = raw[i] + prev[i];
+            break;
+
+        case PNG_FILTER_VALUE_AVG:
+            for (size_t i = 0; i < len; i++)
+                row[i] = raw[i] + (((i >= bpp ? row[i - bpp] : 0) + prev[i]) >> 1);
+            break;
+
+        case PNG_FILTER_VALUE_PAETH:
+            for (size_t i = 0; i < len; i++)
+                row[i] = raw[i] + (i >= bpp ? pt_idat_paeth(row[i - bpp], prev[i], prev[i - bpp]) : prev[i]);
+            break;
+
+        default:
+            return -PT_ERR_PNG;
+    }
+
+    return 0;
+}
+
+/**
+ * Unpack sub-8-bit pixels to one byte per pixel
+ */
+static void pt_idat_unpack (const struct pt_idat *idat, uint8_t *buf, const uint8_t *row)
+{
+    unsigned bits = idat->bit_depth, mask = (1 << bits) - 1;
+
+    for (size_t col = 0; col < idat->width; col++) {
+        size_t bit = col * bits;
+
+        buf[col] = (row[bit / 8] >> (8 - bits - bit % 8)) & mask;
+    }
+}
+
+int pt_idat_read_row (struct pt_idat *idat, uint8_t *buf)
+{
+    uint8_t *prev;
+    int ret, err;
+
+    if (idat->row >= idat->height)
+        return -PT_ERR_PNG;
+
+    while (idat->raw_len < idat->raw_bytes) {
+        const uint8_t *in;
+
+        if (idat->stream_end)
+            return -PT_ERR_PNG;
+
+        if (!idat->zs.avail_in && (err = pt_idat_fill(idat)))
+            return err;
+
+        in = idat->zs.next_in;
+
+        idat->zs.next_out = idat->raw + idat->raw_len;
+        idat->zs.avail_out = idat->raw_bytes - idat->raw_len;
+
+        // stop at the end of each deflate block
+        ret = inflate(&idat->zs, Z_BLOCK);
+
+        if (ret != Z_OK && ret != Z_BUF_ERROR && ret != Z_STREAM_END) {
+            PT_DEBUG("inflate: %s", idat->zs.msg);
+            return -PT_ERR_PNG;
+        }
+
+        pt_idat_consumed(idat, in);
+
+        idat->adler = adler32(idat->adler, idat->raw + idat->raw_len, idat->raw_bytes - idat->zs.avail_out - idat->raw_len);
+        idat->raw_len = idat->raw_bytes - idat->zs.avail_out;
+
+        if (ret == Z_STREAM_END)
+            idat->stream_end = true;
+
+        // at the end of a deflate block, other than the last one
+        if (idat->want_point && (idat->zs.data_type & 128) && !(idat->zs.data_type & 64) && (err = pt_idat_point(idat)))
+            return err;
+    }
+
+    if ((err = pt_idat_unfilter(idat, idat->cur)))
+        return err;
+
+    if (idat->unpack)
+        pt_idat_unpack(idat, buf, idat->cur);
+    else
+        memcpy(buf, idat->cur, idat->raw_bytes - 1);
+
+    // the unfiltered row becomes the previous row
+    prev = idat->prev;
+
+    idat->prev = idat->cur;
+    idat->cur = prev;
+    idat->raw_len = 0;
+    idat->row++;
+
+    return 0;
+}
+
+int pt_idat_finish (struct pt_idat *idat)
+{
+    uint8_t buf[256];
+    int ret, err;
+
+    // inflate up to the end of the deflate data, discarding any excess data
+    while (!idat->stream_end) {
+        const uint8_t *in;
+
+        if (!idat->zs.avail_in && (err = pt_idat_fill(idat)))
+            return err;
+
+        in = idat->zs.next_in;
+
+        idat->zs.next_out = buf;
+        idat->zs.avail_out = sizeof(buf);
+
+        // checks the adler32 of a zlib stream
+        ret = inflate(&idat->zs, Z_NO_FLUSH);
+
+        if (ret != Z_OK && ret != Z_BUF_ERROR && ret != Z_STREAM_END) {
+            PT_DEBUG("inflate: %s", idat->zs.msg);
+            return -PT_ERR_PNG;
+        }
+
+        pt_idat_consumed(idat, in);
+
+        idat->adler = adler32(idat->adler, buf, sizeof(buf) - idat->zs.avail_out);
+
+        if (ret == Z_STREAM_END)
+            idat->stream_end = true;
+    }
+
+    // the adler32 of the zlib stream follows the raw deflate data
+    if (idat->raw_deflate) {
+        uint8_t trailer[4];
+
+        for (size_t i = 0; i < sizeof(trailer); i++) {
+            if (!idat->zs.avail_in && (err = pt_idat_fill(idat)))
+                return err;
+
+            trailer[i] = *idat->zs.next_in++;
+            idat->zs.avail_in--;
+
+            pt_idat_consumed(idat, idat->zs.next_in - 1);
+        }
+
+        if (pt_idat_uint32(trailer) != idat->adler) {
+            PT_DEBUG("IDAT: incorrect data check");
+            return -PT_ERR_PNG;
+        }
+    }
+
+    // the rest of the last IDAT chunk, up to its CRC
+    if (idat->zs.avail_in) {
+        idat->crc = crc32(idat->crc, idat->zs.next_in, idat->zs.avail_in);
+        idat->zs.avail_in = 0;
+    }
+
+    while (idat->chunk_len) {
+        size_t len = min(idat->chunk_len, sizeof(idat->buf));
+
+        if ((err = pt_idat_pread(idat, idat->buf, len, idat->offset)))
+            return err;
+
+        idat->crc = crc32(idat->crc, idat->buf, len);
+        idat->offset += len;
+        idat->chunk_len -= len;
+    }
+
+    return pt_idat_crc(idat);
+}
+
+void pt_idat_close (struct pt_idat *idat)
+{
+    if (idat->zs_init)
+        inflateEnd(&idat->zs);
+
+    if (idat->fd >= 0 && close(idat->fd))
+        PT_WARN_ERRNO("close %d", idat->fd);
+
+    free(idat->raw);
+    free(idat->prev);
+    free(idat->cur);
+    free(idat->point_raw);
+    free(idat->point_prev);
+
+    idat->fd = -1;
+    idat->zs_init = false;
+    idat->raw = idat->prev = idat->cur = idat->point_raw = idat->point_prev = NULL;
+}
@@ -0,0 +1,148 @@
+#ifndef PNGTILE_IDAT_H
+#define PNGTILE_IDAT_H
+
+/**
+ * @file
+ *
+ * Resumable decoding of the PNG image data, without libpng.
+ *
+ * The state of the decoder can be saved at the boundaries of the deflate blocks within the image data, by saving the
+ * position within the file, the inflate window, and the unfiltered rows. Decoding can later be resumed from that point.
+ *
+ * The CRC of each IDAT chunk and the adler32 of the zlib stream are checked as the data is decoded, carrying the
+ * running checksums across resumes, as libpng does when decoding the whole image.
+ */
+#include "png.h"
+
+#include <zlib.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+ * Size of the inflate window
+ */
+#define PT_IDAT_WINDOW 32768
+
+/**
+ * Size of the buffer used to read in the image data
+ */
+#define PT_IDAT_BUF_SIZE (64 * 1024)
+
+/**
+ * Point to resume decoding from, at the end of a deflate block.
+ */
+struct pt_idat_point {
+    /** Row being decoded, and the number of bytes of its filtered data already decoded, including the filter type */
+    uint32_t row, row_len;
+
+    /** File offset of the next compressed byte, and the remaining length of the IDAT chunk containing it */
+    off_t offset;
+    uint32_t chunk_len;
+
+    /** CRC of the IDAT chunk up to the next compressed byte, and adler32 of the decompressed data so far */
+    uint32_t crc, adler;
+
+    /** Number of bits of the previous compressed byte not yet consumed, and the previous byte */
+    uint8_t bits, byte;
+
+    /** Inflate window */
+    uint32_t window_len;
+    uint8_t window[PT_IDAT_WINDOW];
+};
+
+/**
+ * Decoder state
+ */
+struct pt_idat {
+    int fd;
+
+    z_stream zs;
+    bool zs_init;
+
+    /** File offset of the next byte to read, and the remaining length of the current IDAT chunk */
+    off_t offset;
+    uint32_t chunk_len;
+
+    /** CRC of the current IDAT chunk up to the next compressed byte to inflate, and adler32 of the decompressed data */
+    uint32_t crc, adler;
+
+    /** Inflating raw deflate data when resumed, with the adler32 checked by pt_idat_finish instead of zlib */
+    bool raw_deflate;
+
+    /** Reached the end of the deflate data */
+    bool stream_end;
+
+    /** Compressed data, and the last byte of the previous buffer */
+    uint8_t buf[PT_IDAT_BUF_SIZE];
+    uint8_t last;
+
+    /** Image format */
+    uint32_t width, height;
+    uint8_t bit_depth;
+
+    /** Unpack sub-8-bit pixels to a byte per pixel, as png_set_packing does */
+    bool unpack;
+
+    /** Bytes per complete pixel for the filters, and bytes per filtered row, including the filter type */
+    size_t filter_bytes, raw_bytes;
+
+    /** Row being decoded, and the number of bytes of its filtered data decoded so far */
+    uint32_t row;
+    uint8_t *raw;
+    size_t raw_len;
+
+    /** Previous unfiltered row, without the filter type, and the buffer for the next one */
+    uint8_t *prev, *cur;
+
+    /** Save a point at the end of the next deflate block */
+    bool want_point;
+
+    /** A point was saved, with copies of the previous row, and the partial row of point.row_len bytes */
+    bool have_point;
+    struct pt_idat_point point;
+    uint8_t *point_prev, *point_raw;
+};
+
+/**
+ * Open the given PNG image for decoding from the start of the image data, as described by the header read using
+ * pt_png_read_header.
+ */
+int pt_idat_open (struct pt_idat *idat, const char *path, const struct pt_png_header *header);
+
+/**
+ * Open the given PNG image for decoding from a point saved by a previous decoder.
+ *
+ * @param prev copy of the previous row, of pt_idat_prev_len bytes
+ * @param raw copy of the partial row, of point->row_len bytes
+ */
+int pt_idat_resume (struct pt_idat *idat, const char *path, const struct pt_png_header *header, const struct pt_idat_point *point, const uint8_t *prev, size_t prev_len, const uint8_t *raw);
+
+/**
+ * Return the length of the previous row saved for a point
+ */
+static inline size_t pt_idat_prev_len (const struct pt_idat *idat)
+{
+    return idat->raw_bytes - 1;
+}
+
+/**
+ * Decode the next row, in the format of header->row_bytes.
+ *
+ * If idat->want_point is set, this may save a point to resume decoding from, setting idat->have_point.
+ */
+int pt_idat_read_row (struct pt_idat *idat, uint8_t *buf);
+
+/**
+ * Check the end of the image data once all rows have been decoded: the adler32 of the zlib stream, and the CRC of the
+ * last IDAT chunk.
+ *
+ * Any excess data left in the zlib stream is ignored, as libpng does.
+ */
+int pt_idat_finish (struct pt_idat *idat);
+
+/**
+ * Release all resources
+ */
+void pt_idat_close (struct pt_idat *idat);
+
+#endif
@@ -10,6 +10,9 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
+
+#define min(a, b) (((a) < (b)) ? (a) : (b))
 
 int pt_sniff_image (const char *path, enum pt_image_format *format)
 {
@@ -137,6 +140,7 @@ int pt_image_update_png (struct pt_image *image, const char *path, const struct
 
     struct pt_png_img png_img;
     struct pt_png_header png_header;
+    struct pt_progress progress;
 
     int err = 0;
 
@@ -144,27 +148,49 @@ int pt_image_update_png (struct pt_image *image, const char *path, const struct
         return err;
 
     // read img header
-    if ((err = pt_png_read_header(&png_img, &png_header)))
+    if ((err = pt_png_read_header(&png_img, params, &png_header)))
         goto png_error;
 
-    if ((err = pt_cache_create_png(image->cache, &png_header, params)))
-        goto png_error;
+    pt_progress_init(&progress, params, png_header.height);
+
+    image->cache->progress = &progress;
+
+    // resume from the checkpoint of an interrupted update?
+    if (params && (params->flags & PT_IMAGE_CHECKPOINT))
+        err = pt_cache_resume_png(image->cache, &png_header, params, path);
+    else
+        err = 1;
+
+    if (err < 0)
+        goto progress_error;
+
+    if (err > 0 && (err = pt_cache_create_png(image->cache, &png_header, params, NULL)))
+        goto progress_error;
 
     // pass to cache object
-    if ((err = pt_cache_update_png(image->cache, &png_img, &png_header, params)))
+    if ((err = pt_cache_update_png(image->cache, &png_img, &png_header, params, path)))
+        goto cache_error;
+
+    // downsample
+    if ((err = pt_cache_update_png_zoom(image->cache)))
+        goto cache_error;
+
+    if ((err = pt_progress_done(&progress)))
         goto cache_error;
 
     // done, commit .tmp
     if ((err = pt_cache_create_done(image->cache)))
         goto cache_error;
 
-    goto png_error;
+    goto progress_error;
 
 cache_error:
     // cleanup .tmp
     pt_cache_create_abort(image->cache);
 
-    return err;
+progress_error:
+    image->cache->progress = NULL;
+    pt_progress_destroy(&progress);
 
 png_error:
     // clean up
@@ -222,7 +248,7 @@ int pt_image_update_png_part (struct pt_image *image, const char *path, const st
   if ((err = pt_png_open_path(&png_img, path)))
       return err;
 
-  if ((err = pt_png_read_header(&png_img, &png_header)))
+  if ((err = pt_png_read_header(&png_img, params, &png_header)))
       goto error;
 
   // pass to cache object
@@ -239,38 +265,197 @@ error:
 
 }
 
+/**
+ * Shared state for decoding the parts of a multi-part image on multiple threads.
+ *
+ * Each part is decoded into a separate region of the cache data, so only the choice of the next part is locked.
+ */
+struct pt_image_parts_work {
+  struct pt_image *image;
+  const struct pt_image_parts *parts;
+  const struct pt_image_params *params;
+  const struct pt_png_header *part_header;
+
+  /** Params for decoding each part, without pipelining when decoding multiple parts concurrently */
+  struct pt_image_params part_params;
+
+  /** Updating a clone of the existing cache */
+  bool incremental;
+
+  /** Progress of the update, counting the rows of all parts */
+  struct pt_progress progress;
+
+  pthread_mutex_t lock;
+
+  /** Next part to decode */
+  unsigned next;
+
+  /** First error, stops all threads */
+  int err;
+};
+
+/**
+ * Update the cache for the given part, if it has changed
+ */
+static int pt_image_update_png_parts_one (struct pt_image_parts_work *work, unsigned part)
+{
+  struct pt_image *image = work->image;
+  const char *path = work->parts->paths[part];
+  unsigned row = (part / work->parts->cols) * work->part_header->height;
+  unsigned col = (part % work->parts->cols) * work->part_header->width;
+  int err;
+
+  if ((err = pt_cache_stat_part(image->cache, part, path)) < 0)
+    return err;
+
+  if (!err) {
+    PT_DEBUG("%s: path=%s row=%u col=%u: unchanged", image->cache_path, path, row, col);
+    return pt_progress_rows(&work->progress, work->part_header->height);
+  }
+
+  if (work->incremental)
+    pt_cache_clear_part(image->cache, row, col, work->part_header->width, work->part_header->height);
+
+  // missing parts are left empty
+  if (!path)
+    return pt_progress_rows(&work->progress, work->part_header->height);
+
+  // TODO: verify that PNG header matches part_header
+  return pt_image_update_png_part(image, path, work->params ? &work->part_params : NULL, row, col);
+}
+
+/**
+ * Decode parts until all are done, or any fails
+ */
+static void *pt_image_update_png_parts_thread (void *arg)
+{
+  struct pt_image_parts_work *work = arg;
+  unsigned count = work->parts->rows * work->parts->cols;
+  int err;
+
+  for (;;) {
+    unsigned part;
+
+    pthread_mutex_lock(&work->lock);
+
+    part = work->next++;
+
+    if (work->err || part >= count) {
+      pthread_mutex_unlock(&work->lock);
+      break;
+    }
+
+    pthread_mutex_unlock(&work->lock);
+
+    if ((err = pt_image_update_png_parts_one(work, part))) {
+      pthread_mutex_lock(&work->lock);
+
+      if (!work->err)
+        work->err = err;
+
+      pthread_mutex_unlock(&work->lock);
+      break;
+    }
+  }
+
+  return NULL;
+}
+
 int pt_image_update_png_parts (struct pt_image *image, const struct pt_image_parts *parts, const struct pt_image_params *params)
 {
   struct pt_png_header image_header, part_header;
+  struct pt_image_parts_work work = {
+    .image = image,
+    .parts = parts,
+    .params = params,
+    .part_header = &part_header,
+  };
+  unsigned threads = 1;
+  pthread_t *thread_ids = NULL;
+  unsigned started = 0;
   int err = 0;
 
-  if ((err = pt_read_parts_png_header(parts, &image_header, &part_header)))
+  if ((err = pt_read_parts_png_header(parts, params, &image_header, &part_header)))
     return err;
 
+  if (params && (params->flags & PT_IMAGE_INCREMENTAL)) {
+    // copy the existing cache, if compatible
+    if ((err = pt_cache_clone_png(image->cache, &image_header, params, parts)) < 0)
+      return err;
+
+    work.incremental = !err;
+  }
+
   // create cache object for entire image
-  if ((err = pt_cache_create_png(image->cache, &image_header, params)))
-      goto error;
+  if (!work.incremental && (err = pt_cache_create_png(image->cache, &image_header, params, parts)))
+      return err;
 
-  // update each part
-  for (unsigned row = 0; row < parts->rows; row++) {
-    for (unsigned col = 0; col < parts->cols; col++) {
-      // TODO: verify that PNG header matches part_header
-      if ((err = pt_image_update_png_part(image, parts->paths[row * parts->cols + col], params, row * part_header.height, col * part_header.width))) {
-        goto error;
-      }
+  // update each part, using the calling thread and any additional threads
+  if (params && params->threads > 1)
+    threads = min(params->threads, parts->rows * parts->cols);
+
+  if (params) {
+    work.part_params = *params;
+
+    if (threads > 1)
+      work.part_params.threads = 0;
+  }
+
+  pthread_mutex_init(&work.lock, NULL);
+  pt_progress_init(&work.progress, params, (size_t) parts->rows * parts->cols * part_header.height);
+
+  image->cache->progress = &work.progress;
+
+  if (threads > 1 && (thread_ids = calloc(threads - 1, sizeof(*thread_ids))) == NULL) {
+    err = -PT_ERR_MEM;
+    goto error;
+  }
+
+  for (; started < threads - 1; started++) {
+    if ((err = pthread_create(&thread_ids[started], NULL, pt_image_update_png_parts_thread, &work))) {
+      PT_WARN("pthread_create: %s", strerror(err));
+      break;
     }
   }
 
+  PT_DEBUG("%s: parts=%ux%u threads=%u", image->cache_path, parts->rows, parts->cols, 1 + started);
+
+  pt_image_update_png_parts_thread(&work);
+
+  for (unsigned i = 0; i < started; i++)
+    pthread_join(thread_ids[i], NULL);
+
+  if ((err = work.err))
+    goto error;
+
+  // downsample
+  if ((err = pt_cache_update_png_zoom(image->cache)))
+      goto error;
+
+  if ((err = pt_progress_done(&work.progress)))
+      goto error;
+
   // done, commit .tmp
   if ((err = pt_cache_create_done(image->cache)))
       goto error;
 
+  image->cache->progress = NULL;
+
+  free(thread_ids);
+  pt_progress_destroy(&work.progress);
+  pthread_mutex_destroy(&work.lock);
+
   return 0;
 
 error:
   // cleanup .tmp
   pt_cache_create_abort(image->cache);
 
+  free(thread_ids);
+  image->cache->progress = NULL;
+  pt_progress_destroy(&work.progress);
+  pthread_mutex_destroy(&work.lock);
+
   return err;
 }
 
@@ -287,6 +472,10 @@ int pt_image_update_parts (struct pt_image *image, const struct pt_image_parts *
   for (unsigned i = 0; i < parts->rows * parts->cols; i++) {
     enum pt_image_format format;
 
+    // missing parts are left empty
+    if (!parts->paths[i])
+      continue;
+
     if ((err = pt_sniff_image(parts->paths[i], &format)))
         return err > 0 ? -PT_ERR_IMG_FORMAT : err;
 
@@ -313,19 +502,24 @@ int pt_image_update_parts (struct pt_image *image, const struct pt_image_parts *
 }
 
 int pt_image_open (struct pt_image *image)
+{
+    return pt_image_open_params(image, NULL);
+}
+
+int pt_image_open_params (struct pt_image *image, const struct pt_open_params *params)
 {
     int err;
 
     if (image->cache)
       return -PT_ERR_IMG_MODE;
 
-    PT_DEBUG("%s", image->cache_path);
+    PT_DEBUG("%s: flags=%#x", image->cache_path, params ? params->flags : 0);
 
     // create the cache object for this image (doesn't yet open it)
     if ((err = pt_cache_new(&image->cache, image->cache_path)))
         return err;
 
-    return pt_cache_open(image->cache);
+    return pt_cache_open(image->cache, params);
 }
 
 int pt_image_tile_file (struct pt_image *image, const struct pt_tile_params *params, FILE *out)
@@ -363,10 +557,15 @@ int pt_image_tile_mem (struct pt_image *image, const struct pt_tile_params *para
     PT_DEBUG("%s: width=%u height=%u x=%u y=%u zoom=%d", image->cache_path, params->width, params->height, params->x, params->y, params->zoom);
 
     struct pt_tile tile;
+    size_t size;
     int err;
 
+    // start out at the expected size
+    if ((err = pt_cache_tile_size_hint(image->cache, params, &size)))
+        return err;
+
     // init
-    if ((err = pt_tile_init_mem(&tile,  params)))
+    if ((err = pt_tile_init_mem(&tile, params, size)))
         return err;
 
     // render
@@ -375,16 +574,193 @@ int pt_image_tile_mem (struct pt_image *image, const struct pt_tile_params *para
 
     // ok
     *buf_ptr = tile.out.mem.base;
-    *len_ptr = tile.out.mem.len; // XXX: should be .off
+    *len_ptr = tile.out.mem.off;
+
+    return 0;
+
+error:
+    pt_tile_abort(&tile);
+
+    return err;
+}
+
+int pt_image_tile_buf (struct pt_image *image, const struct pt_tile_params *params, char *buf, size_t size, size_t *len_ptr)
+{
+    if (!image->cache)
+      return -PT_ERR_IMG_MODE;
+
+    PT_DEBUG("%s: width=%u height=%u x=%u y=%u zoom=%d size=%zu", image->cache_path, params->width, params->height, params->x, params->y, params->zoom, size);
+
+    struct pt_tile tile;
+    int err;
+
+    // init
+    if ((err = pt_tile_init_buf(&tile, params, buf, size)))
+        return err;
+
+    // render
+    if ((err = pt_cache_render_tile(image->cache, &tile)))
+        return err;
+
+    // the size of the PNG data, even if it did not fit
+    *len_ptr = tile.out.mem.off;
+
+    if (tile.out.mem.off > size)
+        return -PT_ERR_TILE_BUF;
 
     return 0;
+}
+
+int pt_image_tile_size_hint (struct pt_image *image, const struct pt_tile_params *params, size_t *size_ptr)
+{
+    if (!image->cache)
+      return -PT_ERR_IMG_MODE;
+
+    return pt_cache_tile_size_hint(image->cache, params, size_ptr);
+}
+
+int pt_image_tile_write (struct pt_image *image, const struct pt_tile_params *params, const struct pt_tile_writer *writer)
+{
+    if (!image->cache)
+      return -PT_ERR_IMG_MODE;
+
+    PT_DEBUG("%s: width=%u height=%u x=%u y=%u zoom=%d", image->cache_path, params->width, params->height, params->x, params->y, params->zoom);
+
+    struct pt_tile tile;
+    int err;
+
+    // init
+    if ((err = pt_tile_init_writer(&tile, params, writer)))
+        goto error;
+
+    // render
+    err = pt_cache_render_tile(image->cache, &tile);
 
 error:
+    // release buffer
     pt_tile_abort(&tile);
 
     return err;
 }
 
+int pt_image_tile_fd (struct pt_image *image, const struct pt_tile_params *params, int fd)
+{
+    if (!image->cache)
+      return -PT_ERR_IMG_MODE;
+
+    PT_DEBUG("%s: width=%u height=%u x=%u y=%u zoom=%d fd=%d", image->cache_path, params->width, params->height, params->x, params->y, params->zoom, fd);
+
+    struct pt_tile tile;
+    int err;
+
+    // init
+    if ((err = pt_tile_init_fd(&tile, params, fd)))
+        goto error;
+
+    // render
+    err = pt_cache_render_tile(image->cache, &tile);
+
+error:
+    // release buffer
+    pt_tile_abort(&tile);
+
+    return err;
+}
+
+/**
+ * Position of a tile in a batch, ordered by the first block of cache data it reads
+ */
+struct pt_tile_batch_order {
+    size_t block;
+    unsigned index;
+};
+
+static int pt_tile_batch_order_cmp (const void *a, const void *b)
+{
+    const struct pt_tile_batch_order *order_a = a, *order_b = b;
+
+    if (order_a->block != order_b->block)
+        return order_a->block < order_b->block ? -1 : 1;
+
+    // keep the order of tiles starting from the same block
+    return order_a->index < order_b->index ? -1 : order_a->index > order_b->index;
+}
+
+int pt_image_tile_batch (struct pt_image *image, const struct pt_tile_params *params, unsigned count, struct pt_tile_result *results)
+{
+    if (!image->cache)
+      return -PT_ERR_IMG_MODE;
+
+    PT_DEBUG("%s: count=%u", image->cache_path, count);
+
+    struct pt_tile_batch_order *order = NULL;
+    struct pt_render_ctx *ctx = NULL;
+    int err;
+
+    if (!count)
+        return 0;
+
+    if ((order = calloc(count, sizeof(*order))) == NULL)
+        return -PT_ERR_MEM;
+
+    for (unsigned i = 0; i < count; i++) {
+        results[i] = (struct pt_tile_result) { };
+
+        order[i].index = i;
+
+        if ((err = pt_cache_tile_block(image->cache, &params[i], &order[i].block)))
+            goto error;
+    }
+
+    qsort(order, count, sizeof(*order), pt_tile_batch_order_cmp);
+
+    // shared by the tiles without their own render context
+    if ((err = pt_render_ctx_new(&ctx)))
+        goto error;
+
+    // start reading in all of the tiles before rendering the first one
+    for (unsigned i = 0; i < count; i++) {
+        const struct pt_tile_params *tile_params = &params[order[i].index];
+
+        if (!tile_params->width || !tile_params->height)
+            continue;
+
+        if ((err = pt_cache_prefetch(image->cache, tile_params)))
+            goto error;
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        struct pt_tile_result *result = &results[order[i].index];
+        struct pt_tile_params tile_params = params[order[i].index];
+
+        if (!tile_params.ctx)
+            tile_params.ctx = ctx;
+
+        if ((result->err = pt_image_tile_mem(image, &tile_params, &result->buf, &result->len))) {
+            result->buf = NULL;
+            result->len = 0;
+        }
+    }
+
+error:
+    if (ctx)
+        pt_render_ctx_destroy(ctx);
+
+    free(order);
+
+    return err;
+}
+
+int pt_image_prefetch (struct pt_image *image, const struct pt_tile_params *params)
+{
+    if (!image->cache)
+      return -PT_ERR_IMG_MODE;
+
+    PT_DEBUG("%s: width=%u height=%u x=%u y=%u zoom=%d", image->cache_path, params->width, params->height, params->x, params->y, params->zoom);
+
+    return pt_cache_prefetch(image->cache, params);
+}
+
 int pt_image_close (struct pt_image *image)
 {
   PT_DEBUG("%s", image->cache_path);
@@ -1,14 +1,26 @@
 #include "png.h" // pt_png header
+#include "block.h"
+#include "sparse.h"
+#include "idat.h"
+#include "progress.h"
+#include "render.h"
+#include "encode.h"
+#include "zoom.h"
 #include "log.h"
 
 #include <png.h> // sysmtem libpng header
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <time.h>
 
 const size_t pt_image_block_size = 64;
 
 #define min(a, b) (((a) < (b)) ? (a) : (b))
+#define max(a, b) (((a) > (b)) ? (a) : (b))
 
 int pt_sniff_png (const char *path)
 {
@@ -61,16 +73,23 @@ error:
   return err;
 }
 
-int pt_read_parts_png_header (const struct pt_image_parts *parts, struct pt_png_header *header, struct pt_png_header *part_header)
+int pt_read_parts_png_header (const struct pt_image_parts *parts, const struct pt_image_params *params, struct pt_png_header *header, struct pt_png_header *part_header)
 {
   struct pt_png_img png_img;
+  const char *path = NULL;
   int err;
 
-  // determine format from first image
-  if ((err = pt_png_open_path(&png_img, parts->paths[0])))
+  // determine format from first image that is not missing
+  for (unsigned i = 0; i < parts->rows * parts->cols && !path; i++)
+    path = parts->paths[i];
+
+  if (!path)
+    return -PT_ERR_PATH;
+
+  if ((err = pt_png_open_path(&png_img, path)))
       return err;
 
-  if ((err = pt_png_read_header(&png_img, part_header)))
+  if ((err = pt_png_read_header(&png_img, params, part_header)))
     goto error;
 
   // scale up for multiple parts
@@ -79,7 +98,7 @@ int pt_read_parts_png_header (const struct pt_image_parts *parts, struct pt_png_
   header->width *= parts->cols;
   header->height *= parts->rows;
 
-  header->row_bytes *= parts->cols;
+  header->row_bytes = (header->width * (size_t) header->pixel_bits + 7) / 8;
 
   // ok
 
@@ -112,6 +131,11 @@ static int pt_check_part_png_header (const struct pt_png_header *header, const s
     return -PT_ERR_IMG_FORMAT;
   }
 
+  if (header->pixel_bits != out->header->pixel_bits) {
+    PT_WARN("part pixel_bits=%u mismatch with %u", header->pixel_bits, out->header->pixel_bits);
+    return -PT_ERR_IMG_FORMAT;
+  }
+
   // TODO: compare palettes?
 
   return 0;
@@ -202,8 +226,10 @@ int pt_png_read_info (struct pt_png_img *img, struct pt_image_info *info)
     return 0;
 }
 
-int pt_png_read_header (struct pt_png_img *img, struct pt_png_header *header)
+int pt_png_read_header (struct pt_png_img *img, const struct pt_image_params *params, struct pt_png_header *header)
 {
+    bool packed = params && (params->flags & PT_IMAGE_PACKED);
+
     // check image doesn't use any options we don't handle
     if (png_get_interlace_type(img->png, img->info) != PNG_INTERLACE_NONE)
         return -PT_ERR_IMG_FORMAT_INTERLACE;
@@ -222,9 +248,12 @@ int pt_png_read_header (struct pt_png_img *img, struct pt_png_header *header)
     );
 
     // only pack 1 pixel per byte, changes rowbytes
-    if (header->bit_depth < 8)
+    if (header->bit_depth < 8 && !packed)
         png_set_packing(img->png);
 
+    // apply transformations to rowbytes
+    png_read_update_info(img->png, img->info);
+
     // fill in other info
     header->row_bytes = png_get_rowbytes(img->png, img->info);
 
@@ -232,7 +261,10 @@ int pt_png_read_header (struct pt_png_img *img, struct pt_png_header *header)
     // this assumes the packed bit depth will be either 8 or 16
     header->col_bytes = png_get_channels(img->png, img->info) * (header->bit_depth == 16 ? 2 : 1);
 
-    PT_DEBUG("row_bytes=%u, col_bytes=%u", header->row_bytes, header->col_bytes);
+    // sub-8-bit pixels are only ever a single channel
+    header->pixel_bits = (header->bit_depth < 8 && packed) ? header->bit_depth : header->col_bytes * 8;
+
+    PT_DEBUG("row_bytes=%u, col_bytes=%u, pixel_bits=%u", header->row_bytes, header->col_bytes, header->pixel_bits);
 
     // palette etc.
     if (header->color_type == PNG_COLOR_TYPE_PALETTE) {
@@ -255,445 +287,2054 @@ int pt_png_read_header (struct pt_png_img *img, struct pt_png_header *header)
 
     return 0;
 }
+
+void pt_png_layout (struct pt_png_layout *layout, const struct pt_png_header *header, unsigned block_width, unsigned block_height)
+{
+    layout->col_bytes = header->col_bytes;
+    layout->pixel_bits = header->pixel_bits;
+    layout->block_width = block_width;
+    layout->block_height = block_height;
+
+    // round up to cover any partial blocks along the edges
+    layout->block_cols = (header->width + block_width - 1) / block_width;
+    layout->block_rows = (header->height + block_height - 1) / block_height;
+
+    // block_width is a multiple of 8 for bit-packed pixels
+    layout->block_row_bytes = block_width * layout->pixel_bits / 8;
+    layout->block_bytes = block_height * layout->block_row_bytes;
+}
+
 /**
- * Decode the PNG data directly to memory - not good for sparse backgrounds
+ * Return the value of the bit-packed pixel at \a bit, MSB first as in PNG
  */
-static int pt_png_decode_direct (struct pt_png_img *img, const struct pt_png_header *header, const struct pt_png_out *out)
+static inline uint8_t pt_png_bits_get (const uint8_t *buf, size_t bit, unsigned bits)
 {
-    // write out raw image data a row at a time
-    for (size_t row = 0; row < header->height; row++) {
-        // read row data, non-interlaced
-        png_read_row(img->png, out->data + (out->row + row) * out->header->row_bytes + out->col * out->header->col_bytes, NULL);
-    }
+    return (buf[bit / 8] >> (8 - bits - bit % 8)) & ((1 << bits) - 1);
+}
 
-    return 0;
+/**
+ * Replace the bits of \a dst selected by \a mask with \a value.
+ *
+ * The other bits of a partial byte at either end of a row of pixels may be concurrently written by a different part.
+ */
+static inline void pt_png_bits_set (uint8_t *dst, uint8_t mask, uint8_t value)
+{
+    __atomic_fetch_and(dst, ~mask | value, __ATOMIC_RELAXED);
+    __atomic_fetch_or(dst, value & mask, __ATOMIC_RELAXED);
 }
 
 /**
- * Decode the PNG data, filtering it for sparse regions
+ * Copy \a bits bits of bit-packed data from \a src at \a src_bit to \a dst at \a dst_bit
  */
-static int pt_png_decode_sparse (struct pt_png_img *img, const struct pt_png_header *header, const pt_image_pixel background_pixel, const struct pt_png_out *out)
+static void pt_png_bits_copy (uint8_t *dst, size_t dst_bit, const uint8_t *src, size_t src_bit, size_t bits)
 {
-    // one row of pixel data
-    uint8_t *row_buf;
+    dst += dst_bit / 8;
+    dst_bit %= 8;
+    src += src_bit / 8;
+    src_bit %= 8;
 
-    // alloc
-    if ((row_buf = malloc(header->row_bytes)) == NULL)
-        return -PT_ERR_MEM;
+    if (dst_bit == 0 && src_bit == 0) {
+        memcpy(dst, src, bits / 8);
 
-    // decode each row at a time
-    for (size_t row = 0; row < header->height; row++) {
-        // read row data, non-interlaced
-        png_read_row(img->png, row_buf, NULL);
-
-        // skip background-colored regions to keep the cache file sparse
-        // ...in blocks of PT_CACHE_BLOCK_SIZE bytes
-        for (size_t col_base = 0; col_base < header->width; col_base += pt_image_block_size) {
-            // size of this block in bytes
-            size_t block_size = min(pt_image_block_size * header->col_bytes, header->row_bytes - col_base);
-
-            // ...each pixel
-            for (
-                    size_t col = col_base;
-
-                    // BLOCK_SIZE * col_bytes wide, don't go over the edge
-                    col < col_base + block_size;
-
-                    col += header->col_bytes
-            ) {
-                // test this pixel
-                if (bcmp(row_buf + col, background_pixel, header->col_bytes)) {
-                    // differs
-                    memcpy(
-                            out->data + (out->row + row) * out->header->row_bytes + out->col * out->header->col_bytes + col_base, // XXX
-                            row_buf + col_base,
-                            block_size
-                    );
-
-                    // skip to next block
-                    break;
-                }
-            }
+        if (bits % 8) {
+            uint8_t mask = 0xff << (8 - bits % 8);
 
-            // skip this block
-            continue;
+            pt_png_bits_set(&dst[bits / 8], mask, src[bits / 8] & mask);
         }
-    }
-
-    free(row_buf);
-
-    return 0;
-}
-
-int pt_png_decode (struct pt_png_img *img, const struct pt_png_header *header, const struct pt_image_params *params, const struct pt_png_out *out)
-{
-    int err;
 
-    // verify png header is compatible with output header
-    if ((err = pt_check_part_png_header(header, out))) {
-      return err;
+        return;
     }
 
-    // decode
-    // XXX: it's an array, you silly, this is always true?
-    if (params && (params->flags & PT_IMAGE_BACKGROUND_PIXEL)) {
-        err = pt_png_decode_sparse(img, header, params->background_pixel, out);
-
-    } else {
-        err = pt_png_decode_direct(img, header, out);
-      }
+    // the first and last dst bytes may be shared
+    size_t last = (dst_bit + bits - 1) / 8;
 
-    if (err)
-        return err;
+    // up to one byte at a time, within both the src and dst bytes
+    for (size_t i = 0; i < bits; ) {
+        size_t s = src_bit + i, d = dst_bit + i;
+        unsigned n = min(min(8 - s % 8, 8 - d % 8), bits - i);
+        uint8_t mask = ((1 << n) - 1) << (8 - n - d % 8);
+        uint8_t value = pt_png_bits_get(src, s, n) << (8 - n - d % 8);
 
-    // finish off, ignore trailing data
-    png_read_end(img->png, NULL);
+        if (d / 8 == 0 || d / 8 == last)
+            pt_png_bits_set(&dst[d / 8], mask, value);
+        else
+            dst[d / 8] = (dst[d / 8] & ~mask) | value;
 
-    return 0;
+        i += n;
+    }
 }
 
 /**
- * libpng I/O callback: write out data
+ * Fill \a bits bits at \a dst_bit with the given pattern byte, which repeats each pixel value
  */
-static void pt_png_mem_write (png_structp png, png_bytep data, png_size_t length)
+static void pt_png_bits_fill (uint8_t *dst, size_t dst_bit, uint8_t pattern, size_t bits)
 {
-    struct pt_tile_mem *buf = png_get_io_ptr(png);
-    int err;
+    dst += dst_bit / 8;
+    dst_bit %= 8;
+
+    if (dst_bit) {
+        unsigned n = min(8 - dst_bit, bits);
+        uint8_t mask = ((1 << n) - 1) << (8 - n - dst_bit);
+
+        pt_png_bits_set(dst, mask, pattern & mask);
+        dst++;
+        bits -= n;
+    }
 
-    // write to buffer
-    if ((err = pt_tile_mem_write(buf, data, length)))
-        // drop err, because png_error doesn't do formatted output
-        png_error(png, "pt_tile_mem_write: ...");
+    memset(dst, pattern, bits / 8);
+
+    if (bits % 8) {
+        uint8_t mask = 0xff << (8 - bits % 8);
+
+        pt_png_bits_set(&dst[bits / 8], mask, pattern & mask);
+    }
 }
 
 /**
- * libpng I/O callback: flush buffered data
+ * Return a pattern byte repeating the given bit-packed pixel value
  */
-static void pt_png_mem_flush (png_structp png_ptr)
+static inline uint8_t pt_png_bits_pattern (uint8_t value, unsigned bits)
 {
-    // no-op
-}
+    uint8_t pattern = 0;
 
+    for (unsigned i = 0; i < 8; i += bits)
+        pattern = (pattern << bits) | value;
 
-/**
- * Return a pointer to the pixel data on \a row, starting at \a col.
- */
-static inline const void* tile_row_col (const struct pt_png_header *header, const uint8_t *data, size_t row, size_t col)
-{
-    return data + (row * header->row_bytes) + (col * header->col_bytes);
+    return pattern;
 }
 
 /**
- * Write raw tile image data, directly from the cache
+ * Copy \a width_px pixels from \a src at pixel \a src_col to \a dst at pixel \a dst_col, bit-packed or not
  */
-static int pt_png_encode_direct (struct pt_png_img *img, const struct pt_png_header *header, const uint8_t *data, const struct pt_tile_params *params)
+static inline void pt_png_pixels_copy (uint8_t *dst, size_t dst_col, const uint8_t *src, size_t src_col, size_t width_px, unsigned pixel_bits)
 {
-    for (unsigned int row = params->y; row < params->y + params->height; row++)
-        // write data directly
-        // missing const...
-        png_write_row(img->png, (const png_bytep) tile_row_col(header, data, row, params->x));
-
-    return 0;
+    if (pixel_bits < 8)
+        pt_png_bits_copy(dst, dst_col * pixel_bits, src, src_col * pixel_bits, width_px * pixel_bits);
+    else
+        memcpy(dst + dst_col * pixel_bits / 8, src + src_col * pixel_bits / 8, width_px * pixel_bits / 8);
 }
 
 /**
- * Fill in a clipped region of \a width_px pixels at the given row segment
+ * Build the pattern of background pixels for pt_png_background, from a pixel value as given by pt_png_fill_pixel
  */
-static inline void tile_row_fill_clip (const struct pt_png_header *header, png_byte *row, unsigned int width_px)
+static void pt_png_background_pattern (uint8_t pattern[PT_SPARSE_PATTERN_SIZE], const struct pt_png_header *header, const uint8_t *pixel)
 {
-    // XXX: use a configureable background color, or full transparency?
-    memset(row, /* 0xd7 */ 0x00, width_px * header->col_bytes);
+    if (header->pixel_bits < 8)
+        memset(pattern, pt_png_bits_pattern(pixel[0], header->pixel_bits), PT_SPARSE_PATTERN_SIZE);
+    else
+        pt_sparse_pattern(pattern, pixel, header->col_bytes);
 }
 
 /**
- * Write clipped tile image data (a tile that goes over the edge of the actual image) by aligning the data from the cache as needed
+ * Test if the given region of row data, starting at pixel \a col, consists only of background pixels
+ *
+ * @param background pattern of background pixels from pt_png_background_pattern
  */
-static int pt_png_encode_clipped (struct pt_png_img *img, const struct pt_png_header *header, const uint8_t *data, const struct pt_tile_params *params)
+static bool pt_png_background (const struct pt_png_header *header, const uint8_t *buf, size_t col, size_t rows, size_t width_px, const uint8_t *background)
 {
-    png_byte *rowbuf;
-    unsigned int row;
-
-    // image data goes from (params->x ... clip_x, params->y ... clip_y), remaining region is filled
-    unsigned int clip_x, clip_y;
+    for (size_t row = 0; row < rows; row++) {
+        const uint8_t *p = buf + row * header->row_bytes;
 
+        if (header->pixel_bits < 8) {
+            size_t bit = col * header->pixel_bits, bits = width_px * header->pixel_bits;
 
-    // fit the left/bottom edge against the image dimensions
-    clip_x = min(params->x + params->width, header->width);
-    clip_y = min(params->y + params->height, header->height);
+            // partial bytes at either end
+            if (bit % 8) {
+                unsigned n = min(8 - bit % 8, bits);
+                uint8_t mask = ((1 << n) - 1) << (8 - n - bit % 8);
 
+                if ((p[bit / 8] ^ background[0]) & mask)
+                    return false;
 
-    // allocate buffer for a single row of image data
-    if ((rowbuf = malloc(params->width * header->col_bytes)) == NULL)
-        return -PT_ERR_MEM;
+                bit += n;
+                bits -= n;
+            }
 
-    // how much data we actually have for each row, in px and bytes
-    // from [(paramsle x)---](clip x)
-    unsigned int row_px = clip_x - params->x;
-    size_t row_bytes = row_px * header->col_bytes;
+            if (!pt_sparse_match(p + bit / 8, bits / 8, background))
+                return false;
 
-    // write the rows that we have
-    // from [(tile y]---](clip y)
-    for (row = params->y; row < clip_y; row++) {
-        // copy in the actual tile data...
-        memcpy(rowbuf, tile_row_col(header, data, row, params->x), row_bytes);
+            if (bits % 8 && (p[(bit + bits) / 8] ^ background[0]) & (0xff << (8 - bits % 8)))
+                return false;
 
-        // generate the data for the remaining, clipped, columns
-        tile_row_fill_clip(header, rowbuf + row_bytes, (params->width - row_px));
+            continue;
+        }
 
-        // write
-        png_write_row(img->png, rowbuf);
+        if (!pt_sparse_match(p + col * header->col_bytes, width_px * header->col_bytes, background))
+            return false;
     }
 
-    // generate the data for the remaining, clipped, rows
-    tile_row_fill_clip(header, rowbuf, params->width);
-
-    // write out the remaining rows as clipped data
-    for (; row < params->y + params->height; row++)
-        png_write_row(img->png, rowbuf);
-
-    // ok
-    return 0;
+    return true;
 }
 
 /**
- * Write unscaled tile data
+ * Write out a chunk of decoded rows covering a full row of blocks via out->write_block.
+ *
+ * Each block is gathered into a zero-padded buffer. Blocks consisting only of background pixels are written as NULL.
  */
-static int pt_png_encode_unzoomed (struct pt_png_img *img, const struct pt_png_header *header, const uint8_t *data, const struct pt_tile_params *params)
+static int pt_png_store_blocks (const struct pt_png_header *header, const struct pt_png_out *out, const uint8_t *buf, unsigned row, unsigned rows, const uint8_t *background_pixel)
 {
-    int err;
+    const struct pt_png_layout *layout = out->layout;
+    unsigned out_row = out->row + row;
+    uint8_t *block_buf;
+    int err = 0;
 
-    // set basic info
-    png_set_IHDR(img->png, img->info, params->width, params->height, header->bit_depth, header->color_type,
-            PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT
-    );
+    // blocks can only be written out once, in order
+    if (out->col || header->width != out->header->width || out_row % layout->block_height || rows != min(layout->block_height, out->header->height - out_row))
+        return -PT_ERR_CACHE_COMPRESS;
 
-    // set palette?
-    if (header->color_type == PNG_COLOR_TYPE_PALETTE)
-        // oops... missing const
-        png_set_PLTE(img->png, img->info, (png_colorp) header->palette, header->num_palette);
+    if ((block_buf = malloc(layout->block_bytes)) == NULL)
+        return -PT_ERR_MEM;
 
-    // write meta-info
-    png_write_info(img->png, img->info);
+    for (unsigned col = 0; col < header->width; col += layout->block_width) {
+        unsigned cols = min(layout->block_width, header->width - col);
 
-    // our pixel data is packed into 1 pixel per byte (8bpp or 16bpp)
-    png_set_packing(img->png);
+        size_t bytes = (size_t) rows * cols * layout->pixel_bits / 8;
 
-    // figure out if the tile clips
-    if (params->x + params->width <= header->width && params->y + params->height <= header->height)
-        // doesn't clip, just use the raw data
-        err = pt_png_encode_direct(img, header, data, params);
+        if (background_pixel && pt_png_background(header, buf, col, rows, cols, background_pixel)) {
+            pt_progress_store(out->progress, 0, bytes);
 
-    else
-        // fill in clipped regions
-        err = pt_png_encode_clipped(img, header, data, params);
+            err = out->write_block(out->write_arg, NULL, layout->block_bytes);
+
+        } else {
+            pt_progress_store(out->progress, bytes, 0);
+
+            // pad out partial blocks
+            if (rows < layout->block_height || cols < layout->block_width)
+                memset(block_buf, 0, layout->block_bytes);
+
+            for (unsigned r = 0; r < rows; r++) {
+                pt_png_pixels_copy(block_buf + r * layout->block_row_bytes, 0, buf + r * header->row_bytes, col, cols, layout->pixel_bits);
+            }
+
+            err = out->write_block(out->write_arg, block_buf, layout->block_bytes);
+        }
+
+        if (err)
+            break;
+    }
+
+    free(block_buf);
 
     return err;
 }
 
 /**
- * Manipulate powers of two
+ * Store a chunk of decoded rows into the layout blocks.
+ *
+ * The chunk must not span multiple rows of blocks. Blocks that are completely covered by the chunk and consist only
+ * of background pixels are skipped, leaving the cache file sparse.
+ *
+ * @param buf decoded rows, header->row_bytes each
+ * @param row row offset of the chunk within the decoded image
+ * @param rows number of rows in the chunk
+ * @param background_pixel optional pattern of background pixels to skip, from pt_png_background_pattern
  */
-static inline unsigned int scale_by_zoom_factor (unsigned int value, int z)
+static int pt_png_store (const struct pt_png_header *header, const struct pt_png_out *out, const uint8_t *buf, unsigned row, unsigned rows, const uint8_t *background_pixel)
 {
-    if (z > 0)
-        return value << z;
+    const struct pt_png_layout *layout = out->layout;
+    unsigned out_row = out->row + row;
 
-    else if (z < 0)
-        return value >> -z;
+    if (out->write_block)
+        return pt_png_store_blocks(header, out, buf, row, rows, background_pixel);
 
-    else
-        return value;
-}
+    // rows of the block, clipped to the image, covered by this chunk?
+    unsigned block_top = out_row - out_row % layout->block_height;
+    bool rows_covered = (out_row == block_top) && (rows == min(layout->block_height, out->header->height - block_top));
 
-#define ADD_AVG(l, r) (l) = ((l) + (r)) / 2
+    // each block segment along the row
+    for (unsigned col = 0; col < header->width; ) {
+        unsigned out_col = out->col + col;
+        unsigned block_left = out_col - out_col % layout->block_width;
+        unsigned cols = min(layout->block_width - out_col % layout->block_width, header->width - col);
 
-/**
- * Converts a pixel's data into a png_color
- */
-static inline void png_pixel_data (png_color *c, const struct pt_png_header *header, const uint8_t *data, unsigned int row, unsigned int col)
-{
-    if (header->bit_depth == 8) {
-        // palette entry number
-        uint8_t *p = (uint8_t *) tile_row_col(header, data, row, col);
+        // cols of the block, clipped to the image, covered by this chunk?
+        bool cols_covered = (out_col == block_left) && (cols == min(layout->block_width, out->header->width - block_left));
 
-        switch (header->color_type) {
-            case PNG_COLOR_TYPE_RGB:
-            case PNG_COLOR_TYPE_RGB_ALPHA:
-                c->red   = p[0];
-                c->green = p[1];
-                c->blue  = p[2];
+        uint8_t *dst = out->data + pt_png_data_offset(layout, out_row, block_left);
+        size_t block = (size_t) (out_row / layout->block_height) * layout->block_cols + (out_col / layout->block_width);
+        size_t bytes = (size_t) rows * cols * layout->pixel_bits / 8;
+        unsigned src_col = col;
 
-                return;
+        col += cols;
 
-            case PNG_COLOR_TYPE_PALETTE:
-                // hrhr - assume our working data is valid (or we have 255 palette entries, so it doesn't matter...)
-                assert(*p < header->num_palette);
+        // skip background blocks to keep the cache file sparse
+        if (background_pixel && rows_covered && cols_covered && pt_png_background(header, buf, src_col, rows, cols, background_pixel)) {
+            pt_progress_store(out->progress, 0, bytes);
+            continue;
+        }
 
-                // reference data from palette
-                *c = header->palette[*p];
+        pt_progress_store(out->progress, bytes, 0);
 
-                return;
+        for (unsigned r = 0; r < rows; r++) {
+            pt_png_pixels_copy(dst + r * layout->block_row_bytes, out_col - block_left, buf + r * header->row_bytes, src_col, cols, layout->pixel_bits);
         }
-    } else {
-        // unknown pixel format
-        return;
+
+        // blocks may be shared with parts decoded concurrently
+        if (out->occupancy)
+            __atomic_fetch_or(&out->occupancy[block / 8], 1 << (block % 8), __ATOMIC_RELAXED);
+    }
+
+    return 0;
+}
+
+void pt_png_clear (const struct pt_png_out *out, unsigned width, unsigned height)
+{
+    const struct pt_png_layout *layout = out->layout;
+    unsigned row_end = min(out->row + height, out->header->height);
+    unsigned col_end = min(out->col + width, out->header->width);
+
+    for (unsigned row = out->row; row < row_end; ) {
+        unsigned block_top = row - row % layout->block_height;
+        unsigned rows = min(layout->block_height - row % layout->block_height, row_end - row);
+        bool rows_covered = (row == block_top) && (rows == min(layout->block_height, out->header->height - block_top));
+
+        for (unsigned col = out->col; col < col_end; ) {
+            unsigned block_left = col - col % layout->block_width;
+            unsigned cols = min(layout->block_width - col % layout->block_width, col_end - col);
+            bool cols_covered = (col == block_left) && (cols == min(layout->block_width, out->header->width - block_left));
+            size_t block = (size_t) (row / layout->block_height) * layout->block_cols + (col / layout->block_width);
+
+            if (rows_covered && cols_covered && out->occupancy) {
+                // the stale block data is no longer read
+                __atomic_fetch_and(&out->occupancy[block / 8], ~(1 << (block % 8)), __ATOMIC_RELAXED);
+
+            } else {
+                // shared with another part
+                uint8_t *dst = out->data + pt_png_data_offset(layout, row, block_left);
+
+                for (unsigned r = 0; r < rows; r++) {
+                    pt_png_bits_fill(dst + r * layout->block_row_bytes, (col - block_left) * layout->pixel_bits, 0, cols * layout->pixel_bits);
+                }
+            }
+
+            col += cols;
+        }
+
+        row += rows;
     }
 }
 
 /**
- * Write scaled tile data
+ * Chunk of decoded rows passed from the decoding thread to the store threads
  */
-static int pt_png_encode_zoomed (struct pt_png_img *img, const struct pt_png_header *header, const uint8_t *data, const struct pt_tile_params *params)
-{
-    // size of the image data in px
-    unsigned int data_width = scale_by_zoom_factor(params->width, params->zoom);
-    unsigned int data_height = scale_by_zoom_factor(params->height, params->zoom);
+struct pt_png_decode_chunk {
+    uint8_t *buf;
 
-    // input pixels per output pixel
-    unsigned int pixel_size = scale_by_zoom_factor(1, params->zoom);
+    unsigned row, rows;
 
-    // bytes per output pixel
-    size_t pixel_bytes = 3;
+    /** Filled, and not yet stored */
+    bool busy;
+};
 
-    // size of the output tile in px
-    unsigned int row_width = params->width;
+/**
+ * Shared state for pt_png_decode_pipelined
+ */
+struct pt_png_decode_pipeline {
+    const struct pt_png_header *header;
+    const struct pt_png_out *out;
+    const uint8_t *background_pixel;
 
-    // size of an output row in bytes (RGB)
-    size_t row_bytes = row_width * 3;
+    /** Ring of chunks */
+    struct pt_png_decode_chunk *chunks;
+    unsigned count;
 
-    // buffer to hold output rows
-    uint8_t *row_buf;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
 
-    // color entry for pixel
-    png_color c = header->palette[0];
+    /** Sequence number of the next chunk to fill and to store */
+    unsigned fill, store;
 
-    // only supports zooming out...
-    if (params->zoom < 0)
-        return -PT_ERR_TILE_ZOOM;
+    /** No more chunks will be filled */
+    bool done;
 
-    if ((row_buf = malloc(row_bytes)) == NULL)
-        return -PT_ERR_MEM;
+    /** First error, stops all threads */
+    int err;
+};
 
-    // suppress warning...
-    (void) data_height;
+/**
+ * Store chunks in the order that they were filled, until done
+ */
+static void *pt_png_decode_store_thread (void *arg)
+{
+    struct pt_png_decode_pipeline *pipeline = arg;
 
-    // define pixel format: 8bpp RGB
-    png_set_IHDR(img->png, img->info, params->width, params->height, 8, PNG_COLOR_TYPE_RGB,
-            PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT
-    );
+    pthread_mutex_lock(&pipeline->lock);
 
-    // write meta-info
-    png_write_info(img->png, img->info);
+    for (;;) {
+        struct pt_png_decode_chunk *chunk;
+        int err;
 
-    // ...each output row
-    for (unsigned int out_row = 0; out_row < params->height; out_row++) {
-        memset(row_buf, 0, row_bytes);
+        while (!pipeline->err && !pipeline->done && pipeline->store == pipeline->fill)
+            pthread_cond_wait(&pipeline->cond, &pipeline->lock);
 
-        // ...includes pixels starting from this row.
-        unsigned int in_row_offset = params->y + scale_by_zoom_factor(out_row, params->zoom);
+        if (pipeline->err || pipeline->store == pipeline->fill)
+            break;
 
-        // ...each out row includes pixel_size in rows
-        for (unsigned int in_row = in_row_offset; in_row < in_row_offset + pixel_size && in_row < header->height; in_row++) {
-            // and includes each input pixel
-            for (unsigned int in_col = params->x; in_col < params->x + data_width && in_col < header->width; in_col++) {
+        chunk = &pipeline->chunks[pipeline->store++ % pipeline->count];
 
-                // ...for this output pixel
-                unsigned int out_col = scale_by_zoom_factor(in_col - params->x, -params->zoom);
+        pthread_mutex_unlock(&pipeline->lock);
 
-                // get pixel RGB data
-                png_pixel_data(&c, header, data, in_row, in_col);
+        err = pt_png_store(pipeline->header, pipeline->out, chunk->buf, chunk->row, chunk->rows, pipeline->background_pixel);
 
-                // average the RGB data
-                ADD_AVG(row_buf[out_col * pixel_bytes + 0], c.red);
-                ADD_AVG(row_buf[out_col * pixel_bytes + 1], c.green);
-                ADD_AVG(row_buf[out_col * pixel_bytes + 2], c.blue);
-            }
-        }
+        pthread_mutex_lock(&pipeline->lock);
 
-        // output
-        png_write_row(img->png, row_buf);
+        chunk->busy = false;
+
+        if (err && !pipeline->err)
+            pipeline->err = err;
+
+        pthread_cond_broadcast(&pipeline->cond);
     }
 
-    // done
-    return 0;
+    pthread_mutex_unlock(&pipeline->lock);
+
+    return NULL;
 }
 
-int pt_png_tile (const struct pt_png_header *header, const uint8_t *data, struct pt_tile *tile)
+/**
+ * Decode rows on the calling thread, and store them on separate threads.
+ *
+ * Blocks written out via out->write_block must be written in order, so they only use a single store thread.
+ */
+static int pt_png_decode_pipelined (struct pt_png_img *img, const struct pt_png_header *header, const struct pt_png_out *out, const uint8_t *background_pixel, unsigned threads)
 {
-    struct pt_png_img _img, *img = &_img;
-    struct pt_tile_params *params = &tile->params;
-    int err;
+    unsigned block_height = out->layout->block_height;
+    struct pt_png_decode_pipeline pipeline = {
+        .header = header,
+        .out = out,
+        .background_pixel = background_pixel,
+    };
+    pthread_t *thread_ids;
+    unsigned started = 0;
+    int err = 0;
 
-    // init img
-    memset(img, 0, sizeof(*img));
+    if (out->write_block)
+        threads = 1;
 
-    // check within bounds
-    if (params->x >= header->width || params->y >= header->height)
-        // completely outside
-        return -PT_ERR_TILE_CLIP;
+    // one chunk being decoded and one waiting for each store thread
+    pipeline.count = threads + 1;
 
-    // open PNG writer
-    if ((img->png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL)) == NULL) {
-        err = -PT_ERR_PNG_CREATE;
-        goto error;
+    if ((thread_ids = calloc(threads, sizeof(*thread_ids))) == NULL)
+        return -PT_ERR_MEM;
+
+    if ((pipeline.chunks = calloc(pipeline.count, sizeof(*pipeline.chunks))) == NULL) {
+        free(thread_ids);
+        return -PT_ERR_MEM;
     }
 
-    if ((img->info = png_create_info_struct(img->png)) == NULL) {
-        err = -PT_ERR_PNG_CREATE;
-        goto error;
+    for (unsigned i = 0; i < pipeline.count; i++) {
+        if ((pipeline.chunks[i].buf = malloc(block_height * (size_t) header->row_bytes)) == NULL) {
+            err = -PT_ERR_MEM;
+            goto error;
+        }
+    }
+
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.cond, NULL);
+
+    for (; started < threads; started++) {
+        if ((err = pthread_create(&thread_ids[started], NULL, pt_png_decode_store_thread, &pipeline))) {
+            PT_WARN("pthread_create: %s", strerror(err));
+            err = 0;
+            break;
+        }
     }
 
+    PT_DEBUG("width=%u height=%u threads=%u", header->width, header->height, started);
+
     // libpng error trap
     if (setjmp(png_jmpbuf(img->png))) {
         err = -PT_ERR_PNG;
-        goto error;
+        goto stop;
     }
 
-    // setup output I/O
-    switch (tile->out_type) {
-        case PT_TILE_OUT_FILE:
-            // use default FILE* operation
-            // do NOT store in img->fh
-            png_init_io(img->png, tile->out.file);
+    // decode a chunk at a time, aligned to the rows of blocks in the output
+    for (unsigned row = 0; row < header->height; ) {
+        unsigned rows = min(block_height - (out->row + row) % block_height, header->height - row);
+        struct pt_png_decode_chunk *chunk = &pipeline.chunks[pipeline.fill % pipeline.count];
+        bool failed;
 
-            break;
+        // wait for the chunk to be stored
+        pthread_mutex_lock(&pipeline.lock);
+
+        while (chunk->busy && !pipeline.err)
+            pthread_cond_wait(&pipeline.cond, &pipeline.lock);
 
-        case PT_TILE_OUT_MEM:
-            // use pt_tile_mem struct via pt_png_mem_* callbacks
-            png_set_write_fn(img->png, &tile->out.mem, pt_png_mem_write, pt_png_mem_flush);
+        failed = pipeline.err;
 
+        pthread_mutex_unlock(&pipeline.lock);
+
+        if (failed)
             break;
 
-        default:
-            PT_ABORT("tile->out_type: %d", tile->out_type);
+        // read row data, non-interlaced
+        for (unsigned r = 0; r < rows; r++) {
+            png_read_row(img->png, chunk->buf + r * header->row_bytes, NULL);
+        }
+
+        chunk->row = row;
+        chunk->rows = rows;
+        row += rows;
+
+        if ((err = pt_progress_rows(out->progress, rows)))
+            goto stop;
+
+        if (!started) {
+            // no store threads, store on the calling thread instead
+            if ((err = pt_png_store(header, out, chunk->buf, chunk->row, chunk->rows, background_pixel)))
+                goto stop;
+
+            continue;
+        }
+
+        // pass to the store threads
+        pthread_mutex_lock(&pipeline.lock);
+
+        chunk->busy = true;
+        pipeline.fill++;
+
+        pthread_cond_broadcast(&pipeline.cond);
+        pthread_mutex_unlock(&pipeline.lock);
     }
 
+    // finish off, ignore trailing data
+    pthread_mutex_lock(&pipeline.lock);
+    err = pipeline.err;
+    pthread_mutex_unlock(&pipeline.lock);
 
+    if (!err)
+        png_read_end(img->png, NULL);
 
-    // unscaled or scaled?
-    if (params->zoom)
-        err = pt_png_encode_zoomed(img, header, data, params);
+stop:
+    // let the store threads finish, or abort them
+    pthread_mutex_lock(&pipeline.lock);
 
-    else
-        err = pt_png_encode_unzoomed(img, header, data, params);
+    pipeline.done = true;
 
-    if (err)
-        goto error;
+    if (err && !pipeline.err)
+        pipeline.err = err;
 
+    pthread_cond_broadcast(&pipeline.cond);
+    pthread_mutex_unlock(&pipeline.lock);
 
-    // flush remaining output
-    png_write_flush(img->png);
+    for (unsigned i = 0; i < started; i++)
+        pthread_join(thread_ids[i], NULL);
 
-    // done
-    png_write_end(img->png, img->info);
+    err = pipeline.err;
+
+    pthread_cond_destroy(&pipeline.cond);
+    pthread_mutex_destroy(&pipeline.lock);
 
 error:
-    // cleanup
-    pt_png_release_write(img);
+    for (unsigned i = 0; i < pipeline.count; i++)
+        free(pipeline.chunks[i].buf);
+
+    free(pipeline.chunks);
+    free(thread_ids);
 
     return err;
 }
 
+/**
+ * Compute the background pattern used to skip sparse regions, if any
+ *
+ * @return background, or NULL if not used
+ */
+static const uint8_t *pt_png_decode_background (uint8_t background[PT_SPARSE_PATTERN_SIZE], const struct pt_png_header *header, const struct pt_image_params *params)
+{
+    uint8_t fill[PT_PNG_COL_BYTES_MAX];
+
+    if (!params || !(params->flags & PT_IMAGE_BACKGROUND_PIXEL))
+        return NULL;
+
+    pt_png_fill_pixel(fill, header, params, 0);
+    pt_png_background_pattern(background, header, fill);
+
+    return background;
+}
+
+int pt_png_decode (struct pt_png_img *img, const struct pt_png_header *header, const struct pt_image_params *params, const struct pt_png_out *out)
+{
+    uint8_t background[PT_SPARSE_PATTERN_SIZE];
+    const uint8_t *background_pixel;
+    unsigned block_height = out->layout->block_height;
+
+    // chunk of pixel data, up to one row of blocks
+    uint8_t *buf;
+
+    int err;
+
+    // verify png header is compatible with output header
+    if ((err = pt_check_part_png_header(header, out))) {
+      return err;
+    }
+
+    // skip sparse regions?
+    background_pixel = pt_png_decode_background(background, header, params);
+
+    // store rows on separate threads
+    if (params && params->threads > 1)
+        return pt_png_decode_pipelined(img, header, out, background_pixel, params->threads - 1);
+
+    // alloc
+    if ((buf = malloc(block_height * (size_t) header->row_bytes)) == NULL)
+        return -PT_ERR_MEM;
+
+    // libpng error trap
+    if (setjmp(png_jmpbuf(img->png))) {
+        err = -PT_ERR_PNG;
+        goto error;
+    }
+
+    // decode a chunk at a time, aligned to the rows of blocks in the output
+    for (unsigned row = 0; row < header->height; ) {
+        unsigned rows = min(block_height - (out->row + row) % block_height, header->height - row);
+
+        // read row data, non-interlaced
+        for (unsigned r = 0; r < rows; r++) {
+            png_read_row(img->png, buf + r * header->row_bytes, NULL);
+        }
+
+        if ((err = pt_png_store(header, out, buf, row, rows, background_pixel)))
+            goto error;
+
+        if ((err = pt_progress_rows(out->progress, rows)))
+            goto error;
+
+        row += rows;
+    }
+
+    // finish off, ignore trailing data
+    png_read_end(img->png, NULL);
+
+error:
+    free(buf);
+
+    return err;
+}
+
+int pt_png_decode_resumable (const char *path, const struct pt_png_header *header, const struct pt_image_params *params, const struct pt_png_out *out, const struct pt_png_resume *resume)
+{
+    uint8_t background[PT_SPARSE_PATTERN_SIZE];
+    const uint8_t *background_pixel;
+    unsigned block_height = out->layout->block_height;
+    struct pt_idat idat;
+    struct timespec last, now;
+    long interval = PT_IMAGE_CHECKPOINT_INTERVAL;
+
+    // next row to decode, and the first row of the chunk containing it
+    unsigned row = 0, start = 0;
+
+    // chunk of pixel data, up to one row of blocks
+    uint8_t *buf;
+
+    int err;
+
+    if ((err = pt_check_part_png_header(header, out)))
+        return err;
+
+    background_pixel = pt_png_decode_background(background, header, params);
+
+    if (params && params->checkpoint_interval)
+        interval = params->checkpoint_interval;
+
+    if (resume) {
+        row = resume->point->row;
+        start = row - (out->row + row) % block_height;
+
+        if (resume->raw_len != resume->point->row_len || resume->rows_len != (row - start) * (size_t) header->row_bytes)
+            return -PT_ERR_PNG;
+    }
+
+    if ((buf = malloc(block_height * (size_t) header->row_bytes)) == NULL)
+        return -PT_ERR_MEM;
+
+    if (resume) {
+        PT_DEBUG("resume row=%u offset=%ld", row, (long) resume->point->offset);
+
+        memcpy(buf, resume->rows, resume->rows_len);
+
+        err = pt_idat_resume(&idat, path, header, resume->point, resume->prev, resume->prev_len, resume->raw);
+    } else {
+        err = pt_idat_open(&idat, path, header);
+    }
+
+    if (err)
+        goto error;
+
+    // the rows stored before the checkpoint
+    if ((err = pt_progress_rows(out->progress, start)))
+        goto error;
+
+    clock_gettime(CLOCK_MONOTONIC, &last);
+
+    // decode a chunk at a time, aligned to the rows of blocks in the output
+    while (start < header->height) {
+        unsigned rows = min(block_height - (out->row + start) % block_height, header->height - start);
+
+        for (; row < start + rows; row++) {
+            if ((err = pt_idat_read_row(&idat, buf + (row - start) * header->row_bytes)))
+                goto error;
+
+            // the chunks before this one have all been stored
+            if (idat.have_point) {
+                struct pt_png_resume state = {
+                    .point = &idat.point,
+                    .prev = idat.point_prev,
+                    .prev_len = pt_idat_prev_len(&idat),
+                    .raw = idat.point_raw,
+                    .raw_len = idat.point.row_len,
+                    .rows = buf,
+                    .rows_len = (idat.point.row - start) * (size_t) header->row_bytes,
+                };
+
+                if ((err = out->checkpoint(out->checkpoint_arg, &state)))
+                    goto error;
+
+                idat.have_point = false;
+
+                clock_gettime(CLOCK_MONOTONIC, &last);
+            }
+        }
+
+        if ((err = pt_png_store(header, out, buf, start, rows, background_pixel)))
+            goto error;
+
+        if ((err = pt_progress_rows(out->progress, rows)))
+            goto error;
+
+        start += rows;
+
+        // save a point at the end of the next deflate block
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        if (out->checkpoint && (now.tv_sec - last.tv_sec) * 1000 + (now.tv_nsec - last.tv_nsec) / 1000000 >= interval)
+            idat.want_point = true;
+    }
+
+    if ((err = pt_idat_finish(&idat)))
+        goto error;
+
+error:
+    pt_idat_close(&idat);
+    free(buf);
+
+    return err;
+}
+
+/**
+ * libpng I/O callback: write out data to the pt_tile output
+ */
+static void pt_png_tile_write (png_structp png, png_bytep data, png_size_t length)
+{
+    struct pt_tile *tile = png_get_io_ptr(png);
+
+    // error is kept in tile->out_err
+    if (pt_tile_write(tile, data, length))
+        png_error(png, "pt_tile_write: ...");
+}
+
+/**
+ * libpng I/O callback: flush buffered data, which is deferred until the end of the tile
+ */
+static void pt_png_tile_flush (png_structp png_ptr)
+{
+    // no-op
+}
+
+
+/**
+ * libpng memory callback: allocate from the pt_render_ctx
+ */
+static png_voidp pt_png_render_malloc (png_structp png, png_alloc_size_t size)
+{
+    return pt_render_malloc(png_get_mem_ptr(png), size);
+}
+
+/**
+ * libpng memory callback: release to the pt_render_ctx
+ */
+static void pt_png_render_free (png_structp png, png_voidp ptr)
+{
+    pt_render_free(png_get_mem_ptr(png), ptr);
+}
+
+/**
+ * Per-render state for reading pixel rows from a pt_png_in.
+ */
+struct pt_png_reader {
+    const struct pt_png_in *in;
+
+    /** Optional render context to allocate from */
+    struct pt_render_ctx *ctx;
+
+    /** Lazily initialized for compressed blocks, either _zs or kept in the render context */
+    z_stream *zs, _zs;
+    bool *zs_init, _zs_init;
+
+    /** Most recently read block for each column of blocks, for compressed blocks */
+    struct pt_png_reader_block {
+        size_t block;
+
+        /** Either buf, or the uncompressed block within in->data */
+        const uint8_t *data;
+
+        uint8_t *buf;
+    } *blocks;
+};
+
+static void pt_png_reader_init (struct pt_png_reader *reader, const struct pt_png_in *in, struct pt_render_ctx *ctx)
+{
+    memset(reader, 0, sizeof(*reader));
+
+    reader->in = in;
+    reader->ctx = ctx;
+
+    if (ctx) {
+        reader->zs = &ctx->zs;
+        reader->zs_init = &ctx->zs_init;
+    } else {
+        reader->zs = &reader->_zs;
+        reader->zs_init = &reader->_zs_init;
+    }
+}
+
+/**
+ * Fill \a width_px pixels of \a buf starting at pixel \a col with the pixel value of empty blocks
+ */
+static inline void tile_pixel_fill (const struct pt_png_in *in, png_byte *buf, unsigned int col, unsigned int width_px)
+{
+    size_t col_bytes = in->layout->col_bytes;
+    unsigned pixel_bits = in->layout->pixel_bits;
+
+    if (pixel_bits < 8) {
+        pt_png_bits_fill(buf, col * pixel_bits, pt_png_bits_pattern(in->fill[0], pixel_bits), width_px * pixel_bits);
+
+        return;
+    }
+
+    buf += col * col_bytes;
+
+    if (col_bytes == 1) {
+        memset(buf, in->fill[0], width_px);
+
+        return;
+    }
+
+    for (unsigned int c = 0; c < width_px; c++, buf += col_bytes)
+        memcpy(buf, in->fill, col_bytes);
+}
+
+/**
+ * Test if the given block is known to be empty, without touching the block data
+ */
+static inline bool tile_block_empty (const struct pt_png_in *in, size_t block)
+{
+    if (in->index)
+        return in->index[block] == in->index[block + 1];
+
+    if (in->occupancy)
+        return !(in->occupancy[block / 8] & (1 << (block % 8)));
+
+    return false;
+}
+
+/**
+ * Test if all blocks covering \a width_px pixels on \a rows rows, starting at \a row, \a col, are empty
+ */
+static bool tile_rows_empty (const struct pt_png_in *in, unsigned int row, unsigned int rows, unsigned int col, unsigned int width_px)
+{
+    const struct pt_png_layout *layout = in->layout;
+
+    if (!rows || !width_px || (!in->index && !in->occupancy))
+        return false;
+
+    for (unsigned int block_row = row / layout->block_height; block_row <= (row + rows - 1) / layout->block_height; block_row++) {
+        for (unsigned int block_col = col / layout->block_width; block_col <= (col + width_px - 1) / layout->block_width; block_col++) {
+            if (!tile_block_empty(in, (size_t) block_row * layout->block_cols + block_col))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Load the given compressed block into the reader slot
+ */
+static int pt_png_reader_load (struct pt_png_reader *reader, struct pt_png_reader_block *slot, size_t block)
+{
+    const struct pt_png_in *in = reader->in;
+    size_t block_bytes = in->layout->block_bytes;
+    size_t offset = in->index[block], len = in->index[block + 1] - offset;
+    const uint8_t *data = in->data + offset;
+    int err;
+
+    if (len == block_bytes) {
+        // stored as-is
+        slot->data = data;
+        slot->block = block;
+
+        return 0;
+    }
+
+    if (!slot->buf && (slot->buf = pt_render_malloc(reader->ctx, block_bytes)) == NULL)
+        return -PT_ERR_MEM;
+
+    if (len == 0) {
+        // empty background block
+        tile_pixel_fill(in, slot->buf, 0, in->layout->block_width * in->layout->block_height);
+
+    } else if (in->block_cache && pt_block_cache_get(in->block_cache, data, slot->buf, block_bytes)) {
+        // shared with other renders
+
+    } else {
+        if (!*reader->zs_init) {
+            if ((err = pt_block_inflate_init(reader->zs)))
+                return err;
+
+            *reader->zs_init = true;
+        }
+
+        if ((err = pt_block_inflate(reader->zs, data, len, slot->buf, block_bytes)))
+            return err;
+
+        if (in->block_cache)
+            pt_block_cache_put(in->block_cache, data, slot->buf, block_bytes);
+    }
+
+    slot->data = slot->buf;
+    slot->block = block;
+
+    return 0;
+}
+
+/**
+ * Return a pointer to the pixel data on \a row, starting at the left edge of the block containing \a col.
+ *
+ * The data is only contiguous up to the right edge of the block.
+ */
+static int tile_row_col (struct pt_png_reader *reader, size_t row, size_t col, const uint8_t **ptr)
+{
+    const struct pt_png_in *in = reader->in;
+    const struct pt_png_layout *layout = in->layout;
+    struct pt_png_reader_block *slot;
+    size_t block_col = col / layout->block_width;
+    size_t block = (row / layout->block_height) * layout->block_cols + block_col;
+    int err;
+
+    if (!in->index) {
+        *ptr = in->data + pt_png_data_offset(layout, row, col - col % layout->block_width);
+
+        return 0;
+    }
+
+    if (!reader->blocks && (reader->blocks = pt_render_calloc(reader->ctx, layout->block_cols * sizeof(*reader->blocks))) == NULL)
+        return -PT_ERR_MEM;
+
+    slot = &reader->blocks[block_col];
+
+    if ((!slot->data || slot->block != block) && (err = pt_png_reader_load(reader, slot, block)))
+        return err;
+
+    *ptr = slot->data + (row % layout->block_height) * layout->block_row_bytes;
+
+    return 0;
+}
+
+/**
+ * Test if the uncompressed data for \a width_px pixels on \a row, starting at \a col, lies within a hole
+ */
+static bool tile_row_hole (const struct pt_png_in *in, unsigned int row, unsigned int col, unsigned int width_px)
+{
+    const struct pt_png_layout *layout = in->layout;
+    size_t bit = (col % layout->block_width) * layout->pixel_bits % 8;
+
+    return pt_sparse_map_hole(in->holes, in->data + pt_png_data_offset(layout, row, col), (bit + width_px * layout->pixel_bits + 7) / 8);
+}
+
+/**
+ * Copy \a width_px pixels of data on \a row, starting at \a col, from each block into \a buf.
+ *
+ * Bit-packed pixels are copied as bit-packed.
+ */
+static int tile_row_read (struct pt_png_reader *reader, png_byte *buf, unsigned int row, unsigned int col, unsigned int width_px)
+{
+    const struct pt_png_in *in = reader->in;
+    const struct pt_png_layout *layout = in->layout;
+    size_t block_row = (size_t) (row / layout->block_height) * layout->block_cols;
+    unsigned int buf_col = 0;
+    const uint8_t *ptr;
+    int err;
+
+    while (width_px) {
+        // up to the edge of the block
+        unsigned int block_px = min(layout->block_width - col % layout->block_width, width_px);
+
+        if (tile_block_empty(in, block_row + col / layout->block_width)) {
+            // do not touch the sparse data
+            tile_pixel_fill(in, buf, buf_col, block_px);
+
+        } else if (in->holes && tile_row_hole(in, row, col, block_px)) {
+            // reads as zero, do not touch the sparse file
+            if (layout->pixel_bits < 8)
+                pt_png_bits_fill(buf, buf_col * layout->pixel_bits, 0, block_px * layout->pixel_bits);
+            else
+                memset(buf + buf_col * layout->col_bytes, 0, block_px * layout->col_bytes);
+
+        } else {
+            if ((err = tile_row_col(reader, row, col, &ptr)))
+                return err;
+
+            pt_png_pixels_copy(buf, buf_col, ptr, col % layout->block_width, block_px, layout->pixel_bits);
+        }
+
+        buf_col += block_px;
+        col += block_px;
+        width_px -= block_px;
+    }
+
+    return 0;
+}
+
+/**
+ * Unpack a row of \a width_px bit-packed pixels in \a buf to one byte per pixel, in place
+ */
+static void tile_row_unpack (const struct pt_png_header *header, png_byte *buf, unsigned int width_px)
+{
+    if (header->pixel_bits >= 8)
+        return;
+
+    // backwards, as each pixel is unpacked at or after its packed offset
+    for (unsigned int col = width_px; col-- > 0; )
+        buf[col] = pt_png_bits_get(buf, col * header->pixel_bits, header->pixel_bits);
+}
+
+static void pt_png_reader_release (struct pt_png_reader *reader)
+{
+    if (reader->blocks) {
+        for (unsigned i = 0; i < reader->in->layout->block_cols; i++)
+            pt_render_free(reader->ctx, reader->blocks[i].buf);
+
+        pt_render_free(reader->ctx, reader->blocks);
+    }
+
+    // the render context keeps its inflate stream
+    if (reader->_zs_init)
+        pt_block_inflate_end(&reader->_zs);
+}
+
+/**
+ * Check the tile encoder settings
+ */
+static int pt_png_encode_check (const struct pt_tile_params *params)
+{
+    if (params->profile < PT_TILE_PROFILE_DEFAULT || params->profile > PT_TILE_PROFILE_SMALL)
+        return -PT_ERR_TILE_ENCODE;
+
+    if (params->encoder < PT_TILE_ENCODER_AUTO || params->encoder > PT_TILE_ENCODER_BUILTIN)
+        return -PT_ERR_TILE_ENCODE;
+
+    if ((params->flags & PT_TILE_LEVEL) && (params->level < 0 || params->level > 9))
+        return -PT_ERR_TILE_ENCODE;
+
+    if ((params->flags & PT_TILE_STRATEGY) && (params->strategy < Z_DEFAULT_STRATEGY || params->strategy > Z_FIXED))
+        return -PT_ERR_TILE_ENCODE;
+
+    if ((params->flags & PT_TILE_FILTERS) && (!params->filters || params->filters & ~PNG_ALL_FILTERS))
+        return -PT_ERR_TILE_ENCODE;
+
+    if ((params->flags & PT_TILE_WINDOW_BITS) && (params->window_bits < 8 || params->window_bits > 15))
+        return -PT_ERR_TILE_ENCODE;
+
+    if ((params->flags & PT_TILE_MEM_LEVEL) && (params->mem_level < 1 || params->mem_level > 9))
+        return -PT_ERR_TILE_ENCODE;
+
+    if (params->zoom_mode < PT_TILE_ZOOM_AVERAGE || params->zoom_mode > PT_TILE_ZOOM_DOMINANT)
+        return -PT_ERR_TILE_ZOOM;
+
+    return 0;
+}
+
+/**
+ * Resolve the encoder settings for the tile's profile and settings, for the given output pixel format
+ */
+static void pt_png_encode_settings (struct pt_encode_settings *settings, const struct pt_tile_params *params, int color_type, int bit_depth)
+{
+    // -1 leaves the libpng default
+    *settings = (struct pt_encode_settings) { -1, -1, -1, -1, -1 };
+
+    switch (params->profile) {
+        case PT_TILE_PROFILE_DEFAULT:
+            break;
+
+        case PT_TILE_PROFILE_FAST:
+            settings->level = 1;
+            settings->strategy = Z_RLE;
+
+            // palette indexes do not filter well
+            if (color_type == PNG_COLOR_TYPE_PALETTE || bit_depth < 8)
+                settings->filters = PNG_FILTER_NONE;
+            else
+                settings->filters = PNG_FILTER_SUB;
+
+            // the rows repeated when zooming in filter away to nothing, as Z_RLE does not reach back to the previous row
+            if (params->zoom < 0)
+                settings->filters |= PNG_FILTER_UP;
+
+            break;
+
+        case PT_TILE_PROFILE_SMALL:
+            settings->level = 9;
+            settings->window_bits = 15;
+            settings->mem_level = 9;
+
+            break;
+    }
+
+    if (params->flags & PT_TILE_LEVEL)
+        settings->level = params->level;
+
+    if (params->flags & PT_TILE_STRATEGY)
+        settings->strategy = params->strategy;
+
+    if (params->flags & PT_TILE_FILTERS)
+        settings->filters = params->filters;
+
+    if (params->flags & PT_TILE_WINDOW_BITS)
+        settings->window_bits = params->window_bits;
+
+    if (params->flags & PT_TILE_MEM_LEVEL)
+        settings->mem_level = params->mem_level;
+}
+
+/**
+ * Test if the tile is to be encoded using the built-in encoder, for the given output bit depth
+ */
+static bool pt_png_encode_builtin (const struct pt_tile_params *params, int color_type, int bit_depth)
+{
+    switch (params->encoder) {
+        case PT_TILE_ENCODER_AUTO:
+            return params->profile == PT_TILE_PROFILE_FAST && pt_encode_supported(color_type, bit_depth);
+
+        case PT_TILE_ENCODER_LIBPNG:
+            return false;
+
+        case PT_TILE_ENCODER_BUILTIN:
+            return pt_encode_supported(color_type, bit_depth);
+    }
+
+    return false;
+}
+
+/**
+ * Output for the encoded tile, using either libpng or the built-in encoder
+ */
+struct pt_png_writer {
+    /** libpng state */
+    struct pt_png_img *img;
+
+    /** Built-in encoder state, writing into out */
+    bool builtin;
+    struct pt_encoder encoder;
+    struct pt_tile_mem *out;
+
+    struct pt_render_ctx *ctx;
+
+    /** Row buffers and box filter of the pt_png_encode_* functions, which libpng errors longjmp out of */
+    uint8_t *row_buf, *in_buf;
+    struct pt_zoom zoom;
+};
+
+/**
+ * Release the buffers used to encode the tile, once done or after an error
+ */
+static void pt_png_writer_release (struct pt_png_writer *writer)
+{
+    pt_zoom_release(&writer->zoom);
+    pt_render_free(writer->ctx, writer->in_buf);
+    pt_render_free(writer->ctx, writer->row_buf);
+
+    writer->in_buf = NULL;
+    writer->row_buf = NULL;
+}
+
+/**
+ * Set up the encoder, and write out the image header.
+ *
+ * @param bit_depth output bit depth, which may be less than 8 for libpng only
+ * @param packing the rows have sub-8-bit pixels unpacked to one byte per pixel, for libpng only
+ */
+static int pt_png_write_begin (struct pt_png_writer *writer, const struct pt_tile_params *params, const struct pt_encode_format *format, int bit_depth, bool packing)
+{
+    struct pt_png_img *img = writer->img;
+    struct pt_encode_settings settings;
+
+    pt_png_encode_settings(&settings, params, format->color_type, bit_depth);
+
+    if (writer->builtin)
+        return pt_encode_begin(&writer->encoder, writer->ctx, &settings, format, writer->out);
+
+    // set basic info
+    png_set_IHDR(img->png, img->info, format->width, format->height, bit_depth, format->color_type,
+            PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT
+    );
+
+    // set palette?
+    if (format->color_type == PNG_COLOR_TYPE_PALETTE)
+        // oops... missing const
+        png_set_PLTE(img->png, img->info, (png_colorp) format->palette, format->num_palette);
+
+    if (settings.level >= 0)
+        png_set_compression_level(img->png, settings.level);
+
+    if (settings.strategy >= 0)
+        png_set_compression_strategy(img->png, settings.strategy);
+
+    if (settings.filters >= 0)
+        png_set_filter(img->png, PNG_FILTER_TYPE_BASE, settings.filters);
+
+    if (settings.window_bits >= 0)
+        png_set_compression_window_bits(img->png, settings.window_bits);
+
+    if (settings.mem_level >= 0)
+        png_set_compression_mem_level(img->png, settings.mem_level);
+
+    // write meta-info
+    png_write_info(img->png, img->info);
+
+    if (packing)
+        png_set_packing(img->png);
+
+    return 0;
+}
+
+/**
+ * Write out the next row of pixels
+ */
+static inline int pt_png_write_row (struct pt_png_writer *writer, const uint8_t *row)
+{
+    if (writer->builtin)
+        return pt_encode_row(&writer->encoder, row);
+
+    // oops... missing const
+    png_write_row(writer->img->png, (png_bytep) row);
+
+    return 0;
+}
+
+/**
+ * Write out the end of the image
+ */
+static int pt_png_write_end (struct pt_png_writer *writer)
+{
+    if (writer->builtin)
+        return pt_encode_end(&writer->encoder);
+
+    // flush remaining output
+    png_write_flush(writer->img->png);
+
+    // done
+    png_write_end(writer->img->png, writer->img->info);
+
+    return 0;
+}
+
+/**
+ * Write raw tile image data, directly from the cache
+ */
+static int pt_png_encode_direct (struct pt_png_writer *writer, struct pt_png_reader *reader, const struct pt_tile_params *params)
+{
+    const struct pt_png_in *in = reader->in;
+    png_byte *rowbuf;
+    bool empty = false;
+    int err = 0;
+
+    // allocate buffer for a single row of image data, zeroing any padding bits
+    if ((rowbuf = writer->row_buf = pt_render_calloc(reader->ctx, params->width * in->header->col_bytes)) == NULL)
+        return -PT_ERR_MEM;
+
+    for (unsigned int row = params->y; row < params->y + params->height; row++) {
+        // rows across only empty blocks are all the same
+        if (row == params->y || row % in->layout->block_height == 0) {
+            if ((empty = tile_rows_empty(in, row, 1, params->x, params->width)))
+                tile_pixel_fill(in, rowbuf, 0, params->width);
+        }
+
+        // gather from blocks
+        if (!empty && (err = tile_row_read(reader, rowbuf, row, params->x, params->width)))
+            break;
+
+        if ((err = pt_png_write_row(writer, rowbuf)))
+            break;
+    }
+
+    return err;
+}
+
+/**
+ * Fill in a clipped region of \a width_px pixels at the given row segment, starting at pixel \a col
+ */
+static inline void tile_row_fill_clip (const struct pt_png_header *header, png_byte *row, unsigned int col, unsigned int width_px)
+{
+    // XXX: use a configureable background color, or full transparency?
+    if (header->pixel_bits < 8)
+        pt_png_bits_fill(row, col * header->pixel_bits, 0x00, width_px * header->pixel_bits);
+    else
+        memset(row + col * header->col_bytes, /* 0xd7 */ 0x00, width_px * header->col_bytes);
+}
+
+/**
+ * Write clipped tile image data (a tile that goes over the edge of the actual image) by aligning the data from the cache as needed
+ */
+static int pt_png_encode_clipped (struct pt_png_writer *writer, struct pt_png_reader *reader, const struct pt_tile_params *params)
+{
+    const struct pt_png_in *in = reader->in;
+    const struct pt_png_header *header = in->header;
+    png_byte *rowbuf;
+    unsigned int row;
+    bool empty = false;
+    int err = 0;
+
+    // image data goes from (params->x ... clip_x, params->y ... clip_y), remaining region is filled
+    unsigned int clip_x, clip_y;
+
+
+    // fit the left/bottom edge against the image dimensions
+    clip_x = min(params->x + params->width, header->width);
+    clip_y = min(params->y + params->height, header->height);
+
+
+    // allocate buffer for a single row of image data, zeroing any padding bits
+    if ((rowbuf = writer->row_buf = pt_render_calloc(reader->ctx, params->width * header->col_bytes)) == NULL)
+        return -PT_ERR_MEM;
+
+    // how much data we actually have for each row, in px
+    // from [(paramsle x)---](clip x)
+    unsigned int row_px = clip_x - params->x;
+
+    // write the rows that we have
+    // from [(tile y]---](clip y)
+    for (row = params->y; row < clip_y; row++) {
+        // rows across only empty blocks are all the same
+        if (row == params->y || row % in->layout->block_height == 0) {
+            if ((empty = tile_rows_empty(in, row, 1, params->x, row_px)))
+                tile_pixel_fill(in, rowbuf, 0, row_px);
+        }
+
+        // copy in the actual tile data...
+        if (!empty && (err = tile_row_read(reader, rowbuf, row, params->x, row_px)))
+            return err;
+
+        // generate the data for the remaining, clipped, columns
+        tile_row_fill_clip(header, rowbuf, row_px, (params->width - row_px));
+
+        // write
+        if ((err = pt_png_write_row(writer, rowbuf)))
+            return err;
+    }
+
+    // generate the data for the remaining, clipped, rows
+    tile_row_fill_clip(header, rowbuf, 0, params->width);
+
+    // write out the remaining rows as clipped data
+    for (; row < params->y + params->height; row++) {
+        if ((err = pt_png_write_row(writer, rowbuf)))
+            return err;
+    }
+
+    return 0;
+}
+
+/**
+ * Write unscaled tile data
+ */
+static int pt_png_encode_unzoomed (struct pt_png_writer *writer, struct pt_png_reader *reader, const struct pt_tile_params *params)
+{
+    const struct pt_png_header *header = reader->in->header;
+    struct pt_encode_format format = {
+        .width          = params->width,
+        .height         = params->height,
+        .color_type     = header->color_type,
+        .col_bytes      = header->col_bytes,
+        .palette        = header->palette,
+        .num_palette    = header->num_palette,
+    };
+    int err;
+
+    // our pixel data is packed into 1 pixel per byte (8bpp or 16bpp), unless kept bit-packed
+    if ((err = pt_png_write_begin(writer, params, &format, header->bit_depth, header->pixel_bits >= 8)))
+        return err;
+
+    // figure out if the tile clips
+    if (params->x + params->width <= header->width && params->y + params->height <= header->height)
+        // doesn't clip, just use the raw data
+        err = pt_png_encode_direct(writer, reader, params);
+
+    else
+        // fill in clipped regions
+        err = pt_png_encode_clipped(writer, reader, params);
+
+    return err;
+}
+
+/**
+ * Manipulate powers of two, rounding up when zooming in to cover any partial pixels
+ */
+static inline unsigned int scale_by_zoom_factor (unsigned int value, int z)
+{
+    if (z > 0)
+        return value << z;
+
+    else if (z < 0)
+        return value ? ((value - 1) >> -z) + 1 : 0;
+
+    else
+        return value;
+}
+
+/**
+ * Converts a pixel's data into a png_color
+ */
+static inline void png_pixel_data (png_color *c, const struct pt_png_header *header, const uint8_t *p)
+{
+    if (header->bit_depth == 8) {
+        switch (header->color_type) {
+            case PNG_COLOR_TYPE_RGB:
+            case PNG_COLOR_TYPE_RGB_ALPHA:
+                c->red   = p[0];
+                c->green = p[1];
+                c->blue  = p[2];
+
+                return;
+        }
+    }
+
+    if (header->bit_depth <= 8) {
+        // unpacked to one byte per pixel
+        switch (header->color_type) {
+            case PNG_COLOR_TYPE_PALETTE:
+                // hrhr - assume our working data is valid (or we have 255 palette entries, so it doesn't matter...)
+                assert(*p < header->num_palette);
+
+                // reference data from palette
+                *c = header->palette[*p];
+
+                return;
+
+            case PNG_COLOR_TYPE_GRAY:
+                // scale up to 8 bits
+                c->red = c->green = c->blue = *p * 255 / ((1 << header->bit_depth) - 1);
+
+                return;
+        }
+    }
+
+    // unknown pixel format
+    return;
+}
+
+int pt_png_zoom_header (struct pt_png_header *zoom_header, const struct pt_png_header *header, int zoom)
+{
+    // pixel formats supported by png_pixel_data
+    switch (header->color_type) {
+        case PNG_COLOR_TYPE_RGB:
+        case PNG_COLOR_TYPE_RGB_ALPHA:
+            if (header->bit_depth != 8)
+                return -PT_ERR_IMG_FORMAT;
+
+            break;
+
+        case PNG_COLOR_TYPE_PALETTE:
+        case PNG_COLOR_TYPE_GRAY:
+            if (header->bit_depth > 8)
+                return -PT_ERR_IMG_FORMAT;
+
+            break;
+
+        default:
+            return -PT_ERR_IMG_FORMAT;
+    }
+
+    memset(zoom_header, 0, sizeof(*zoom_header));
+
+    // round up to include any partial pixels along the edges
+    zoom_header->width = ((header->width - 1) >> zoom) + 1;
+    zoom_header->height = ((header->height - 1) >> zoom) + 1;
+
+    // 8bpp RGB
+    zoom_header->bit_depth = 8;
+    zoom_header->color_type = PNG_COLOR_TYPE_RGB;
+    zoom_header->col_bytes = 3;
+    zoom_header->pixel_bits = 24;
+    zoom_header->row_bytes = zoom_header->width * zoom_header->col_bytes;
+
+    // keep any palette, for zooming out into palette tiles
+    zoom_header->num_palette = header->num_palette;
+    memcpy(zoom_header->palette, header->palette, header->num_palette * sizeof(*header->palette));
+
+    return 0;
+}
+
+void pt_png_fill_pixel (uint8_t fill[PT_PNG_COL_BYTES_MAX], const struct pt_png_header *header, const struct pt_image_params *params, int zoom)
+{
+    png_color c = { 0, 0, 0 };
+
+    memset(fill, 0, PT_PNG_COL_BYTES_MAX);
+
+    if (params && (params->flags & PT_IMAGE_BACKGROUND_PIXEL))
+        memcpy(fill, params->background_pixel, min(header->col_bytes, sizeof(params->background_pixel)));
+
+    // the pixel value, for bit-packed pixels
+    if (header->pixel_bits < 8)
+        fill[0] &= (1 << header->pixel_bits) - 1;
+
+    if (zoom) {
+        // downsampled as 8bpp RGB
+        png_pixel_data(&c, header, fill);
+
+        memset(fill, 0, PT_PNG_COL_BYTES_MAX);
+
+        fill[0] = c.red;
+        fill[1] = c.green;
+        fill[2] = c.blue;
+    }
+}
+
+/**
+ * Downsampling state of each zoom level built by pt_png_downsample
+ */
+struct pt_png_downsample_level {
+    const struct pt_png_out *out;
+
+    /** Box filter of the full-size input rows, by 2^zoom */
+    struct pt_zoom zoom;
+
+    /** Blocks downsampled from empty blocks are also left empty */
+    uint8_t background[PT_SPARSE_PATTERN_SIZE];
+
+    /** Chunk of output pixel data, up to one row of blocks, of rows starting from row */
+    uint8_t *buf;
+    unsigned row, rows;
+};
+
+int pt_png_downsample (const struct pt_png_in *in, const struct pt_png_out out[], int levels)
+{
+    // one row of input pixel data
+    uint8_t *in_buf = NULL;
+
+    png_color c = in->header->palette[0];
+    struct pt_png_downsample_level *zoom_levels;
+    struct pt_png_reader reader;
+    int err = 0;
+
+    uint8_t fill[3];
+
+    png_pixel_data(&c, in->header, in->fill);
+
+    fill[0] = c.red;
+    fill[1] = c.green;
+    fill[2] = c.blue;
+
+    if ((zoom_levels = calloc(levels, sizeof(*zoom_levels))) == NULL)
+        return -PT_ERR_MEM;
+
+    pt_png_reader_init(&reader, in, NULL);
+
+    for (int z = 1; z <= levels; z++) {
+        struct pt_png_downsample_level *level = &zoom_levels[z - 1];
+        const struct pt_png_header *header = out[z - 1].header;
+
+        level->out = &out[z - 1];
+
+        pt_png_background_pattern(level->background, header, fill);
+
+        // each output pixel averages up to 2^z x 2^z input pixels
+        if ((err = pt_zoom_begin(&level->zoom, NULL, in->header, z, in->header->width, PT_TILE_ZOOM_AVERAGE, NULL)))
+            goto error;
+
+        if ((level->buf = malloc(out[z - 1].layout->block_height * (size_t) header->row_bytes)) == NULL) {
+            err = -PT_ERR_MEM;
+            goto error;
+        }
+    }
+
+    if ((in_buf = malloc(in->header->width * (size_t) in->header->col_bytes)) == NULL) {
+        err = -PT_ERR_MEM;
+        goto error;
+    }
+
+    // each input row is read once, and added to each zoom level from the full-size pixels, as averaging the rounded
+    // pixels of the previous level would not be exact
+    for (unsigned in_row = 0; in_row < in->header->height; in_row++) {
+        if ((err = tile_row_read(&reader, in_buf, in_row, 0, in->header->width)))
+            goto error;
+
+        tile_row_unpack(in->header, in_buf, in->header->width);
+
+        for (int z = 1; z <= levels; z++) {
+            struct pt_png_downsample_level *level = &zoom_levels[z - 1];
+            const struct pt_png_header *header = level->out->header;
+
+            pt_zoom_row(&level->zoom, in_buf);
+
+            // output row is complete at the last input row it covers
+            if ((in_row + 1) % (1u << z) && in_row + 1 < in->header->height)
+                continue;
+
+            pt_zoom_out(&level->zoom, level->buf + level->rows * header->row_bytes);
+
+            // store each full row of blocks
+            if (++level->rows < min(level->out->layout->block_height, header->height - level->row))
+                continue;
+
+            if ((err = pt_png_store(header, level->out, level->buf, level->row, level->rows, level->background)))
+                goto error;
+
+            level->row += level->rows;
+            level->rows = 0;
+        }
+    }
+
+error:
+    for (int z = 1; z <= levels; z++) {
+        free(zoom_levels[z - 1].buf);
+        pt_zoom_release(&zoom_levels[z - 1].zoom);
+    }
+
+    free(zoom_levels);
+    free(in_buf);
+    pt_png_reader_release(&reader);
+
+    return err;
+}
+
+/**
+ * Write scaled tile data
+ */
+static int pt_png_encode_zoomed (struct pt_png_writer *writer, struct pt_png_reader *reader, const struct pt_tile_params *params)
+{
+    const struct pt_png_in *in = reader->in;
+    const struct pt_png_header *header = in->header;
+
+    // size of the image data in px
+    unsigned int data_width = scale_by_zoom_factor(params->width, params->zoom);
+    unsigned int data_height = scale_by_zoom_factor(params->height, params->zoom);
+
+    // input pixels per output pixel
+    unsigned int pixel_size = scale_by_zoom_factor(1, params->zoom);
+
+    // averaged RGB, or palette indexes
+    enum pt_tile_zoom_mode mode = pt_zoom_mode(header, params->zoom_mode);
+
+    // bytes per output pixel
+    size_t pixel_bytes = mode == PT_TILE_ZOOM_AVERAGE ? 3 : 1;
+
+    // size of the output tile in px
+    unsigned int row_width = params->width;
+
+    // size of an output row in bytes
+    size_t row_bytes = row_width * pixel_bytes;
+
+    // buffer to hold output rows
+    uint8_t *row_buf;
+
+    // size of an input row in px, clipped to the image
+    unsigned int in_width = min(data_width, header->width - params->x);
+
+    // buffer to hold input rows
+    uint8_t *in_buf;
+
+    // box filter of the input rows
+    struct pt_zoom *zoom = &writer->zoom;
+
+    // previous output row was from this many input rows across only empty blocks
+    unsigned int empty_rows = 0;
+
+    int err = 0;
+
+    // suppress warning...
+    (void) data_height;
+
+    if ((err = pt_zoom_begin(zoom, reader->ctx, header, params->zoom, in_width, params->zoom_mode, in->palette_lut)))
+        return err;
+
+    if ((row_buf = writer->row_buf = pt_render_calloc(reader->ctx, row_bytes)) == NULL)
+        return -PT_ERR_MEM;
+
+    if ((in_buf = writer->in_buf = pt_render_malloc(reader->ctx, in_width * header->col_bytes)) == NULL)
+        return -PT_ERR_MEM;
+
+    // define pixel format: 8bpp RGB, or 8bpp palette
+    struct pt_encode_format format = {
+        .width          = params->width,
+        .height         = params->height,
+        .color_type     = PNG_COLOR_TYPE_RGB,
+        .col_bytes      = pixel_bytes,
+    };
+
+    if (mode != PT_TILE_ZOOM_AVERAGE) {
+        format.color_type = PNG_COLOR_TYPE_PALETTE;
+        format.palette = header->palette;
+        format.num_palette = header->num_palette;
+    }
+
+    if ((err = pt_png_write_begin(writer, params, &format, 8, false)))
+        return err;
+
+    // ...each output row
+    for (unsigned int out_row = 0; out_row < params->height; out_row++) {
+        // ...includes pixels starting from this row.
+        unsigned int in_row_offset = params->y + scale_by_zoom_factor(out_row, params->zoom);
+        unsigned int in_rows = in_row_offset < header->height ? min(pixel_size, header->height - in_row_offset) : 0;
+
+        // output rows from the same number of rows across only empty blocks are all the same
+        if (tile_rows_empty(in, in_row_offset, in_rows, params->x, in_width)) {
+            if (empty_rows == in_rows) {
+                if ((err = pt_png_write_row(writer, row_buf)))
+                    return err;
+
+                continue;
+            }
+
+            empty_rows = in_rows;
+        } else {
+            empty_rows = 0;
+        }
+
+        // pixels outside of the image are left black
+        memset(row_buf, 0, row_bytes);
+
+        // ...each out row includes pixel_size in rows
+        for (unsigned int in_row = in_row_offset; in_row < in_row_offset + pixel_size && in_row < header->height; in_row++) {
+            // gather from blocks
+            if ((err = tile_row_read(reader, in_buf, in_row, params->x, in_width)))
+                return err;
+
+            tile_row_unpack(header, in_buf, in_width);
+
+            pt_zoom_row(zoom, in_buf);
+        }
+
+        // average each square of pixel_size x pixel_size input pixels
+        pt_zoom_out(zoom, row_buf);
+
+        // output
+        if ((err = pt_png_write_row(writer, row_buf)))
+            return err;
+    }
+
+    return 0;
+}
+
+/**
+ * Write zoomed-in tile data, replicating each pixel of the image data in the same pixel format
+ */
+static int pt_png_encode_zoomed_in (struct pt_png_writer *writer, struct pt_png_reader *reader, const struct pt_tile_params *params)
+{
+    const struct pt_png_in *in = reader->in;
+    const struct pt_png_header *header = in->header;
+    int z = -params->zoom;
+
+    // size of the image data in px, clipped to the image
+    unsigned int data_width;
+
+    // output pixels per input pixel
+    unsigned int pixel_size;
+
+    // the expanded image data may go past the edge of the tile
+    size_t row_bytes;
+    uint8_t *row_buf;
+
+    // the remaining rows are clipped
+    bool clipped = false;
+
+    int err = 0;
+
+    struct pt_encode_format format = {
+        .width          = params->width,
+        .height         = params->height,
+        .color_type     = header->color_type,
+        .col_bytes      = header->col_bytes,
+        .palette        = header->palette,
+        .num_palette    = header->num_palette,
+    };
+
+    if (z > PT_ZOOM_IN_MAX)
+        return -PT_ERR_TILE_ZOOM;
+
+    data_width = min(scale_by_zoom_factor(params->width, params->zoom), header->width - params->x);
+    pixel_size = 1u << z;
+    row_bytes = max(params->width, data_width << z) * header->col_bytes;
+
+    if ((row_buf = writer->row_buf = pt_render_calloc(reader->ctx, row_bytes)) == NULL)
+        return -PT_ERR_MEM;
+
+    // our pixel data is unpacked to one byte per pixel (8bpp or 16bpp), even if kept bit-packed
+    if ((err = pt_png_write_begin(writer, params, &format, header->bit_depth, true)))
+        return err;
+
+    // ...each input row
+    for (unsigned int out_row = 0; out_row < params->height; out_row += pixel_size) {
+        unsigned int in_row = params->y + (out_row >> z);
+
+        if (in_row < header->height) {
+            // gather from blocks
+            if ((err = tile_row_read(reader, row_buf, in_row, params->x, data_width)))
+                return err;
+
+            tile_row_unpack(header, row_buf, data_width);
+
+            pt_zoom_expand(row_buf, data_width, header->col_bytes, z);
+
+            // pixels outside of the image are left black
+            if (data_width << z < params->width)
+                memset(row_buf + (data_width << z) * header->col_bytes, 0, (params->width - (data_width << z)) * header->col_bytes);
+
+        } else if (!clipped) {
+            memset(row_buf, 0, params->width * header->col_bytes);
+
+            clipped = true;
+        }
+
+        // ...is encoded once, and repeated for each output row it covers
+        for (unsigned int row = out_row; row < out_row + pixel_size && row < params->height; row++) {
+            if ((err = pt_png_write_row(writer, row_buf)))
+                return err;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Zoomed-out tiles are downsampled into 8bpp RGB or palette pixels, including palette tiles rendered from the RGB zoom
+ * level of the same scale
+ */
+static bool pt_png_tile_zoomed (const struct pt_png_header *header, const struct pt_tile_params *params)
+{
+    if (params->zoom > 0)
+        return true;
+
+    // mapped back into the palette
+    return params->zoom == 0 && header->color_type != PNG_COLOR_TYPE_PALETTE && pt_zoom_mode(header, params->zoom_mode) != PT_TILE_ZOOM_AVERAGE;
+}
+
+int pt_png_tile (const struct pt_png_in *in, struct pt_tile *tile)
+{
+    const struct pt_png_header *header = in->header;
+    struct pt_png_img _img, *img = &_img;
+    struct pt_tile_params _params = tile->params, *params = &_params;
+    struct pt_png_reader reader;
+    struct pt_png_writer writer = { .img = img, .ctx = params->ctx };
+    struct pt_tile_mem _out_buf = { }, *out_buf = params->ctx ? &params->ctx->encode_buf : &_out_buf;
+    int err;
+
+    // adjust for downsampled data
+    if (in->zoom) {
+        params->x >>= in->zoom;
+        params->y >>= in->zoom;
+        params->zoom -= in->zoom;
+    }
+
+    // init img
+    memset(img, 0, sizeof(*img));
+    pt_png_reader_init(&reader, in, params->ctx);
+
+    // check within bounds
+    if (params->x >= header->width || params->y >= header->height)
+        // completely outside
+        return -PT_ERR_TILE_CLIP;
+
+    if ((err = pt_png_encode_check(params)))
+        return err;
+
+    // zoomed-out tiles are 8bpp RGB, or 8bpp palette
+    if (pt_png_tile_zoomed(header, params) && pt_zoom_mode(header, params->zoom_mode) == PT_TILE_ZOOM_AVERAGE)
+        writer.builtin = pt_png_encode_builtin(params, PNG_COLOR_TYPE_RGB, 8);
+    else if (pt_png_tile_zoomed(header, params))
+        writer.builtin = pt_png_encode_builtin(params, PNG_COLOR_TYPE_PALETTE, 8);
+    else
+        writer.builtin = pt_png_encode_builtin(params, header->color_type, header->bit_depth);
+
+    if (writer.builtin) {
+        if (tile->out_type == PT_TILE_OUT_MEM) {
+            writer.out = &tile->out.mem;
+        } else {
+            // encode into memory, kept in the render context for reuse, and write it out at the end
+            writer.out = out_buf;
+            writer.out->off = 0;
+        }
+
+        goto encode;
+    }
+
+    // open PNG writer, allocating from the render context
+    if (params->ctx)
+        img->png = png_create_write_struct_2(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL, params->ctx, pt_png_render_malloc, pt_png_render_free);
+    else
+        img->png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+
+    if (img->png == NULL) {
+        err = -PT_ERR_PNG_CREATE;
+        goto error;
+    }
+
+    if ((img->info = png_create_info_struct(img->png)) == NULL) {
+        err = -PT_ERR_PNG_CREATE;
+        goto error;
+    }
+
+    // libpng error trap
+    if (setjmp(png_jmpbuf(img->png))) {
+        err = tile->out_err ? tile->out_err : -PT_ERR_PNG;
+        goto error;
+    }
+
+    // setup output I/O via pt_tile_write
+    png_set_write_fn(img->png, tile, pt_png_tile_write, pt_png_tile_flush);
+
+
+encode:
+    // unscaled or scaled?
+    if (pt_png_tile_zoomed(header, params))
+        err = pt_png_encode_zoomed(&writer, &reader, params);
+
+    else if (params->zoom < 0)
+        err = pt_png_encode_zoomed_in(&writer, &reader, params);
+
+    else
+        err = pt_png_encode_unzoomed(&writer, &reader, params);
+
+    if (err)
+        goto error;
+
+    if ((err = pt_png_write_end(&writer)))
+        goto error;
+
+    if (writer.out == &tile->out.mem)
+        // written directly
+        tile->out_bytes = tile->out.mem.off;
+
+    else if (writer.builtin && (err = pt_tile_write(tile, out_buf->base, out_buf->off)))
+        goto error;
+
+    if ((err = pt_tile_flush(tile)))
+        goto error;
+
+error:
+    // cleanup, including after a libpng error within the pt_png_encode_* functions
+    if (writer.builtin)
+        pt_encode_release(&writer.encoder);
+    else
+        pt_png_release_write(img);
+
+    pt_png_writer_release(&writer);
+
+    free(_out_buf.base);
+    pt_png_reader_release(&reader);
+
+    return err;
+}
+
+
+/**
+ * Start reading in the pages covering the given range of the data, without waiting for them
+ */
+static void tile_prefetch_range (const struct pt_png_in *in, size_t start, size_t end)
+{
+    uintptr_t page_mask = sysconf(_SC_PAGESIZE) - 1;
+    uintptr_t addr = (uintptr_t) (in->data + start) & ~page_mask;
+    size_t len = (uintptr_t) (in->data + end) - addr;
+
+    if (in->holes && pt_sparse_map_hole(in->holes, in->data + start, end - start))
+        return;
+
+    if (madvise((void *) addr, len, MADV_WILLNEED))
+        PT_WARN_ERRNO("madvise %#lx, %zu: MADV_WILLNEED", (unsigned long) addr, len);
+}
+
+size_t pt_png_tile_raw_size (const struct pt_png_header *header, const struct pt_tile_params *params)
+{
+    // zoomed-out tiles are 8bpp RGB, or 8bpp palette
+    size_t pixel_bits = params->zoom > 0 ? (pt_zoom_mode(header, params->zoom_mode) == PT_TILE_ZOOM_AVERAGE ? 24 : 8) : header->bit_depth < 8 ? header->bit_depth : header->col_bytes * 8;
+
+    return ((params->width * pixel_bits + 7) / 8 + 1) * params->height;
+}
+
+size_t pt_png_tile_size_bound (const struct pt_png_header *header, size_t raw_size)
+{
+    // signature, IHDR, PLTE and IEND
+    size_t size = 8 + (12 + 13) + (12 + 3 * header->num_palette) + 12;
+
+    // libpng splits the image data into IDAT chunks of up to 8k
+    size_t data_size = compressBound(raw_size);
+
+    return size + data_size + 12 * (data_size / 8192 + 1);
+}
+
+int pt_png_prefetch (const struct pt_png_in *in, const struct pt_tile_params *tile_params)
+{
+    const struct pt_png_header *header = in->header;
+    const struct pt_png_layout *layout = in->layout;
+    struct pt_tile_params _params = *tile_params, *params = &_params;
+
+    // adjust for downsampled data
+    if (in->zoom) {
+        params->x >>= in->zoom;
+        params->y >>= in->zoom;
+        params->zoom -= in->zoom;
+    }
+
+    if (params->x >= header->width || params->y >= header->height)
+        // completely outside, nothing to read
+        return 0;
+
+    // size of the image data in px, clipped to the image
+    unsigned int data_width = min(scale_by_zoom_factor(params->width, params->zoom), header->width - params->x);
+    unsigned int data_height = min(scale_by_zoom_factor(params->height, params->zoom), header->height - params->y);
+
+    if (!data_width || !data_height)
+        return 0;
+
+    for (unsigned int block_row = params->y / layout->block_height; block_row <= (params->y + data_height - 1) / layout->block_height; block_row++) {
+        // range of data covering adjacent non-empty blocks on this row of blocks
+        size_t start = 0, end = 0;
+
+        for (unsigned int block_col = params->x / layout->block_width; block_col <= (params->x + data_width - 1) / layout->block_width; block_col++) {
+            size_t block = (size_t) block_row * layout->block_cols + block_col;
+            size_t block_start, block_end;
+
+            if (tile_block_empty(in, block))
+                // do not touch the sparse data
+                continue;
+
+            if (in->index) {
+                block_start = in->index[block];
+                block_end = in->index[block + 1];
+            } else {
+                block_start = pt_png_data_offset(layout, block_row * layout->block_height, block_col * layout->block_width);
+                block_end = block_start + layout->block_bytes;
+            }
+
+            if (end > start && block_start != end) {
+                tile_prefetch_range(in, start, end);
+
+                start = end = 0;
+            }
+
+            if (end == start)
+                start = block_start;
+
+            end = block_end;
+        }
+
+        if (end > start)
+            tile_prefetch_range(in, start, end);
+    }
+
+    return 0;
+}
 
 void pt_png_release_read (struct pt_png_img *img)
 {
@@ -5,6 +5,8 @@
  * @file
  * PNG-specific handling
  */
+#include "sparse.h"
+
 #include <png.h>
 #include <stdint.h>
 
@@ -20,6 +22,11 @@ struct pt_png_img {
     FILE *fh;
 };
 
+/**
+ * Largest number of bytes per pixel, for 16-bit RGBA
+ */
+#define PT_PNG_COL_BYTES_MAX 8
+
 /**
  * Cache header layout for PNG-format images
  */
@@ -36,28 +43,165 @@ struct pt_png_header {
     /** Number of bytes per row */
     uint32_t row_bytes;
 
-    /** Number of bytes per pixel */
+    /** Number of bytes per pixel, once unpacked */
     uint8_t col_bytes;
 
+    /** Number of bits per pixel as stored, less than 8 if bit-packed */
+    uint8_t pixel_bits;
+
     /** Palette entries, up to 256 entries used */
     png_color palette[PNG_MAX_PALETTE_LENGTH];
 };
 
-static inline size_t pt_png_data_size (const struct pt_png_header *header)
+/**
+ * Cache data layout for PNG-format images.
+ *
+ * The pixel data is stored as blocks of block_width x block_height pixels, with the blocks in row-major order, and the
+ * pixel rows of each block stored contiguously. Blocks along the right and bottom edges of the image are padded out to
+ * the full block size.
+ */
+struct pt_png_layout {
+    /** Number of bytes per pixel */
+    size_t col_bytes;
+
+    /** Number of bits per pixel, less than 8 if bit-packed */
+    unsigned pixel_bits;
+
+    /** Block dimensions in pixels */
+    unsigned block_width, block_height;
+
+    /** Number of blocks per row and column of blocks */
+    unsigned block_cols, block_rows;
+
+    /** Number of bytes per pixel row within a block */
+    size_t block_row_bytes;
+
+    /** Number of bytes per block */
+    size_t block_bytes;
+};
+
+/**
+ * Compute the data layout for the given PNG header and block dimensions.
+ */
+void pt_png_layout (struct pt_png_layout *layout, const struct pt_png_header *header, unsigned block_width, unsigned block_height);
+
+static inline size_t pt_png_data_size (const struct pt_png_layout *layout)
 {
   // calculate data size
-  return header->height * (size_t)header->row_bytes;
+  return (size_t) layout->block_rows * layout->block_cols * layout->block_bytes;
 }
 
+/**
+ * Return the offset of the pixel at \a row, \a col within the data segment.
+ *
+ * The data is contiguous up to the right edge of the block. For bit-packed pixels, this is the offset of the byte
+ * containing the pixel, at bit (col * pixel_bits) % 8.
+ */
+static inline size_t pt_png_data_offset (const struct pt_png_layout *layout, unsigned row, unsigned col)
+{
+  size_t block = (size_t) (row / layout->block_height) * layout->block_cols + (col / layout->block_width);
+
+  return block * layout->block_bytes
+    + (row % layout->block_height) * layout->block_row_bytes
+    + (col % layout->block_width) * layout->pixel_bits / 8
+  ;
+}
+
+struct pt_block_cache;
+
+/**
+ * Return the size of the occupancy bitmap, with one bit per block.
+ */
+static inline size_t pt_png_occupancy_size (const struct pt_png_layout *layout)
+{
+  return ((size_t) layout->block_rows * layout->block_cols + 7) / 8;
+}
+
+struct pt_idat_point;
+struct pt_progress;
+
+/**
+ * Decoder state to resume pt_png_decode_resumable from, as passed to the pt_png_out checkpoint callback.
+ */
+struct pt_png_resume {
+  /** Point within the image data */
+  const struct pt_idat_point *point;
+
+  /** Previous unfiltered row, and the filtered data of point->row decoded so far */
+  const uint8_t *prev, *raw;
+  size_t prev_len, raw_len;
+
+  /** Decoded rows preceding point->row within its row of blocks, header->row_bytes each */
+  const uint8_t *rows;
+  size_t rows_len;
+};
+
 /**
  * Decode target.
  */
 struct pt_png_out {
   const struct pt_png_header *header;
+  const struct pt_png_layout *layout;
 
   uint8_t *data;
 
   unsigned row, col; // pixels
+
+  /** Optional occupancy bitmap, with a bit set for each block written to data */
+  uint8_t *occupancy;
+
+  /**
+   * Optional callback to write out each full block of layout->block_bytes in order, instead of storing into data.
+   *
+   * The data is NULL for blocks consisting only of background pixels.
+   */
+  int (*write_block)(void *arg, const uint8_t *data, size_t len);
+  void *write_arg;
+
+  /**
+   * Optional callback for pt_png_decode_resumable to save the decoder state, once all of the rows of blocks before
+   * the resume point have been stored.
+   */
+  int (*checkpoint)(void *arg, const struct pt_png_resume *resume);
+  void *checkpoint_arg;
+
+  /** Optional progress of the update, counting the decoded rows and the stored pixel data */
+  struct pt_progress *progress;
+};
+
+/**
+ * Render source.
+ */
+struct pt_png_in {
+  const struct pt_png_header *header;
+  const struct pt_png_layout *layout;
+
+  const uint8_t *data;
+
+  /**
+   * Optional index of compressed blocks, giving the offset of each block within data, followed by the end offset.
+   *
+   * Empty blocks have zero length, and blocks of layout->block_bytes are stored uncompressed.
+   */
+  const size_t *index;
+
+  /** Optional shared cache of decompressed blocks */
+  struct pt_block_cache *block_cache;
+
+  /** Optional occupancy bitmap for uncompressed data, with a bit set for each block that was written */
+  const uint8_t *occupancy;
+
+  /** Optional map of the holes in uncompressed data, which read as zero */
+  const struct pt_sparse_map *holes;
+
+  /** Pixel value of empty blocks */
+  uint8_t fill[PT_PNG_COL_BYTES_MAX];
+
+  /** Optional nearest palette color table shared between renders, for PT_TILE_ZOOM_PALETTE */
+  uint16_t *palette_lut;
+
+  /** Data is downsampled by 2^zoom */
+  int zoom;
 };
 
 #include "tile.h"
@@ -77,7 +221,7 @@ int pt_read_png_info (const char *path, struct pt_image_info *info);
 /**
  * Scale PNG header for mutli-part image.
  */
- int pt_read_parts_png_header (const struct pt_image_parts *parts, struct pt_png_header *header, struct pt_png_header *part_header);
+ int pt_read_parts_png_header (const struct pt_image_parts *parts, const struct pt_image_params *params, struct pt_png_header *header, struct pt_png_header *part_header);
 
 /**
  * Open the given .png image file.
@@ -95,19 +239,72 @@ int pt_png_open (struct pt_png_img *img, FILE *file);
 int pt_png_read_info (struct pt_png_img *img, struct pt_image_info *info);
 
 /**
- * Fill in the PNG header and return the size of the pixel data
+ * Fill in the PNG header and return the size of the pixel data.
+ *
+ * Pixels of less than 8 bits are unpacked to one byte per pixel, unless using PT_IMAGE_PACKED.
  */
- int pt_png_read_header (struct pt_png_img *img, struct pt_png_header *header);
+ int pt_png_read_header (struct pt_png_img *img, const struct pt_image_params *params, struct pt_png_header *header);
+
+/**
+ * Reset the region of \a width x \a height pixels at out->row, out->col to its state before any data was decoded into
+ * it: blocks completely within the region are marked empty, and the region's pixels within any other blocks are zeroed.
+ */
+void pt_png_clear (const struct pt_png_out *out, unsigned width, unsigned height);
 
 /**
  * Decode the PNG data into the given data segment, using the header as decoded by pt_png_read_header
  */
 int pt_png_decode (struct pt_png_img *img, const struct pt_png_header *header, const struct pt_image_params *params, const struct pt_png_out *out);
 
+/**
+ * Decode the PNG image data from the given file on the calling thread, using the header as decoded by
+ * pt_png_read_header, calling out->checkpoint every params->checkpoint_interval.
+ *
+ * @param resume optional state saved by a previous out->checkpoint to resume from
+ */
+int pt_png_decode_resumable (const char *path, const struct pt_png_header *header, const struct pt_image_params *params, const struct pt_png_out *out, const struct pt_png_resume *resume);
+
+/**
+ * Compute the pixel value of empty blocks for the given image or zoom level, zero-padded to PT_PNG_COL_BYTES_MAX.
+ *
+ * This is the background pixel, if used to skip blocks.
+ */
+void pt_png_fill_pixel (uint8_t fill[PT_PNG_COL_BYTES_MAX], const struct pt_png_header *header, const struct pt_image_params *params, int zoom);
+
+/**
+ * Fill in the header for the given PNG image downsampled by 2^zoom as 8bpp RGB.
+ *
+ * @return -PT_ERR_IMG_FORMAT if the image's pixel format cannot be downsampled
+ */
+int pt_png_zoom_header (struct pt_png_header *zoom_header, const struct pt_png_header *header, int zoom);
+
+/**
+ * Downsample the given data by 2^1 .. 2^levels at once, into the given target for each zoom level, as described by
+ * pt_png_zoom_header.
+ *
+ * Each zoom level is written out in order, with the levels interleaved.
+ */
+int pt_png_downsample (const struct pt_png_in *in, const struct pt_png_out out[], int levels);
+
 /**
  * Render out a tile
  */
-int pt_png_tile (const struct pt_png_header *header, const uint8_t *data, struct pt_tile *tile);
+int pt_png_tile (const struct pt_png_in *in, struct pt_tile *tile);
+
+/**
+ * Return the size of the filtered image data for the tile, before compression, including the filter type bytes
+ */
+size_t pt_png_tile_raw_size (const struct pt_png_header *header, const struct pt_tile_params *params);
+
+/**
+ * Return the largest size of the encoded tile for the given raw size, if stored without any compression
+ */
+size_t pt_png_tile_size_bound (const struct pt_png_header *header, size_t raw_size);
+
+/**
+ * Start reading in the data covering a tile, without waiting for it
+ */
+int pt_png_prefetch (const struct pt_png_in *in, const struct pt_tile_params *params);
 
 /**
  * Release pt_png_ctx resources as allocated by pt_png_open
@@ -0,0 +1,109 @@
+#include "progress.h"
+
+void pt_progress_init (struct pt_progress *progress, const struct pt_image_params *params, size_t rows_total)
+{
+    *progress = (struct pt_progress) {
+        .rows_total = rows_total,
+        .interval = PT_IMAGE_PROGRESS_INTERVAL,
+    };
+
+    if (params) {
+        progress->func = params->progress;
+        progress->arg = params->progress_arg;
+
+        if (params->progress_interval)
+            progress->interval = params->progress_interval;
+    }
+
+    pthread_mutex_init(&progress->lock, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &progress->start);
+
+    progress->last = progress->start;
+}
+
+/**
+ * Call the callback with the current counters, with the lock held
+ */
+static int pt_progress_report (struct pt_progress *progress, const struct timespec *now)
+{
+    struct pt_image_progress state = {
+        .rows = __atomic_load_n(&progress->rows, __ATOMIC_RELAXED),
+        .rows_total = progress->rows_total,
+        .bytes = __atomic_load_n(&progress->bytes, __ATOMIC_RELAXED),
+        .sparse_bytes = __atomic_load_n(&progress->sparse_bytes, __ATOMIC_RELAXED),
+        .elapsed = {
+            .tv_sec = now->tv_sec - progress->start.tv_sec,
+            .tv_nsec = now->tv_nsec - progress->start.tv_nsec,
+        },
+    };
+
+    if (state.elapsed.tv_nsec < 0) {
+        state.elapsed.tv_sec -= 1;
+        state.elapsed.tv_nsec += 1000000000;
+    }
+
+    progress->last = *now;
+
+    if (progress->func(progress->arg, &state))
+        __atomic_store_n(&progress->cancel, true, __ATOMIC_RELAXED);
+
+    return __atomic_load_n(&progress->cancel, __ATOMIC_RELAXED) ? -PT_ERR_CANCEL : 0;
+}
+
+int pt_progress_rows (struct pt_progress *progress, size_t rows)
+{
+    struct timespec now;
+    long elapsed_ms;
+    int err = 0;
+
+    if (!progress)
+        return 0;
+
+    __atomic_add_fetch(&progress->rows, rows, __ATOMIC_RELAXED);
+
+    if (!progress->func)
+        return 0;
+
+    if (__atomic_load_n(&progress->cancel, __ATOMIC_RELAXED))
+        return -PT_ERR_CANCEL;
+
+    // another thread is reporting the progress
+    if (pthread_mutex_trylock(&progress->lock))
+        return 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    elapsed_ms = (now.tv_sec - progress->last.tv_sec) * 1000 + (now.tv_nsec - progress->last.tv_nsec) / 1000000;
+
+    if (elapsed_ms >= progress->interval)
+        err = pt_progress_report(progress, &now);
+
+    pthread_mutex_unlock(&progress->lock);
+
+    return err;
+}
+
+int pt_progress_done (struct pt_progress *progress)
+{
+    struct timespec now;
+    int err;
+
+    if (!progress->func)
+        return 0;
+
+    pthread_mutex_lock(&progress->lock);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    err = pt_progress_report(progress, &now);
+
+    pthread_mutex_unlock(&progress->lock);
+
+    return err;
+}
+
+void pt_progress_destroy (struct pt_progress *progress)
+{
+    pthread_mutex_destroy(&progress->lock);
+}
@@ -0,0 +1,79 @@
+#ifndef PNGTILE_PROGRESS_H
+#define PNGTILE_PROGRESS_H
+
+/**
+ * @file
+ *
+ * Progress reporting for cache updates, shared between the threads decoding the image
+ */
+#include "pngtile.h"
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+
+/**
+ * Progress state for an update
+ */
+struct pt_progress {
+    /** Callback from the pt_image_params */
+    int (*func)(void *arg, const struct pt_image_progress *progress);
+    void *arg;
+
+    /** Counters, updated atomically */
+    size_t rows, rows_total, bytes, sparse_bytes;
+
+    /** The callback cancelled the update */
+    bool cancel;
+
+    /** Minimum interval between calls to the callback, in milliseconds */
+    long interval;
+
+    /** Held while calling the callback */
+    pthread_mutex_t lock;
+
+    /** Start of the update, and the last call to the callback */
+    struct timespec start, last;
+};
+
+/**
+ * Start tracking the progress of an update of \a rows_total rows, reporting to the params callback, if any
+ */
+void pt_progress_init (struct pt_progress *progress, const struct pt_image_params *params, size_t rows_total);
+
+/**
+ * Count stored and skipped bytes of pixel data.
+ *
+ * @param progress optional
+ */
+static inline void pt_progress_store (struct pt_progress *progress, size_t bytes, size_t sparse_bytes)
+{
+    if (!progress)
+        return;
+
+    if (bytes)
+        __atomic_add_fetch(&progress->bytes, bytes, __ATOMIC_RELAXED);
+
+    if (sparse_bytes)
+        __atomic_add_fetch(&progress->sparse_bytes, sparse_bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * Count decoded rows, and call the callback if it is due and no other thread is calling it.
+ *
+ * @param progress optional
+ * @return -PT_ERR_CANCEL if the update was cancelled
+ */
+int pt_progress_rows (struct pt_progress *progress, size_t rows);
+
+/**
+ * Call the callback once the update is done
+ */
+int pt_progress_done (struct pt_progress *progress);
+
+/**
+ * Release resources
+ */
+void pt_progress_destroy (struct pt_progress *progress);
+
+#endif
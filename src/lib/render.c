@@ -0,0 +1,108 @@
+#include "render.h"
+#include "block.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Header preceding each allocation, to recover the size on free, padded to keep the allocation aligned for any type
+ */
+union pt_render_alloc_header {
+    size_t size;
+
+    long double align_ld;
+    long long align_ll;
+    void *align_ptr;
+};
+
+int pt_render_ctx_new (struct pt_render_ctx **ctx_ptr)
+{
+    struct pt_render_ctx *ctx;
+
+    if ((ctx = calloc(1, sizeof(*ctx))) == NULL)
+        return -PT_ERR_MEM;
+
+    *ctx_ptr = ctx;
+
+    return 0;
+}
+
+void *pt_render_malloc (struct pt_render_ctx *ctx, size_t size)
+{
+    union pt_render_alloc_header *header;
+    struct pt_render_alloc *best = NULL;
+
+    if (!ctx)
+        return malloc(size);
+
+    // the smallest released allocation that fits, without wasting more than half of it
+    for (unsigned i = 0; i < ctx->allocs_count; i++) {
+        struct pt_render_alloc *alloc = &ctx->allocs[i];
+
+        if (alloc->size >= size && alloc->size / 2 <= size && (!best || alloc->size < best->size))
+            best = alloc;
+    }
+
+    if (best) {
+        header = best->ptr;
+
+        // keep the remaining allocations contiguous
+        *best = ctx->allocs[--ctx->allocs_count];
+
+    } else if ((header = malloc(sizeof(*header) + size)) == NULL) {
+        return NULL;
+
+    } else {
+        header->size = size;
+    }
+
+    return header + 1;
+}
+
+void *pt_render_calloc (struct pt_render_ctx *ctx, size_t size)
+{
+    void *ptr;
+
+    if (!ctx)
+        return calloc(1, size);
+
+    if ((ptr = pt_render_malloc(ctx, size)) != NULL)
+        memset(ptr, 0, size);
+
+    return ptr;
+}
+
+void pt_render_free (struct pt_render_ctx *ctx, void *ptr)
+{
+    union pt_render_alloc_header *header;
+
+    if (!ctx) {
+        free(ptr);
+        return;
+    }
+
+    if (!ptr)
+        return;
+
+    header = (union pt_render_alloc_header *) ptr - 1;
+
+    if (ctx->allocs_count < PT_RENDER_CTX_ALLOCS)
+        ctx->allocs[ctx->allocs_count++] = (struct pt_render_alloc) { header, header->size };
+    else
+        free(header);
+}
+
+void pt_render_ctx_destroy (struct pt_render_ctx *ctx)
+{
+    for (unsigned i = 0; i < ctx->allocs_count; i++)
+        free(ctx->allocs[i].ptr);
+
+    if (ctx->zs_init)
+        pt_block_inflate_end(&ctx->zs);
+
+    if (ctx->deflate_init)
+        deflateEnd(&ctx->deflate_zs);
+
+    free(ctx->encode_buf.base);
+    free(ctx);
+}
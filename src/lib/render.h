@@ -0,0 +1,64 @@
+#ifndef PNGTILE_RENDER_H
+#define PNGTILE_RENDER_H
+
+/**
+ * @file
+ *
+ * Reusable state for tile renders.
+ *
+ * Memory released during a render is kept for reuse by later renders of the same size, which is the common case for a
+ * server rendering tiles of the same dimensions from the same images.
+ */
+#include "pngtile.h"
+#include "tile.h"
+
+#include <zlib.h>
+#include <stdbool.h>
+
+/**
+ * Number of released allocations kept for reuse
+ */
+#define PT_RENDER_CTX_ALLOCS 32
+
+struct pt_render_ctx {
+    /** Released allocations, by size */
+    struct pt_render_alloc {
+        void *ptr;
+        size_t size;
+    } allocs[PT_RENDER_CTX_ALLOCS];
+
+    unsigned allocs_count;
+
+    /** Inflate stream for compressed blocks, reset before each use */
+    z_stream zs;
+    bool zs_init;
+
+    /** Deflate stream for the built-in encoder, reset before each use, as initialized with the window and memory level */
+    z_stream deflate_zs;
+    bool deflate_init;
+    int deflate_window_bits, deflate_mem_level;
+
+    /** Output buffer for the built-in encoder, when not rendering into a PT_TILE_OUT_MEM buffer */
+    struct pt_tile_mem encode_buf;
+};
+
+/**
+ * Allocate \a size bytes, reusing memory released by an earlier render if possible.
+ *
+ * @param ctx optional, falls back to malloc()
+ */
+void *pt_render_malloc (struct pt_render_ctx *ctx, size_t size);
+
+/**
+ * Allocate \a size zeroed bytes, as pt_render_malloc()
+ */
+void *pt_render_calloc (struct pt_render_ctx *ctx, size_t size);
+
+/**
+ * Release memory allocated using pt_render_malloc(), keeping it for reuse if possible.
+ *
+ * @param ctx optional, falls back to free()
+ */
+void pt_render_free (struct pt_render_ctx *ctx, void *ptr);
+
+#endif
@@ -0,0 +1,315 @@
+#include "renderer.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static int pt_renderer_deque_init (struct pt_renderer_deque *deque)
+{
+    if ((deque->jobs = calloc(PT_RENDERER_DEQUE_SIZE, sizeof(*deque->jobs))) == NULL)
+        return -PT_ERR_MEM;
+
+    deque->size = PT_RENDERER_DEQUE_SIZE;
+    deque->head = deque->tail = 0;
+
+    pthread_mutex_init(&deque->lock, NULL);
+
+    return 0;
+}
+
+/**
+ * Queue the job as the newest job in the deque, growing it as needed
+ */
+static int pt_renderer_deque_push (struct pt_renderer_deque *deque, struct pt_render_job *job)
+{
+    int err = 0;
+
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->tail - deque->head == deque->size) {
+        struct pt_render_job **jobs;
+
+        if ((jobs = calloc(deque->size * 2, sizeof(*jobs))) == NULL) {
+            err = -PT_ERR_MEM;
+            goto error;
+        }
+
+        // keep the queued jobs at the same sequence numbers
+        for (unsigned seq = deque->head; seq != deque->tail; seq++)
+            jobs[seq & (deque->size * 2 - 1)] = deque->jobs[seq & (deque->size - 1)];
+
+        free(deque->jobs);
+
+        deque->jobs = jobs;
+        deque->size *= 2;
+    }
+
+    deque->jobs[deque->tail++ & (deque->size - 1)] = job;
+
+error:
+    pthread_mutex_unlock(&deque->lock);
+
+    return err;
+}
+
+/**
+ * Take the oldest job from the deque, or the newest job for stealing it, or NULL if empty
+ */
+static struct pt_render_job *pt_renderer_deque_take (struct pt_renderer_deque *deque, bool steal)
+{
+    struct pt_render_job *job = NULL;
+
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->head == deque->tail)
+        ;
+    else if (steal)
+        job = deque->jobs[--deque->tail & (deque->size - 1)];
+    else
+        job = deque->jobs[deque->head++ & (deque->size - 1)];
+
+    pthread_mutex_unlock(&deque->lock);
+
+    return job;
+}
+
+static void pt_renderer_deque_release (struct pt_renderer_deque *deque)
+{
+    pthread_mutex_destroy(&deque->lock);
+
+    free(deque->jobs);
+}
+
+/**
+ * Take the next job for the thread, from its own deque, or stolen from the other threads
+ */
+static struct pt_render_job *pt_renderer_take (struct pt_renderer_thread *thread)
+{
+    struct pt_renderer *renderer = thread->renderer;
+    struct pt_render_job *job;
+
+    if ((job = pt_renderer_deque_take(&thread->deque, false)) == NULL) {
+        // starting from the next thread, so that idle threads steal from different threads
+        for (unsigned i = 1; i < renderer->count && !job; i++)
+            job = pt_renderer_deque_take(&renderer->threads[(thread->index + i) % renderer->count].deque, true);
+    }
+
+    if (job)
+        __atomic_sub_fetch(&renderer->queued, 1, __ATOMIC_RELAXED);
+
+    return job;
+}
+
+/**
+ * Render the job using the thread's render context
+ */
+static void pt_renderer_render (struct pt_renderer_thread *thread, struct pt_render_job *job)
+{
+    struct pt_tile_params params = job->params;
+
+    params.ctx = thread->ctx;
+
+    if (job->buf) {
+        if ((job->result.err = pt_image_tile_buf(job->image, &params, job->buf, job->size, &job->result.len)) == 0)
+            job->result.buf = job->buf;
+        else if (job->result.err != -PT_ERR_TILE_BUF)
+            job->result.len = 0; // keep the required size for -PT_ERR_TILE_BUF
+    } else if ((job->result.err = pt_image_tile_mem(job->image, &params, &job->result.buf, &job->result.len))) {
+        job->result.buf = NULL;
+        job->result.len = 0;
+    }
+}
+
+static void *pt_renderer_thread (void *arg)
+{
+    struct pt_renderer_thread *thread = arg;
+    struct pt_renderer *renderer = thread->renderer;
+
+    // wait for pt_renderer_new to finish starting the threads
+    pthread_mutex_lock(&renderer->lock);
+    pthread_mutex_unlock(&renderer->lock);
+
+    for (;;) {
+        struct pt_render_job *job;
+
+        if ((job = pt_renderer_take(thread)) == NULL) {
+            bool stop;
+
+            // sleep until more jobs are queued
+            pthread_mutex_lock(&renderer->lock);
+
+            while (__atomic_load_n(&renderer->queued, __ATOMIC_RELAXED) <= 0 && !renderer->stop)
+                pthread_cond_wait(&renderer->queue_cond, &renderer->lock);
+
+            stop = __atomic_load_n(&renderer->queued, __ATOMIC_RELAXED) <= 0;
+
+            pthread_mutex_unlock(&renderer->lock);
+
+            if (stop)
+                break;
+
+            continue;
+        }
+
+        pt_renderer_render(thread, job);
+
+        pthread_mutex_lock(&renderer->lock);
+
+        job->next = NULL;
+        *renderer->complete_tail = job;
+        renderer->complete_tail = &job->next;
+        renderer->pending--;
+
+        pthread_cond_signal(&renderer->complete_cond);
+        pthread_mutex_unlock(&renderer->lock);
+    }
+
+    return NULL;
+}
+
+static void pt_renderer_thread_release (struct pt_renderer_thread *thread)
+{
+    pt_renderer_deque_release(&thread->deque);
+
+    if (thread->ctx)
+        pt_render_ctx_destroy(thread->ctx);
+}
+
+int pt_renderer_new (struct pt_renderer **renderer_ptr, unsigned threads)
+{
+    struct pt_renderer *renderer;
+    int err = 0;
+
+    if (!threads)
+        return -PT_ERR_THREAD;
+
+    if ((renderer = calloc(1, sizeof(*renderer))) == NULL)
+        return -PT_ERR_MEM;
+
+    pthread_mutex_init(&renderer->lock, NULL);
+    pthread_cond_init(&renderer->queue_cond, NULL);
+    pthread_cond_init(&renderer->complete_cond, NULL);
+
+    renderer->complete_tail = &renderer->complete_head;
+
+    if ((renderer->threads = calloc(threads, sizeof(*renderer->threads))) == NULL) {
+        err = -PT_ERR_MEM;
+        goto error;
+    }
+
+    // the threads wait for the lock before starting, so that the count does not change under them
+    pthread_mutex_lock(&renderer->lock);
+
+    for (unsigned i = 0; i < threads; i++) {
+        struct pt_renderer_thread *thread = &renderer->threads[i];
+
+        thread->renderer = renderer;
+        thread->index = i;
+
+        if ((err = pt_render_ctx_new(&thread->ctx)))
+            break;
+
+        if ((err = pt_renderer_deque_init(&thread->deque))) {
+            pt_render_ctx_destroy(thread->ctx);
+            break;
+        }
+
+        if ((err = pthread_create(&thread->thread, NULL, pt_renderer_thread, thread))) {
+            PT_WARN("pthread_create: %s", strerror(err));
+            pt_renderer_thread_release(thread);
+            err = 0;
+            break;
+        }
+
+        renderer->count++;
+    }
+
+    pthread_mutex_unlock(&renderer->lock);
+
+    if (!err && !renderer->count)
+        err = -PT_ERR_THREAD;
+
+    if (err)
+        goto error;
+
+    PT_DEBUG("threads=%u", renderer->count);
+
+    *renderer_ptr = renderer;
+
+    return 0;
+
+error:
+    pt_renderer_destroy(renderer);
+
+    return err;
+}
+
+int pt_renderer_submit (struct pt_renderer *renderer, struct pt_render_job *job)
+{
+    unsigned index = __atomic_fetch_add(&renderer->next, 1, __ATOMIC_RELAXED) % renderer->count;
+    int err;
+
+    job->result = (struct pt_tile_result) { };
+    job->next = NULL;
+
+    if ((err = pt_renderer_deque_push(&renderer->threads[index].deque, job)))
+        return err;
+
+    // counted once the job can be taken, so that idle threads only wake up once there is a job for them to take
+    pthread_mutex_lock(&renderer->lock);
+
+    renderer->pending++;
+    __atomic_add_fetch(&renderer->queued, 1, __ATOMIC_RELAXED);
+
+    pthread_cond_signal(&renderer->queue_cond);
+    pthread_mutex_unlock(&renderer->lock);
+
+    return 0;
+}
+
+int pt_renderer_complete (struct pt_renderer *renderer, struct pt_render_job **job_ptr, bool wait)
+{
+    struct pt_render_job *job;
+
+    pthread_mutex_lock(&renderer->lock);
+
+    while (wait && !renderer->complete_head && renderer->pending > 0)
+        pthread_cond_wait(&renderer->complete_cond, &renderer->lock);
+
+    if ((job = renderer->complete_head)) {
+        if ((renderer->complete_head = job->next) == NULL)
+            renderer->complete_tail = &renderer->complete_head;
+
+        job->next = NULL;
+    }
+
+    pthread_mutex_unlock(&renderer->lock);
+
+    *job_ptr = job;
+
+    return 0;
+}
+
+void pt_renderer_destroy (struct pt_renderer *renderer)
+{
+    // the threads render any queued jobs before stopping
+    pthread_mutex_lock(&renderer->lock);
+
+    renderer->stop = true;
+
+    pthread_cond_broadcast(&renderer->queue_cond);
+    pthread_mutex_unlock(&renderer->lock);
+
+    for (unsigned i = 0; i < renderer->count; i++)
+        pthread_join(renderer->threads[i].thread, NULL);
+
+    for (unsigned i = 0; i < renderer->count; i++)
+        pt_renderer_thread_release(&renderer->threads[i]);
+
+    pthread_cond_destroy(&renderer->complete_cond);
+    pthread_cond_destroy(&renderer->queue_cond);
+    pthread_mutex_destroy(&renderer->lock);
+
+    free(renderer->threads);
+    free(renderer);
+}
@@ -0,0 +1,83 @@
+#ifndef PNGTILE_RENDERER_H
+#define PNGTILE_RENDERER_H
+
+/**
+ * @file
+ *
+ * Pool of threads for rendering tiles.
+ *
+ * Each thread has its own deque of jobs, which jobs are submitted to in turn. A thread takes the oldest job from its
+ * own deque, or steals the newest job from the deque of another thread once its own is empty, and only sleeps once all
+ * of the deques are empty.
+ */
+#include "pngtile.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+
+/**
+ * Initial number of jobs in each deque, grown as needed
+ */
+#define PT_RENDERER_DEQUE_SIZE 64
+
+/**
+ * Ring of jobs queued for a thread
+ */
+struct pt_renderer_deque {
+    pthread_mutex_t lock;
+
+    /** Ring of size jobs, a power of two */
+    struct pt_render_job **jobs;
+    unsigned size;
+
+    /** Sequence numbers of the oldest job, and past the newest job */
+    unsigned head, tail;
+};
+
+struct pt_renderer_thread {
+    struct pt_renderer *renderer;
+    unsigned index;
+
+    pthread_t thread;
+
+    /** Render context kept for the thread's renders */
+    struct pt_render_ctx *ctx;
+
+    /** Jobs submitted to this thread */
+    struct pt_renderer_deque deque;
+};
+
+struct pt_renderer {
+    /** Started threads */
+    struct pt_renderer_thread *threads;
+    unsigned count;
+
+    /** Next thread to submit to */
+    unsigned next;
+
+    /**
+     * Number of jobs queued across all deques, counted up once pushed, and down as they are taken.
+     *
+     * A job may be taken before it is counted, leaving this briefly negative.
+     */
+    int queued;
+
+    pthread_mutex_t lock;
+
+    /** Signalled when jobs are queued, or when stopping */
+    pthread_cond_t queue_cond;
+
+    /** Signalled when jobs are complete */
+    pthread_cond_t complete_cond;
+
+    /** Number of jobs submitted, but not yet complete, which may also be briefly negative */
+    int pending;
+
+    /** Completed jobs, in the order they completed */
+    struct pt_render_job *complete_head, **complete_tail;
+
+    /** Render any queued jobs, and stop the threads */
+    bool stop;
+};
+
+#endif
@@ -0,0 +1,213 @@
+#define _GNU_SOURCE // SEEK_DATA
+
+#include "sparse.h"
+#include "pngtile.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define PT_SPARSE_X86 1
+#endif
+
+void pt_sparse_pattern (uint8_t pattern[PT_SPARSE_PATTERN_SIZE], const uint8_t *pixel, size_t pixel_bytes)
+{
+    for (size_t i = 0; i < PT_SPARSE_PATTERN_SIZE; i += pixel_bytes)
+        memcpy(pattern + i, pixel, pixel_bytes);
+}
+
+/**
+ * Compare a full pattern at a time, using the C library's vectorised memcmp
+ */
+static bool pt_sparse_match_scalar (const uint8_t *buf, size_t len, const uint8_t pattern[PT_SPARSE_PATTERN_SIZE])
+{
+    for (; len >= PT_SPARSE_PATTERN_SIZE; buf += PT_SPARSE_PATTERN_SIZE, len -= PT_SPARSE_PATTERN_SIZE) {
+        if (memcmp(buf, pattern, PT_SPARSE_PATTERN_SIZE))
+            return false;
+    }
+
+    return memcmp(buf, pattern, len) == 0;
+}
+
+#ifdef PT_SPARSE_X86
+/**
+ * Compare a full pattern of three 32-byte vectors at a time, then 32 bytes at a time
+ */
+__attribute__((target("avx2")))
+static bool pt_sparse_match_avx2 (const uint8_t *buf, size_t len, const uint8_t pattern[PT_SPARSE_PATTERN_SIZE])
+{
+    __m256i p0 = _mm256_loadu_si256((const __m256i *) (pattern + 0));
+    __m256i p1 = _mm256_loadu_si256((const __m256i *) (pattern + 32));
+    __m256i p2 = _mm256_loadu_si256((const __m256i *) (pattern + 64));
+    size_t offset = 0;
+
+    for (; len >= PT_SPARSE_PATTERN_SIZE; buf += PT_SPARSE_PATTERN_SIZE, len -= PT_SPARSE_PATTERN_SIZE) {
+        __m256i diff = _mm256_or_si256(
+            _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (buf + 0)), p0),
+            _mm256_or_si256(
+                _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (buf + 32)), p1),
+                _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (buf + 64)), p2)
+            )
+        );
+
+        if (!_mm256_testz_si256(diff, diff))
+            return false;
+    }
+
+    for (; len >= 32; buf += 32, len -= 32, offset += 32) {
+        __m256i diff = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) buf), _mm256_loadu_si256((const __m256i *) (pattern + offset)));
+
+        if (!_mm256_testz_si256(diff, diff))
+            return false;
+    }
+
+    return memcmp(buf, pattern + offset, len) == 0;
+}
+#endif
+
+/**
+ * Choose the implementation supported by the CPU
+ */
+static pt_sparse_match_func pt_sparse_match_select (void)
+{
+#ifdef PT_SPARSE_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        return pt_sparse_match_avx2;
+#endif
+
+    return pt_sparse_match_scalar;
+}
+
+pt_sparse_match_func pt_sparse_match_impl (const char *name)
+{
+    if (strcmp(name, "memcmp") == 0)
+        return pt_sparse_match_scalar;
+
+#ifdef PT_SPARSE_X86
+    __builtin_cpu_init();
+
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+        return pt_sparse_match_avx2;
+#endif
+
+    return NULL;
+}
+
+bool pt_sparse_match (const uint8_t *buf, size_t len, const uint8_t pattern[PT_SPARSE_PATTERN_SIZE])
+{
+    static pt_sparse_match_func match;
+    pt_sparse_match_func func = __atomic_load_n(&match, __ATOMIC_RELAXED);
+
+    if (!func) {
+        func = pt_sparse_match_select();
+
+        __atomic_store_n(&match, func, __ATOMIC_RELAXED);
+    }
+
+    return func(buf, len, pattern);
+}
+
+/**
+ * Append an extent of data, growing the map as needed
+ */
+static int pt_sparse_map_add (struct pt_sparse_map *map, size_t start, size_t end)
+{
+    if (map->count == map->size) {
+        size_t size = map->size ? map->size * 2 : 16;
+        struct pt_sparse_extent *extents;
+
+        if ((extents = realloc(map->extents, size * sizeof(*extents))) == NULL)
+            return -PT_ERR_MEM;
+
+        map->extents = extents;
+        map->size = size;
+    }
+
+    map->extents[map->count++] = (struct pt_sparse_extent) { start, end };
+
+    return 0;
+}
+
+int pt_sparse_map_read (struct pt_sparse_map *map, int fd, off_t offset, size_t size, const uint8_t *base)
+{
+    off_t pos = offset, end = offset + size;
+    int err;
+
+    *map = (struct pt_sparse_map) {
+        .base = base,
+    };
+
+    while (pos < end) {
+        off_t data, hole;
+
+        if ((data = lseek(fd, pos, SEEK_DATA)) < 0) {
+            if (errno == ENXIO)
+                break; // trailing hole
+
+            if (errno != EINVAL)
+                return -PT_ERR_CACHE_SEEK;
+
+            // not supported, all data
+            data = pos;
+            hole = end;
+
+        } else if ((hole = lseek(fd, data, SEEK_HOLE)) < 0) {
+            return -PT_ERR_CACHE_SEEK;
+        }
+
+        if (data >= end)
+            break;
+
+        if (hole > end)
+            hole = end;
+
+        if ((err = pt_sparse_map_add(map, data - offset, hole - offset)))
+            return err;
+
+        pos = hole;
+    }
+
+    return 0;
+}
+
+size_t pt_sparse_map_bytes (const struct pt_sparse_map *map)
+{
+    size_t bytes = 0;
+
+    for (size_t i = 0; i < map->count; i++)
+        bytes += map->extents[i].end - map->extents[i].start;
+
+    return bytes;
+}
+
+bool pt_sparse_map_hole (const struct pt_sparse_map *map, const uint8_t *ptr, size_t len)
+{
+    size_t offset = ptr - map->base;
+    size_t lo = 0, hi = map->count;
+
+    // first extent ending after the offset
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+
+        if (map->extents[mid].end <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo == map->count || map->extents[lo].start >= offset + len;
+}
+
+void pt_sparse_map_release (struct pt_sparse_map *map)
+{
+    free(map->extents);
+
+    map->extents = NULL;
+    map->count = map->size = 0;
+}
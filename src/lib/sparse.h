@@ -0,0 +1,77 @@
+#ifndef PNGTILE_SPARSE_H
+#define PNGTILE_SPARSE_H
+
+/**
+ * @file
+ *
+ * Sparse cache data: background pixel detection for sparse cache blocks, and the holes in sparse cache files
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+ * Size of a background pattern: a multiple of every supported pixel size, and of the vector width
+ */
+#define PT_SPARSE_PATTERN_SIZE 96
+
+/**
+ * Fill the pattern by repeating the given pixel of \a pixel_bytes bytes, which must divide PT_SPARSE_PATTERN_SIZE.
+ */
+void pt_sparse_pattern (uint8_t pattern[PT_SPARSE_PATTERN_SIZE], const uint8_t *pixel, size_t pixel_bytes);
+
+/**
+ * Test if the \a len bytes of \a buf match the pattern, starting from the beginning of the pattern.
+ *
+ * Uses AVX2 if supported by the CPU.
+ */
+bool pt_sparse_match (const uint8_t *buf, size_t len, const uint8_t pattern[PT_SPARSE_PATTERN_SIZE]);
+
+typedef bool (*pt_sparse_match_func) (const uint8_t *buf, size_t len, const uint8_t pattern[PT_SPARSE_PATTERN_SIZE]);
+
+/**
+ * Look up an implementation of pt_sparse_match by name, for benchmarking: "memcmp" or "avx2".
+ *
+ * @return NULL if unknown, or not supported by the CPU
+ */
+pt_sparse_match_func pt_sparse_match_impl (const char *name);
+
+/**
+ * Map of the data stored in a mmap'd sparse file, as sorted extents of data separated by holes
+ */
+struct pt_sparse_map {
+    /** Address of the start of the mapped range */
+    const uint8_t *base;
+
+    /** Offsets relative to base */
+    struct pt_sparse_extent {
+        size_t start, end;
+    } *extents;
+
+    size_t count, size;
+};
+
+/**
+ * Map out the data within \a size bytes of the file starting at \a offset, mapped at \a base.
+ *
+ * If the filesystem does not support SEEK_DATA, the entire range is mapped as data.
+ */
+int pt_sparse_map_read (struct pt_sparse_map *map, int fd, off_t offset, size_t size, const uint8_t *base);
+
+/**
+ * Return the number of bytes of data within the mapped range, excluding holes
+ */
+size_t pt_sparse_map_bytes (const struct pt_sparse_map *map);
+
+/**
+ * Test if the \a len bytes at \a ptr lie entirely within a hole, and read as zero
+ */
+bool pt_sparse_map_hole (const struct pt_sparse_map *map, const uint8_t *ptr, size_t len);
+
+/**
+ * Release the extents
+ */
+void pt_sparse_map_release (struct pt_sparse_map *map);
+
+#endif
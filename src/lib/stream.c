@@ -0,0 +1,225 @@
+#define _GNU_SOURCE // O_DIRECT, sync_file_range, fallocate
+
+#include "stream.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+
+int pt_stream_init (struct pt_stream *stream, int fd, const char *path, enum pt_stream_flags flags)
+{
+    int err;
+
+    *stream = (struct pt_stream) {
+        .fd = fd,
+        .direct_fd = -1,
+        .flags = flags,
+    };
+
+    // O_DIRECT requires aligned buffers
+    if ((err = posix_memalign((void **) &stream->buf, PT_STREAM_ALIGN, PT_STREAM_BUF_SIZE))) {
+        stream->buf = NULL;
+        return -PT_ERR_MEM;
+    }
+
+    if (flags & PT_STREAM_DIRECT) {
+        if ((stream->direct_fd = open(path, O_WRONLY | O_DIRECT)) < 0) {
+            PT_WARN_ERRNO("open %s: O_DIRECT", path);
+
+            stream->flags &= ~PT_STREAM_DIRECT;
+        }
+    }
+
+    PT_DEBUG("%s: flags=%#x", path, stream->flags);
+
+    return 0;
+}
+
+/**
+ * Write out all of the given data, setting errno on errors
+ */
+static int pt_stream_pwrite (int fd, const uint8_t *buf, size_t len, off_t offset)
+{
+    while (len) {
+        ssize_t ret;
+
+        if ((ret = pwrite(fd, buf, len, offset)) < 0)
+            return -PT_ERR_CACHE_WRITE;
+
+        // no progress, and no errno from pwrite for the caller to check
+        if (ret == 0) {
+            errno = EIO;
+            return -PT_ERR_CACHE_WRITE;
+        }
+
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+
+    return 0;
+}
+
+/**
+ * Wait for the previous window of data to be written back and drop it from the page cache, and start writeback for
+ * the data written since, once there is enough of it.
+ */
+static void pt_stream_sync (struct pt_stream *stream, off_t end)
+{
+    int err;
+
+    if (!(stream->flags & PT_STREAM_SYNC) || end < stream->sync_end + PT_STREAM_SYNC_SIZE)
+        return;
+
+    if (stream->sync_end > stream->sync_start) {
+        if (sync_file_range(stream->fd, stream->sync_start, stream->sync_end - stream->sync_start, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER)) {
+            PT_WARN_ERRNO("sync_file_range %ld, %ld", (long) stream->sync_start, (long) (stream->sync_end - stream->sync_start));
+
+            stream->flags &= ~PT_STREAM_SYNC;
+            return;
+        }
+
+        if ((err = posix_fadvise(stream->fd, stream->sync_start, stream->sync_end - stream->sync_start, POSIX_FADV_DONTNEED)))
+            PT_WARN("posix_fadvise %ld, %ld: %s", (long) stream->sync_start, (long) (stream->sync_end - stream->sync_start), strerror(err));
+    }
+
+    if (sync_file_range(stream->fd, stream->sync_end, end - stream->sync_end, SYNC_FILE_RANGE_WRITE))
+        PT_WARN_ERRNO("sync_file_range %ld, %ld", (long) stream->sync_end, (long) (end - stream->sync_end));
+
+    stream->sync_start = stream->sync_end;
+    stream->sync_end = end;
+}
+
+/**
+ * Write out the pending data, using O_DIRECT for the aligned part of it
+ */
+static int pt_stream_flush_data (struct pt_stream *stream)
+{
+    size_t direct_len = 0;
+    off_t end = stream->offset + stream->len;
+    int err;
+
+    if (!stream->len)
+        return 0;
+
+    if (stream->direct_fd >= 0 && stream->offset % PT_STREAM_ALIGN == 0)
+        direct_len = stream->len - stream->len % PT_STREAM_ALIGN;
+
+    if (direct_len && (err = pt_stream_pwrite(stream->direct_fd, stream->buf, direct_len, stream->offset))) {
+        if (errno != EINVAL)
+            return err;
+
+        // the filesystem accepted O_DIRECT at open, but not the write
+        PT_WARN_ERRNO("pwrite %d: O_DIRECT", stream->direct_fd);
+
+        close(stream->direct_fd);
+
+        stream->direct_fd = -1;
+        stream->flags &= ~PT_STREAM_DIRECT;
+        direct_len = 0;
+    }
+
+    if ((err = pt_stream_pwrite(stream->fd, stream->buf + direct_len, stream->len - direct_len, stream->offset + direct_len)))
+        return err;
+
+    stream->len = 0;
+
+    pt_stream_sync(stream, end);
+
+    return 0;
+}
+
+/**
+ * Punch out the pending hole
+ */
+static void pt_stream_flush_hole (struct pt_stream *stream)
+{
+    if (!stream->hole_len)
+        return;
+
+    if (fallocate(stream->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, stream->hole_offset, stream->hole_len)) {
+        // the stale data is harmless, it is never read
+        PT_WARN_ERRNO("fallocate %ld, %zu: FALLOC_FL_PUNCH_HOLE", (long) stream->hole_offset, stream->hole_len);
+
+        stream->flags &= ~PT_STREAM_PUNCH;
+    }
+
+    stream->hole_len = 0;
+}
+
+int pt_stream_write (struct pt_stream *stream, const uint8_t *data, size_t len, off_t offset)
+{
+    int err;
+
+    pt_stream_flush_hole(stream);
+
+    // not contiguous with the pending data
+    if (stream->len && offset != stream->offset + (off_t) stream->len && (err = pt_stream_flush_data(stream)))
+        return err;
+
+    while (len) {
+        size_t n;
+
+        if (!stream->len)
+            stream->offset = offset;
+
+        n = min(len, PT_STREAM_BUF_SIZE - stream->len);
+
+        memcpy(stream->buf + stream->len, data, n);
+
+        stream->len += n;
+        data += n;
+        len -= n;
+        offset += n;
+
+        if (stream->len == PT_STREAM_BUF_SIZE && (err = pt_stream_flush_data(stream)))
+            return err;
+    }
+
+    return 0;
+}
+
+int pt_stream_hole (struct pt_stream *stream, size_t len, off_t offset)
+{
+    if (!(stream->flags & PT_STREAM_PUNCH))
+        return 0;
+
+    if (stream->hole_len && offset == stream->hole_offset + (off_t) stream->hole_len) {
+        stream->hole_len += len;
+
+        return 0;
+    }
+
+    pt_stream_flush_hole(stream);
+
+    stream->hole_offset = offset;
+    stream->hole_len = len;
+
+    return 0;
+}
+
+int pt_stream_flush (struct pt_stream *stream)
+{
+    pt_stream_flush_hole(stream);
+
+    return pt_stream_flush_data(stream);
+}
+
+void pt_stream_release (struct pt_stream *stream)
+{
+    free(stream->buf);
+    stream->buf = NULL;
+    stream->len = 0;
+
+    if (stream->direct_fd >= 0) {
+        if (close(stream->direct_fd))
+            PT_WARN_ERRNO("close %d", stream->direct_fd);
+
+        stream->direct_fd = -1;
+    }
+}
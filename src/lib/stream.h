@@ -0,0 +1,93 @@
+#ifndef PNGTILE_STREAM_H
+#define PNGTILE_STREAM_H
+
+/**
+ * @file
+ *
+ * Streaming writes to the cache file using pwrite, instead of dirtying a shared mmap
+ */
+#include "pngtile.h"
+
+#include <sys/types.h>
+
+/**
+ * Size of the buffer used to merge contiguous writes, a multiple of PT_STREAM_ALIGN
+ */
+#define PT_STREAM_BUF_SIZE (1024 * 1024)
+
+/**
+ * Offset and length alignment required for O_DIRECT writes
+ */
+#define PT_STREAM_ALIGN 4096
+
+/**
+ * Start writeback after each this many bytes written, once the previous window has been written back
+ */
+#define PT_STREAM_SYNC_SIZE (16 * 1024 * 1024)
+
+/**
+ * Options for pt_stream_init
+ */
+enum pt_stream_flags {
+    /** Write aligned data using O_DIRECT, bypassing the page cache */
+    PT_STREAM_DIRECT = 1,
+
+    /** Limit the amount of dirty data using sync_file_range, and drop it from the page cache once written back */
+    PT_STREAM_SYNC = 2,
+
+    /** Punch out holes over any existing data, for files that are not created empty */
+    PT_STREAM_PUNCH = 4,
+};
+
+/**
+ * Streaming writer state.
+ *
+ * Writes must be made in order of increasing offset.
+ */
+struct pt_stream {
+    /** Opened file, and separate O_DIRECT fd or -1 */
+    int fd, direct_fd;
+
+    enum pt_stream_flags flags;
+
+    /** Pending data to write at offset, PT_STREAM_ALIGN-aligned */
+    uint8_t *buf;
+    size_t len;
+    off_t offset;
+
+    /** Pending hole to punch */
+    off_t hole_offset;
+    size_t hole_len;
+
+    /** Window of data being written back, following the window that has already been written back */
+    off_t sync_start, sync_end;
+};
+
+/**
+ * Initialize the writer for the given file, opening it again from \a path for O_DIRECT.
+ *
+ * Falls back to buffered writes with a warning if O_DIRECT is not supported.
+ */
+int pt_stream_init (struct pt_stream *stream, int fd, const char *path, enum pt_stream_flags flags);
+
+/**
+ * Write out \a len bytes of data at the given file offset.
+ */
+int pt_stream_write (struct pt_stream *stream, const uint8_t *data, size_t len, off_t offset);
+
+/**
+ * Leave \a len bytes at the given file offset unwritten, punching out any existing data using PT_STREAM_PUNCH.
+ */
+int pt_stream_hole (struct pt_stream *stream, size_t len, off_t offset);
+
+/**
+ * Write out any pending data, so that it can be read back from the file.
+ */
+int pt_stream_flush (struct pt_stream *stream);
+
+/**
+ * Release the writer, discarding any pending data. Does not close the fd.
+ */
+void pt_stream_release (struct pt_stream *stream);
+
+#endif
@@ -1,12 +1,18 @@
 #include "tile.h"
+#include "render.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
-int pt_tile_mem_write (struct pt_tile_mem *buf, void *data, size_t len)
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+
+int pt_tile_mem_reserve (struct pt_tile_mem *buf, size_t len)
 {
-    size_t buf_len = buf->len;
+    size_t buf_len = buf->len ? buf->len : PT_TILE_BUF_SIZE;
 
     // grow?
     while (buf->off + len > buf_len)
@@ -22,6 +28,16 @@ int pt_tile_mem_write (struct pt_tile_mem *buf, void *data, size_t len)
         buf->len = buf_len;
     }
 
+    return 0;
+}
+
+int pt_tile_mem_write (struct pt_tile_mem *buf, void *data, size_t len)
+{
+    int err;
+
+    if ((err = pt_tile_mem_reserve(buf, len)))
+        return err;
+
     // copy
     memcpy(buf->base + buf->off, data, len);
 
@@ -30,6 +46,168 @@ int pt_tile_mem_write (struct pt_tile_mem *buf, void *data, size_t len)
     return 0;
 }
 
+/**
+ * Write out all of the given buffers to the fd, retrying on partial writes
+ */
+static int pt_tile_fd_writev (int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t ret;
+
+    while (iovcnt) {
+        if ((ret = writev(fd, iov, iovcnt)) < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return -PT_ERR_TILE_WRITE;
+        }
+
+        // skip written buffers
+        for (; iovcnt && (size_t) ret >= iov->iov_len; iov++, iovcnt--)
+            ret -= iov->iov_len;
+
+        if (iovcnt) {
+            iov->iov_base = (char *) iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Write out the buffered data followed by the given data, which may be empty
+ */
+static int pt_tile_drain (struct pt_tile *tile, const void *data, size_t len)
+{
+    struct pt_tile_mem *buf = &tile->buf;
+    int err = 0;
+
+    switch (tile->out_type) {
+        case PT_TILE_OUT_WRITER:
+            if (buf->off && tile->out.writer.write(tile->out.writer.arg, buf->base, buf->off))
+                err = -PT_ERR_TILE_WRITE;
+
+            else if (len && tile->out.writer.write(tile->out.writer.arg, data, len))
+                err = -PT_ERR_TILE_WRITE;
+
+            break;
+
+        case PT_TILE_OUT_FD: {
+            struct iovec iov[2] = {
+                { buf->base, buf->off },
+                { (void *) data, len },
+            };
+
+            err = pt_tile_fd_writev(tile->out.fd, iov, 2);
+
+        } break;
+
+        default:
+            assert(false);
+    }
+
+    buf->off = 0;
+
+    return err;
+}
+
+int pt_tile_write (struct pt_tile *tile, const void *data, size_t len)
+{
+    struct pt_tile_mem *buf = &tile->buf;
+    int err = 0;
+
+    switch (tile->out_type) {
+        case PT_TILE_OUT_FILE:
+            if (len && fwrite(data, len, 1, tile->out.file) != 1)
+                err = -PT_ERR_TILE_WRITE;
+
+            break;
+
+        case PT_TILE_OUT_MEM:
+            // oops... missing const
+            err = pt_tile_mem_write(&tile->out.mem, (void *) data, len);
+
+            break;
+
+        case PT_TILE_OUT_BUF:
+            // keep counting past the end of the buffer
+            if (tile->out.mem.off < tile->out.mem.len)
+                memcpy(tile->out.mem.base + tile->out.mem.off, data, min(len, tile->out.mem.len - tile->out.mem.off));
+
+            tile->out.mem.off += len;
+
+            break;
+
+        case PT_TILE_OUT_WRITER:
+        case PT_TILE_OUT_FD:
+            if (buf->off + len <= buf->len) {
+                // buffer small writes, such as the chunk headers
+                memcpy(buf->base + buf->off, data, len);
+                buf->off += len;
+
+            } else if (len < buf->len) {
+                // fill up the buffer and drain it
+                size_t fill = buf->len - buf->off;
+
+                memcpy(buf->base + buf->off, data, fill);
+                buf->off += fill;
+
+                if (!(err = pt_tile_drain(tile, NULL, 0))) {
+                    memcpy(buf->base, (const char *) data + fill, len - fill);
+                    buf->off = len - fill;
+                }
+
+            } else {
+                // write out large data without copying
+                err = pt_tile_drain(tile, data, len);
+            }
+
+            break;
+    }
+
+    if (err)
+        tile->out_err = err;
+    else
+        tile->out_bytes += len;
+
+    return err;
+}
+
+int pt_tile_flush (struct pt_tile *tile)
+{
+    int err = 0;
+
+    switch (tile->out_type) {
+        case PT_TILE_OUT_FILE:
+            if (fflush(tile->out.file))
+                err = -PT_ERR_TILE_WRITE;
+
+            break;
+
+        case PT_TILE_OUT_MEM:
+        case PT_TILE_OUT_BUF:
+            break;
+
+        case PT_TILE_OUT_WRITER:
+            if ((err = pt_tile_drain(tile, NULL, 0)))
+                break;
+
+            if (tile->out.writer.flush && tile->out.writer.flush(tile->out.writer.arg))
+                err = -PT_ERR_TILE_WRITE;
+
+            break;
+
+        case PT_TILE_OUT_FD:
+            err = pt_tile_drain(tile, NULL, 0);
+
+            break;
+    }
+
+    if (err)
+        tile->out_err = err;
+
+    return err;
+}
 
 int pt_tile_new (struct pt_tile **tile_ptr)
 {
@@ -48,6 +226,23 @@ static void pt_tile_init (struct pt_tile *tile, const struct pt_tile_params *par
     // init
     tile->params = *params;
     tile->out_type = out_type;
+    tile->buf = (struct pt_tile_mem) { };
+    tile->out_err = 0;
+    tile->out_bytes = 0;
+}
+
+/**
+ * Allocate the output buffer for streaming output
+ */
+static int pt_tile_alloc_buf (struct pt_tile *tile)
+{
+    if ((tile->buf.base = pt_render_malloc(tile->params.ctx, PT_TILE_BUF_SIZE)) == NULL)
+        return -PT_ERR_MEM;
+
+    tile->buf.len = PT_TILE_BUF_SIZE;
+    tile->buf.off = 0;
+
+    return 0;
 }
 
 int pt_tile_init_file (struct pt_tile *tile, const struct pt_tile_params *params, FILE *out)
@@ -59,25 +254,58 @@ int pt_tile_init_file (struct pt_tile *tile, const struct pt_tile_params *params
     return 0;
 }
 
-int pt_tile_init_mem (struct pt_tile *tile, const struct pt_tile_params *params)
+int pt_tile_init_mem (struct pt_tile *tile, const struct pt_tile_params *params, size_t size)
 {
     pt_tile_init(tile, params, PT_TILE_OUT_MEM);
 
+    if (!size)
+        size = PT_TILE_BUF_SIZE;
+
     // init buffer
-    if ((tile->out.mem.base = malloc(PT_TILE_BUF_SIZE)) == NULL)
+    if ((tile->out.mem.base = malloc(size)) == NULL)
         return -PT_ERR_MEM;
 
-    tile->out.mem.len = PT_TILE_BUF_SIZE;
+    tile->out.mem.len = size;
+    tile->out.mem.off = 0;
+
+    return 0;
+}
+
+int pt_tile_init_buf (struct pt_tile *tile, const struct pt_tile_params *params, char *buf, size_t size)
+{
+    pt_tile_init(tile, params, PT_TILE_OUT_BUF);
+
+    tile->out.mem.base = buf;
+    tile->out.mem.len = size;
     tile->out.mem.off = 0;
 
     return 0;
 }
 
+int pt_tile_init_writer (struct pt_tile *tile, const struct pt_tile_params *params, const struct pt_tile_writer *writer)
+{
+    pt_tile_init(tile, params, PT_TILE_OUT_WRITER);
+
+    tile->out.writer = *writer;
+
+    return pt_tile_alloc_buf(tile);
+}
+
+int pt_tile_init_fd (struct pt_tile *tile, const struct pt_tile_params *params, int fd)
+{
+    pt_tile_init(tile, params, PT_TILE_OUT_FD);
+
+    tile->out.fd = fd;
+
+    return pt_tile_alloc_buf(tile);
+}
+
 void pt_tile_abort (struct pt_tile *tile)
 {
     // cleanup
     switch (tile->out_type) {
         case PT_TILE_OUT_FILE:
+        case PT_TILE_OUT_BUF:
             // no-op
             break;
 
@@ -85,6 +313,15 @@ void pt_tile_abort (struct pt_tile *tile)
             // drop buffer
             free(tile->out.mem.base);
 
+            break;
+
+        case PT_TILE_OUT_WRITER:
+        case PT_TILE_OUT_FD:
+            // drop buffer, keeping it for reuse
+            pt_render_free(tile->params.ctx, tile->buf.base);
+
+            tile->buf.base = NULL;
+
             break;
     }
 }
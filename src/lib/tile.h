@@ -7,6 +7,9 @@
 enum pt_tile_output {
     PT_TILE_OUT_FILE,
     PT_TILE_OUT_MEM,
+    PT_TILE_OUT_WRITER,
+    PT_TILE_OUT_FD,
+    PT_TILE_OUT_BUF,
 };
 
 /** Initial size of out.mem.base, 16k */
@@ -24,19 +27,55 @@ struct pt_tile {
         /** Output file */
         FILE *file;
 
-        /** Output buffer */
+        /**
+         * Output buffer, or the caller's buffer for PT_TILE_OUT_BUF.
+         *
+         * For PT_TILE_OUT_BUF, off keeps counting past the end of the buffer, giving the required size.
+         */
         struct pt_tile_mem {
             char *base;
             size_t off, len;
         } mem;
+
+        /** Output callbacks */
+        struct pt_tile_writer writer;
+
+        /** Output file descriptor */
+        int fd;
     } out;
+
+    /** Buffer of PT_TILE_BUF_SIZE for PT_TILE_OUT_WRITER and PT_TILE_OUT_FD, allocated from params.ctx */
+    struct pt_tile_mem buf;
+
+    /** Error from the output, if writing out failed */
+    int out_err;
+
+    /** Total number of bytes written out */
+    size_t out_bytes;
 };
 
+/**
+ * Grow the tile's output buffer to fit \a len more bytes
+ */
+int pt_tile_mem_reserve (struct pt_tile_mem *buf, size_t len);
+
 /**
  * Write to the tile's output buffer
  */
 int pt_tile_mem_write (struct pt_tile_mem *buf, void *data, size_t len);
 
+/**
+ * Write out PNG data to the tile's output, buffering it for PT_TILE_OUT_WRITER and PT_TILE_OUT_FD.
+ *
+ * On errors, the error is also stored in tile->out_err.
+ */
+int pt_tile_write (struct pt_tile *tile, const void *data, size_t len);
+
+/**
+ * Write out any buffered PNG data to the tile's output, and flush it
+ */
+int pt_tile_flush (struct pt_tile *tile);
+
 /**
  * Alloc a new pt_tile, which must be initialized using pt_tile_init_*
  */
@@ -49,11 +88,30 @@ int pt_tile_init_file (struct pt_tile *tile, const struct pt_tile_params *params
 
 /**
  * Initialize to render with given params, writing output to a memory buffer
+ *
+ * @param size initial size of the buffer, or 0 for PT_TILE_BUF_SIZE
+ */
+int pt_tile_init_mem (struct pt_tile *tile, const struct pt_tile_params *params, size_t size);
+
+/**
+ * Initialize to render with given params, writing output to the caller's buffer of \a size bytes
+ */
+int pt_tile_init_buf (struct pt_tile *tile, const struct pt_tile_params *params, char *buf, size_t size);
+
+/**
+ * Initialize to render with given params, writing output to the given callbacks
+ */
+int pt_tile_init_writer (struct pt_tile *tile, const struct pt_tile_params *params, const struct pt_tile_writer *writer);
+
+/**
+ * Initialize to render with given params, writing output to the given file descriptor
  */
-int pt_tile_init_mem (struct pt_tile *tile, const struct pt_tile_params *params);
+int pt_tile_init_fd (struct pt_tile *tile, const struct pt_tile_params *params, int fd);
 
 /**
  * Abort any failed render process, cleaning up.
+ *
+ * This must also be called after successful renders to PT_TILE_OUT_WRITER or PT_TILE_OUT_FD, to release the buffer.
  */
 void pt_tile_abort (struct pt_tile *tile);
 
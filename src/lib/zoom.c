@@ -0,0 +1,440 @@
+#include "zoom.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+
+/**
+ * Fill in the RGBX lookup table for unpacked palette or gray pixels
+ */
+static void pt_zoom_lut (struct pt_zoom *zoom, const struct pt_png_header *header)
+{
+    for (unsigned i = 0; i < 256; i++) {
+        uint8_t c[4] = { 0, 0, 0, 0 };
+
+        if (header->color_type == PNG_COLOR_TYPE_PALETTE) {
+            // invalid indexes are black
+            if (i < header->num_palette) {
+                c[0] = header->palette[i].red;
+                c[1] = header->palette[i].green;
+                c[2] = header->palette[i].blue;
+            }
+        } else if (i < (1u << header->bit_depth)) {
+            // scale up to 8 bits
+            c[0] = c[1] = c[2] = i * 255 / ((1 << header->bit_depth) - 1);
+        }
+
+        memcpy(&zoom->lut[i], c, sizeof(c));
+    }
+}
+
+uint16_t *pt_zoom_palette_lut_new (void)
+{
+    uint16_t *lut;
+
+    if ((lut = malloc(PT_ZOOM_PALETTE_SIZE * sizeof(*lut))) == NULL)
+        return NULL;
+
+    // not yet looked up
+    memset(lut, 0xff, PT_ZOOM_PALETTE_SIZE * sizeof(*lut));
+
+    return lut;
+}
+
+int pt_zoom_begin (struct pt_zoom *zoom, struct pt_render_ctx *ctx, const struct pt_png_header *header, int z, unsigned in_width, enum pt_tile_zoom_mode mode, uint16_t *palette_lut)
+{
+    memset(zoom, 0, sizeof(*zoom));
+
+    zoom->ctx = ctx;
+    zoom->mode = pt_zoom_mode(header, mode);
+    zoom->zoom = z;
+    zoom->pixel_size = 1u << z;
+    zoom->in_width = in_width;
+    zoom->out_width = in_width ? ((in_width - 1) >> z) + 1 : 0;
+    zoom->col_bytes = header->col_bytes;
+
+    switch (zoom->mode) {
+        case PT_TILE_ZOOM_AVERAGE:
+            break;
+
+        case PT_TILE_ZOOM_PALETTE:
+            zoom->palette = header->palette;
+            zoom->num_palette = header->num_palette;
+            zoom->palette_lut = palette_lut;
+
+            break;
+
+        case PT_TILE_ZOOM_DOMINANT:
+            // the input rows are only collected, for counting the indexes within each square
+            if ((zoom->rows_buf = pt_render_malloc(ctx, (size_t) in_width << z)) == NULL)
+                return -PT_ERR_MEM;
+
+            return 0;
+
+        default:
+            return -PT_ERR_TILE_ZOOM;
+    }
+
+    switch (header->color_type) {
+        case PNG_COLOR_TYPE_RGB:
+        case PNG_COLOR_TYPE_RGB_ALPHA:
+            if (header->bit_depth != 8)
+                return -PT_ERR_IMG_FORMAT;
+
+            // sum up the pixels as they are, ignoring any alpha
+            zoom->channels = header->col_bytes;
+
+            break;
+
+        case PNG_COLOR_TYPE_PALETTE:
+        case PNG_COLOR_TYPE_GRAY:
+            if (header->bit_depth > 8)
+                return -PT_ERR_IMG_FORMAT;
+
+            zoom->expand = true;
+            zoom->channels = 4;
+
+            pt_zoom_lut(zoom, header);
+
+            break;
+
+        default:
+            return -PT_ERR_IMG_FORMAT;
+    }
+
+    if (zoom->expand && (zoom->expand_buf = pt_render_malloc(ctx, in_width * sizeof(uint32_t))) == NULL)
+        return -PT_ERR_MEM;
+
+    if ((zoom->cols = pt_render_calloc(ctx, in_width * zoom->channels * sizeof(*zoom->cols))) == NULL)
+        return -PT_ERR_MEM;
+
+    if ((zoom->sums = pt_render_calloc(ctx, zoom->out_width * 3 * sizeof(*zoom->sums))) == NULL)
+        return -PT_ERR_MEM;
+
+    return 0;
+}
+
+/**
+ * Add \a len bytes of input to the 16-bit column sums
+ */
+static void pt_zoom_add_cols (uint16_t *cols, const uint8_t *in, size_t len)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (in + i));
+        __m128i *c = (__m128i *) (cols + i);
+
+        _mm_storeu_si128(c + 0, _mm_add_epi16(_mm_loadu_si128(c + 0), _mm_unpacklo_epi8(v, zero)));
+        _mm_storeu_si128(c + 1, _mm_add_epi16(_mm_loadu_si128(c + 1), _mm_unpackhi_epi8(v, zero)));
+    }
+#endif
+
+    for (; i < len; i++)
+        cols[i] += in[i];
+}
+
+/**
+ * Add the column sums into the sums of the output pixels covering them, and clear them
+ */
+static void pt_zoom_fold (struct pt_zoom *zoom)
+{
+    const uint16_t *cols = zoom->cols;
+    uint32_t *sums = zoom->sums;
+
+    for (unsigned o = 0; o < zoom->out_width; o++) {
+        unsigned start = o << zoom->zoom, end = min(start + zoom->pixel_size, zoom->in_width);
+        uint32_t *s = sums + o * 3;
+
+#ifdef __SSE2__
+        if (zoom->channels == 4) {
+            const __m128i zero = _mm_setzero_si128();
+            __m128i acc = _mm_setzero_si128();
+            uint32_t a[4];
+
+            // widen each RGBX pixel's sums to 32 bits
+            for (unsigned x = start; x < end; x++)
+                acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *) (cols + x * 4)), zero));
+
+            _mm_storeu_si128((__m128i *) a, acc);
+
+            s[0] += a[0];
+            s[1] += a[1];
+            s[2] += a[2];
+
+            continue;
+        }
+#endif
+
+        for (unsigned x = start; x < end; x++) {
+            const uint16_t *c = cols + x * zoom->channels;
+
+            s[0] += c[0];
+            s[1] += c[1];
+            s[2] += c[2];
+        }
+    }
+
+    memset(zoom->cols, 0, zoom->in_width * zoom->channels * sizeof(*zoom->cols));
+
+    zoom->col_rows = 0;
+}
+
+void pt_zoom_row (struct pt_zoom *zoom, const uint8_t *row)
+{
+    const uint8_t *in = row;
+
+    if (zoom->mode == PT_TILE_ZOOM_DOMINANT) {
+        memcpy(zoom->rows_buf + (size_t) zoom->rows * zoom->in_width, row, zoom->in_width);
+
+        zoom->rows++;
+
+        return;
+    }
+
+    if (zoom->expand) {
+        uint32_t *out = (uint32_t *) zoom->expand_buf;
+
+        for (unsigned x = 0; x < zoom->in_width; x++)
+            out[x] = zoom->lut[row[x]];
+
+        in = zoom->expand_buf;
+    }
+
+    pt_zoom_add_cols(zoom->cols, in, zoom->in_width * zoom->channels);
+
+    zoom->rows++;
+
+    // before the column sums can overflow
+    if (++zoom->col_rows == PT_ZOOM_COL_ROWS)
+        pt_zoom_fold(zoom);
+}
+
+/**
+ * Find the palette index of the color closest to the given RGB color, preferring the lowest index
+ */
+static uint8_t pt_zoom_nearest (const struct pt_zoom *zoom, const uint8_t c[3])
+{
+    unsigned best = 0, best_dist = UINT_MAX;
+
+    for (unsigned i = 0; i < zoom->num_palette; i++) {
+        int r = zoom->palette[i].red - c[0], g = zoom->palette[i].green - c[1], b = zoom->palette[i].blue - c[2];
+        unsigned dist = r * r + g * g + b * b;
+
+        if (dist < best_dist) {
+            best = i;
+            best_dist = dist;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Map an averaged color to the nearest palette color, looking up the quantized color in the nearest palette color table
+ */
+static uint8_t pt_zoom_palette (const struct pt_zoom *zoom, const uint8_t c[3])
+{
+    const unsigned shift = 8 - PT_ZOOM_PALETTE_BITS;
+    size_t key;
+    uint16_t index;
+
+    if (!zoom->palette_lut)
+        return pt_zoom_nearest(zoom, c);
+
+    key = ((size_t) (c[0] >> shift) << (2 * PT_ZOOM_PALETTE_BITS)) | ((c[1] >> shift) << PT_ZOOM_PALETTE_BITS) | (c[2] >> shift);
+
+    // other renders may be filling in the same entry, with the same value
+    if ((index = __atomic_load_n(&zoom->palette_lut[key], __ATOMIC_RELAXED)) > 0xff) {
+        // the center of the range of colors quantized to the same key
+        uint8_t center[3] = {
+            (c[0] >> shift << shift) | (1 << shift >> 1),
+            (c[1] >> shift << shift) | (1 << shift >> 1),
+            (c[2] >> shift << shift) | (1 << shift >> 1),
+        };
+
+        index = pt_zoom_nearest(zoom, center);
+
+        __atomic_store_n(&zoom->palette_lut[key], index, __ATOMIC_RELAXED);
+    }
+
+    return index;
+}
+
+/**
+ * Write out the most common palette index within each square of the input rows
+ */
+static void pt_zoom_out_dominant (struct pt_zoom *zoom, uint8_t *out)
+{
+    uint32_t counts[256] = { 0 };
+    uint8_t used[256];
+
+    for (unsigned o = 0; o < zoom->out_width; o++) {
+        unsigned start = o << zoom->zoom, end = min(start + zoom->pixel_size, zoom->in_width);
+        uint32_t best_count = 0;
+        uint8_t best = 0;
+        unsigned num_used = 0;
+
+        // count runs of the same index at a time, the first index to reach the highest count wins
+        for (unsigned r = 0; r < zoom->rows; r++) {
+            const uint8_t *row = zoom->rows_buf + (size_t) r * zoom->in_width;
+
+            for (unsigned x = start; x < end; ) {
+                uint8_t v = row[x];
+                unsigned n = 1;
+
+                while (x + n < end && row[x + n] == v)
+                    n++;
+
+                x += n;
+
+                if (!counts[v])
+                    used[num_used++] = v;
+
+                if ((counts[v] += n) > best_count) {
+                    best = v;
+                    best_count = counts[v];
+                }
+            }
+        }
+
+        out[o] = best;
+
+        // clear the counts used
+        for (unsigned i = 0; i < num_used; i++)
+            counts[used[i]] = 0;
+    }
+}
+
+void pt_zoom_out (struct pt_zoom *zoom, uint8_t *out)
+{
+    if (!zoom->rows)
+        return;
+
+    if (zoom->mode == PT_TILE_ZOOM_DOMINANT) {
+        pt_zoom_out_dominant(zoom, out);
+
+        zoom->rows = 0;
+
+        return;
+    }
+
+    if (zoom->col_rows)
+        pt_zoom_fold(zoom);
+
+    for (unsigned o = 0; o < zoom->out_width; o++) {
+        // the last column may be partial
+        unsigned start = o << zoom->zoom;
+        unsigned n = zoom->rows * (min(start + zoom->pixel_size, zoom->in_width) - start);
+        uint8_t c[3];
+
+        for (unsigned i = 0; i < 3; i++)
+            c[i] = (zoom->sums[o * 3 + i] + n / 2) / n;
+
+        if (zoom->mode == PT_TILE_ZOOM_PALETTE)
+            out[o] = pt_zoom_palette(zoom, c);
+        else
+            memcpy(out + o * 3, c, 3);
+    }
+
+    memset(zoom->sums, 0, zoom->out_width * 3 * sizeof(*zoom->sums));
+
+    zoom->rows = 0;
+}
+
+void pt_zoom_release (struct pt_zoom *zoom)
+{
+    pt_render_free(zoom->ctx, zoom->expand_buf);
+    pt_render_free(zoom->ctx, zoom->cols);
+    pt_render_free(zoom->ctx, zoom->sums);
+    pt_render_free(zoom->ctx, zoom->rows_buf);
+
+    zoom->expand_buf = NULL;
+    zoom->cols = NULL;
+    zoom->sums = NULL;
+    zoom->rows_buf = NULL;
+}
+
+#ifdef __SSE2__
+/**
+ * Double each element of \a width elements of (1 << shift) bytes in place, backwards so that each chunk is read before
+ * it gets overwritten.
+ */
+static void pt_zoom_double (uint8_t *buf, size_t width, unsigned shift)
+{
+    size_t len = width << shift, end = len & ~(size_t) 15;
+
+    // the partial chunk at the end
+    for (size_t i = len; i > end; ) {
+        uint64_t e = 0;
+
+        i -= 1 << shift;
+
+        memcpy(&e, buf + i, 1 << shift);
+        memcpy(buf + i * 2 + (1 << shift), &e, 1 << shift);
+        memcpy(buf + i * 2, &e, 1 << shift);
+    }
+
+    for (size_t i = end; i > 0; ) {
+        __m128i v, lo, hi;
+
+        i -= 16;
+
+        v = _mm_loadu_si128((const __m128i *) (buf + i));
+
+        switch (shift) {
+            case 0: lo = _mm_unpacklo_epi8(v, v);  hi = _mm_unpackhi_epi8(v, v);  break;
+            case 1: lo = _mm_unpacklo_epi16(v, v); hi = _mm_unpackhi_epi16(v, v); break;
+            case 2: lo = _mm_unpacklo_epi32(v, v); hi = _mm_unpackhi_epi32(v, v); break;
+            default: lo = _mm_unpacklo_epi64(v, v); hi = _mm_unpackhi_epi64(v, v); break;
+        }
+
+        _mm_storeu_si128((__m128i *) (buf + i * 2), lo);
+        _mm_storeu_si128((__m128i *) (buf + i * 2 + 16), hi);
+    }
+}
+#endif
+
+void pt_zoom_expand (uint8_t *buf, unsigned width_px, size_t col_bytes, int z)
+{
+    size_t pixel_size = (size_t) 1 << z;
+
+#ifdef __SSE2__
+    // pixels of 1, 2, 4 or 8 bytes are doubled up z times, except for long runs of bytes that are better memset
+    if (col_bytes <= 8 && !(col_bytes & (col_bytes - 1)) && !(col_bytes == 1 && pixel_size >= 16)) {
+        unsigned shift = col_bytes == 1 ? 0 : col_bytes == 2 ? 1 : col_bytes == 4 ? 2 : 3;
+
+        for (int i = 0; i < z; i++)
+            pt_zoom_double(buf, (size_t) width_px << i, shift);
+
+        return;
+    }
+#endif
+
+    if (col_bytes == 1) {
+        for (unsigned x = width_px; x-- > 0; )
+            memset(buf + x * pixel_size, buf[x], pixel_size);
+
+        return;
+    }
+
+    // backwards, as each pixel is expanded at or after its offset
+    for (unsigned x = width_px; x-- > 0; ) {
+        uint8_t *out = buf + x * pixel_size * col_bytes;
+
+        memmove(out, buf + x * col_bytes, col_bytes);
+
+        // doubling up the copies made so far
+        for (size_t n = col_bytes; n < pixel_size * col_bytes; n *= 2)
+            memcpy(out + n, out, min(n, pixel_size * col_bytes - n));
+    }
+}
@@ -0,0 +1,143 @@
+#ifndef PNGTILE_ZOOM_H
+#define PNGTILE_ZOOM_H
+
+/**
+ * @file
+ *
+ * Box-filter downsampling of rows of pixels by 2^zoom into 8bpp RGB, averaging each square of input pixels.
+ *
+ * The input rows are summed up per channel into 16-bit column sums using SSE2 where available, with palette and gray
+ * pixels first expanded to RGB through a lookup table. Each output pixel then sums up its columns, and divides once.
+ *
+ * Palette images can also be zoomed out into palette indexes, either by mapping the averaged colors back to the nearest
+ * palette color through a lookup table shared between renders, or by using the most common index in each square.
+ *
+ * Zooming in instead replicates each input pixel, keeping the pixel format as it is.
+ */
+#include "png.h"
+#include "render.h"
+
+#include <stdint.h>
+
+/**
+ * Number of input rows that fit into the 16-bit column sums
+ */
+#define PT_ZOOM_COL_ROWS 256
+
+/**
+ * Number of bits per channel of the averaged colors looked up in the nearest palette color table
+ */
+#define PT_ZOOM_PALETTE_BITS 6
+
+/**
+ * Number of entries in the nearest palette color table
+ */
+#define PT_ZOOM_PALETTE_SIZE (1 << (3 * PT_ZOOM_PALETTE_BITS))
+
+/**
+ * Maximum zoom-in level, replicating each input pixel 2^PT_ZOOM_IN_MAX times along each side
+ */
+#define PT_ZOOM_IN_MAX 8
+
+/**
+ * Downsampling state for one row of output pixels at a time
+ */
+struct pt_zoom {
+    struct pt_render_ctx *ctx;
+
+    /** Output pixel format, see pt_zoom_mode() */
+    enum pt_tile_zoom_mode mode;
+
+    /** Input pixels per output pixel along each side, 2^zoom */
+    int zoom;
+    unsigned pixel_size;
+
+    /** Input row width in pixels, and the output row width in pixels covering it */
+    unsigned in_width, out_width;
+
+    /** Bytes per input pixel, and the number of channels per pixel in the column sums */
+    size_t col_bytes;
+    unsigned channels;
+
+    /** Palette or gray pixels are expanded to RGBX through the lookup table, of pixels in memory order */
+    bool expand;
+    uint32_t lut[256];
+
+    /** Input row, expanded to RGBX */
+    uint8_t *expand_buf;
+
+    /** Per-channel sums of each input column, over col_rows rows */
+    uint16_t *cols;
+    unsigned col_rows;
+
+    /** Per-channel RGB sums of each output pixel, over rows rows */
+    uint32_t *sums;
+    unsigned rows;
+
+    /** Image palette, and the optional nearest palette color table, for PT_TILE_ZOOM_PALETTE */
+    const png_color *palette;
+    unsigned num_palette;
+    uint16_t *palette_lut;
+
+    /** Input rows of palette indexes, for PT_TILE_ZOOM_DOMINANT */
+    uint8_t *rows_buf;
+};
+
+/**
+ * The zoom mode used for data of the given format, as only palette images can be zoomed out into palette indexes.
+ *
+ * The downsampled zoom levels of palette images keep the palette, but not the indexes.
+ */
+static inline enum pt_tile_zoom_mode pt_zoom_mode (const struct pt_png_header *header, enum pt_tile_zoom_mode mode)
+{
+    if (!header->num_palette)
+        return PT_TILE_ZOOM_AVERAGE;
+
+    if (mode == PT_TILE_ZOOM_DOMINANT && header->color_type != PNG_COLOR_TYPE_PALETTE)
+        return PT_TILE_ZOOM_PALETTE;
+
+    return mode;
+}
+
+/**
+ * Allocate an empty nearest palette color table, to be filled in as used by PT_TILE_ZOOM_PALETTE renders of the same
+ * image. Free using free().
+ */
+uint16_t *pt_zoom_palette_lut_new (void);
+
+/**
+ * Set up to downsample rows of \a in_width unpacked pixels of the given format by 2^zoom.
+ *
+ * @param mode output pixel format, see pt_zoom_mode()
+ * @param palette_lut optional nearest palette color table for PT_TILE_ZOOM_PALETTE, see pt_zoom_palette_lut_new()
+ * @return -PT_ERR_IMG_FORMAT if the pixel format is not supported, see pt_png_zoom_header()
+ */
+int pt_zoom_begin (struct pt_zoom *zoom, struct pt_render_ctx *ctx, const struct pt_png_header *header, int z, unsigned in_width, enum pt_tile_zoom_mode mode, uint16_t *palette_lut);
+
+/**
+ * Add an input row of in_width unpacked pixels to the output row, up to 2^zoom rows
+ */
+void pt_zoom_row (struct pt_zoom *zoom, const uint8_t *row);
+
+/**
+ * Write out the out_width pixels of the output row, and start the next row.
+ *
+ * The pixels are 8bpp RGB averages of the input pixels added, or palette indexes of a byte per pixel.
+ *
+ * Does nothing if no input rows were added.
+ */
+void pt_zoom_out (struct pt_zoom *zoom, uint8_t *out);
+
+/**
+ * Release resources, after pt_zoom_begin, whether or not it failed
+ */
+void pt_zoom_release (struct pt_zoom *zoom);
+
+/**
+ * Expand a row of \a width_px unpacked pixels of \a col_bytes each in place, replicating each pixel 2^z times.
+ *
+ * The buffer must have room for the (width_px << z) expanded pixels.
+ */
+void pt_zoom_expand (uint8_t *buf, unsigned width_px, size_t col_bytes, int z);
+
+#endif
@@ -1,18 +1,33 @@
 #include "pngtile.h"
 #include "log.h"
 
+#include <png.h>
 #include <getopt.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <time.h>
 
 enum option_names {
 
     _OPT_LONGONLY       = 255,
 
+    OPT_ZOOM_LEVELS,
+    OPT_COMPRESS,
+    OPT_PACKED,
+    OPT_STREAM,
+    OPT_DIRECT,
+    OPT_CHECKPOINT,
+    OPT_PROGRESS,
     OPT_BENCHMARK,
     OPT_RANDOMIZE,
+    OPT_PROFILE,
+    OPT_ENCODER,
+    OPT_ZOOM_MODE,
+    OPT_VERIFY,
+    OPT_RENDER_THREADS,
 };
 
 /**
@@ -32,10 +47,23 @@ static const struct option options[] = {
     { "y",              true,   NULL,   'y' },
     { "zoom",           true,   NULL,   'z' },
     { "out",            true,   NULL,   'o' },
+    { "threads",        true,   NULL,   'j' },
 
     // --long-only options
+    { "zoom-levels",    false,  NULL,   OPT_ZOOM_LEVELS },
+    { "compress",       false,  NULL,   OPT_COMPRESS    },
+    { "packed",         false,  NULL,   OPT_PACKED      },
+    { "stream",         false,  NULL,   OPT_STREAM      },
+    { "direct",         false,  NULL,   OPT_DIRECT      },
+    { "checkpoint",     false,  NULL,   OPT_CHECKPOINT  },
+    { "progress",       false,  NULL,   OPT_PROGRESS    },
     { "benchmark",      true,   NULL,   OPT_BENCHMARK   },
     { "randomize",      false,  NULL,   OPT_RANDOMIZE   },
+    { "profile",        true,   NULL,   OPT_PROFILE     },
+    { "encoder",        true,   NULL,   OPT_ENCODER     },
+    { "zoom-mode",      true,   NULL,   OPT_ZOOM_MODE   },
+    { "verify",         false,  NULL,   OPT_VERIFY      },
+    { "render-threads", true,   NULL,   OPT_RENDER_THREADS },
     { 0,                0,      0,      0               }
 };
 
@@ -56,13 +84,26 @@ void help (const char *argv0)
         "\t-U, --force-update       unconditionally update image caches\n"
         "\t-N, --no-update          do not update the image cache\n"
         "\t-B, --background         set background pattern for sparse cache file: 0xHH..\n"
+        "\t--zoom-levels            store downsampled zoom levels in the cache file\n"
+        "\t--compress               store compressed blocks in the cache file\n"
+        "\t--packed                 store 1/2/4-bit pixels bit-packed in the cache file\n"
+        "\t--stream                 write the cache file using throttled pwrite instead of mmap\n"
+        "\t--direct                 write the cache file using O_DIRECT\n"
+        "\t--checkpoint             checkpoint the cache update, and resume an interrupted update\n"
+        "\t--progress               display the progress of cache updates\n"
+        "\t-j, --threads    N       decode using N threads\n"
         "\t-W, --width      PX      set tile width\n"
         "\t-H, --height     PX      set tile height\n"
         "\t-x, --x          PX      set tile x offset\n"
         "\t-y, --y          PX      set tile y offset\n"
-        "\t-z, --zoom       ZL      set zoom factor (<0)\n"
+        "\t-z, --zoom       ZL      set zoom factor (>0 out, <0 in)\n"
         "\t-o, --out        FILE    set tile output file\n"
+        "\t--profile        NAME    encode tiles using the default, fast or small profile\n"
+        "\t--encoder        NAME    encode tiles using the auto, libpng or builtin encoder\n"
+        "\t--zoom-mode      NAME    zoom out palette images using the average, palette or dominant mode\n"
         "\t--benchmark      N       do N tile renders\n"
+        "\t--render-threads N       do the benchmark tile renders in memory using a pool of N threads\n"
+        "\t--verify                 compare the decoded pixels of each tile with the libpng encoder's\n"
         "\t--randomize              randomize tile x/y coords\n"
     );
 }
@@ -99,6 +140,51 @@ signed long parse_sint (const char *val, const char *name)
     return out;
 }
 
+enum pt_tile_profile parse_profile (const char *val, const char *name)
+{
+    if (strcmp(val, "default") == 0)
+        return PT_TILE_PROFILE_DEFAULT;
+
+    else if (strcmp(val, "fast") == 0)
+        return PT_TILE_PROFILE_FAST;
+
+    else if (strcmp(val, "small") == 0)
+        return PT_TILE_PROFILE_SMALL;
+
+    else
+        EXIT_ERROR(EXIT_FAILURE, "Invalid value for %s: %s", name, val);
+}
+
+enum pt_tile_encoder parse_encoder (const char *val, const char *name)
+{
+    if (strcmp(val, "auto") == 0)
+        return PT_TILE_ENCODER_AUTO;
+
+    else if (strcmp(val, "libpng") == 0)
+        return PT_TILE_ENCODER_LIBPNG;
+
+    else if (strcmp(val, "builtin") == 0)
+        return PT_TILE_ENCODER_BUILTIN;
+
+    else
+        EXIT_ERROR(EXIT_FAILURE, "Invalid value for %s: %s", name, val);
+}
+
+enum pt_tile_zoom_mode parse_zoom_mode (const char *val, const char *name)
+{
+    if (strcmp(val, "average") == 0)
+        return PT_TILE_ZOOM_AVERAGE;
+
+    else if (strcmp(val, "palette") == 0)
+        return PT_TILE_ZOOM_PALETTE;
+
+    else if (strcmp(val, "dominant") == 0)
+        return PT_TILE_ZOOM_DOMINANT;
+
+    else
+        EXIT_ERROR(EXIT_FAILURE, "Invalid value for %s: %s", name, val);
+}
+
 long randrange (long start, long end)
 {
     return start + (rand() * (end - start) / RAND_MAX);
@@ -113,6 +199,154 @@ void randomize_tile (struct pt_tile_params *params, const struct pt_image_info *
     params->y = randrange(0, info->height - params->height);
 }
 
+/**
+ * Display the progress of a cache update on a single line, with the throughput of decoded pixel data
+ */
+int update_progress (void *arg, const struct pt_image_progress *progress)
+{
+    double elapsed = progress->elapsed.tv_sec + progress->elapsed.tv_nsec / 1e9;
+    double mb = (progress->bytes + progress->sparse_bytes) / 1e6;
+
+    fprintf(stderr, "\r\t%zu/%zu rows (%.1f%%), %.1f MB stored, %.1f MB sparse, %.1f MB/s ",
+            progress->rows, progress->rows_total, progress->rows_total ? 100.0 * progress->rows / progress->rows_total : 100.0,
+            progress->bytes / 1e6, progress->sparse_bytes / 1e6, elapsed > 0 ? mb / elapsed : 0.0
+    );
+
+    return 0;
+}
+
+/**
+ * Decode a rendered tile as 8-bit RGBA into a new buffer
+ */
+int decode_tile (const char *buf, size_t len, png_bytep *pixels_ptr, size_t *size_ptr)
+{
+    png_image image = { .version = PNG_IMAGE_VERSION };
+    png_bytep pixels = NULL;
+
+    if (!png_image_begin_read_from_memory(&image, buf, len)) {
+        log_error("png_image_begin_read_from_memory: %s", image.message);
+        goto error;
+    }
+
+    image.format = PNG_FORMAT_RGBA;
+
+    if ((pixels = malloc(PNG_IMAGE_SIZE(image))) == NULL) {
+        log_errno("malloc");
+        goto error;
+    }
+
+    if (!png_image_finish_read(&image, NULL, pixels, 0, NULL)) {
+        log_error("png_image_finish_read: %s", image.message);
+        goto error;
+    }
+
+    *pixels_ptr = pixels;
+    *size_ptr = PNG_IMAGE_SIZE(image);
+
+    return 0;
+
+error:
+    png_image_free(&image);
+    free(pixels);
+
+    return -1;
+}
+
+/**
+ * Render a tile using both the given encoder and libpng, and compare the decoded pixels
+ */
+int verify_tile (struct pt_image *image, const struct pt_tile_params *params)
+{
+    struct pt_tile_params libpng_params = *params;
+    char *bufs[2] = { };
+    size_t lens[2];
+    png_bytep pixels[2] = { };
+    size_t sizes[2];
+    int err = 0;
+
+    libpng_params.encoder = PT_TILE_ENCODER_LIBPNG;
+
+    if ((err = pt_image_tile_mem(image, params, &bufs[0], &lens[0]))) {
+        log_error("pt_image_tile_mem: %s", pt_strerror(err));
+        goto error;
+    }
+
+    if ((err = pt_image_tile_mem(image, &libpng_params, &bufs[1], &lens[1]))) {
+        log_error("pt_image_tile_mem: %s", pt_strerror(err));
+        goto error;
+    }
+
+    if ((err = decode_tile(bufs[0], lens[0], &pixels[0], &sizes[0])))
+        goto error;
+
+    if ((err = decode_tile(bufs[1], lens[1], &pixels[1], &sizes[1])))
+        goto error;
+
+    if (sizes[0] != sizes[1] || memcmp(pixels[0], pixels[1], sizes[0])) {
+        log_error("Tile %ux%u@(%u,%u) differs from libpng", params->width, params->height, params->x, params->y);
+        err = -1;
+    }
+
+error:
+    for (int i = 0; i < 2; i++) {
+        free(bufs[i]);
+        free(pixels[i]);
+    }
+
+    return err;
+}
+
+/**
+ * Render n tiles into memory using a pool of threads, submitting them all at once
+ */
+int do_tile_renderer (struct pt_image *image, const struct pt_tile_params *params, const struct pt_image_info *info, int n, bool randomize, unsigned threads)
+{
+    struct pt_renderer *renderer;
+    struct pt_render_job *jobs, *job;
+    int err = 0;
+
+    if ((jobs = calloc(n, sizeof(*jobs))) == NULL) {
+        log_errno("calloc");
+        return -1;
+    }
+
+    if ((err = pt_renderer_new(&renderer, threads))) {
+        log_error("pt_renderer_new: %s", pt_strerror(err));
+        free(jobs);
+        return err;
+    }
+
+    for (int i = 0; i < n; i++) {
+        jobs[i].image = image;
+        jobs[i].params = *params;
+
+        // randomize x, y
+        if (randomize)
+            randomize_tile(&jobs[i].params, info);
+
+        if ((err = pt_renderer_submit(renderer, &jobs[i]))) {
+            log_error("pt_renderer_submit: %s", pt_strerror(err));
+            goto error;
+        }
+    }
+
+error:
+    // wait for the submitted jobs
+    while (!pt_renderer_complete(renderer, &job, true) && job) {
+        if (job->result.err && !err) {
+            log_error("Render tile %ux%u@(%u,%u): %s", job->params.width, job->params.height, job->params.x, job->params.y, pt_strerror(job->result.err));
+            err = job->result.err;
+        }
+
+        free(job->result.buf);
+    }
+
+    pt_renderer_destroy(renderer);
+    free(jobs);
+
+    return err;
+}
+
 /**
  * Render a tile
  */
@@ -140,11 +374,13 @@ int do_tile (struct pt_image *image, const struct pt_tile_params *params, const
         }
 
     } else if (strcmp(out_path, "-") == 0) {
-        // use stdout
-        if ((out_file = fdopen(STDOUT_FILENO, "wb")) == NULL) {
-            log_errno("fdopen: STDOUT_FILENO");
-            goto error;
-        }
+        // stream to stdout
+        log_info("\tRender tile %ux%u@(%u,%u) -> %s", params->width, params->height, params->x, params->y, out_path);
+
+        if ((err = pt_image_tile_fd(image, params, STDOUT_FILENO)))
+            log_errno("pt_image_tile_fd: %s", pt_strerror(err));
+
+        return err;
 
     } else {
         // use file
@@ -174,7 +410,7 @@ error:
 int main (int argc, char **argv)
 {
     int opt;
-    bool force_update = false, no_update = false, randomize = false;
+    bool force_update = false, no_update = false, randomize = false, verify = false;
     struct pt_tile_params params = {
         .width  = 800,
         .height = 600,
@@ -185,6 +421,7 @@ int main (int argc, char **argv)
     struct pt_image_params update_params = { };
     const char *out_path = NULL;
     int benchmark = 0;
+    unsigned render_threads = 0;
     int err;
 
     // parse arguments
@@ -255,9 +492,48 @@ int main (int argc, char **argv)
                 // output file
                 out_path = optarg; break;
 
+            case 'j':
+                update_params.threads = parse_uint(optarg, "--threads"); break;
+
+            case OPT_ZOOM_LEVELS:
+                update_params.flags |= PT_IMAGE_ZOOM_LEVELS; break;
+
+            case OPT_COMPRESS:
+                update_params.flags |= PT_IMAGE_COMPRESS; break;
+
+            case OPT_PACKED:
+                update_params.flags |= PT_IMAGE_PACKED; break;
+
+            case OPT_STREAM:
+                update_params.flags |= PT_IMAGE_STREAM; break;
+
+            case OPT_DIRECT:
+                update_params.flags |= PT_IMAGE_DIRECT; break;
+
+            case OPT_CHECKPOINT:
+                update_params.flags |= PT_IMAGE_CHECKPOINT; break;
+
+            case OPT_PROGRESS:
+                update_params.progress = update_progress; break;
+
             case OPT_BENCHMARK:
                 benchmark = parse_uint(optarg, "--benchmark"); break;
 
+            case OPT_RENDER_THREADS:
+                render_threads = parse_uint(optarg, "--render-threads"); break;
+
+            case OPT_PROFILE:
+                params.profile = parse_profile(optarg, "--profile"); break;
+
+            case OPT_ENCODER:
+                params.encoder = parse_encoder(optarg, "--encoder"); break;
+
+            case OPT_ZOOM_MODE:
+                params.zoom_mode = parse_zoom_mode(optarg, "--zoom-mode"); break;
+
+            case OPT_VERIFY:
+                verify = true; break;
+
             case OPT_RANDOMIZE:
                 randomize = true; break;
 
@@ -329,7 +605,13 @@ int main (int argc, char **argv)
             if (!no_update) {
                 log_info("\tUpdating image cache...");
 
-                if ((err = pt_image_update(image, img_path, &update_params))) {
+                err = pt_image_update(image, img_path, &update_params);
+
+                // end the progress line
+                if (update_params.progress)
+                    fprintf(stderr, "\n");
+
+                if (err) {
                     log_error("pt_image_update: %s: %s", img_path, pt_strerror(err));
                     goto error;
                 }
@@ -365,12 +647,41 @@ int main (int argc, char **argv)
             log_info("\tCache mtime=%ld, bytes=%zu, blocks=%zu (%zu bytes), version=%d",
                     (long) cache_info.mtime, cache_info.bytes, cache_info.blocks, cache_info.blocks * 512, cache_info.version
             );
+            log_info("\tCache data=%zu/%zu bytes (%.1f%%)",
+                    cache_info.data_bytes, cache_info.data_size, cache_info.data_size ? 100.0 * cache_info.data_bytes / cache_info.data_size : 100.0
+            );
         }
 
         // render tile?
-        if (benchmark) {
+        if (benchmark && render_threads) {
+            log_info("\tRunning %d %stile renders using %u threads...", benchmark, randomize ? "randomized " : "", render_threads);
+
+            struct timespec start, end;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+
+            if (do_tile_renderer(image, &params, &info, benchmark, randomize, render_threads))
+                goto error;
+
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+            log_info("\tRendered %d tiles in %.3fs (%.1f tiles/s)", benchmark, elapsed, benchmark / elapsed);
+
+        } else if (benchmark) {
             log_info("\tRunning %d %stile renders...", benchmark, randomize ? "randomized " : "");
 
+            // reuse the encoder state across renders
+            if ((err = pt_render_ctx_new(&params.ctx))) {
+                log_error("pt_render_ctx_new: %s", pt_strerror(err));
+                goto error;
+            }
+
+            struct timespec start, end;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+
             // n times
             for (int i = 0; i < benchmark; i++) {
                 // randomize x, y
@@ -379,8 +690,22 @@ int main (int argc, char **argv)
 
                 if (do_tile(image, &params, out_path))
                     goto error;
+
+                if (verify && verify_tile(image, &params))
+                    goto error;
             }
 
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+            log_info("\tRendered %d tiles in %.3fs (%.1f tiles/s)%s", benchmark, elapsed, benchmark / elapsed,
+                    verify ? ", including verification" : ""
+            );
+
+            pt_render_ctx_destroy(params.ctx);
+            params.ctx = NULL;
+
         } else if (out_path) {
             // randomize x, y
             if (randomize)
@@ -390,6 +715,9 @@ int main (int argc, char **argv)
             if (do_tile(image, &params, out_path))
                 goto error;
 
+            if (verify && verify_tile(image, &params))
+                goto error;
+
         }
 
         // cleanup
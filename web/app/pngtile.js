@@ -33,8 +33,8 @@ L.Control.Link = L.Control.extend({
         var state = {
             w: size.x,
             h: size.y,
-            x: x >> zoom,
-            y: y >> zoom,
+            x: Math.floor(x / Math.pow(2, zoom)),
+            y: Math.floor(y / Math.pow(2, zoom)),
             z: zoom
         };
 
@@ -67,10 +67,13 @@ function map_init (id, _config) {
         [ 0, +(map_config.image_width >> map_config.tile_zoom) ],
     ];
 
+    // zooming in past 1:1 goes beyond tile_zoom
+    var max_zoom = map_config.tile_zoom - map_config.tile_zoom_min;
+
     map = L.map(id, {
         crs: L              .CRS.Simple,
         minZoom:            0,
-        maxZoom:            map_config.tile_zoom,
+        maxZoom:            max_zoom,
         maxBounds:          map_bounds
     });
 
@@ -80,11 +83,12 @@ function map_init (id, _config) {
         url:                map_config.url,
         mtime:              map_config.mtime,
         minZoom:            0,
-        maxZoom:            map_config.tile_zoom,
+        maxZoom:            max_zoom,
         tileSize:           map_config.tile_size,
         continuousWorld:    true,
         noWrap:             true,
         zoomReverse:        true,
+        zoomOffset:         map_config.tile_zoom_min,
         bounds:             bounds
     }).addTo(map);
 